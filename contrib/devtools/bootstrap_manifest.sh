@@ -0,0 +1,60 @@
+#!/usr/bin/env bash
+#
+# Copyright (c) 2020 The Vericonomy developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#
+export LC_ALL=C
+
+set -ueo pipefail
+
+if (( $# < 3 )); then
+  echo 'Usage: bootstrap_manifest.sh <bootstrap-dir> <signing-address> <vericoin-cli-call ...>'
+  echo
+  echo '  Print the signed manifest of a bootstrap, to be published as bootstrap.manifest'
+  echo '  next to bootstrap.zip. <bootstrap-dir> holds the blocks, chainstate and indexes'
+  echo '  directories copied from a stopped node. The cli call must reach that node,'
+  echo '  restarted with -connect=0 so its tip is still the one of the copy, and a wallet'
+  echo '  holding the key of <signing-address> (the BootstrapManifestAddress of the chain).'
+  echo
+  echo 'Examples:'
+  echo
+  echo "  ./contrib/devtools/bootstrap_manifest.sh bootstrap \"\${SIGNING_ADDRESS}\" ./src/vericoin-cli > bootstrap.manifest"
+  exit 1
+fi
+
+BOOTSTRAP_DIR="${1}"; shift;
+SIGNING_ADDRESS="${1}"; shift;
+# Hashing the UTXO set takes a while, so pad with a lengthy timeout.
+BITCOIN_CLI_CALL="${*} -rpcclienttimeout=9999999"
+
+for dir in blocks chainstate indexes; do
+  if [[ ! -d "${BOOTSTRAP_DIR}/${dir}" ]]; then
+    (>&2 echo "${BOOTSTRAP_DIR}/${dir} not found")
+    exit 1
+  fi
+done
+
+(>&2 echo "Generating txoutset info...")
+TXOUTSETINFO=$(${BITCOIN_CLI_CALL} gettxoutsetinfo)
+field() {
+  echo "${TXOUTSETINFO}" | grep "\"${1}\"" | sed 's/^.*: "\?\([^",]\+\)"\?,\?$/\1/'
+}
+
+MANIFEST=$(mktemp)
+trap 'rm -f "${MANIFEST}"' EXIT
+
+{
+  echo "bootstrap-manifest 1"
+  echo "height $(field height)"
+  echo "blockhash $(field bestblock)"
+  echo "utxohash $(field hash_serialized_3)"
+  (>&2 echo "Hashing bootstrap files...")
+  (cd "${BOOTSTRAP_DIR}" && find blocks chainstate indexes -type f -print0 | sort -z | xargs -0 sha256sum) | sed 's/^\([0-9a-f]\+\)  /file \1 /'
+} > "${MANIFEST}"
+
+SIGNATURE=$(${BITCOIN_CLI_CALL} signmessage "${SIGNING_ADDRESS}" "$(cat "${MANIFEST}")
+")
+
+cat "${MANIFEST}"
+echo "signature ${SIGNATURE}"
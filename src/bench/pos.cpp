@@ -0,0 +1,223 @@
+// Copyright (c) 2020 The Vericonomy developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <chain.h>
+#include <chainparams.h>
+#include <coins.h>
+#include <pos.h>
+#include <random.h>
+#include <test/util/mining.h>
+#include <validation.h>
+
+#include <vector>
+
+// Check the stake kernels of a run of PoS blocks, as ConnectBlock() does for
+// each block it connects, each staking a coin 1000 to 2000 blocks deep.
+static void CheckStakeKernelRun(benchmark::State& state)
+{
+    static const int CHAIN_LENGTH = 3000;
+    static const int RUN_LENGTH = 500;
+
+    SelectParams(CBaseChainParams::VERICOIN);
+    FastRandomContext rng(true);
+    LOCK(cs_main);
+    CBlockIndex* pindexTip = BuildStakeModifierChain(::ChainActive().Tip(), CHAIN_LENGTH, rng);
+    ::ChainActive().SetTip(pindexTip);
+
+    struct Kernel {
+        CBlockIndex* pindexPrev;
+        CBlockHeader blockFrom;
+        CTransactionRef txPrev;
+        unsigned int nTimeTx;
+    };
+    std::vector<Kernel> kernels;
+    for (int i = 0; i < RUN_LENGTH; i++) {
+        CBlockIndex* pindexPrev = ::ChainActive()[CHAIN_LENGTH - RUN_LENGTH + i];
+        const CBlockIndex* pindexFrom = ::ChainActive()[pindexPrev->nHeight - 1000 - rng.randrange(1000)];
+        CMutableTransaction txPrev;
+        txPrev.nTime = pindexFrom->nTime;
+        txPrev.vout.emplace_back(1000 * COIN, CScript());
+        kernels.push_back({pindexPrev, pindexFrom->GetBlockHeader(), MakeTransactionRef(txPrev), pindexPrev->nTime + 30});
+    }
+
+    while (state.KeepRunning()) {
+        for (const Kernel& kernel : kernels) {
+            uint256 hashProofOfStake;
+            CheckStakeKernelHash(0x1e0fffff, kernel.pindexPrev, kernel.blockFrom, 100, kernel.txPrev, COutPoint(kernel.txPrev->GetHash(), 0), kernel.nTimeTx, hashProofOfStake);
+        }
+    }
+
+    SelectParams(CBaseChainParams::VERIUM);
+}
+
+// Resolve the stake modifiers of coins anywhere in a long chain, as the
+// staker does for every coin of the wallet each round.
+static void GetKernelStakeModifierDeep(benchmark::State& state)
+{
+    static const int CHAIN_LENGTH = 100000;
+    static const int LOOKUPS = 1000;
+
+    SelectParams(CBaseChainParams::VERICOIN);
+    FastRandomContext rng(true);
+    LOCK(cs_main);
+    CBlockIndex* pindexTip = BuildStakeModifierChain(::ChainActive().Tip(), CHAIN_LENGTH, rng);
+    ::ChainActive().SetTip(pindexTip);
+
+    std::vector<const CBlockIndex*> vFrom;
+    for (int i = 0; i < LOOKUPS; i++)
+        vFrom.push_back(::ChainActive()[1 + rng.randrange(CHAIN_LENGTH - 1000)]);
+
+    while (state.KeepRunning()) {
+        for (const CBlockIndex* pindexFrom : vFrom) {
+            uint64_t nStakeModifier;
+            int nStakeModifierHeight;
+            int64_t nStakeModifierTime;
+            GetKernelStakeModifier(pindexTip, pindexFrom->GetBlockHash(), pindexFrom->nTime, nStakeModifier, nStakeModifierHeight, nStakeModifierTime, false);
+        }
+    }
+
+    SelectParams(CBaseChainParams::VERIUM);
+}
+
+// Compute the stake modifiers of a run of blocks, as AddToBlockIndex() does
+// for each block accepted. Most blocks keep the modifier of their parent, the
+// rest sort and select from the blocks of the last selection interval.
+static void ComputeNextStakeModifierRun(benchmark::State& state)
+{
+    static const int CHAIN_LENGTH = 3000;
+    static const int RUN_LENGTH = 500;
+
+    SelectParams(CBaseChainParams::VERICOIN);
+    FastRandomContext rng(true);
+    LOCK(cs_main);
+    CBlockIndex* pindexTip = BuildStakeModifierChain(::ChainActive().Tip(), CHAIN_LENGTH, rng);
+    ::ChainActive().SetTip(pindexTip);
+
+    while (state.KeepRunning()) {
+        for (int nHeight = CHAIN_LENGTH - RUN_LENGTH; nHeight <= CHAIN_LENGTH; nHeight++) {
+            uint64_t nStakeModifier;
+            bool fGeneratedStakeModifier;
+            ComputeNextStakeModifier(::ChainActive()[nHeight], nStakeModifier, fGeneratedStakeModifier);
+        }
+    }
+
+    SelectParams(CBaseChainParams::VERIUM);
+}
+
+// Each call is on the next block of a chain longer than the memo holds, so
+// every call computes what it would for a newly connected block.
+static void GetPoSKernelPSNextBlock(benchmark::State& state)
+{
+    static const int CHAIN_LENGTH = 10000;
+
+    SelectParams(CBaseChainParams::VERICOIN);
+    FastRandomContext rng(true);
+    LOCK(cs_main);
+    ::ChainActive().SetTip(BuildStakeModifierChain(::ChainActive().Tip(), CHAIN_LENGTH, rng));
+
+    int nHeight = 0;
+    while (state.KeepRunning()) {
+        GetPoSKernelPS(::ChainActive()[1 + nHeight++ % CHAIN_LENGTH]);
+    }
+
+    SelectParams(CBaseChainParams::VERIUM);
+}
+
+static void GetAverageStakeWeightNextBlock(benchmark::State& state)
+{
+    static const int CHAIN_LENGTH = 10000;
+
+    SelectParams(CBaseChainParams::VERICOIN);
+    FastRandomContext rng(true);
+    LOCK(cs_main);
+    ::ChainActive().SetTip(BuildStakeModifierChain(::ChainActive().Tip(), CHAIN_LENGTH, rng));
+
+    int nHeight = 0;
+    while (state.KeepRunning()) {
+        GetAverageStakeWeight(::ChainActive()[1 + nHeight++ % CHAIN_LENGTH]);
+    }
+
+    SelectParams(CBaseChainParams::VERIUM);
+}
+
+// Compute the coin age of coinstakes combining 100 coins each, from the UTXO
+// set as ConnectBlock() does for every coinstake it connects.
+static void GetCoinAgeCoinstakes(benchmark::State& state)
+{
+    static const int CHAIN_LENGTH = 10000;
+    static const int COINSTAKES = 100;
+    static const int INPUTS = 100;
+
+    SelectParams(CBaseChainParams::VERICOIN);
+    FastRandomContext rng(true);
+    LOCK(cs_main);
+    CBlockIndex* pindexTip = BuildStakeModifierChain(::ChainActive().Tip(), CHAIN_LENGTH, rng);
+
+    CCoinsView viewDummy;
+    CCoinsViewCache view(&viewDummy);
+    std::vector<CTransactionRef> vCoinStakes;
+    for (int i = 0; i < COINSTAKES; i++) {
+        CMutableTransaction tx;
+        tx.nTime = pindexTip->nTime + 30;
+        for (int j = 0; j < INPUTS; j++) {
+            const CBlockIndex* pindexFrom = pindexTip->GetAncestor(pindexTip->nHeight - 1000 - rng.randrange(CHAIN_LENGTH - 2000));
+            const COutPoint prevout(rng.rand256(), 0);
+            view.AddCoin(prevout, Coin(CTxOut(100 * COIN, CScript()), pindexFrom->nHeight, false, false, pindexFrom->nTime), false);
+            tx.vin.emplace_back(prevout);
+        }
+        vCoinStakes.push_back(MakeTransactionRef(tx));
+    }
+
+    while (state.KeepRunning()) {
+        for (const CTransactionRef& tx : vCoinStakes) {
+            uint64_t nCoinAge;
+            GetCoinAge(*tx, view, nCoinAge, pindexTip);
+        }
+    }
+
+    SelectParams(CBaseChainParams::VERIUM);
+}
+
+// One round of the staker over 10000 coins: every coin is hashed at each of
+// the 60 timestamps of the search window, at a target no kernel meets.
+static void StakeKernelSearchRound(benchmark::State& state)
+{
+    static const int CHAIN_LENGTH = 100000;
+    static const int COINS = 10000;
+
+    SelectParams(CBaseChainParams::VERICOIN);
+    FastRandomContext rng(true);
+    LOCK(cs_main);
+    CBlockIndex* pindexTip = BuildStakeModifierChain(::ChainActive().Tip(), CHAIN_LENGTH, rng);
+    ::ChainActive().SetTip(pindexTip);
+
+    StakeKernelSearch search(0x1c00ffff, pindexTip);
+    for (int i = 0; i < COINS; i++) {
+        const CBlockIndex* pindexFrom = ::ChainActive()[1 + rng.randrange(CHAIN_LENGTH - 1000)];
+        CMutableTransaction txPrev;
+        txPrev.nTime = pindexFrom->nTime;
+        txPrev.vout.emplace_back(100 * COIN, CScript());
+        const CTransactionRef tx = MakeTransactionRef(txPrev);
+        search.AddCoin(pindexFrom->GetBlockHeader(), 100, tx, COutPoint(tx->GetHash(), 0));
+    }
+    assert(search.size() == COINS);
+
+    while (state.KeepRunning()) {
+        size_t nCoin;
+        unsigned int nTimeKernel;
+        uint256 hashProofOfStake;
+        search.Find(pindexTip->nTime + 30, 60, nCoin, nTimeKernel, hashProofOfStake);
+    }
+
+    SelectParams(CBaseChainParams::VERIUM);
+}
+
+BENCHMARK(CheckStakeKernelRun, 50);
+BENCHMARK(GetKernelStakeModifierDeep, 500);
+BENCHMARK(ComputeNextStakeModifierRun, 20);
+BENCHMARK(GetPoSKernelPSNextBlock, 50000);
+BENCHMARK(GetAverageStakeWeightNextBlock, 50000);
+BENCHMARK(GetCoinAgeCoinstakes, 100);
+BENCHMARK(StakeKernelSearchRound, 1);
@@ -0,0 +1,79 @@
+// Copyright (c) 2020 The Vericonomy developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <crypto/scrypt.h>
+#include <primitives/block.h>
+
+#include <algorithm>
+#include <stdlib.h>
+#include <vector>
+
+static void ScryptHash(benchmark::State& state)
+{
+    CBlockHeader header;
+    uint256 hash;
+    while (state.KeepRunning()) {
+        scryptHash(BEGIN(header.nVersion), BEGIN(hash));
+        header.nNonce++;
+    }
+}
+
+// Allocates a fresh scratchpad for every hash, as scryptHash() used to.
+static void ScryptHashAlloc(benchmark::State& state)
+{
+    CBlockHeader header;
+    uint256 hash;
+    while (state.KeepRunning()) {
+        unsigned char* scratchbuf = (unsigned char*)malloc(SCRYPT_SCRATCHPAD_SIZE);
+        scryptHash(BEGIN(header.nVersion), BEGIN(hash), scratchbuf);
+        free(scratchbuf);
+        header.nNonce++;
+    }
+}
+
+// One call of the mining loop on `throughput` lanes, that many nonces per
+// iteration. Widths this CPU has no kernel for report no result.
+static void ScryptMulti(benchmark::State& state, int throughput)
+{
+    const std::vector<int> ways = scrypt_supported_throughputs();
+    if (std::find(ways.begin(), ways.end(), throughput) == ways.end())
+        return;
+
+    unsigned char* scratchbuf = (unsigned char*)malloc(scrypt_buffer_size(throughput));
+    CBlockHeader header;
+    int nHashesDone;
+    while (state.KeepRunning()) {
+        scrypt_N_1_1_256_multi(BEGIN(header.nVersion), uint256(), &nHashesDone, scratchbuf, throughput);
+        header.nNonce += nHashesDone;
+    }
+    free(scratchbuf);
+}
+
+static void ScryptMulti1Way(benchmark::State& state) { ScryptMulti(state, 1); }
+static void ScryptMulti3Way(benchmark::State& state) { ScryptMulti(state, 3); }
+static void ScryptMulti4Way(benchmark::State& state) { ScryptMulti(state, 4); }
+static void ScryptMulti12Way(benchmark::State& state) { ScryptMulti(state, 12); }
+static void ScryptMulti16Way(benchmark::State& state) { ScryptMulti(state, 16); }
+static void ScryptMulti24Way(benchmark::State& state) { ScryptMulti(state, 24); }
+
+#if CLIENT_IS_VERIUM
+BENCHMARK(ScryptHash, 2);
+BENCHMARK(ScryptHashAlloc, 2);
+BENCHMARK(ScryptMulti1Way, 2);
+BENCHMARK(ScryptMulti3Way, 1);
+BENCHMARK(ScryptMulti4Way, 1);
+BENCHMARK(ScryptMulti12Way, 1);
+BENCHMARK(ScryptMulti16Way, 1);
+BENCHMARK(ScryptMulti24Way, 1);
+#else
+BENCHMARK(ScryptHash, 2000);
+BENCHMARK(ScryptHashAlloc, 2000);
+BENCHMARK(ScryptMulti1Way, 2000);
+BENCHMARK(ScryptMulti3Way, 700);
+BENCHMARK(ScryptMulti4Way, 500);
+BENCHMARK(ScryptMulti12Way, 200);
+BENCHMARK(ScryptMulti16Way, 200);
+BENCHMARK(ScryptMulti24Way, 100);
+#endif
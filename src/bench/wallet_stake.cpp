@@ -0,0 +1,91 @@
+// Copyright (c) 2020 The Vericonomy developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <chain.h>
+#include <chainparams.h>
+#include <coins.h>
+#include <interfaces/chain.h>
+#include <key.h>
+#include <node/context.h>
+#include <pos.h>
+#include <random.h>
+#include <script/standard.h>
+#include <test/util/mining.h>
+#include <util/time.h>
+#include <validation.h>
+#include <wallet/wallet.h>
+
+// A wallet of 10000 confirmed coins of one key, on a chain of 100000 blocks
+// with the clock at its tip.
+static void StakeWallet(benchmark::State& state, bool fCreateCoinStake)
+{
+    static const int CHAIN_LENGTH = 100000;
+    static const int COINS = 10000;
+
+    SelectParams(CBaseChainParams::VERICOIN);
+    FastRandomContext rng(true);
+    NodeContext node;
+    std::unique_ptr<interfaces::Chain> chain = interfaces::MakeChain(node);
+    CWallet wallet{chain.get(), WalletLocation(), WalletDatabase::CreateDummy()};
+    wallet.SetupLegacyScriptPubKeyMan();
+
+    LOCK(cs_main);
+    CBlockIndex* pindexTip = BuildStakeModifierChain(::ChainActive().Tip(), CHAIN_LENGTH, rng);
+    ::ChainActive().SetTip(pindexTip);
+    SetMockTime(pindexTip->nTime + 30);
+
+    CKey key;
+    key.MakeNewKey(true);
+    const CScript scriptPubKey = GetScriptForDestination(PKHash(key.GetPubKey()));
+    std::vector<COutPoint> vCoins;
+    {
+        LOCK(wallet.cs_wallet);
+        wallet.GetLegacyScriptPubKeyMan()->AddKeyPubKey(key, key.GetPubKey());
+        wallet.SetLastBlockProcessed(pindexTip->nHeight, pindexTip->GetBlockHash());
+        for (int i = 0; i < COINS; i++) {
+            const CBlockIndex* pindexFrom = ::ChainActive()[1 + rng.randrange(CHAIN_LENGTH - 1000)];
+            CMutableTransaction tx;
+            tx.nTime = pindexFrom->nTime;
+            tx.vin.emplace_back(COutPoint(rng.rand256(), 0));
+            tx.vout.emplace_back(10 * COIN, scriptPubKey);
+            CWalletTx wtx(&wallet, MakeTransactionRef(tx));
+            wtx.m_confirm = CWalletTx::Confirmation(CWalletTx::Status::CONFIRMED, pindexFrom->nHeight, pindexFrom->GetBlockHash(), 1);
+            wallet.AddToWallet(wtx);
+            vCoins.emplace_back(wtx.GetHash(), 0);
+            ::ChainstateActive().CoinsTip().AddCoin(vCoins.back(), Coin(wtx.tx->vout[0], pindexFrom->nHeight, false, false, tx.nTime, 100), false);
+        }
+    }
+
+    if (fCreateCoinStake) {
+        StakeKernel kernel;
+        kernel.pindexPrev = pindexTip;
+        kernel.nBits = GetNextTargetRequired(pindexTip, true, Params().GetConsensus());
+        kernel.prevout = vCoins[0];
+        kernel.nTime = pindexTip->nTime + 30;
+        kernel.scriptPubKeyOut = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+        kernel.fSplit = false;
+        while (state.KeepRunning()) {
+            CMutableTransaction txCoinStake;
+            if (!wallet.CreateCoinStake(kernel, 0, txCoinStake)) assert(false);
+        }
+    } else {
+        while (state.KeepRunning()) {
+            StakeKernel kernel;
+            wallet.SearchStakeKernel(60, kernel);
+        }
+    }
+
+    SetMockTime(0);
+    SelectParams(CBaseChainParams::VERIUM);
+}
+
+// The part of a staker round that holds cs_main and the wallet lock: select
+// the coins and resolve their stake modifiers, then search them.
+static void WalletSearchStakeKernel(benchmark::State& state) { StakeWallet(state, /* fCreateCoinStake */ false); }
+// Turn a kernel into a signed coinstake, combining the other coins of its key.
+static void WalletCreateCoinStake(benchmark::State& state) { StakeWallet(state, /* fCreateCoinStake */ true); }
+
+BENCHMARK(WalletSearchStakeKernel, 1);
+BENCHMARK(WalletCreateCoinStake, 2);
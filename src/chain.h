@@ -135,6 +135,13 @@ enum BlockStatus: uint32_t {
     BLOCK_FAILED_MASK        =   BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
 
     BLOCK_OPT_WITNESS       =   128, //!< block data in blk*.data was received with a witness-enforcing client
+
+    /**
+     * Stood in for by a UTXO set snapshot up to its base: marked
+     * BLOCK_VALID_SCRIPTS without being checked, and without data or undo
+     * data, so it can never be disconnected.
+     */
+    BLOCK_ASSUMED_VALID      =   256,
 };
 
 /** The block chain is a tree shaped structure starting with the
@@ -208,6 +215,7 @@ public:
     };
     uint64_t nStakeModifier{0}; // hash modifier for proof-of-stake
     unsigned int nStakeModifierChecksum{0}; // checksum of index; in-memory only
+    unsigned int nStakeModifierTimeMax{0}; // max nTime of modifier-generating blocks up to and including this one; in-memory only
     COutPoint prevoutStake{};
     unsigned int nStakeTime{0};
     uint256 hashProofOfStake{};
@@ -178,6 +178,10 @@ public:
             /* nTxCount */ 8703568,
             /* dTxRate  */ 0.03584488067744419,
         };
+
+        // Signer of the published bootstrap manifests; while none is set a
+        // bootstrap is only checked against its checksums, with a warning
+        m_bootstrap_manifest_address = "";
     }
 };
 
@@ -274,6 +278,16 @@ public:
             /* nTxCount */ 728227,
             /* dTxRate  */ 0.003821978324894454,
         };
+
+        // Signer of the published bootstrap manifests; while none is set a
+        // bootstrap is only checked against its checksums, with a warning
+        m_bootstrap_manifest_address = "";
+
+        m_assumeutxo_data = MapAssumeutxo{
+            // Data from RPC: dumptxoutset at a block below the last checkpoint
+            // {height, {txoutset_hash, nchaintx, money_supply}}
+            // None yet, so loadtxoutset refuses every snapshot on this chain
+        };
     }
 };
 
@@ -10,6 +10,7 @@
 #include <config/bitcoin-config.h>
 #endif
 
+#include <amount.h>
 #include <chainparamsbase.h>
 #include <consensus/params.h>
 #include <primitives/block.h>
@@ -41,6 +42,21 @@ struct ChainTxData {
     double dTxRate;   //!< estimated number of transactions per second after that timestamp
 };
 
+/**
+ * What a UTXO set snapshot taken at some height must hash to, for
+ * loadtxoutset to accept it, and what the chain it stands for cannot be
+ * recomputed from without the blocks.
+ *
+ * See also: CChainParams::Assumeutxo, LoadTxOutSet.
+ */
+struct AssumeutxoData {
+    uint256 hash_serialized; //!< hash_serialized_3 of gettxoutsetinfo at that height
+    unsigned int nChainTx;   //!< total number of transactions up to and including that block
+    CAmount nMoneySupply;    //!< money supply at that block, which later Verium rewards depend on
+};
+
+typedef std::map<int, const AssumeutxoData> MapAssumeutxo;
+
 /**
  * CChainParams defines various tweakable parameters of a given instance of the
  * Bitcoin system. There are three: the main network on which people trade goods
@@ -95,6 +111,10 @@ public:
     const std::vector<SeedSpec6>& FixedSeeds() const { return vFixedSeeds; }
     const CCheckpointData& Checkpoints() const { return checkpointData; }
     const ChainTxData& TxData() const { return chainTxData; }
+    /** Address whose signature bootstrap manifests must carry; without one only their checksums are checked */
+    const std::string& BootstrapManifestAddress() const { return m_bootstrap_manifest_address; }
+    /** UTXO set snapshots that may be loaded, by the height they were taken at */
+    const MapAssumeutxo& Assumeutxo() const { return m_assumeutxo_data; }
 protected:
     CChainParams() {}
 
@@ -119,6 +139,8 @@ protected:
     bool fIsVericoin;
     CCheckpointData checkpointData;
     ChainTxData chainTxData;
+    std::string m_bootstrap_manifest_address;
+    MapAssumeutxo m_assumeutxo_data;
 };
 
 /**
@@ -26,6 +26,9 @@
  * Serialized format:
  * - VARINT((coinbase ? 1 : 0) | (height << 1))
  * - the non-spent CTxOut (via CTxOutCompressor)
+ * - VARINT((coinstake ? 1 : 0) | (offset known ? 2 : 0))
+ * - VARINT(transaction time)
+ * - VARINT(transaction offset), if known
  */
 class Coin
 {
@@ -45,11 +48,15 @@ public:
     // ppcoin: transaction timestamp
     unsigned int nTime;
 
+    //! offset of the containing transaction in its block past the header, 0 if unknown.
+    //! Together with the block at nHeight this is all a stake kernel needs.
+    unsigned int nTxOffset;
+
     //! construct a Coin from a CTxOut and height/coinbase information.
-    Coin(CTxOut&& outIn, int nHeightIn, bool fCoinBaseIn, bool fCoinStakeIn, int nTimeIn) :
-        out(std::move(outIn)), fCoinBase(fCoinBaseIn), nHeight(nHeightIn), fCoinStake(fCoinStakeIn), nTime(nTimeIn) {}
-    Coin(const CTxOut& outIn, int nHeightIn, bool fCoinBaseIn, bool fCoinStakeIn, int nTimeIn) :
-        out(outIn), fCoinBase(fCoinBaseIn), nHeight(nHeightIn), fCoinStake(fCoinStakeIn), nTime(nTimeIn) {}
+    Coin(CTxOut&& outIn, int nHeightIn, bool fCoinBaseIn, bool fCoinStakeIn, int nTimeIn, unsigned int nTxOffsetIn = 0) :
+        out(std::move(outIn)), fCoinBase(fCoinBaseIn), nHeight(nHeightIn), fCoinStake(fCoinStakeIn), nTime(nTimeIn), nTxOffset(nTxOffsetIn) {}
+    Coin(const CTxOut& outIn, int nHeightIn, bool fCoinBaseIn, bool fCoinStakeIn, int nTimeIn, unsigned int nTxOffsetIn = 0) :
+        out(outIn), fCoinBase(fCoinBaseIn), nHeight(nHeightIn), fCoinStake(fCoinStakeIn), nTime(nTimeIn), nTxOffset(nTxOffsetIn) {}
 
     void Clear() {
         out.SetNull();
@@ -57,10 +64,11 @@ public:
         nHeight = 0;
         fCoinStake = false;
         nTime = 0;
+        nTxOffset = 0;
     }
 
     //! empty constructor
-    Coin() : fCoinBase(false), nHeight(0), fCoinStake(false), nTime(0) { }
+    Coin() : fCoinBase(false), nHeight(0), fCoinStake(false), nTime(0), nTxOffset(0) { }
 
     bool IsCoinBase() const {
         return fCoinBase;
@@ -77,10 +85,13 @@ public:
         ::Serialize(s, VARINT(code));
         ::Serialize(s, Using<TxOutCompression>(out));
         // ppcoin flags
-        unsigned int nFlag = fCoinStake? 1 : 0;
+        unsigned int nFlag = (fCoinStake? 1 : 0) | (nTxOffset ? 2 : 0);
         ::Serialize(s, VARINT(nFlag));
         // ppcoin transaction timestamp
         ::Serialize(s, VARINT(nTime));
+        // transaction offset, last so that older versions ignore it
+        if (nTxOffset)
+            ::Serialize(s, VARINT(nTxOffset));
     }
 
     template<typename Stream>
@@ -96,6 +107,10 @@ public:
         fCoinStake = nFlag & 1;
         // ppcoin transaction timestamp
         ::Unserialize(s, VARINT(nTime));
+        // transaction offset, absent from records written by older versions
+        nTxOffset = 0;
+        if (nFlag & 2)
+            ::Unserialize(s, VARINT(nTxOffset));
     }
 
     bool IsSpent() const {
@@ -338,10 +353,10 @@ private:
 //! Utility function to add all of a transaction's outputs to a cache.
 //! When check is false, this assumes that overwrites are only possible for coinbase transactions.
 //! When check is true, the underlying view may be queried to determine whether an addition is
-//! an overwrite.
+//! an overwrite. nTxOffset is the offset of tx in its block past the header, if known.
 // TODO: pass in a boolean to limit these possible overwrites to known
 // (pre-BIP34) cases.
-void AddCoins(CCoinsViewCache& cache, const CTransaction& tx, int nHeight, bool check = false);
+void AddCoins(CCoinsViewCache& cache, const CTransaction& tx, int nHeight, bool check = false, unsigned int nTxOffset = 0);
 
 //! Utility function to find any unspent output with a given txid.
 //! This function can be quite expensive because in the event of a transaction
@@ -5,6 +5,8 @@
 #include <consensus/merkle.h>
 #include <hash.h>
 
+#include <string.h>
+
 /*     WARNING! If you're reading this because you're learning about crypto
        and/or designing a new system that will use merkle trees, keep in mind
        that the following merkle tree algorithm has a serious flaw related to
@@ -83,3 +85,32 @@ uint256 BlockWitnessMerkleRoot(const CBlock& block, bool* mutated)
     return ComputeMerkleRoot(std::move(leaves), mutated);
 }
 
+std::vector<uint256> BlockCoinbaseMerkleBranch(const CBlock& block)
+{
+    std::vector<uint256> hashes;
+    hashes.resize(block.vtx.size());
+    for (size_t s = 0; s < block.vtx.size(); s++) {
+        hashes[s] = block.vtx[s]->GetHash();
+    }
+    std::vector<uint256> branch;
+    while (hashes.size() > 1) {
+        branch.push_back(hashes[1]);
+        if (hashes.size() & 1) {
+            hashes.push_back(hashes.back());
+        }
+        SHA256D64(hashes[0].begin(), hashes[0].begin(), hashes.size() / 2);
+        hashes.resize(hashes.size() / 2);
+    }
+    return branch;
+}
+
+uint256 ComputeCoinbaseMerkleRoot(uint256 coinbase_hash, const std::vector<uint256>& branch)
+{
+    unsigned char pair[64];
+    for (const uint256& sibling : branch) {
+        memcpy(pair, coinbase_hash.begin(), 32);
+        memcpy(pair + 32, sibling.begin(), 32);
+        SHA256D64(coinbase_hash.begin(), pair, 1);
+    }
+    return coinbase_hash;
+}
@@ -24,4 +24,16 @@ uint256 BlockMerkleRoot(const CBlock& block, bool* mutated = nullptr);
  */
 uint256 BlockWitnessMerkleRoot(const CBlock& block, bool* mutated = nullptr);
 
+/*
+ * Compute the Merkle branch of the coinbase of a block, from which the root
+ * can be recomputed with ComputeCoinbaseMerkleRoot() for any other coinbase.
+ */
+std::vector<uint256> BlockCoinbaseMerkleBranch(const CBlock& block);
+
+/*
+ * Compute the Merkle root of a block whose coinbase hashes to coinbase_hash,
+ * given the branch returned by BlockCoinbaseMerkleBranch().
+ */
+uint256 ComputeCoinbaseMerkleRoot(uint256 coinbase_hash, const std::vector<uint256>& branch);
+
 #endif // BITCOIN_CONSENSUS_MERKLE_H
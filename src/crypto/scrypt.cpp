@@ -29,9 +29,14 @@
 
 #include "scrypt.h"
 #include "compat.h"
+#include "compat/cpuid.h"
+#include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
+#include <algorithm>
+#include <mutex>
+#include <vector>
 
 static const uint32_t sha256_h[8] = {
     0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
@@ -549,15 +554,164 @@ static inline void PBKDF2_SHA256_128_32_8way(uint32_t *tstate,
 
 #endif /* HAVE_SHA256_8WAY */
 
+
+#ifdef HAVE_SCRYPT_16WAY
+
+using scrypt_avx512::sha256_init_16way;
+using scrypt_avx512::sha256_transform_16way;
+
+static inline void HMAC_SHA256_80_init_16way(const uint32_t *key,
+	uint32_t *tstate, uint32_t *ostate)
+{
+	uint32_t ihash[16 * 8] __attribute__((aligned(64)));
+	uint32_t pad[16 * 16] __attribute__((aligned(64)));
+	int i;
+	
+	/* tstate is assumed to contain the midstate of key */
+	memcpy(pad, key + 16 * 16, 16 * 16);
+	for (i = 0; i < 16; i++)
+		pad[16 * 4 + i] = 0x80000000;
+	memset(pad + 16 * 5, 0x00, 16 * 40);
+	for (i = 0; i < 16; i++)
+		pad[16 * 15 + i] = 0x00000280;
+	sha256_transform_16way(tstate, pad, 0);
+	memcpy(ihash, tstate, 16 * 32);
+	
+	sha256_init_16way(ostate);
+	for (i = 0; i < 16 * 8; i++)
+		pad[i] = ihash[i] ^ 0x5c5c5c5c;
+	for (; i < 16 * 16; i++)
+		pad[i] = 0x5c5c5c5c;
+	sha256_transform_16way(ostate, pad, 0);
+	
+	sha256_init_16way(tstate);
+	for (i = 0; i < 16 * 8; i++)
+		pad[i] = ihash[i] ^ 0x36363636;
+	for (; i < 16 * 16; i++)
+		pad[i] = 0x36363636;
+	sha256_transform_16way(tstate, pad, 0);
+}
+
+static inline void PBKDF2_SHA256_80_128_16way(const uint32_t *tstate,
+	const uint32_t *ostate, const uint32_t *salt, uint32_t *output)
+{
+	uint32_t istate[16 * 8] __attribute__((aligned(64)));
+	uint32_t ostate2[16 * 8] __attribute__((aligned(64)));
+	uint32_t ibuf[16 * 16] __attribute__((aligned(64)));
+	uint32_t obuf[16 * 16] __attribute__((aligned(64)));
+	int i, j;
+	
+	memcpy(istate, tstate, 16 * 32);
+	sha256_transform_16way(istate, salt, 0);
+	
+	memcpy(ibuf, salt + 16 * 16, 16 * 16);
+	for (i = 0; i < 16; i++)
+		ibuf[16 * 5 + i] = 0x80000000;
+	memset(ibuf + 16 * 6, 0x00, 16 * 36);
+	for (i = 0; i < 16; i++)
+		ibuf[16 * 15 + i] = 0x000004a0;
+	
+	for (i = 0; i < 16; i++)
+		obuf[16 * 8 + i] = 0x80000000;
+	memset(obuf + 16 * 9, 0x00, 16 * 24);
+	for (i = 0; i < 16; i++)
+		obuf[16 * 15 + i] = 0x00000300;
+	
+	for (i = 0; i < 4; i++) {
+		memcpy(obuf, istate, 16 * 32);
+		for (j = 0; j < 16; j++)
+			ibuf[16 * 4 + j] = i + 1;
+		sha256_transform_16way(obuf, ibuf, 0);
+		
+		memcpy(ostate2, ostate, 16 * 32);
+		sha256_transform_16way(ostate2, obuf, 0);
+		for (j = 0; j < 16 * 8; j++)
+			output[16 * 8 * i + j] = swab32(ostate2[j]);
+	}
+}
+
+static inline void PBKDF2_SHA256_128_32_16way(uint32_t *tstate,
+	uint32_t *ostate, const uint32_t *salt, uint32_t *output)
+{
+	uint32_t buf[16 * 16] __attribute__((aligned(64)));
+	int i;
+	
+	sha256_transform_16way(tstate, salt, 1);
+	sha256_transform_16way(tstate, salt + 16 * 16, 1);
+	for (i = 0; i < 16; i++) {
+		buf[i] = 0x00000001;
+		buf[16 + i] = 0x80000000;
+		buf[16 * 15 + i] = 0x00000620;
+	}
+	memset(buf + 16 * 2, 0x00, 16 * 52);
+	sha256_transform_16way(tstate, buf, 0);
+	
+	memcpy(buf, tstate, 16 * 32);
+	for (i = 0; i < 16; i++)
+		buf[16 * 8 + i] = 0x80000000;
+	memset(buf + 16 * 9, 0x00, 16 * 24);
+	for (i = 0; i < 16; i++)
+		buf[16 * 15 + i] = 0x00000300;
+	sha256_transform_16way(ostate, buf, 0);
+	
+	for (i = 0; i < 16 * 8; i++)
+		output[i] = swab32(ostate[i]);
+}
+
+#endif /* HAVE_SCRYPT_16WAY */
+
 #ifndef SCRYPT_MAX_WAYS
 #define SCRYPT_MAX_WAYS 1
 #define scrypt_best_throughput() 1
 #endif
 
-unsigned char *scrypt_buffer_alloc()
+/*
+ * Single-way scratchpads used by scryptHash(). Allocating (and faulting in)
+ * N * 128 bytes for every header hash dominates the cost of a single hash,
+ * so released scratchpads are kept for reuse. The pool only ever holds as
+ * many buffers as there were concurrent callers.
+ */
+namespace {
+class ScryptScratchpadPool
 {
-    return (unsigned char*)malloc((size_t)N * SCRYPT_MAX_WAYS * 128 + 63);
-}
+private:
+    const size_t nSize;
+    std::mutex cs;
+    std::vector<unsigned char*> vFree;
+
+public:
+    explicit ScryptScratchpadPool(size_t size) : nSize(size) {}
+
+    ~ScryptScratchpadPool()
+    {
+        for (unsigned char* scratchpad : vFree)
+            free(scratchpad);
+    }
+
+    unsigned char* Acquire()
+    {
+        {
+            std::lock_guard<std::mutex> lock(cs);
+            if (!vFree.empty()) {
+                unsigned char* scratchpad = vFree.back();
+                vFree.pop_back();
+                return scratchpad;
+            }
+        }
+        return (unsigned char*)malloc(nSize);
+    }
+
+    void Release(unsigned char* scratchpad)
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        vFree.push_back(scratchpad);
+    }
+};
+
+ScryptScratchpadPool g_scratchpad_pool(SCRYPT_SCRATCHPAD_SIZE);
+/* Multi-way scratchpads used by scryptHashBatch() */
+ScryptScratchpadPool g_scratchpad_pool_multi(scrypt_buffer_size());
+} // namespace
 
 static void scrypt_N_1_1_256(const uint32_t *input, uint32_t *output, uint32_t *midstate, unsigned char *scratchpad)
 {
@@ -594,7 +748,7 @@ static void scrypt_N_1_1_256_4way(const uint32_t *input,
 			W[4 * i + k] = input[k * 20 + i];
 	for (i = 0; i < 8; i++)
 		for (k = 0; k < 4; k++)
-			tstate[4 * i + k] = midstate[i];
+			tstate[4 * i + k] = midstate[k * 8 + i];
 	HMAC_SHA256_80_init_4way(W, tstate, ostate);
 	PBKDF2_SHA256_80_128_4way(tstate, ostate, W, W);
 	for (i = 0; i < 32; i++)
@@ -625,9 +779,7 @@ static void scrypt_N_1_1_256_3way(const uint32_t *input,
 	
 	V = (uint32_t *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
 
-	memcpy(tstate +  0, midstate, 32);
-	memcpy(tstate +  8, midstate, 32);
-	memcpy(tstate + 16, midstate, 32);
+	memcpy(tstate, midstate, 3 * 32);
 	HMAC_SHA256_80_init(input +  0, tstate +  0, ostate +  0);
 	HMAC_SHA256_80_init(input + 20, tstate +  8, ostate +  8);
 	HMAC_SHA256_80_init(input + 40, tstate + 16, ostate + 16);
@@ -643,8 +795,9 @@ static void scrypt_N_1_1_256_3way(const uint32_t *input,
 }
 
 #ifdef HAVE_SHA256_4WAY
-static void scrypt_N_1_1_256_12way(const uint32_t *input,
-	uint32_t *output, uint32_t *midstate, unsigned char *scratchpad, int N)
+static bool scrypt_N_1_1_256_12way(const uint32_t *input,
+	uint32_t *output, uint32_t *midstate, unsigned char *scratchpad, int N,
+	const std::atomic<bool> *abort)
 {
 	uint32_t tstate[12 * 8] __attribute__((aligned(128)));
 	uint32_t ostate[12 * 8] __attribute__((aligned(128)));
@@ -662,7 +815,7 @@ static void scrypt_N_1_1_256_12way(const uint32_t *input,
 	for (j = 0; j < 3; j++)
 		for (i = 0; i < 8; i++)
 			for (k = 0; k < 4; k++)
-				tstate[32 * j + 4 * i + k] = midstate[i];
+				tstate[32 * j + 4 * i + k] = midstate[32 * j + k * 8 + i];
 	HMAC_SHA256_80_init_4way(W +   0, tstate +  0, ostate +  0);
 	HMAC_SHA256_80_init_4way(W + 128, tstate + 32, ostate + 32);
 	HMAC_SHA256_80_init_4way(W + 256, tstate + 64, ostate + 64);
@@ -673,10 +826,12 @@ static void scrypt_N_1_1_256_12way(const uint32_t *input,
 		for (i = 0; i < 32; i++)
 			for (k = 0; k < 4; k++)
 				X[128 * j + k * 32 + i] = W[128 * j + 4 * i + k];
-	scrypt_core_3way(X + 0 * 96, V, N);
-	scrypt_core_3way(X + 1 * 96, V, N);
-	scrypt_core_3way(X + 2 * 96, V, N);
-	scrypt_core_3way(X + 3 * 96, V, N);
+	/* The cores share one scratchpad and run in turn, so give up between them */
+	for (j = 0; j < 4; j++) {
+		if (abort && abort->load(std::memory_order_relaxed))
+			return false;
+		scrypt_core_3way(X + j * 96, V, N);
+	}
 	for (j = 0; j < 3; j++)
 		for (i = 0; i < 32; i++)
 			for (k = 0; k < 4; k++)
@@ -688,14 +843,16 @@ static void scrypt_N_1_1_256_12way(const uint32_t *input,
 		for (i = 0; i < 8; i++)
 			for (k = 0; k < 4; k++)
 				output[32 * j + k * 8 + i] = W[128 * j + 4 * i + k];
+	return true;
 }
 #endif /* HAVE_SHA256_4WAY */
 
 #endif /* HAVE_SCRYPT_3WAY */
 
 #ifdef HAVE_SCRYPT_6WAY
-static void scrypt_N_1_1_256_24way(const uint32_t *input,
-	uint32_t *output, uint32_t *midstate, unsigned char *scratchpad, int N)
+static bool scrypt_N_1_1_256_24way(const uint32_t *input,
+	uint32_t *output, uint32_t *midstate, unsigned char *scratchpad, int N,
+	const std::atomic<bool> *abort)
 {
 	uint32_t tstate[24 * 8] __attribute__((aligned(128)));
 	uint32_t ostate[24 * 8] __attribute__((aligned(128)));
@@ -713,7 +870,7 @@ static void scrypt_N_1_1_256_24way(const uint32_t *input,
 	for (j = 0; j < 3; j++)
 		for (i = 0; i < 8; i++)
 			for (k = 0; k < 8; k++)
-				tstate[8 * 8 * j + 8 * i + k] = midstate[i];
+				tstate[8 * 8 * j + 8 * i + k] = midstate[8 * 8 * j + k * 8 + i];
 	HMAC_SHA256_80_init_8way(W +   0, tstate +   0, ostate +   0);
 	HMAC_SHA256_80_init_8way(W + 256, tstate +  64, ostate +  64);
 	HMAC_SHA256_80_init_8way(W + 512, tstate + 128, ostate + 128);
@@ -724,10 +881,11 @@ static void scrypt_N_1_1_256_24way(const uint32_t *input,
 		for (i = 0; i < 32; i++)
 			for (k = 0; k < 8; k++)
 				X[8 * 32 * j + k * 32 + i] = W[8 * 32 * j + 8 * i + k];
-	scrypt_core_6way(X + 0 * 32, V, N);
-	scrypt_core_6way(X + 6 * 32, V, N);
-	scrypt_core_6way(X + 12 * 32, V, N);
-	scrypt_core_6way(X + 18 * 32, V, N);
+	for (j = 0; j < 4; j++) {
+		if (abort && abort->load(std::memory_order_relaxed))
+			return false;
+		scrypt_core_6way(X + j * 6 * 32, V, N);
+	}
 	for (j = 0; j < 3; j++)
 		for (i = 0; i < 32; i++)
 			for (k = 0; k < 8; k++)
@@ -739,9 +897,42 @@ static void scrypt_N_1_1_256_24way(const uint32_t *input,
 		for (i = 0; i < 8; i++)
 			for (k = 0; k < 8; k++)
 				output[8 * 8 * j + k * 8 + i] = W[8 * 32 * j + 8 * i + k];
+	return true;
 }
 #endif /* HAVE_SCRYPT_6WAY */
 
+#ifdef HAVE_SCRYPT_16WAY
+static bool scrypt_N_1_1_256_16way(const uint32_t *input,
+	uint32_t *output, uint32_t *midstate, unsigned char *scratchpad, int N,
+	const std::atomic<bool> *abort)
+{
+	uint32_t tstate[16 * 8] __attribute__((aligned(64)));
+	uint32_t ostate[16 * 8] __attribute__((aligned(64)));
+	uint32_t W[16 * 32] __attribute__((aligned(64)));
+	uint32_t *V;
+	int i, k;
+	
+	V = (uint32_t *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
+	
+	for (i = 0; i < 20; i++)
+		for (k = 0; k < 16; k++)
+			W[16 * i + k] = input[k * 20 + i];
+	for (i = 0; i < 8; i++)
+		for (k = 0; k < 16; k++)
+			tstate[16 * i + k] = midstate[k * 8 + i];
+	HMAC_SHA256_80_init_16way(W, tstate, ostate);
+	PBKDF2_SHA256_80_128_16way(tstate, ostate, W, W);
+	/* The 16-way core works on the interleaved layout directly */
+	if (!scrypt_avx512::scrypt_core_16way(W, V, N, abort))
+		return false;
+	PBKDF2_SHA256_128_32_16way(tstate, ostate, W, W);
+	for (i = 0; i < 8; i++)
+		for (k = 0; k < 16; k++)
+			output[k * 8 + i] = W[16 * i + k];
+	return true;
+}
+#endif /* HAVE_SCRYPT_16WAY */
+
 bool fulltest(const uint32_t *hash, const uint32_t *target)
 {
 	int i;
@@ -757,47 +948,158 @@ bool fulltest(const uint32_t *hash, const uint32_t *target)
 	return true;
 }
 
-bool scrypt_N_1_1_256_multi(void *input, uint256 hashTarget, int *nHashesDone, unsigned char *scratchbuf)
+/*
+ * Number of lanes hashed at once by the widest kernel this CPU runs.
+ * sha256_use_4way() also installs the 4-way SHA256 core, so it must run
+ * before any 4-way transform.
+ */
+#ifdef HAVE_SCRYPT_16WAY
+static bool scrypt_use_16way()
 {
-	uint32_t pdata[20];
-	uint32_t data[SCRYPT_MAX_WAYS * 20];
-	uint32_t dhash[SCRYPT_MAX_WAYS * 8];
-	uint32_t midstate[8];
-	uint32_t n;
-	int throughput = scrypt_best_throughput();
-	int i;
+	uint32_t eax, ebx, ecx, edx;
+	GetCPUID(1, 0, eax, ebx, ecx, edx);
+	if (!((ecx >> 27) & 1)) /* OSXSAVE */
+		return false;
+	GetCPUID(7, 0, eax, ebx, ecx, edx);
+	if (!((ebx >> 16) & 1)) /* AVX512F */
+		return false;
+	/* XMM, YMM, opmask and ZMM state enabled by the OS */
+	uint32_t xcr0, xcr0_hi;
+	__asm__("xgetbv" : "=a"(xcr0), "=d"(xcr0_hi) : "c"(0));
+	return (xcr0 & 0xe6) == 0xe6;
+}
+#endif
 
-	for (int i = 0; i < 20; i++)
-		pdata[i] = be32dec(&((const uint32_t *)input)[i]);
-	n = pdata[19];
-	
+static int scrypt_detect_throughput()
+{
+#ifdef HAVE_SCRYPT_16WAY
+	if (scrypt_use_16way())
+		return 16;
+#endif
+	int throughput = scrypt_best_throughput();
 #ifdef HAVE_SHA256_4WAY
 	if (sha256_use_4way())
 		throughput *= 4;
+#ifdef HAVE_SCRYPT_6WAY
+	else if (throughput == 6)
+		throughput = 3;
+#endif
+#endif
+	return throughput;
+}
+
+int scrypt_throughput()
+{
+	static const int throughput = scrypt_detect_throughput();
+	return throughput;
+}
+
+size_t scrypt_buffer_size(int throughput)
+{
+	/*
+	 * The multi-way kernels run their scrypt cores one after another on the
+	 * same V, so V only has to fit the lanes of one core: the SHA256 4-way
+	 * factor does not count.
+	 */
+	const int core_lanes = (throughput == 16 || throughput % 4 != 0) ? throughput : throughput / 4;
+	return (size_t)N * core_lanes * 128 + 63;
+}
+
+size_t scrypt_buffer_size()
+{
+	return scrypt_buffer_size(scrypt_throughput());
+}
+
+std::vector<int> scrypt_supported_throughputs()
+{
+	/* Runs the detection, which installs the SHA256 cores, first */
+	scrypt_throughput();
+	std::vector<int> ways{1};
+#if defined(HAVE_SCRYPT_3WAY)
+	ways.push_back(3);
 #endif
-	
-	for (i = 0; i < throughput; i++)
-		memcpy(data + i * 20, pdata, 80);
-	
-	sha256_init(midstate);
-	sha256_transform(midstate, data, 0);
-	
-	for (i = 1; i < throughput; i++)
-		data[i * 20 + 19] = ++n;
-		
+#if defined(HAVE_SHA256_4WAY)
+	if (sha256_use_4way()) {
+		ways.push_back(4);
+#if defined(HAVE_SCRYPT_3WAY)
+		ways.push_back(12);
+#endif
+#if defined(HAVE_SCRYPT_6WAY)
+		if (scrypt_best_throughput() == 6)
+			ways.push_back(24);
+#endif
+	}
+#endif
+#if defined(HAVE_SCRYPT_16WAY)
+	if (scrypt_use_16way())
+		ways.push_back(16);
+#endif
+	std::sort(ways.begin(), ways.end());
+	return ways;
+}
+
+unsigned char *scrypt_buffer_alloc()
+{
+	return (unsigned char*)malloc(scrypt_buffer_size());
+}
+
+std::string ScryptAutoDetect()
+{
+	const int throughput = scrypt_throughput();
+	std::string ret = "standard";
+#if defined(__x86_64__) && defined(HAVE_GETCPUID)
+	ret = "sse2";
+#if defined(USE_AVX)
+	uint32_t eax, ebx, ecx, edx;
+	GetCPUID(1, 0, eax, ebx, ecx, edx);
+	if (((ecx >> 27) & 1) && ((ecx >> 28) & 1)) {
+		uint32_t xcr0, xcr0_hi;
+		__asm__("xgetbv" : "=a"(xcr0), "=d"(xcr0_hi) : "c"(0));
+		if ((xcr0 & 6) == 6) {
+			ret = "avx";
+#if defined(USE_XOP)
+			GetCPUID(0x80000001, 0, eax, ebx, ecx, edx);
+			if ((ecx >> 11) & 1)
+				ret = "xop";
+#endif
+		}
+	}
+#endif
+	if (throughput == 24)
+		ret = "avx2";
+	if (throughput == 16)
+		ret = "avx512";
+#endif
+	return ret + "(" + std::to_string(throughput) + "way)";
+}
+
+/*
+ * Hash `throughput` lanes of 20 words each. midstate holds one SHA-256
+ * midstate per lane, output receives 8 words per lane.
+ */
+/* Returns false if `abort` stopped the kernel before it finished */
+static bool scrypt_N_1_1_256_lanes(const uint32_t *data, uint32_t *dhash,
+	uint32_t *midstate, unsigned char *scratchbuf, int throughput,
+	const std::atomic<bool> *abort = nullptr)
+{
 #if defined(HAVE_SHA256_4WAY)
 	if (throughput == 4)
         scrypt_N_1_1_256_4way(data, dhash, midstate, scratchbuf, N);
 	else
 #endif
+#if defined(HAVE_SCRYPT_16WAY)
+	if (throughput == 16)
+        return scrypt_N_1_1_256_16way(data, dhash, midstate, scratchbuf, N, abort);
+	else
+#endif
 #if defined(HAVE_SCRYPT_3WAY) && defined(HAVE_SHA256_4WAY)
 	if (throughput == 12)
-        scrypt_N_1_1_256_12way(data, dhash, midstate, scratchbuf, N);
+        return scrypt_N_1_1_256_12way(data, dhash, midstate, scratchbuf, N, abort);
 	else
 #endif
 #if defined(HAVE_SCRYPT_6WAY)
 	if (throughput == 24)
-        scrypt_N_1_1_256_24way(data, dhash, midstate, scratchbuf, N);
+        return scrypt_N_1_1_256_24way(data, dhash, midstate, scratchbuf, N, abort);
 	else
 #endif
 #if defined(HAVE_SCRYPT_3WAY)
@@ -806,7 +1108,45 @@ bool scrypt_N_1_1_256_multi(void *input, uint256 hashTarget, int *nHashesDone, u
 	else
 #endif
 		scrypt_N_1_1_256(data, dhash, midstate, scratchbuf);
+	return true;
+}
+
+bool scrypt_N_1_1_256_multi(void *input, uint256 hashTarget, int *nHashesDone, unsigned char *scratchbuf, const std::atomic<bool> *abort)
+{
+	return scrypt_N_1_1_256_multi(input, hashTarget, nHashesDone, scratchbuf, scrypt_throughput(), abort);
+}
+
+bool scrypt_N_1_1_256_multi(void *input, uint256 hashTarget, int *nHashesDone, unsigned char *scratchbuf, int throughput, const std::atomic<bool> *abort)
+{
+	uint32_t pdata[20];
+	uint32_t data[SCRYPT_MAX_WAYS * 20];
+	uint32_t dhash[SCRYPT_MAX_WAYS * 8];
+	uint32_t midstate[SCRYPT_MAX_WAYS * 8];
+	uint32_t n;
+	int i;
+
+	assert(throughput >= 1 && throughput <= SCRYPT_MAX_WAYS);
+
+	for (int i = 0; i < 20; i++)
+		pdata[i] = be32dec(&((const uint32_t *)input)[i]);
+	n = pdata[19];
+	
+	for (i = 0; i < throughput; i++)
+		memcpy(data + i * 20, pdata, 80);
+	
+	/* The nonce is past the first block, so all lanes share one midstate */
+	sha256_init(midstate);
+	sha256_transform(midstate, data, 0);
+	for (i = 1; i < throughput; i++)
+		memcpy(midstate + i * 8, midstate, 32);
+	
+	for (i = 1; i < throughput; i++)
+		data[i * 20 + 19] = ++n;
 		
+	if (!scrypt_N_1_1_256_lanes(data, dhash, midstate, scratchbuf, throughput, abort)) {
+		*nHashesDone = 0;
+		return false;
+	}
 	*nHashesDone = throughput;
 
 	for (i = 0; i < throughput; i++) {
@@ -818,15 +1158,10 @@ bool scrypt_N_1_1_256_multi(void *input, uint256 hashTarget, int *nHashesDone, u
 	return false;
 }
 
-void scryptHash(const void *input, char *output)
+void scryptHash(const void *input, char *output, unsigned char *scratchbuf)
 {
     uint32_t midstate[8];
     uint32_t data[20];
-    unsigned char *scratchbuf = scrypt_buffer_alloc();
-
-    memset(output, 0, 32);
-    if (!scratchbuf)
-        return;
 
     for (int i = 0; i < 20; i++)
         data[i] = be32dec(&((const uint32_t *)input)[i]);
@@ -835,6 +1170,63 @@ void scryptHash(const void *input, char *output)
     sha256_transform(midstate, data, 0);
 
     scrypt_N_1_1_256(data, (uint32_t*)output, midstate, scratchbuf);
+}
+
+void scryptHash(const void *input, char *output)
+{
+    unsigned char *scratchbuf = g_scratchpad_pool.Acquire();
+
+    memset(output, 0, 32);
+    if (!scratchbuf)
+        return;
+
+    scryptHash(input, output, scratchbuf);
+
+    g_scratchpad_pool.Release(scratchbuf);
+}
+
+void scryptHashBatch(const void *input, char *output, size_t count)
+{
+    uint32_t data[SCRYPT_MAX_WAYS * 20];
+    uint32_t dhash[SCRYPT_MAX_WAYS * 8];
+    uint32_t midstate[SCRYPT_MAX_WAYS * 8];
+    const size_t throughput = scrypt_throughput();
+
+    memset(output, 0, 32 * count);
+    if (count == 0)
+        return;
+
+    /* A lone header does not need a multi-way scratchpad */
+    if (count < throughput) {
+        for (size_t i = 0; i < count; i++)
+            scryptHash((const char *)input + 80 * i, output + 32 * i);
+        return;
+    }
+
+    unsigned char *scratchbuf = g_scratchpad_pool_multi.Acquire();
+    if (!scratchbuf)
+        return;
+
+    for (size_t done = 0; done < count; ) {
+        const size_t lanes = std::min(throughput, count - done);
+        const uint32_t *lane_input = (const uint32_t *)((const char *)input + 80 * done);
+
+        if (lanes < throughput) {
+            /* Leftover headers go through the single-way kernel */
+            for (size_t i = 0; i < lanes; i++)
+                scryptHash(lane_input + 20 * i, output + 32 * (done + i), scratchbuf);
+        } else {
+            for (size_t i = 0; i < lanes; i++) {
+                for (int j = 0; j < 20; j++)
+                    data[20 * i + j] = be32dec(&lane_input[20 * i + j]);
+                sha256_init(midstate + 8 * i);
+                sha256_transform(midstate + 8 * i, data + 20 * i, 0);
+            }
+            scrypt_N_1_1_256_lanes(data, dhash, midstate, scratchbuf, throughput);
+            memcpy(output + 32 * done, dhash, 32 * lanes);
+        }
+        done += lanes;
+    }
 
-    free(scratchbuf);
+    g_scratchpad_pool_multi.Release(scratchbuf);
 }
@@ -8,10 +8,13 @@
 #include "uint256.h"
 #include "compat/byteswap.h"
 #include "util/strencodings.h"
+#include <atomic>
 #include <inttypes.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string>
+#include <vector>
 
 #if CLIENT_IS_VERIUM
 static const int SCRYPT_SCRATCHPAD_SIZE = 134218239;
@@ -21,40 +24,72 @@ static const int SCRYPT_SCRATCHPAD_SIZE = 131135;
 static const int N = 1024;
 #endif
 
-int scrypt_best_throughput();
+/** Select the scrypt kernels for this CPU and describe them, like SHA256AutoDetect(). */
+std::string ScryptAutoDetect();
 
-bool scrypt_N_1_1_256_multi(void* input, uint256 hashTarget, int* nHashesDone, unsigned char* scratchbuf);
+/**
+ * Hash scrypt_throughput() consecutive nonces of a header. When `abort` is set
+ * by another thread, the search stops at the next point the kernels allow and
+ * returns false with *nHashesDone = 0.
+ */
+bool scrypt_N_1_1_256_multi(void* input, uint256 hashTarget, int* nHashesDone, unsigned char* scratchbuf, const std::atomic<bool>* abort = nullptr);
+/** Same as above on `throughput` lanes, one of scrypt_supported_throughputs(), with a scratchpad of scrypt_buffer_size(throughput) bytes. */
+bool scrypt_N_1_1_256_multi(void* input, uint256 hashTarget, int* nHashesDone, unsigned char* scratchbuf, int throughput, const std::atomic<bool>* abort = nullptr);
 
+/** Hash an 80-byte header with scrypt(N, 1, 1) using a pooled single-way scratchpad. */
 void scryptHash(const void* input, char* output);
+/** Same as above, with a caller-owned scratchpad of at least SCRYPT_SCRATCHPAD_SIZE bytes. */
+void scryptHash(const void* input, char* output, unsigned char* scratchbuf);
+/** Hash `count` packed 80-byte headers into `count` packed 32-byte outputs, filling the widest multi-way kernel. */
+void scryptHashBatch(const void* input, char* output, size_t count);
+/** Bytes needed by a scratchpad for scrypt_N_1_1_256_multi(), 63 of which are alignment slack. */
+size_t scrypt_buffer_size();
+size_t scrypt_buffer_size(int throughput);
+/** Lane count of the multi-way kernel picked for this CPU, which scryptHashBatch() fills. */
+int scrypt_throughput();
+/** Lane counts of every multi-way kernel this CPU runs, in increasing order. */
+std::vector<int> scrypt_supported_throughputs();
 extern unsigned char* scrypt_buffer_alloc();
 extern "C" void scrypt_core(uint32_t* X, uint32_t* V, int N);
 extern "C" void sha256_transform(uint32_t* state, const uint32_t* block, int swap);
 
-#if defined(__x86_64__) && !defined(USE_AVX2)
+#if defined(__x86_64__)
 
-#define SCRYPT_MAX_WAYS 12
+/* The assembly picks the SSE2, AVX, XOP or AVX2 variant of each kernel at runtime. */
 #define HAVE_SCRYPT_3WAY 1
 #define HAVE_SHA256_4WAY 1
-#define scrypt_best_throughput() 3;
+extern "C" int scrypt_best_throughput();
 extern "C" int sha256_use_4way();
 extern "C" void sha256_init_4way(uint32_t* state);
 extern "C" void sha256_transform_4way(uint32_t* state, const uint32_t* block, int swap);
 extern "C" void scrypt_core_3way(uint32_t* X, uint32_t* V, int N);
 
-#elif defined(__x86_64__) && defined(USE_AVX2)
-
+#if defined(USE_AVX2)
 #define SCRYPT_MAX_WAYS 24
 #define HAVE_SCRYPT_6WAY 1
-#define HAVE_SHA256_4WAY 1
 #define HAVE_SHA256_8WAY 1
-#define scrypt_best_throughput() 6;
 extern "C" int sha256_use_8way();
 extern "C" void sha256_init_8way(uint32_t* state);
 extern "C" void sha256_transform_8way(uint32_t* state, const uint32_t* block, int swap);
-extern "C" int sha256_use_4way();
-extern "C" void sha256_init_4way(uint32_t* state);
-extern "C" void sha256_transform_4way(uint32_t* state, const uint32_t* block, int swap);
 extern "C" void scrypt_core_6way(uint32_t* X, uint32_t* V, int N);
+#else
+#define SCRYPT_MAX_WAYS 12
+#endif
+
+#if defined(ENABLE_AVX512F) && !defined(BUILD_BITCOIN_INTERNAL)
+#define HAVE_SCRYPT_16WAY 1
+#if SCRYPT_MAX_WAYS < 16
+#undef SCRYPT_MAX_WAYS
+#define SCRYPT_MAX_WAYS 16
+#endif
+namespace scrypt_avx512 {
+/** Words are interleaved across lanes: lane k of word i is at index 16 * i + k. */
+void sha256_init_16way(uint32_t* state);
+void sha256_transform_16way(uint32_t* state, const uint32_t* block, int swap);
+/** V must hold N * 16 * 128 bytes. Returns false if `abort` was set before the core finished. */
+bool scrypt_core_16way(uint32_t* X, uint32_t* V, int N, const std::atomic<bool>* abort = nullptr);
+}
+#endif
 
 #elif defined(__i386__)
 
@@ -0,0 +1,187 @@
+// Copyright (c) 2020 The Vericonomy developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// 16-way scrypt kernels. Every __m512i holds the same 32-bit word of 16
+// independent lanes, so lane k of word i lives at index 16 * i + k.
+
+#ifdef ENABLE_AVX512F
+
+#include <atomic>
+#include <stdint.h>
+#include <immintrin.h>
+
+namespace scrypt_avx512 {
+namespace {
+
+__m512i inline K(uint32_t x) { return _mm512_set1_epi32(x); }
+
+__m512i inline Add(__m512i x, __m512i y) { return _mm512_add_epi32(x, y); }
+__m512i inline Add(__m512i x, __m512i y, __m512i z) { return Add(Add(x, y), z); }
+__m512i inline Add(__m512i x, __m512i y, __m512i z, __m512i w) { return Add(Add(x, y), Add(z, w)); }
+__m512i inline Xor(__m512i x, __m512i y) { return _mm512_xor_si512(x, y); }
+__m512i inline Xor(__m512i x, __m512i y, __m512i z) { return _mm512_ternarylogic_epi32(x, y, z, 0x96); }
+__m512i inline And(__m512i x, __m512i y) { return _mm512_and_si512(x, y); }
+__m512i inline Or(__m512i x, __m512i y) { return _mm512_or_si512(x, y); }
+// The zero-masked forms, as GCC 12 warns of the undefined source in the unmasked ones
+const __mmask16 ALL = 0xFFFF;
+__m512i inline ShL(__m512i x, int n) { return _mm512_maskz_slli_epi32(ALL, x, n); }
+__m512i inline ShR(__m512i x, int n) { return _mm512_maskz_srli_epi32(ALL, x, n); }
+template <int n> __m512i inline RotL(__m512i x) { return _mm512_maskz_rol_epi32(ALL, x, n); }
+template <int n> __m512i inline RotR(__m512i x) { return _mm512_maskz_ror_epi32(ALL, x, n); }
+
+__m512i inline Ch(__m512i x, __m512i y, __m512i z) { return _mm512_ternarylogic_epi32(x, y, z, 0xca); }
+__m512i inline Maj(__m512i x, __m512i y, __m512i z) { return _mm512_ternarylogic_epi32(x, y, z, 0xe8); }
+__m512i inline Sigma0(__m512i x) { return Xor(RotR<2>(x), RotR<13>(x), RotR<22>(x)); }
+__m512i inline Sigma1(__m512i x) { return Xor(RotR<6>(x), RotR<11>(x), RotR<25>(x)); }
+__m512i inline sigma0(__m512i x) { return Xor(RotR<7>(x), RotR<18>(x), ShR(x, 3)); }
+__m512i inline sigma1(__m512i x) { return Xor(RotR<17>(x), RotR<19>(x), ShR(x, 10)); }
+
+/** Byte swap every word, using AVX512F only. */
+__m512i inline BSwap(__m512i x)
+{
+    return Or(RotL<24>(And(x, K(0x00ff00ff))), RotL<8>(And(x, K(0xff00ff00))));
+}
+
+const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+const uint32_t sha256_h[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+/** Salsa20/8 core: B ^= Bx, then B += Salsa20/8(B). */
+void inline __attribute__((always_inline)) XorSalsa8(__m512i* B, const __m512i* Bx)
+{
+    __m512i x[16];
+    for (int i = 0; i < 16; i++)
+        x[i] = B[i] = Xor(B[i], Bx[i]);
+
+    for (int i = 0; i < 8; i += 2) {
+        // Columns
+        x[ 4] = Xor(x[ 4], RotL<7>(Add(x[ 0], x[12])));  x[ 9] = Xor(x[ 9], RotL<7>(Add(x[ 5], x[ 1])));
+        x[14] = Xor(x[14], RotL<7>(Add(x[10], x[ 6])));  x[ 3] = Xor(x[ 3], RotL<7>(Add(x[15], x[11])));
+        x[ 8] = Xor(x[ 8], RotL<9>(Add(x[ 4], x[ 0])));  x[13] = Xor(x[13], RotL<9>(Add(x[ 9], x[ 5])));
+        x[ 2] = Xor(x[ 2], RotL<9>(Add(x[14], x[10])));  x[ 7] = Xor(x[ 7], RotL<9>(Add(x[ 3], x[15])));
+        x[12] = Xor(x[12], RotL<13>(Add(x[ 8], x[ 4]))); x[ 1] = Xor(x[ 1], RotL<13>(Add(x[13], x[ 9])));
+        x[ 6] = Xor(x[ 6], RotL<13>(Add(x[ 2], x[14]))); x[11] = Xor(x[11], RotL<13>(Add(x[ 7], x[ 3])));
+        x[ 0] = Xor(x[ 0], RotL<18>(Add(x[12], x[ 8]))); x[ 5] = Xor(x[ 5], RotL<18>(Add(x[ 1], x[13])));
+        x[10] = Xor(x[10], RotL<18>(Add(x[ 6], x[ 2]))); x[15] = Xor(x[15], RotL<18>(Add(x[11], x[ 7])));
+
+        // Rows
+        x[ 1] = Xor(x[ 1], RotL<7>(Add(x[ 0], x[ 3])));  x[ 6] = Xor(x[ 6], RotL<7>(Add(x[ 5], x[ 4])));
+        x[11] = Xor(x[11], RotL<7>(Add(x[10], x[ 9])));  x[12] = Xor(x[12], RotL<7>(Add(x[15], x[14])));
+        x[ 2] = Xor(x[ 2], RotL<9>(Add(x[ 1], x[ 0])));  x[ 7] = Xor(x[ 7], RotL<9>(Add(x[ 6], x[ 5])));
+        x[ 8] = Xor(x[ 8], RotL<9>(Add(x[11], x[10])));  x[13] = Xor(x[13], RotL<9>(Add(x[12], x[15])));
+        x[ 3] = Xor(x[ 3], RotL<13>(Add(x[ 2], x[ 1]))); x[ 4] = Xor(x[ 4], RotL<13>(Add(x[ 7], x[ 6])));
+        x[ 9] = Xor(x[ 9], RotL<13>(Add(x[ 8], x[11]))); x[14] = Xor(x[14], RotL<13>(Add(x[13], x[12])));
+        x[ 0] = Xor(x[ 0], RotL<18>(Add(x[ 3], x[ 2]))); x[ 5] = Xor(x[ 5], RotL<18>(Add(x[ 4], x[ 7])));
+        x[10] = Xor(x[10], RotL<18>(Add(x[ 9], x[ 8]))); x[15] = Xor(x[15], RotL<18>(Add(x[14], x[13])));
+    }
+
+    for (int i = 0; i < 16; i++)
+        B[i] = Add(B[i], x[i]);
+}
+
+/** One round of SHA-256. */
+void inline __attribute__((always_inline)) Round(__m512i a, __m512i b, __m512i c, __m512i& d, __m512i e, __m512i f, __m512i g, __m512i& h, __m512i k)
+{
+    __m512i t1 = Add(h, Sigma1(e), Ch(e, f, g), k);
+    __m512i t2 = Add(Sigma0(a), Maj(a, b, c));
+    d = Add(d, t1);
+    h = Add(t1, t2);
+}
+
+} // namespace
+
+void sha256_init_16way(uint32_t* state)
+{
+    for (int i = 0; i < 8; i++)
+        _mm512_storeu_si512(state + 16 * i, K(sha256_h[i]));
+}
+
+void sha256_transform_16way(uint32_t* state, const uint32_t* block, int swap)
+{
+    __m512i W[64];
+    for (int i = 0; i < 16; i++) {
+        W[i] = _mm512_loadu_si512(block + 16 * i);
+        if (swap)
+            W[i] = BSwap(W[i]);
+    }
+    for (int i = 16; i < 64; i++)
+        W[i] = Add(sigma1(W[i - 2]), W[i - 7], sigma0(W[i - 15]), W[i - 16]);
+
+    __m512i S[8];
+    for (int i = 0; i < 8; i++)
+        S[i] = _mm512_loadu_si512(state + 16 * i);
+
+    __m512i a = S[0], b = S[1], c = S[2], d = S[3], e = S[4], f = S[5], g = S[6], h = S[7];
+    for (int i = 0; i < 64; i += 8) {
+        Round(a, b, c, d, e, f, g, h, Add(W[i + 0], K(sha256_k[i + 0])));
+        Round(h, a, b, c, d, e, f, g, Add(W[i + 1], K(sha256_k[i + 1])));
+        Round(g, h, a, b, c, d, e, f, Add(W[i + 2], K(sha256_k[i + 2])));
+        Round(f, g, h, a, b, c, d, e, Add(W[i + 3], K(sha256_k[i + 3])));
+        Round(e, f, g, h, a, b, c, d, Add(W[i + 4], K(sha256_k[i + 4])));
+        Round(d, e, f, g, h, a, b, c, Add(W[i + 5], K(sha256_k[i + 5])));
+        Round(c, d, e, f, g, h, a, b, Add(W[i + 6], K(sha256_k[i + 6])));
+        Round(b, c, d, e, f, g, h, a, Add(W[i + 7], K(sha256_k[i + 7])));
+    }
+
+    _mm512_storeu_si512(state + 16 * 0, Add(S[0], a));
+    _mm512_storeu_si512(state + 16 * 1, Add(S[1], b));
+    _mm512_storeu_si512(state + 16 * 2, Add(S[2], c));
+    _mm512_storeu_si512(state + 16 * 3, Add(S[3], d));
+    _mm512_storeu_si512(state + 16 * 4, Add(S[4], e));
+    _mm512_storeu_si512(state + 16 * 5, Add(S[5], f));
+    _mm512_storeu_si512(state + 16 * 6, Add(S[6], g));
+    _mm512_storeu_si512(state + 16 * 7, Add(S[7], h));
+}
+
+/** Iterations of the core between two looks at the abort flag */
+static const int ABORT_CHECK_INTERVAL = 1 << 16;
+
+bool scrypt_core_16way(uint32_t* X, uint32_t* V, int N, const std::atomic<bool>* abort)
+{
+    __m512i B[32];
+    for (int i = 0; i < 32; i++)
+        B[i] = _mm512_loadu_si512(X + 16 * i);
+
+    for (int i = 0; i < N; i++) {
+        if (abort && i % ABORT_CHECK_INTERVAL == 0 && abort->load(std::memory_order_relaxed))
+            return false;
+        for (int j = 0; j < 32; j++)
+            _mm512_storeu_si512(V + 512 * i + 16 * j, B[j]);
+        XorSalsa8(B, B + 16);
+        XorSalsa8(B + 16, B);
+    }
+
+    // Every lane picks its own V entry from its word 16: gather word j of
+    // lane k from V[512 * entry + 16 * j + k].
+    const __m512i lanes = _mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    const __m512i mask = K(N - 1);
+    for (int i = 0; i < N; i++) {
+        if (abort && i % ABORT_CHECK_INTERVAL == 0 && abort->load(std::memory_order_relaxed))
+            return false;
+        const __m512i index = Add(ShL(And(B[16], mask), 9), lanes);
+        for (int j = 0; j < 32; j++)
+            B[j] = Xor(B[j], _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), ALL, index, V + 16 * j, 4));
+        XorSalsa8(B, B + 16);
+        XorSalsa8(B + 16, B);
+    }
+
+    for (int i = 0; i < 32; i++)
+        _mm512_storeu_si512(X + 16 * i, B[i]);
+    return true;
+}
+
+} // namespace scrypt_avx512
+
+#endif
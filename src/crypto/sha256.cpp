@@ -22,11 +22,13 @@ void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks);
 namespace sha256d64_sse41
 {
 void Transform_4way(unsigned char* out, const unsigned char* in);
+void Transform_4way_1block(unsigned char* out, const unsigned char* in);
 }
 
 namespace sha256d64_avx2
 {
 void Transform_8way(unsigned char* out, const unsigned char* in);
+void Transform_8way_1block(unsigned char* out, const unsigned char* in);
 }
 
 namespace sha256d64_shani
@@ -461,6 +463,40 @@ TransformD64Type TransformD64 = sha256::TransformD64;
 TransformD64Type TransformD64_2way = nullptr;
 TransformD64Type TransformD64_4way = nullptr;
 TransformD64Type TransformD64_8way = nullptr;
+TransformD64Type TransformD1_4way = nullptr;
+TransformD64Type TransformD1_8way = nullptr;
+
+/** Double-SHA256 of a single block that already carries its message padding. */
+void TransformD1(unsigned char* out, const unsigned char* in)
+{
+    uint32_t s[8];
+    unsigned char buffer2[64] = {
+        0,    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0,    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0,    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0
+    };
+    sha256::Initialize(s);
+    Transform(s, in, 1);
+    WriteBE32(buffer2 + 0, s[0]);
+    WriteBE32(buffer2 + 4, s[1]);
+    WriteBE32(buffer2 + 8, s[2]);
+    WriteBE32(buffer2 + 12, s[3]);
+    WriteBE32(buffer2 + 16, s[4]);
+    WriteBE32(buffer2 + 20, s[5]);
+    WriteBE32(buffer2 + 24, s[6]);
+    WriteBE32(buffer2 + 28, s[7]);
+    sha256::Initialize(s);
+    Transform(s, buffer2, 1);
+    WriteBE32(out + 0, s[0]);
+    WriteBE32(out + 4, s[1]);
+    WriteBE32(out + 8, s[2]);
+    WriteBE32(out + 12, s[3]);
+    WriteBE32(out + 16, s[4]);
+    WriteBE32(out + 20, s[5]);
+    WriteBE32(out + 24, s[6]);
+    WriteBE32(out + 28, s[7]);
+}
 
 bool SelfTest() {
     // Input state (equal to the initial SHA256 state)
@@ -544,6 +580,22 @@ bool SelfTest() {
         if (!std::equal(out, out + 256, result_d64)) return false;
     }
 
+    // Test TransformD1_4way and TransformD1_8way against TransformD1, if available.
+    unsigned char result_d1[256];
+    for (size_t i = 0; i < 8; ++i) {
+        TransformD1(result_d1 + 32 * i, data + 1 + 64 * i);
+    }
+    if (TransformD1_4way) {
+        unsigned char out[128];
+        TransformD1_4way(out, data + 1);
+        if (!std::equal(out, out + 128, result_d1)) return false;
+    }
+    if (TransformD1_8way) {
+        unsigned char out[256];
+        TransformD1_8way(out, data + 1);
+        if (!std::equal(out, out + 256, result_d1)) return false;
+    }
+
     return true;
 }
 
@@ -611,6 +663,7 @@ std::string SHA256AutoDetect()
 #endif
 #if defined(ENABLE_SSE41) && !defined(BUILD_BITCOIN_INTERNAL)
         TransformD64_4way = sha256d64_sse41::Transform_4way;
+        TransformD1_4way = sha256d64_sse41::Transform_4way_1block;
         ret += ",sse41(4way)";
 #endif
     }
@@ -618,6 +671,7 @@ std::string SHA256AutoDetect()
 #if defined(ENABLE_AVX2) && !defined(BUILD_BITCOIN_INTERNAL)
     if (have_avx2 && have_avx && enabled_avx) {
         TransformD64_8way = sha256d64_avx2::Transform_8way;
+        TransformD1_8way = sha256d64_avx2::Transform_8way_1block;
         ret += ",avx2(8way)";
     }
 #endif
@@ -717,3 +771,29 @@ void SHA256D64(unsigned char* out, const unsigned char* in, size_t blocks)
         --blocks;
     }
 }
+
+void SHA256D1(unsigned char* out, const unsigned char* in, size_t blocks)
+{
+    if (TransformD1_8way) {
+        while (blocks >= 8) {
+            TransformD1_8way(out, in);
+            out += 256;
+            in += 512;
+            blocks -= 8;
+        }
+    }
+    if (TransformD1_4way) {
+        while (blocks >= 4) {
+            TransformD1_4way(out, in);
+            out += 128;
+            in += 256;
+            blocks -= 4;
+        }
+    }
+    while (blocks) {
+        TransformD1(out, in);
+        out += 32;
+        in += 64;
+        --blocks;
+    }
+}
@@ -38,4 +38,12 @@ std::string SHA256AutoDetect();
  */
 void SHA256D64(unsigned char* output, const unsigned char* input, size_t blocks);
 
+/** Compute multiple double-SHA256's of messages that fit in one block.
+ *  output:  pointer to a blocks*32 byte output buffer
+ *  input:   pointer to a blocks*64 byte input buffer, each 64 bytes holding a
+ *           message of at most 55 bytes followed by its SHA-256 padding
+ *  blocks:  the number of hashes to compute.
+ */
+void SHA256D1(unsigned char* output, const unsigned char* input, size_t blocks);
+
 #endif // BITCOIN_CRYPTO_SHA256_H
@@ -1,9 +1,27 @@
 #include <downloader.h>
 
+#include <chainparams.h>
 #include <clientversion.h>
+#include <crypto/sha256.h>
 #include <init.h>
 #include <logging.h>
+#include <node/coinstats.h>
+#include <serialize.h>
+#include <streams.h>
+#include <txdb.h>
+#include <util/message.h>
+#include <util/strencodings.h>
+#include <util/string.h>
 #include <util/system.h>
+#include <util/threadnames.h>
+#include <warnings.h>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <map>
+#include <vector>
 
 #include <util/miniunz.h>
 #define CURL_STATICLIB
@@ -44,13 +62,9 @@ std::string getClientUrl() {
         return CLIENT_URL_VRM;
 }
 
-void downloadFile(std::string url, const fs::path& target_file_path) {
-
-    LogPrintf("Download: Downloading from %s. \n", url);
-
-    FILE *file = fsbridge::fopen(target_file_path, "wb");
-    if( ! file )
-        throw std::runtime_error(strprintf("Download: error: Unable to open output file for writing: %s.", target_file_path.string().c_str()));
+/* Run one transfer, handing the body to write_function, or to fwrite() into
+ * write_data if it is nullptr. Throws on any transfer or HTTP error. */
+static void performDownload(const std::string& url, curl_write_callback write_function, void* write_data) {
 
     CURL *curlHandle = curl_easy_init();
 
@@ -62,10 +76,14 @@ void downloadFile(std::string url, const fs::path& target_file_path) {
 
     curl_easy_setopt(curlHandle, CURLOPT_URL, url.c_str());
     curl_easy_setopt(curlHandle, CURLOPT_FOLLOWLOCATION, 1L);
+    // An error page must not reach a write callback as if it were the body
+    curl_easy_setopt(curlHandle, CURLOPT_FAILONERROR, 1L);
     curl_easy_setopt(curlHandle, CURLOPT_NOPROGRESS, 0);
     curl_easy_setopt(curlHandle, CURLOPT_XFERINFODATA, xferinfo_data);
     curl_easy_setopt(curlHandle, CURLOPT_XFERINFOFUNCTION, xferinfo);
-    curl_easy_setopt(curlHandle, CURLOPT_WRITEDATA, file);
+    if (write_function)
+        curl_easy_setopt(curlHandle, CURLOPT_WRITEFUNCTION, write_function);
+    curl_easy_setopt(curlHandle, CURLOPT_WRITEDATA, write_data);
     res = curl_easy_perform(curlHandle);
 
     if(res != CURLE_OK) {
@@ -79,10 +97,311 @@ void downloadFile(std::string url, const fs::path& target_file_path) {
 
     long response_code;
     curl_easy_getinfo(curlHandle, CURLINFO_RESPONSE_CODE, &response_code);
+    curl_easy_cleanup(curlHandle);
     if( response_code != 200 )
         throw std::runtime_error(strprintf("Download: error: Server responded with a %d .", response_code));
+}
+
+static size_t writeString(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    std::string* str = static_cast<std::string*>(userdata);
+    str->append(ptr, size * nmemb);
+    return size * nmemb;
+}
+
+std::string downloadString(const std::string& url) {
+    std::string str;
+    performDownload(url, writeString, &str);
+    return str;
+}
+
+/* What the server tells of a file before it is downloaded */
+struct RemoteFile
+{
+    bool fRanges{false};
+    uint64_t nSize{0};
+    std::string strETag;
+    std::string strLastModified;
+
+    // Identifies the content, so a partial download is only resumed on the same file
+    std::string Validator() const { return strETag.empty() ? strLastModified : strETag; }
+};
 
+static size_t parseHeader(char *buffer, size_t size, size_t nitems, void *userdata)
+{
+    RemoteFile* remote = static_cast<RemoteFile*>(userdata);
+    const std::string header(buffer, size * nitems);
+    const size_t colon = header.find(':');
+    if (header.compare(0, 5, "HTTP/") == 0) {
+        // Each response of a redirect chain brings its own headers
+        *remote = RemoteFile();
+    } else if (colon != std::string::npos) {
+        const std::string name = ToLower(TrimString(header.substr(0, colon)));
+        const std::string value = TrimString(header.substr(colon + 1));
+        if (name == "accept-ranges")
+            remote->fRanges = value == "bytes";
+        else if (name == "etag")
+            remote->strETag = value;
+        else if (name == "last-modified")
+            remote->strLastModified = value;
+    }
+    return size * nitems;
+}
+
+/* Ask for the size of a file and whether it can be downloaded in ranges. A
+ * failed probe is not an error, the file is then downloaded in one piece. */
+static RemoteFile probeDownload(const std::string& url) {
+
+    RemoteFile remote;
+    CURL *curlHandle = curl_easy_init();
+    curl_easy_setopt(curlHandle, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curlHandle, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curlHandle, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(curlHandle, CURLOPT_NOBODY, 1L);
+    curl_easy_setopt(curlHandle, CURLOPT_HEADERFUNCTION, parseHeader);
+    curl_easy_setopt(curlHandle, CURLOPT_HEADERDATA, &remote);
+    curl_off_t nLength = -1;
+    if (curl_easy_perform(curlHandle) == CURLE_OK)
+        curl_easy_getinfo(curlHandle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &nLength);
     curl_easy_cleanup(curlHandle);
+
+    if (nLength <= 0)
+        remote.fRanges = false;
+    else
+        remote.nSize = nLength;
+    return remote;
+}
+
+/* The state of a ranged download, kept next to its partial file */
+struct DownloadProgress
+{
+    std::string strUrl;
+    uint64_t nSize;
+    std::string strValidator;
+    uint64_t nChunkSize;
+    std::vector<unsigned char> vDone;
+
+    SERIALIZE_METHODS(DownloadProgress, obj) { READWRITE(obj.strUrl, obj.nSize, obj.strValidator, obj.nChunkSize, obj.vDone); }
+};
+
+static bool readProgress(const fs::path& path, DownloadProgress& progress) {
+    CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull())
+        return false;
+    try {
+        file >> progress;
+    } catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
+
+static void writeProgress(const fs::path& path, const DownloadProgress& progress) {
+    const fs::path pathTmp = path.string() + ".new";
+    CAutoFile file(fsbridge::fopen(pathTmp, "wb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull())
+        throw std::runtime_error(strprintf("Download: error: Unable to open progress file for writing: %s.", pathTmp.string()));
+    file << progress;
+    if (!FileCommit(file.Get()))
+        throw std::runtime_error(strprintf("Download: error: Unable to write progress file: %s.", pathTmp.string()));
+    file.fclose();
+    if (!RenameOver(pathTmp, path))
+        throw std::runtime_error(strprintf("Download: error: Unable to write progress file: %s.", path.string()));
+}
+
+static bool seekFile(FILE* file, uint64_t nPos) {
+#ifdef WIN32
+    return _fseeki64(file, nPos, SEEK_SET) == 0;
+#else
+    return fseeko(file, nPos, SEEK_SET) == 0;
+#endif
+}
+
+/* One ranged request of a download */
+struct RangeTransfer
+{
+    size_t nChunk;
+    uint64_t nLength;
+    uint64_t nReceived;
+    FILE* file;
+};
+
+static size_t writeRange(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    RangeTransfer* transfer = static_cast<RangeTransfer*>(userdata);
+    const size_t len = size * nmemb;
+    // A server ignoring the range would send more than was asked for
+    if (transfer->nReceived + len > transfer->nLength || fwrite(ptr, 1, len, transfer->file) != len)
+        return 0; // abort the transfer
+    transfer->nReceived += len;
+    return len;
+}
+
+/* Download a file as chunks of nChunkSize, several at a time, into
+ * target_file_path.part. Completed chunks are recorded in
+ * target_file_path.progress so an interrupted download resumes where it
+ * stopped. on_prefix, if set, is told each time the part of the file that is
+ * complete from its start grows. */
+static void downloadRanges(const std::string& url, const RemoteFile& remote, const fs::path& target_file_path, uint64_t nChunkSize, const std::function<void(uint64_t)>& on_prefix) {
+
+    const fs::path part_path = target_file_path.string() + ".part";
+    const fs::path progress_path = target_file_path.string() + ".progress";
+    const size_t nChunks = (remote.nSize + nChunkSize - 1) / nChunkSize;
+
+    DownloadProgress progress;
+    if (remote.Validator().empty() || !fs::exists(part_path) || !readProgress(progress_path, progress) ||
+        progress.strUrl != url || progress.nSize != remote.nSize || progress.strValidator != remote.Validator() ||
+        progress.nChunkSize != nChunkSize || progress.vDone.size() != nChunks) {
+        progress = DownloadProgress{url, remote.nSize, remote.Validator(), nChunkSize, std::vector<unsigned char>(nChunks, 0)};
+        fs::create_directories(part_path.parent_path());
+        FILE* file = fsbridge::fopen(part_path, "wb");
+        if (!file)
+            throw std::runtime_error(strprintf("Download: error: Unable to open output file for writing: %s.", part_path.string()));
+        fclose(file);
+        writeProgress(progress_path, progress);
+    } else {
+        LogPrintf("Download: Resuming, %u of %u chunks already downloaded.\n", std::count(progress.vDone.begin(), progress.vDone.end(), 1), nChunks);
+    }
+
+    auto chunkLength = [&](size_t nChunk) { return std::min(nChunkSize, remote.nSize - nChunk * nChunkSize); };
+    std::deque<size_t> queue;
+    uint64_t nDone = 0;
+    for (size_t nChunk = 0; nChunk < nChunks; nChunk++) {
+        if (progress.vDone[nChunk])
+            nDone += chunkLength(nChunk);
+        else
+            queue.push_back(nChunk);
+    }
+    std::vector<int> vAttempts(nChunks, 0);
+    std::string strError;
+    size_t nPrefix = 0;
+    bool fPrefixGrew = true;
+    const int nConnections = std::max(1, std::min(MAX_DOWNLOAD_CONNECTIONS, (int)gArgs.GetArg("-downloadconnections", DEFAULT_DOWNLOAD_CONNECTIONS)));
+
+    CURLM *multiHandle = curl_multi_init();
+    std::map<CURL*, RangeTransfer> transfers;
+    auto cleanup = [&]() {
+        for (auto& transfer : transfers) {
+            curl_multi_remove_handle(multiHandle, transfer.first);
+            curl_easy_cleanup(transfer.first);
+            fclose(transfer.second.file);
+        }
+        curl_multi_cleanup(multiHandle);
+    };
+
+    try {
+        while (true) {
+            // Hand on what is complete from the start of the file
+            while (nPrefix < nChunks && progress.vDone[nPrefix]) {
+                nPrefix++;
+                fPrefixGrew = true;
+            }
+            if (fPrefixGrew && on_prefix)
+                on_prefix(std::min(nPrefix * nChunkSize, remote.nSize));
+            fPrefixGrew = false;
+
+            if (transfers.empty() && (queue.empty() || !strError.empty()))
+                break;
+
+            // After a failure only the transfers in flight are finished, to keep what they get
+            while ((int)transfers.size() < nConnections && !queue.empty() && strError.empty()) {
+                const size_t nChunk = queue.front();
+                queue.pop_front();
+                FILE* file = fsbridge::fopen(part_path, "r+b");
+                if (!file || !seekFile(file, nChunk * nChunkSize)) {
+                    if (file)
+                        fclose(file);
+                    throw std::runtime_error(strprintf("Download: error: Unable to open output file for writing: %s.", part_path.string()));
+                }
+                CURL *curlHandle = curl_easy_init();
+                RangeTransfer& transfer = transfers[curlHandle];
+                transfer = RangeTransfer{nChunk, chunkLength(nChunk), 0, file};
+                const std::string range = strprintf("%u-%u", nChunk * nChunkSize, nChunk * nChunkSize + transfer.nLength - 1);
+                curl_easy_setopt(curlHandle, CURLOPT_URL, url.c_str());
+                curl_easy_setopt(curlHandle, CURLOPT_FOLLOWLOCATION, 1L);
+                curl_easy_setopt(curlHandle, CURLOPT_FAILONERROR, 1L);
+                curl_easy_setopt(curlHandle, CURLOPT_RANGE, range.c_str());
+                curl_easy_setopt(curlHandle, CURLOPT_WRITEFUNCTION, writeRange);
+                curl_easy_setopt(curlHandle, CURLOPT_WRITEDATA, &transfer);
+                curl_multi_add_handle(multiHandle, curlHandle);
+            }
+
+            int nRunning;
+            curl_multi_perform(multiHandle, &nRunning);
+
+            CURLMsg *msg;
+            int nMsgs;
+            while ((msg = curl_multi_info_read(multiHandle, &nMsgs))) {
+                if (msg->msg != CURLMSG_DONE)
+                    continue;
+                CURL *curlHandle = msg->easy_handle;
+                const CURLcode res = msg->data.result;
+                long response_code = 0;
+                curl_easy_getinfo(curlHandle, CURLINFO_RESPONSE_CODE, &response_code);
+                const RangeTransfer transfer = transfers[curlHandle];
+                transfers.erase(curlHandle);
+                curl_multi_remove_handle(multiHandle, curlHandle);
+                curl_easy_cleanup(curlHandle);
+
+                // The chunk must be on disk before the progress file says so
+                const bool fWritten = FileCommit(transfer.file);
+                fclose(transfer.file);
+                if (res != CURLE_OK || response_code != 206 || transfer.nReceived != transfer.nLength || !fWritten) {
+                    const std::string strChunkError = res != CURLE_OK ? curl_easy_strerror(res) : strprintf("Server responded with a %d", response_code);
+                    LogPrintf("Download: Chunk %u failed: %s.\n", transfer.nChunk, strChunkError);
+                    if (++vAttempts[transfer.nChunk] >= MAX_DOWNLOAD_ATTEMPTS)
+                        strError = strChunkError;
+                    queue.push_back(transfer.nChunk);
+                    continue;
+                }
+                progress.vDone[transfer.nChunk] = 1;
+                writeProgress(progress_path, progress);
+                nDone += transfer.nLength;
+            }
+
+            uint64_t nNow = nDone;
+            for (const auto& transfer : transfers)
+                nNow += transfer.second.nReceived;
+            void (*ptr)(curl_off_t, curl_off_t) = (void(*)(curl_off_t, curl_off_t))xferinfo_data;
+            if (ptr != nullptr) ptr(nNow, remote.nSize);
+
+            if (!transfers.empty())
+                curl_multi_wait(multiHandle, nullptr, 0, 1000, nullptr);
+        }
+    } catch (...) {
+        cleanup();
+        throw;
+    }
+    cleanup();
+
+    if (!strError.empty())
+        throw std::runtime_error(strprintf("Download: error: %s.", strError));
+}
+
+void downloadFile(std::string url, const fs::path& target_file_path, uint64_t nChunkSize) {
+
+    LogPrintf("Download: Downloading from %s. \n", url);
+
+    const RemoteFile remote = probeDownload(url);
+    if (remote.fRanges) {
+        downloadRanges(url, remote, target_file_path, nChunkSize, nullptr);
+        if (!RenameOver(target_file_path.string() + ".part", target_file_path))
+            throw std::runtime_error(strprintf("Download: error: Unable to move download to %s.", target_file_path.string()));
+        fs::remove(target_file_path.string() + ".progress");
+        LogPrintf("Download: Successful.\n");
+        return;
+    }
+
+    FILE *file = fsbridge::fopen(target_file_path, "wb");
+    if( ! file )
+        throw std::runtime_error(strprintf("Download: error: Unable to open output file for writing: %s.", target_file_path.string().c_str()));
+
+    try {
+        performDownload(url, nullptr, file);
+    } catch (...) {
+        fclose(file);
+        throw;
+    }
     fclose(file);
 
     LogPrintf("Download: Successful.\n");
@@ -90,6 +409,336 @@ void downloadFile(std::string url, const fs::path& target_file_path) {
     return;
 }
 
+static size_t writeZipStream(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    ZipStreamExtractor* extractor = static_cast<ZipStreamExtractor*>(userdata);
+    if (extractor->Write((const unsigned char*)ptr, size * nmemb) != UNZ_OK)
+        return 0; // abort the transfer
+    return size * nmemb;
+}
+
+void downloadAndExtract(std::string url, const fs::path& root_file_path, const char* allowed_dir, uint64_t nChunkSize, std::function<void(const fs::path&)> on_file) {
+
+    LogPrintf("Download: Downloading and extracting from %s. \n", url);
+
+    const RemoteFile remote = probeDownload(url);
+    if (!remote.fRanges) {
+        ZipStreamExtractor extractor(root_file_path, allowed_dir, std::move(on_file));
+        try {
+            performDownload(url, writeZipStream, &extractor);
+        } catch (...) {
+            if (extractor.Failed())
+                throw std::runtime_error("Download: error: Unzip failed.");
+            throw;
+        }
+        if (extractor.Finish() != UNZ_OK)
+            throw std::runtime_error("Download: error: Archive is incomplete.");
+
+        LogPrintf("Download: Successful, %u files extracted.\n", extractor.EntriesExtracted());
+        return;
+    }
+
+    // The archive is kept until it is extracted so the download can resume.
+    // Its entries are extracted on a thread of their own as soon as they are
+    // in, and those the download outran afterwards on all cores.
+    const fs::path archive_path = root_file_path / (std::string(allowed_dir) + ".zip");
+    const fs::path part_path = archive_path.string() + ".part";
+    auto removeArchive = [&] {
+        fs::remove(part_path);
+        fs::remove(archive_path.string() + ".progress");
+    };
+
+    uint64_t nStreamed, nExtractedOffset;
+    {
+        ZipStreamExtractor extractor(root_file_path, allowed_dir, on_file);
+        Mutex cs_feed;
+        std::condition_variable cond_feed;
+        uint64_t nPrefix = 0;
+        bool fStop = false;
+        std::atomic<bool> fFeedFailed{false};
+
+        std::thread feeder([&] {
+            util::ThreadRename("unzip.stream");
+            FILE* file = nullptr;
+            uint64_t nFed = 0;
+            std::vector<unsigned char> buf(1 << 16);
+            while (true) {
+                uint64_t nAvailable;
+                {
+                    WAIT_LOCK(cs_feed, lock);
+                    while (!fStop && nPrefix == nFed)
+                        cond_feed.wait(lock);
+                    if (fStop)
+                        break;
+                    nAvailable = nPrefix;
+                }
+                if (!file) {
+                    if (!(file = fsbridge::fopen(part_path, "rb")))
+                        break;
+                    // Read-ahead could see chunks that are still being written
+                    setvbuf(file, nullptr, _IONBF, 0);
+                }
+                if (!seekFile(file, nFed))
+                    break;
+                const size_t len = fread(buf.data(), 1, std::min<uint64_t>(buf.size(), nAvailable - nFed), file);
+                if (len == 0 || extractor.Write(buf.data(), len) != UNZ_OK)
+                    break;
+                nFed += len;
+            }
+            if (file)
+                fclose(file);
+            if (extractor.Failed())
+                fFeedFailed = true;
+        });
+        auto stopFeeder = [&] {
+            {
+                LOCK(cs_feed);
+                fStop = true;
+                cond_feed.notify_one();
+            }
+            feeder.join();
+        };
+
+        try {
+            downloadRanges(url, remote, archive_path, nChunkSize, [&](uint64_t nPrefixIn) {
+                if (fFeedFailed)
+                    throw std::runtime_error("Download: error: Unzip failed.");
+                LOCK(cs_feed);
+                nPrefix = nPrefixIn;
+                cond_feed.notify_one();
+            });
+        } catch (...) {
+            stopFeeder();
+            // A corrupt archive would fail the same way again
+            if (extractor.Failed())
+                removeArchive();
+            throw;
+        }
+        stopFeeder();
+        if (extractor.Failed()) {
+            removeArchive();
+            throw std::runtime_error("Download: error: Unzip failed.");
+        }
+        nStreamed = extractor.EntriesExtracted();
+        nExtractedOffset = extractor.ExtractedOffset();
+        // The entry the extractor was in the middle of, if any, is closed
+        // here and extracted again from its start below
+    }
+
+    uint64_t nEntries = 0;
+    const int err = zip_extract_parallel(part_path, root_file_path, allowed_dir, GetNumCores(), nExtractedOffset, on_file, &nEntries);
+    removeArchive();
+    if (err != UNZ_OK)
+        throw std::runtime_error("Download: error: Unzip failed.");
+
+    LogPrintf("Download: Successful, %u files extracted, %u of them after the download.\n", nStreamed + nEntries, nEntries);
+}
+
+static bool parseManifestHash(const std::string& str, uint256& hash)
+{
+    if (str.size() != 64 || !IsHex(str))
+        return false;
+    hash = uint256S(str);
+    return true;
+}
+
+BootstrapManifest parseBootstrapManifest(const std::string& text, const std::string& address) {
+    BootstrapManifest manifest;
+    bool fHeader = false, fHeight = false, fBlock = false, fUTXO = false;
+    std::string strSigned, strSignature;
+
+    size_t nPos = 0;
+    while (nPos < text.size()) {
+        const size_t nLineStart = nPos;
+        size_t nEnd = text.find('\n', nPos);
+        if (nEnd == std::string::npos)
+            nEnd = text.size();
+        std::string line = text.substr(nPos, nEnd - nPos);
+        nPos = nEnd + 1;
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (line.empty())
+            continue;
+
+        if (!strSignature.empty())
+            throw std::runtime_error("bootstrap: Manifest has lines after its signature.");
+        if (!fHeader) {
+            if (line != "bootstrap-manifest 1")
+                throw std::runtime_error("bootstrap: Manifest format is not supported.");
+            fHeader = true;
+            continue;
+        }
+
+        const size_t nSpace = line.find(' ');
+        const std::string key = line.substr(0, nSpace);
+        const std::string value = nSpace == std::string::npos ? "" : line.substr(nSpace + 1);
+        if (key == "height") {
+            if (!ParseInt32(value, &manifest.nHeight) || manifest.nHeight < 0)
+                throw std::runtime_error(strprintf("bootstrap: Manifest has an invalid height: %s", value));
+            fHeight = true;
+        } else if (key == "blockhash") {
+            if (!parseManifestHash(value, manifest.hashBlock))
+                throw std::runtime_error(strprintf("bootstrap: Manifest has an invalid block hash: %s", value));
+            fBlock = true;
+        } else if (key == "utxohash") {
+            if (!parseManifestHash(value, manifest.hashUTXO))
+                throw std::runtime_error(strprintf("bootstrap: Manifest has an invalid UTXO set hash: %s", value));
+            fUTXO = true;
+        } else if (key == "file") {
+            const size_t nSep = value.find(' ');
+            const std::string strHash = ToLower(value.substr(0, nSep));
+            const std::string strPath = nSep == std::string::npos ? "" : value.substr(nSep + 1);
+            if (strHash.size() != 64 || !IsHex(strHash) || strPath.empty())
+                throw std::runtime_error(strprintf("bootstrap: Manifest has an invalid file line: %s", line));
+            if (!manifest.mapFiles.emplace(strPath, strHash).second)
+                throw std::runtime_error(strprintf("bootstrap: Manifest lists %s twice.", strPath));
+        } else if (key == "signature") {
+            strSigned = text.substr(0, nLineStart);
+            strSignature = value;
+            if (strSignature.empty())
+                throw std::runtime_error("bootstrap: Manifest has an empty signature.");
+        } else {
+            throw std::runtime_error(strprintf("bootstrap: Manifest has an unknown line: %s", line));
+        }
+    }
+
+    if (!fHeader || !fHeight || !fBlock || !fUTXO || manifest.mapFiles.empty())
+        throw std::runtime_error("bootstrap: Manifest is incomplete.");
+
+    if (!address.empty()) {
+        if (strSignature.empty())
+            throw std::runtime_error("bootstrap: Manifest is not signed.");
+        if (MessageVerify(address, strSignature, strSigned) != MessageVerificationResult::OK)
+            throw std::runtime_error("bootstrap: Manifest signature is invalid.");
+    }
+
+    return manifest;
+}
+
+BootstrapVerifier::BootstrapVerifier(const fs::path& root_path_in, const BootstrapManifest& manifest_in)
+    : root_path(root_path_in), manifest(manifest_in)
+{
+    const int nThreads = std::max(GetNumCores(), 1);
+    for (int i = 0; i < nThreads; i++) {
+        threads.emplace_back([this, i] {
+            util::ThreadRename(strprintf("bootverify.%i", i));
+            ThreadVerify();
+        });
+    }
+}
+
+BootstrapVerifier::~BootstrapVerifier()
+{
+    {
+        LOCK(cs);
+        queue.clear();
+    }
+    Stop();
+}
+
+void BootstrapVerifier::Add(const fs::path& file_path)
+{
+    LOCK(cs);
+    queue.push_back(file_path);
+    cond.notify_one();
+}
+
+void BootstrapVerifier::Stop()
+{
+    {
+        LOCK(cs);
+        fStop = true;
+        cond.notify_all();
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    threads.clear();
+}
+
+void BootstrapVerifier::ThreadVerify()
+{
+    std::vector<unsigned char> buf(1 << 20);
+    while (true) {
+        fs::path file_path;
+        {
+            WAIT_LOCK(cs, lock);
+            while (!fStop && queue.empty())
+                cond.wait(lock);
+            // Files still queued on a stop are checked, unless the queue was dropped
+            if (queue.empty())
+                return;
+            file_path = queue.front();
+            queue.pop_front();
+        }
+
+        const std::string strRoot = root_path.generic_string() + "/";
+        std::string strName = file_path.generic_string();
+        std::string strError;
+        if (strName.compare(0, strRoot.size(), strRoot) != 0) {
+            strError = strprintf("%s is outside of the bootstrap", strName);
+        } else {
+            strName = strName.substr(strRoot.size());
+            const auto it = manifest.mapFiles.find(strName);
+            FILE* file = nullptr;
+            if (it == manifest.mapFiles.end()) {
+                strError = strprintf("%s is not in the manifest", strName);
+            } else if (!(file = fsbridge::fopen(file_path, "rb"))) {
+                strError = strprintf("%s cannot be read", strName);
+            } else {
+                CSHA256 hasher;
+                size_t len;
+                while ((len = fread(buf.data(), 1, buf.size(), file)) > 0)
+                    hasher.Write(buf.data(), len);
+                const bool fReadError = ferror(file);
+                fclose(file);
+                unsigned char digest[CSHA256::OUTPUT_SIZE];
+                hasher.Finalize(digest);
+                if (fReadError)
+                    strError = strprintf("%s cannot be read", strName);
+                else if (HexStr(digest, digest + sizeof(digest)) != it->second)
+                    strError = strprintf("%s does not match the manifest", strName);
+            }
+        }
+
+        LOCK(cs);
+        if (strError.empty())
+            mapVerified[strName] = true;
+        else
+            vErrors.push_back(strError);
+    }
+}
+
+void BootstrapVerifier::Finish()
+{
+    Stop();
+
+    LOCK(cs);
+    for (const auto& file : manifest.mapFiles) {
+        if (!mapVerified.count(file.first))
+            vErrors.push_back(strprintf("%s is missing", file.first));
+    }
+    if (!vErrors.empty()) {
+        for (const std::string& strError : vErrors)
+            LogPrintf("bootstrap: %s\n", strError);
+        throw std::runtime_error(strprintf("bootstrap: Bootstrap is corrupt: %s%s.", vErrors.front(),
+            vErrors.size() > 1 ? strprintf(" and %u more problems", vErrors.size() - 1) : ""));
+    }
+    LogPrintf("bootstrap: %u files match the manifest\n", mapVerified.size());
+}
+
+void verifyBootstrapChainstate(const fs::path& chainstate_path, const BootstrapManifest& manifest) {
+    LogPrintf("bootstrap: Checking the UTXO set at height %d\n", manifest.nHeight);
+
+    CCoinsViewDB view(chainstate_path, 8 << 20, false, false);
+    if (view.GetBestBlock() != manifest.hashBlock)
+        throw std::runtime_error(strprintf("bootstrap: Chainstate is at block %s, not %s.", view.GetBestBlock().ToString(), manifest.hashBlock.ToString()));
+
+    CCoinsStats stats;
+    if (!GetUTXOStats(&view, stats))
+        throw std::runtime_error("bootstrap: Unable to read the chainstate.");
+    if (stats.hashSerialized != manifest.hashUTXO)
+        throw std::runtime_error(strprintf("bootstrap: UTXO set hash %s does not match the manifest.", stats.hashSerialized.ToString()));
+}
 
 // bootstrap
 void extractBootstrap(const fs::path& target_file_path) {
@@ -98,21 +747,7 @@ void extractBootstrap(const fs::path& target_file_path) {
     if (!boost::filesystem::exists(target_file_path))
         throw std::runtime_error("bootstrap: Bootstrap archive not found");
 
-
-    const char * zipfilename = target_file_path.string().c_str();
-    unzFile uf;
-#ifdef USEWIN32IOAPI
-    zlib_filefunc64_def ffunc;
-    fill_win32_filefunc64A(&ffunc);
-    uf = unzOpen2_64(zipfilename, &ffunc);
-#else
-    uf = unzOpen64(zipfilename);
-#endif
-
-    if (uf == NULL)
-        throw std::runtime_error(strprintf("bootstrap: Cannot open bootstrap archive: %s\n", zipfilename));
-
-    int unzip_err = zip_extract_all(uf, GetDataDir(), "bootstrap");
+    int unzip_err = zip_extract_parallel(target_file_path, GetDataDir(), "bootstrap", GetNumCores());
     if (unzip_err != UNZ_OK)
         throw std::runtime_error("bootstrap: Unzip failed\n");
 
@@ -154,23 +789,32 @@ void applyBootstrap() {
 void downloadBootstrap() {
     LogPrintf("bootstrap: Starting bootstrap process.\n");
 
-    boost::filesystem::path pathBootstrapZip = GetDataDir() / "bootstrap.zip";
-
-    try {
-        downloadFile(strprintf("%s/%d.%d%s", getClientUrl(), CLIENT_VERSION_MAJOR, CLIENT_VERSION_MINOR, BOOTSTRAP_PATH), pathBootstrapZip);
-    } catch (...) {
-        throw;
+    const std::string strBaseUrl = strprintf("%s/%d.%d", getClientUrl(), CLIENT_VERSION_MAJOR, CLIENT_VERSION_MINOR);
+    // Without a signer for the chain the manifest only guards against a
+    // corrupt download, not a tampered one
+    const std::string& strAddress = Params().BootstrapManifestAddress();
+    if (strAddress.empty()) {
+        const std::string strWarning = "Warning: No bootstrap manifest signer is set for this chain, the bootstrap is only checked against the checksums it is published with.";
+        LogPrintf("bootstrap: %s\n", strWarning);
+        SetMiscWarning(strWarning);
     }
+    const BootstrapManifest manifest = parseBootstrapManifest(downloadString(strBaseUrl + BOOTSTRAP_MANIFEST_PATH), strAddress);
 
-    try {
-        extractBootstrap(pathBootstrapZip);
-    } catch (...) {
-        throw;
-    }
+    // Entries are inflated into the staging directory as the archive arrives,
+    // and hashed while the rest of it is still downloading
+    const fs::path bootstrap_path = GetDataDir() / "bootstrap";
+    boost::filesystem::remove_all(bootstrap_path);
 
     try {
+        BootstrapVerifier verifier(bootstrap_path, manifest);
+        downloadAndExtract(strBaseUrl + BOOTSTRAP_PATH, GetDataDir(), "bootstrap", DOWNLOAD_CHUNK_SIZE,
+            [&verifier](const fs::path& file_path) { verifier.Add(file_path); });
+        verifier.Finish();
         validateBootstrapContent();
+        verifyBootstrapChainstate(bootstrap_path / "chainstate", manifest);
     } catch (...) {
+        // Nothing of a bootstrap that does not check out is kept
+        boost::filesystem::remove_all(bootstrap_path);
         throw;
     }
 
@@ -5,12 +5,24 @@
 #include <config/bitcoin-config.h>
 #endif
 
+#include <fs.h>
+#include <sync.h>
+#include <uint256.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
 #include <string>
+#include <thread>
+#include <vector>
 
 #if defined(__arm__) || defined(__aarch64__)
 const std::string BOOTSTRAP_PATH("/bootstrap-arm/bootstrap.zip");
+const std::string BOOTSTRAP_MANIFEST_PATH("/bootstrap-arm/bootstrap.manifest");
 #else
 const std::string BOOTSTRAP_PATH("/bootstrap/bootstrap.zip");
+const std::string BOOTSTRAP_MANIFEST_PATH("/bootstrap/bootstrap.manifest");
 #endif
 
 const std::string VERSIONFILE_PATH("/VERSION.json");
@@ -18,6 +30,74 @@ const std::string VERSIONFILE_PATH("/VERSION.json");
 const std::string CLIENT_URL_VRM("https://files.vericonomy.com/vrm");
 const std::string CLIENT_URL_VRC("https://files.vericonomy.com/vrc");
 
+//! Files served with ranges are downloaded as chunks of this size, several at a time
+static const uint64_t DOWNLOAD_CHUNK_SIZE = 8 << 20;
+static const int DEFAULT_DOWNLOAD_CONNECTIONS = 4;
+static const int MAX_DOWNLOAD_CONNECTIONS = 16;
+//! Times a chunk is tried before the download fails
+static const int MAX_DOWNLOAD_ATTEMPTS = 3;
+
+/** What a bootstrap must contain, as published next to it:
+ *
+ *   bootstrap-manifest 1
+ *   height <height of the chainstate>
+ *   blockhash <best block of the chainstate>
+ *   utxohash <hash_serialized_3 of gettxoutsetinfo at that block>
+ *   file <sha256 of the file> <path under bootstrap/>
+ *   ...
+ *   signature <signmessage of all lines above>
+ */
+struct BootstrapManifest
+{
+    int nHeight{0};
+    uint256 hashBlock;
+    uint256 hashUTXO;
+    //! Hex SHA256 of each file, as sha256sum prints it, by path under bootstrap/
+    std::map<std::string, std::string> mapFiles;
+};
+
+// Parse a manifest, checking its signature against address if one is given.
+// downloadBootstrap() gives the signer of the chain, if it has one.
+BootstrapManifest parseBootstrapManifest(const std::string& text, const std::string& address);
+
+/** Hashes the files of a bootstrap on a pool of threads as they are extracted,
+ * so the check is done about when the extraction is. */
+class BootstrapVerifier
+{
+public:
+    BootstrapVerifier(const fs::path& root_path, const BootstrapManifest& manifest);
+    ~BootstrapVerifier();
+
+    // Queue an extracted file to be checked against the manifest
+    void Add(const fs::path& file_path);
+    // Wait for the queued files, throws unless every file of the manifest matches
+    void Finish();
+
+private:
+    void ThreadVerify();
+    void Stop();
+
+    const fs::path root_path;
+    const BootstrapManifest& manifest;
+    Mutex cs;
+    std::condition_variable cond;
+    std::deque<fs::path> queue GUARDED_BY(cs);
+    std::vector<std::string> vErrors GUARDED_BY(cs);
+    std::map<std::string, bool> mapVerified GUARDED_BY(cs);
+    bool fStop GUARDED_BY(cs){false};
+    std::vector<std::thread> threads;
+};
+
+// Check that the chainstate at chainstate_path is the UTXO set of the manifest
+void verifyBootstrapChainstate(const fs::path& chainstate_path, const BootstrapManifest& manifest);
+
+// Download a small file into memory
+std::string downloadString(const std::string& url);
+// Download a file; an interrupted download of a file served with ranges resumes
+void downloadFile(std::string url, const fs::path& target_file_path, uint64_t nChunkSize = DOWNLOAD_CHUNK_SIZE);
+// Download a zip archive and extract it under root_file_path/allowed_dir as it
+// arrives, handing each extracted file to on_file
+void downloadAndExtract(std::string url, const fs::path& root_file_path, const char* allowed_dir, uint64_t nChunkSize = DOWNLOAD_CHUNK_SIZE, std::function<void(const fs::path&)> on_file = nullptr);
 void downloadBootstrap();
 void applyBootstrap();
 void downloadVersionFile();
@@ -52,6 +52,8 @@ void DummyWalletInit::AddWalletOptions() const
         "-privdb",
         "-walletrejectlongchains",
         "-mining",
+        "-minerhugepages",
+        "-minernuma",
         "-staking"
     });
 }
@@ -204,7 +204,4 @@ unsigned int MurmurHash3(unsigned int nHashSeed, const std::vector<unsigned char
 
 void BIP32Hash(const ChainCode &chainCode, unsigned int nChild, unsigned char header, const unsigned char data[32], unsigned char output[64]);
 
-extern int32_t vericonomyRandseed;
-int univHash(const uint256 &x);
-
 #endif // BITCOIN_HASH_H
@@ -16,6 +16,7 @@
 #include <chain.h>
 #include <chainparams.h>
 #include <compat/sanity.h>
+#include <crypto/scrypt.h>
 #include <consensus/validation.h>
 #include <downloader.h>
 #include <fs.h>
@@ -32,6 +33,7 @@
 #include <net_processing.h>
 #include <netbase.h>
 #include <node/context.h>
+#include <node/utxo_snapshot.h>
 #include <policy/feerate.h>
 #include <policy/policy.h>
 #include <policy/settings.h>
@@ -43,6 +45,7 @@
 #include <script/sigcache.h>
 #include <script/standard.h>
 #include <shutdown.h>
+#include <streams.h>
 #include <timedata.h>
 #include <torcontrol.h>
 #include <txdb.h>
@@ -394,9 +397,11 @@ void SetupServerArgs()
     gArgs.AddArg("-dbbatchsize", strprintf("Maximum database write batch size in bytes (default: %u)", nDefaultDbBatchSize), ArgsManager::ALLOW_ANY | ArgsManager::DEBUG_ONLY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-dbcache=<n>", strprintf("Maximum database cache size <n> MiB (%d to %d, default: %d). In addition, unused mempool memory is shared for this cache (see -maxmempool).", nMinDbCache, nMaxDbCache, nDefaultDbCache), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-debuglogfile=<file>", strprintf("Specify location of debug log file. Relative paths will be prefixed by a net-specific datadir location. (-nodebuglogfile to disable; default: %s)", DEFAULT_DEBUGLOGFILE), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-downloadconnections=<n>", strprintf("Number of parallel connections for bootstrap and client downloads (1 to %d, default: %d)", MAX_DOWNLOAD_CONNECTIONS, DEFAULT_DOWNLOAD_CONNECTIONS), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-feefilter", strprintf("Tell other nodes to filter invs to us by our mempool min fee (default: %u)", DEFAULT_FEEFILTER), ArgsManager::ALLOW_ANY | ArgsManager::DEBUG_ONLY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-includeconf=<file>", "Specify additional configuration file, relative to the -datadir path (only useable from configuration file, not command line)", ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-loadblock=<file>", "Imports blocks from external file on startup", ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-loadtxoutset=<file>", "Load a UTXO set snapshot written by dumptxoutset on startup, once the headers up to its base are known, instead of syncing the blocks below it. Relative paths will be prefixed by a net-specific datadir location. Turns -txindex off unless it is set, not available on Vericoin, and only of use for testing until snapshots are compiled into the release chains", ArgsManager::ALLOW_ANY | ArgsManager::DEBUG_ONLY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-maxmempool=<n>", strprintf("Keep the transaction memory pool below <n> megabytes (default: %u)", DEFAULT_MAX_MEMPOOL_SIZE), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-maxorphantx=<n>", strprintf("Keep at most <n> unconnectable transactions in memory (default: %u)", DEFAULT_MAX_ORPHAN_TRANSACTIONS), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-mempoolexpiry=<n>", strprintf("Do not keep transactions in the mempool longer than <n> hours (default: %u)", DEFAULT_MEMPOOL_EXPIRY), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
@@ -407,6 +412,7 @@ void SetupServerArgs()
     gArgs.AddArg("-pid=<file>", strprintf("Specify pid file. Relative paths will be prefixed by a net-specific datadir location. (default: %s)", BITCOIN_PID_FILENAME), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-reindex", "Rebuild chain state and block index from the blk*.dat files on disk", ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-reindex-chainstate", "Rebuild chain state from the currently indexed blocks. When in pruning mode or if blocks on disk might be corrupted, use full -reindex instead.", ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-txindex", strprintf("Maintain a full transaction index, used by the getrawtransaction rpc call. Staking and proof-of-stake validation do not need it. (default: %u)", DEFAULT_TXINDEX), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
 #ifndef WIN32
     gArgs.AddArg("-sysperms", "Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)", ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
 #else
@@ -497,6 +503,7 @@ void SetupServerArgs()
         "(0-4, default: %u)", DEFAULT_CHECKLEVEL), ArgsManager::ALLOW_ANY | ArgsManager::DEBUG_ONLY, OptionsCategory::DEBUG_TEST);
     gArgs.AddArg("-checkblockindex", strprintf("Do a consistency check for the block tree, chainstate, and other validation data structures occasionally. (vericoin: %u, verium: %u)", vericoinChainParams->DefaultConsistencyChecks(), veriumChainParams->DefaultConsistencyChecks()), ArgsManager::ALLOW_ANY | ArgsManager::DEBUG_ONLY, OptionsCategory::DEBUG_TEST);
     gArgs.AddArg("-checkmempool=<n>", strprintf("Run checks every <n> transactions (vericoin: %u, verium: %u)", vericoinChainParams->DefaultConsistencyChecks(), veriumChainParams->DefaultConsistencyChecks()), ArgsManager::ALLOW_ANY | ArgsManager::DEBUG_ONLY, OptionsCategory::DEBUG_TEST);
+    gArgs.AddArg("-checkheaderpow", "Check the proof of work of block headers before downloading their blocks (vericoin: 1, verium: 0)", ArgsManager::ALLOW_ANY | ArgsManager::DEBUG_ONLY, OptionsCategory::DEBUG_TEST);
     gArgs.AddArg("-checkpoints", strprintf("Enable rejection of any forks from the known historical chain until block 295000 (default: %u)", DEFAULT_CHECKPOINTS_ENABLED), ArgsManager::ALLOW_ANY | ArgsManager::DEBUG_ONLY, OptionsCategory::DEBUG_TEST);
     gArgs.AddArg("-deprecatedrpc=<method>", "Allows deprecated RPC method(s) to be used", ArgsManager::ALLOW_ANY | ArgsManager::DEBUG_ONLY, OptionsCategory::DEBUG_TEST);
     gArgs.AddArg("-dropmessagestest=<n>", "Randomly drop 1 of every <n> network messages", ArgsManager::ALLOW_ANY | ArgsManager::DEBUG_ONLY, OptionsCategory::DEBUG_TEST);
@@ -639,7 +646,7 @@ struct CImportingNow
 };
 
 
-static void ThreadImport(std::vector<fs::path> vImportFiles)
+static void ThreadImport(std::vector<fs::path> vImportFiles, fs::path snapshot_path)
 {
     const CChainParams& chainparams = Params();
     util::ThreadRename("loadblk");
@@ -694,6 +701,40 @@ static void ThreadImport(std::vector<fs::path> vImportFiles)
         return;
     }
     } // End scope of CImportingNow
+
+    // -loadtxoutset=
+    if (!snapshot_path.empty()) {
+        CAutoFile file(fsbridge::fopen(snapshot_path, "rb"), SER_DISK, CLIENT_VERSION);
+        SnapshotMetadata metadata;
+        try {
+            file >> metadata;
+        } catch (const std::exception& e) {
+            InitError(strprintf(_("Unable to read UTXO set snapshot %s: %s").translated, snapshot_path.string(), e.what()));
+            StartShutdown();
+            return;
+        }
+
+        // Its base must be a known header, which may take the headers sync
+        const CBlockIndex* pindexBase = WITH_LOCK(cs_main, return LookupBlockIndex(metadata.m_base_blockhash));
+        if (!pindexBase) LogPrintf("Waiting for the headers up to block %s to load UTXO set snapshot %s...\n", metadata.m_base_blockhash.ToString(), snapshot_path.string());
+        while (!pindexBase) {
+            if (ShutdownRequested()) return;
+            UninterruptibleSleep(std::chrono::milliseconds{500});
+            pindexBase = WITH_LOCK(cs_main, return LookupBlockIndex(metadata.m_base_blockhash));
+        }
+
+        if (WITH_LOCK(cs_main, return ::ChainActive().Contains(pindexBase))) {
+            LogPrintf("The chain already includes the base of UTXO set snapshot %s, not loading it\n", snapshot_path.string());
+        } else {
+            std::string error;
+            if (!LoadTxOutSet(file, metadata, chainparams, error)) {
+                InitError(strprintf(_("Unable to load UTXO set snapshot %s: %s").translated, snapshot_path.string(), error));
+                StartShutdown();
+                return;
+            }
+        }
+    }
+
     if (gArgs.GetArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
         LoadMempool(::mempool);
     }
@@ -798,6 +839,12 @@ void InitParameterInteraction()
         if (gArgs.SoftSetBoolArg("-whitelistrelay", true))
             LogPrintf("%s: parameter interaction: -whitelistforcerelay=1 -> setting -whitelistrelay=1\n", __func__);
     }
+
+    // the blocks below the base of a UTXO set snapshot cannot be indexed
+    if (gArgs.IsArgSet("-loadtxoutset") && !gArgs.IsArgNegated("-loadtxoutset")) {
+        if (gArgs.SoftSetBoolArg("-txindex", false))
+            LogPrintf("%s: parameter interaction: -loadtxoutset set -> setting -txindex=0\n", __func__);
+    }
 }
 
 /**
@@ -988,6 +1035,7 @@ bool AppInitParameterInteraction()
     }
     fCheckBlockIndex = gArgs.GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
     fCheckpointsEnabled = gArgs.GetBoolArg("-checkpoints", DEFAULT_CHECKPOINTS_ENABLED);
+    fCheckHeaderPoW = gArgs.GetBoolArg("-checkheaderpow", chainparams.IsVericoin());
 
     hashAssumeValid = uint256S(gArgs.GetArg("-assumevalid", chainparams.GetConsensus().defaultAssumeValid.GetHex()));
     if (!hashAssumeValid.IsNull())
@@ -1093,13 +1141,11 @@ bool AppInitSanityChecks()
     // Initialize elliptic curve code
     std::string sha256_algo = SHA256AutoDetect();
     LogPrintf("Using the '%s' SHA256 implementation\n", sha256_algo);
+    LogPrintf("Using the '%s' scrypt implementation\n", ScryptAutoDetect());
     RandomInit();
     ECC_Start();
     globalVerifyHandle.reset(new ECCVerifyHandle());
 
-    // vericonomy: init hash seed
-    vericonomyRandseed = GetRand(1 << 30);
-
     // Sanity check
     if (!InitSanityCheck())
         return InitError(strprintf(_("Initialization sanity check failed. %s is shutting down.").translated, PACKAGE_NAME));
@@ -1194,6 +1240,7 @@ bool AppInitMain(NodeContext& node)
         g_parallel_script_checks = true;
         for (int i = 0; i < script_threads; ++i) {
             threadGroup.create_thread([i]() { return ThreadScriptCheck(i); });
+            threadGroup.create_thread([i]() { return ThreadWorkHashCheck(i); });
         }
     }
 
@@ -1402,7 +1449,7 @@ bool AppInitMain(NodeContext& node)
     nTotalCache = std::min(nTotalCache, nMaxDbCache << 20); // total cache cannot be greater than nMaxDbcache
     int64_t nBlockTreeDBCache = std::min(nTotalCache / 8, nMaxBlockDBCache << 20);
     nTotalCache -= nBlockTreeDBCache;
-    int64_t nTxIndexCache = std::min(nTotalCache / 8, nMaxTxIndexCache << 20);
+    int64_t nTxIndexCache = std::min(nTotalCache / 8, gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX) ? nMaxTxIndexCache << 20 : 0);
     nTotalCache -= nTxIndexCache;
     int64_t filter_index_cache = 0;
     if (!g_enabled_filter_types.empty()) {
@@ -1592,9 +1639,25 @@ bool AppInitMain(NodeContext& node)
         return false;
     }
 
+    // The blocks below the base of a UTXO set snapshot have no data, so they
+    // can be neither indexed nor served
+    if ((gArgs.IsArgSet("-loadtxoutset") && !gArgs.IsArgNegated("-loadtxoutset")) || WITH_LOCK(cs_main, return HaveTxOutSetSnapshot())) {
+        // Only an index asked for explicitly is an error
+        if (gArgs.SoftSetBoolArg("-txindex", false)) {
+            LogPrintf("Not building the transaction index, the chainstate was loaded from a UTXO set snapshot\n");
+        }
+        if (gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX) || !g_enabled_filter_types.empty()) {
+            return InitError(_("Indexes cannot be built from a UTXO set snapshot, restart with -txindex=0 -blockfilterindex=0.").translated);
+        }
+        LogPrintf("Unsetting NODE_NETWORK, the blocks below the UTXO set snapshot are missing\n");
+        nLocalServices = ServiceFlags(nLocalServices & ~NODE_NETWORK);
+    }
+
     // ********************************************************* Step 8: start indexers
-    g_txindex = MakeUnique<TxIndex>(nTxIndexCache, false, fReindex);
-    g_txindex->Start();
+    if (gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
+        g_txindex = MakeUnique<TxIndex>(nTxIndexCache, false, fReindex);
+        g_txindex->Start();
+    }
 
     for (const auto& filter_type : g_enabled_filter_types) {
         InitBlockFilterIndex(filter_type, filter_index_cache, false, fReindex);
@@ -1638,7 +1701,12 @@ bool AppInitMain(NodeContext& node)
         vImportFiles.push_back(strFile);
     }
 
-    threadGroup.create_thread(std::bind(&ThreadImport, vImportFiles));
+    fs::path snapshot_path;
+    if (gArgs.IsArgSet("-loadtxoutset") && !gArgs.IsArgNegated("-loadtxoutset")) {
+        snapshot_path = fs::absolute(gArgs.GetArg("-loadtxoutset", ""), GetDataDir());
+    }
+
+    threadGroup.create_thread(std::bind(&ThreadImport, vImportFiles, snapshot_path));
 
     // Wait for genesis block to be processed
     {
@@ -14,6 +14,7 @@
 #include <consensus/tx_verify.h>
 #include <consensus/validation.h>
 #include <crypto/scrypt.h>
+#include <fs.h>
 #include <net.h>
 #include <policy/feerate.h>
 #include <policy/policy.h>
@@ -23,15 +24,24 @@
 #include <shutdown.h>
 #include <timedata.h>
 #include <util/moneystr.h>
+#include <util/strencodings.h>
 #include <util/system.h>
 #include <wallet/wallet.h>
 #include <util/threadnames.h>
+#include <validationinterface.h>
 
 #include <algorithm>
+#include <fstream>
+#include <sstream>
 #include <utility>
 #include <thread>
 #include <boost/thread/thread.hpp>
 
+#ifdef __linux__
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
 #include <openssl/sha.h>
 
 int64_t nLastCoinStakeSearchInterval = 0;
@@ -88,7 +98,7 @@ Optional<int64_t> BlockAssembler::m_last_block_num_txs{nullopt};
 Optional<int64_t> BlockAssembler::m_last_block_weight{nullopt};
 
 
-std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn, bool fPos, CWallet* pwallet, bool* pfPoSCancel)
+std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn, bool fPos, CWallet* pwallet, bool* pfPoSCancel, const StakeKernel* pkernel)
 {
     int64_t nTimeStart = GetTimeMicros();
 
@@ -130,29 +140,21 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     else
         pblock->nBits = GetNextWorkRequired(pindexPrev, chainparams.GetConsensus());
 
-    // if coinstake available add coinstake tx
-    static int64_t nLastCoinStakeSearchTime = GetAdjustedTime();  // only initialized at startup
-
-    if (pwallet && fPos)  // attempt to find a coinstake
+    // if a kernel was found add coinstake tx
+    if (pwallet && fPos)
     {
         *pfPoSCancel = true;
         CMutableTransaction txCoinStake;
-        int64_t nSearchTime = txCoinStake.nTime; // search to current time
-        if (nSearchTime > nLastCoinStakeSearchTime)
+        if (pkernel && pkernel->nBits == pblock->nBits && pwallet->CreateCoinStake(*pkernel, nFees, txCoinStake))
         {
-            if (pwallet->CreateCoinStake(pwallet, pblock->nBits, nSearchTime-nLastCoinStakeSearchTime, nFees, txCoinStake))
-            {
-                if (txCoinStake.nTime >= std::max(pindexPrev->GetMedianTimePast()+1, pindexPrev->GetBlockTime() - MAX_FUTURE_BLOCK_TIME))
-                {   // make sure coinstake would meet timestamp protocol
-                    // as it would be the same as the block timestamp
-                    coinbaseTx.vout[0].SetEmpty();
-                    coinbaseTx.nTime = txCoinStake.nTime;
-                    pblock->vtx.push_back(MakeTransactionRef(CTransaction(txCoinStake)));
-                    *pfPoSCancel = false;
-                }
+            if (txCoinStake.nTime >= std::max(pindexPrev->GetMedianTimePast()+1, pindexPrev->GetBlockTime() - MAX_FUTURE_BLOCK_TIME))
+            {   // make sure coinstake would meet timestamp protocol
+                // as it would be the same as the block timestamp
+                coinbaseTx.vout[0].SetEmpty();
+                coinbaseTx.nTime = txCoinStake.nTime;
+                pblock->vtx.push_back(MakeTransactionRef(CTransaction(txCoinStake)));
+                *pfPoSCancel = false;
             }
-            nLastCoinStakeSearchInterval = nSearchTime - nLastCoinStakeSearchTime;
-            nLastCoinStakeSearchTime = nSearchTime;
         }
         if (*pfPoSCancel)
             return nullptr; // there is no point to continue if we failed to create coinstake
@@ -471,6 +473,11 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
         hashPrevBlock = pblock->hashPrevBlock;
     }
     ++nExtraNonce;
+    SetExtraNonce(pblock, pindexPrev, nExtraNonce);
+}
+
+void SetExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int nExtraNonce)
+{
     unsigned int nHeight = pindexPrev->nHeight+1; // Height first in coinbase required for block.version=2
     CMutableTransaction txCoinbase(*pblock->vtx[0]);
     txCoinbase.vin[0].scriptSig = (CScript() << nHeight << CScriptNum(nExtraNonce)) + COINBASE_FLAGS;
@@ -484,12 +491,51 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
 //////////////////////////////////////////////////////////////////////////////
 ////////////////////// Verium/Vericoin Miner ////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////
-double hashrate = 0.;
 bool fGenerateVerium = false;
 bool fGenerateVericoin = false;
-static int64_t timeElapsed = 30000;
-double dHashesPerMin = 0.0;
-int64_t nHPSTimerStart = 0;
+/** Counters of the running miner threads, swapped with std::atomic_load/atomic_store */
+static std::shared_ptr<MinerHashMeter> g_miner_hash_meter;
+/** Interval between two "Total local hashrate" log lines, in seconds */
+static const int64_t MINER_HASHRATE_LOG_INTERVAL = 30;
+
+MinerTipNotifier::MinerTipNotifier(size_t nThreads) : m_threads(nThreads), m_abort(new std::atomic<bool>[nThreads])
+{
+    for (size_t i = 0; i < m_threads; i++)
+        m_abort[i].store(false);
+}
+
+void MinerTipNotifier::WaitForTipChange(uint64_t nEpoch, std::chrono::milliseconds nTimeout)
+{
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    m_cond.timed_wait(lock, boost::posix_time::milliseconds(nTimeout.count()), [&] { return m_tip_epoch.load() != nEpoch; });
+}
+
+void MinerTipNotifier::AbortAll()
+{
+    for (size_t i = 0; i < m_threads; i++)
+        m_abort[i].store(true);
+}
+
+void MinerTipNotifier::UpdatedBlockTip(const CBlockIndex* pindexNew, const CBlockIndex* pindexFork, bool fInitialDownload)
+{
+    AbortAll();
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        ++m_tip_epoch;
+    }
+    m_cond.notify_all();
+}
+
+void MinerTipNotifier::TransactionAddedToMempool(const CTransactionRef& tx)
+{
+    ++m_mempool_epoch;
+}
+
+/** Whether the node is too far behind its peers for new blocks to make sense */
+static bool IsChainSyncing(CConnman* connman)
+{
+    return ::ChainstateActive().IsInitialBlockDownload() || ::ChainActive().Tip()->nHeight < connman->GetBestHeight() - 10;
+}
 
 static const unsigned int pSHA256InitState[8] =
 {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
@@ -598,89 +644,338 @@ bool CheckWork(CBlock* pblock)
     return true;
 }
 
-void updateHashrate(double nHashrate)
+constexpr int64_t MinerHashMeter::BUCKET_SECONDS;
+constexpr int MinerHashMeter::WINDOW_BUCKETS;
+constexpr int MinerHashMeter::SLOTS;
+
+MinerHashMeter::MinerHashMeter(size_t nThreads, int64_t nStartTime)
+    : m_threads(nThreads), m_start_time(nStartTime), m_buckets(new Bucket[nThreads * SLOTS])
 {
-    hashrate = nHashrate;
+}
+
+void MinerHashMeter::Add(size_t nThread, uint64_t nHashes, int64_t nTime)
+{
+    assert(nThread < m_threads);
+    const int64_t nEpoch = nTime / BUCKET_SECONDS;
+    Bucket& bucket = m_buckets[nThread * SLOTS + nEpoch % SLOTS];
+    if (bucket.nEpoch.load(std::memory_order_relaxed) != nEpoch) {
+        // Recycle the bucket of an epoch that left the window
+        bucket.nHashes.store(0, std::memory_order_relaxed);
+        bucket.nEpoch.store(nEpoch, std::memory_order_release);
+    }
+    bucket.nHashes.fetch_add(nHashes, std::memory_order_relaxed);
+}
+
+double MinerHashMeter::GetThreadRate(size_t nThread, int64_t nTime) const
+{
+    if (nThread >= m_threads)
+        return 0.0;
+
+    // Only complete buckets are counted, the current one is still being filled
+    const int64_t nCurrent = nTime / BUCKET_SECONDS;
+    const int64_t nWindowStart = std::max(m_start_time, (nCurrent - WINDOW_BUCKETS) * BUCKET_SECONDS);
+    const int64_t nSpan = nCurrent * BUCKET_SECONDS - nWindowStart;
+    if (nSpan <= 0)
+        return 0.0;
+
+    uint64_t nHashes = 0;
+    const Bucket* buckets = &m_buckets[nThread * SLOTS];
+    for (int i = 0; i < SLOTS; i++) {
+        const int64_t nEpoch = buckets[i].nEpoch.load();
+        if (nEpoch < nCurrent - WINDOW_BUCKETS || nEpoch >= nCurrent)
+            continue;
+        const uint64_t n = buckets[i].nHashes.load();
+        // Skip a bucket its thread recycled while we were reading it
+        if (buckets[i].nEpoch.load() == nEpoch)
+            nHashes += n;
+    }
+    return 60.0 * nHashes / nSpan;
+}
+
+double MinerHashMeter::GetTotalRate(int64_t nTime) const
+{
+    double dTotal = 0.0;
+    for (size_t i = 0; i < m_threads; i++)
+        dTotal += GetThreadRate(i, nTime);
+    return dTotal;
 }
 
 double GetHashRate()
 {
-    return hashrate;
+    std::shared_ptr<MinerHashMeter> meter = std::atomic_load(&g_miner_hash_meter);
+    return meter ? meter->GetTotalRate(GetTime()) : 0.0;
 }
 
-void Miner(std::shared_ptr<CWallet> pwallet, CConnman* connman, CTxMemPool* mempool)
+std::vector<double> GetThreadHashRates()
 {
-    LogPrintf("Miner started\n");
-    SetThreadPriority(THREAD_PRIORITY_LOWEST);
-    util::ThreadRename("verium-miner");
+    std::vector<double> rates;
+    std::shared_ptr<MinerHashMeter> meter = std::atomic_load(&g_miner_hash_meter);
+    if (meter) {
+        const int64_t nNow = GetTime();
+        for (size_t i = 0; i < meter->GetThreadCount(); i++)
+            rates.push_back(meter->GetThreadRate(i, nNow));
+    }
+    return rates;
+}
 
-    //Build buffer and check for memory availability
-    bool memory = true;
-    unsigned char *scratchbuf = scrypt_buffer_alloc();
-    if(!scratchbuf){memory = false;}
+/**
+ * Scrypt scratchpad of a miner thread. ROMix reads it at random, so with
+ * 4 KiB pages nearly every read misses the TLB. With -minerhugepages it is
+ * mapped with reserved 1 GiB or 2 MiB huge pages when available, falling
+ * back to transparent huge pages.
+ */
+class MinerScratchpad
+{
+private:
+    unsigned char* m_ptr{nullptr};
+    size_t m_mapped_size{0};
+
+#ifdef __linux__
+    bool Map(size_t size, int flags)
+    {
+        void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+        if (addr == MAP_FAILED)
+            return false;
+        m_ptr = (unsigned char*)addr;
+        m_mapped_size = size;
+        return true;
+    }
+#endif
 
-    // Each thread has it's own nonce
-    OutputType output_type = pwallet->m_default_change_type != OutputType::CHANGE_AUTO ? pwallet->m_default_change_type : pwallet->m_default_address_type;
-    ReserveDestination reservedest(pwallet.get(), output_type);
+public:
+    explicit MinerScratchpad(bool fHugePages)
+    {
+#ifdef __linux__
+        if (fHugePages) {
+            // mmap() memory is page aligned, so the alignment slack is not needed
+            const size_t size = scrypt_buffer_size() - 63;
+            const size_t huge_2m = size_t{1} << 21;
+#ifdef MAP_HUGE_1GB
+            const size_t huge_1g = size_t{1} << 30;
+            if (size >= huge_1g && Map((size + huge_1g - 1) & ~(huge_1g - 1), MAP_HUGETLB | MAP_HUGE_1GB)) {
+                LogPrintf("Miner scratchpad: %u MiB on 1 GiB huge pages\n", m_mapped_size >> 20);
+                return;
+            }
+#endif
+            if (Map((size + huge_2m - 1) & ~(huge_2m - 1), MAP_HUGETLB)) {
+                LogPrintf("Miner scratchpad: %u MiB on 2 MiB huge pages\n", m_mapped_size >> 20);
+                return;
+            }
+            if (Map((size + huge_2m - 1) & ~(huge_2m - 1), 0)) {
+#ifdef MADV_HUGEPAGE
+                madvise(m_ptr, m_mapped_size, MADV_HUGEPAGE);
+#endif
+                LogPrintf("Miner scratchpad: no huge pages reserved, using %u MiB of transparent huge pages\n", m_mapped_size >> 20);
+                return;
+            }
+        }
+#else
+        if (fHugePages)
+            LogPrintf("-minerhugepages is only supported on Linux\n");
+#endif
+        m_ptr = scrypt_buffer_alloc();
+    }
 
-    CTxDestination dest;
-    bool ret = reservedest.GetReservedDestination(dest, true);
-    if (!ret)
+    ~MinerScratchpad()
     {
-        fGenerateVerium = false;
+#ifdef __linux__
+        if (m_mapped_size) {
+            munmap(m_ptr, m_mapped_size);
+            return;
+        }
+#endif
+        free(m_ptr);
+    }
+
+    MinerScratchpad(const MinerScratchpad&) = delete;
+    MinerScratchpad& operator=(const MinerScratchpad&) = delete;
+
+    unsigned char* get() const { return m_ptr; }
+};
+
+#ifdef __linux__
+/** NUMA node ids and their CPUs, from sysfs. Empty when the kernel exposes no nodes. */
+static std::vector<std::pair<int, cpu_set_t>> GetNumaNodes()
+{
+    std::vector<std::pair<int, cpu_set_t>> nodes;
+    boost::system::error_code ec;
+    for (fs::directory_iterator it("/sys/devices/system/node", ec), end; !ec && it != end; it.increment(ec)) {
+        const std::string name = it->path().filename().string();
+        if (name.size() <= 4 || name.compare(0, 4, "node") != 0 || !IsDigit(name[4]))
+            continue;
+        std::ifstream file((it->path() / "cpulist").string());
+        std::string cpulist;
+        if (!std::getline(file, cpulist))
+            continue;
+
+        // cpulist looks like "0-7,16-23"
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        std::istringstream ranges(cpulist);
+        std::string range;
+        while (std::getline(ranges, range, ',')) {
+            int first, last;
+            int fields = sscanf(range.c_str(), "%d-%d", &first, &last);
+            if (fields < 1)
+                continue;
+            if (fields == 1)
+                last = first;
+            for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+                CPU_SET(cpu, &cpus);
+        }
+        if (CPU_COUNT(&cpus) > 0)
+            nodes.emplace_back(atoi(name.c_str() + 4), cpus);
+    }
+    std::sort(nodes.begin(), nodes.end(), [](const std::pair<int, cpu_set_t>& a, const std::pair<int, cpu_set_t>& b) { return a.first < b.first; });
+    return nodes;
+}
+#endif
+
+/**
+ * Pin a miner thread to the CPUs of one NUMA node, round robin over the
+ * nodes. Must run before the scratchpad is first touched: the kernel then
+ * places its pages on the same node.
+ */
+static void BindMinerThreadToNumaNode(int thread_id)
+{
+#ifdef __linux__
+    const std::vector<std::pair<int, cpu_set_t>> nodes = GetNumaNodes();
+    if (nodes.size() < 2)
         return;
+    const std::pair<int, cpu_set_t>& node = nodes[thread_id % nodes.size()];
+    if (sched_setaffinity(0, sizeof(node.second), &node.second) == 0)
+        LogPrintf("Miner thread %d bound to NUMA node %d\n", thread_id, node.first);
+    else
+        LogPrintf("Miner thread %d could not be bound to NUMA node %d\n", thread_id, node.first);
+#else
+    LogPrintf("-minernuma is only supported on Linux\n");
+#endif
+}
+
+MinerTemplateProducer::MinerTemplateProducer(CTxMemPool* mempool, std::shared_ptr<CWallet> pwallet)
+    : m_mempool(mempool), m_wallet(std::move(pwallet)),
+      m_reservedest(MakeUnique<ReserveDestination>(m_wallet.get(), m_wallet->m_default_change_type != OutputType::CHANGE_AUTO ? m_wallet->m_default_change_type : m_wallet->m_default_address_type))
+{
+}
+
+MinerTemplateProducer::~MinerTemplateProducer() {}
+
+bool MinerTemplateProducer::Init()
+{
+    LOCK(m_mutex);
+    CTxDestination dest;
+    if (!m_reservedest->GetReservedDestination(dest, true))
+        return false;
+    m_script_pubkey = GetScriptForDestination(dest);
+    return true;
+}
+
+std::unique_ptr<CBlock> MinerTemplateProducer::GetWork(const CBlockIndex*& pindexPrev)
+{
+    LOCK(m_mutex);
+    // Only decides whether to rebuild; the template records its own parent
+    const CBlockIndex* pindexTip = WITH_LOCK(cs_main, return ::ChainActive().Tip());
+    const unsigned int nTransactionsUpdated = m_mempool->GetTransactionsUpdated();
+    if (!m_template || m_tip != pindexTip ||
+        (m_transactions_updated != nTransactionsUpdated && GetTime() - m_created > 60))
+    {
+        m_template.reset();
+        std::unique_ptr<CBlockTemplate> pblocktemplate = BlockAssembler(*m_mempool, Params()).CreateNewBlock(m_script_pubkey, false, m_wallet.get());
+        if (!pblocktemplate)
+            return nullptr;
+        // The tip may have moved on since, so the extranonce height
+        // follows the block the template actually builds on
+        const CBlockIndex* pindexTemplatePrev = WITH_LOCK(cs_main, return LookupBlockIndex(pblocktemplate->block.hashPrevBlock));
+        if (!pindexTemplatePrev)
+            return nullptr;
+        if (m_tip != pindexTemplatePrev)
+            m_extra_nonce = 0;
+        m_template = std::move(pblocktemplate);
+        m_tip = pindexTemplatePrev;
+        m_transactions_updated = nTransactionsUpdated;
+        m_created = GetTime();
+        LogPrintf("Miner template built on block %s (%lu bytes)\n", m_tip->nHeight, ::GetSerializeSize(m_template->block, PROTOCOL_VERSION));
     }
 
-    unsigned int nExtraNonce = 0;
+    std::unique_ptr<CBlock> pblock(new CBlock(m_template->block));
+    SetExtraNonce(pblock.get(), m_tip, ++m_extra_nonce);
+    pindexPrev = m_tip;
+    return pblock;
+}
+
+void MinerTemplateProducer::KeepDestination()
+{
+    LOCK(m_mutex);
+    m_reservedest->KeepDestination();
+}
+
+void Miner(std::shared_ptr<MinerTemplateProducer> producer, CConnman* connman, CTxMemPool* mempool, int thread_id, std::shared_ptr<MinerHashMeter> meter, std::shared_ptr<MinerTipNotifier> notifier)
+{
+    LogPrintf("Miner started\n");
+    SetThreadPriority(THREAD_PRIORITY_LOWEST);
+    util::ThreadRename("verium-miner");
+
+    if (gArgs.GetBoolArg("-minernuma", DEFAULT_MINER_NUMA))
+        BindMinerThreadToNumaNode(thread_id);
+
+    //Build buffer and check for memory availability
+    MinerScratchpad scratchpad(gArgs.GetBoolArg("-minerhugepages", DEFAULT_MINER_HUGEPAGES));
+    unsigned char *scratchbuf = scratchpad.get();
+    bool memory = scratchbuf != nullptr;
+
+    int64_t nLastHashrateLog = GetTime();
+    std::atomic<bool>& fAbort = notifier->AbortFlag(thread_id);
     try
     {
         while (fGenerateVerium && memory)
         {
-            while (::ChainstateActive().IsInitialBlockDownload() || ::ChainActive().Tip()->nHeight < connman->GetBestHeight()-10)
+            uint64_t nTipEpoch = notifier->GetTipEpoch();
+            if (IsChainSyncing(connman))
             {
                 LogPrintf("Mining inactive while chain is syncing\n");
+                do
+                {
+                    if (!fGenerateVerium || ShutdownRequested())
+                        return;
 
-                if (!fGenerateVerium)
-                    return;
-
-                if (!connman->interruptNet.sleep_for(std::chrono::seconds(10)))
-                    return;
+                    // Resume as soon as the block that ends the sync connects
+                    notifier->WaitForTipChange(nTipEpoch, std::chrono::seconds(10));
+                    nTipEpoch = notifier->GetTipEpoch();
+                } while (IsChainSyncing(connman));
             }
             while (connman->GetNodeCount(CConnman::CONNECTIONS_ALL) < 5)
             {
                 LogPrintf("Mining inactive, not enough node...\n");
 
-                if (!fGenerateVerium)
+                if (!fGenerateVerium || ShutdownRequested())
                     return;
 
-                if (!connman->interruptNet.sleep_for(std::chrono::seconds(10)))
-                    return;
+                notifier->WaitForTipChange(nTipEpoch, std::chrono::seconds(10));
             }
 
-            // Create new block
-            unsigned int nTransactionsUpdatedLast = mempool->GetTransactionsUpdated();
-            CBlockIndex* pindexPrev = ::ChainActive().Tip();
-            CScript scriptPubKey = GetScriptForDestination(dest);
+            // Get new work. The abort flag is cleared before the tip is read,
+            // so a tip change from here on cancels the search on this block.
+            fAbort.store(false);
+            const uint64_t nMempoolEpoch = notifier->GetMempoolEpoch();
+            const CBlockIndex* pindexPrev = nullptr;
 
-            std::unique_ptr<CBlockTemplate> pblocktemplate;
+            std::unique_ptr<CBlock> pwork;
             try
             {
-                pblocktemplate = BlockAssembler(*mempool, Params()).CreateNewBlock(scriptPubKey, false, pwallet.get());
+                pwork = producer->GetWork(pindexPrev);
             }
             catch(std::runtime_error& e)
             {
                 continue;
             }
 
-            if (!pblocktemplate.get())
+            if (!pwork)
             {
                 fGenerateVerium = false;
                 return;
             }
 
-            CBlock *pblock = &pblocktemplate->block;
-            IncrementExtraNonce(pblock, pindexPrev, nExtraNonce);
-            LogPrintf("Miner thread running on block %s (%lu bytes)\n", pindexPrev->nHeight, ::GetSerializeSize(*pblock, PROTOCOL_VERSION));
+            CBlock *pblock = pwork.get();
 
             // Pre-build hash buffers
             char pmidstatebuf[32+16]; char* pmidstate = alignup<16>(pmidstatebuf);
@@ -699,12 +994,12 @@ void Miner(std::shared_ptr<CWallet> pwallet, CConnman* connman, CTxMemPool* memp
                 {
                     // scrypt^2
                     int nHashes = 0;
-                    if (scrypt_N_1_1_256_multi(BEGIN(pblock->nVersion), hashTarget, &nHashes, scratchbuf))
+                    if (scrypt_N_1_1_256_multi(BEGIN(pblock->nVersion), hashTarget, &nHashes, scratchbuf, &fAbort))
                     {
                         // Found a solution
                         SetThreadPriority(THREAD_PRIORITY_NORMAL);
                         CheckWork(pblock);
-                        reservedest.KeepDestination();
+                        producer->KeepDestination();
                         SetThreadPriority(THREAD_PRIORITY_LOWEST);
                     }
                     nHashesDone += nHashes;
@@ -712,28 +1007,11 @@ void Miner(std::shared_ptr<CWallet> pwallet, CConnman* connman, CTxMemPool* memp
                 }
 
                 // Hash meter
-                static int64_t nHashCounter;
+                meter->Add(thread_id, nHashesDone, GetTime());
+                if (thread_id == 0 && GetTime() - nLastHashrateLog >= MINER_HASHRATE_LOG_INTERVAL)
                 {
-                    static RecursiveMutex cs;
-                    {
-                        LOCK(cs);
-                        if (nHPSTimerStart == 0)
-                        {
-                            nHPSTimerStart = GetTimeMillis();
-                            nHashCounter = 0;
-                        }
-                        else
-                            nHashCounter += nHashesDone;
-
-                        if (GetTimeMillis() - nHPSTimerStart > timeElapsed)
-                        {
-                            dHashesPerMin = 60000.0 * nHashCounter / (GetTimeMillis() - nHPSTimerStart);
-                            nHPSTimerStart = GetTimeMillis();
-                            nHashCounter = 0;
-                            updateHashrate(dHashesPerMin);
-                            LogPrintf("Total local hashrate: %6.0f H/m\n", hashrate);
-                        }
-                    }
+                    nLastHashrateLog = GetTime();
+                    LogPrintf("Total local hashrate: %6.0f H/m\n", meter->GetTotalRate(nLastHashrateLog));
                 }
 
                 // Check for stop or if block needs to be rebuilt
@@ -746,9 +1024,9 @@ void Miner(std::shared_ptr<CWallet> pwallet, CConnman* connman, CTxMemPool* memp
                     break;
                 if (pblock->nNonce >= 0xffff0000)
                     break;
-                if (mempool->GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 60)
+                if (notifier->GetMempoolEpoch() != nMempoolEpoch && GetTime() - nStart > 60)
                     break;
-                if (pindexPrev != ::ChainActive().Tip())
+                if (fAbort.load() || pindexPrev != ::ChainActive().Tip())
                     break;
 
                 // Update nTime every few seconds
@@ -760,8 +1038,6 @@ void Miner(std::shared_ptr<CWallet> pwallet, CConnman* connman, CTxMemPool* memp
     }
     catch (boost::thread_interrupted)
     {
-        free(scratchbuf);
-        hashrate = 0;
         LogPrintf("Miner terminated\n");
         fGenerateVerium = false;
         throw;
@@ -777,6 +1053,7 @@ void GenerateVerium(bool fGenerate, std::shared_ptr<CWallet> pwallet, int nThrea
 {
     fGenerateVerium = fGenerate;
     static boost::thread_group* minerThreads = NULL;
+    static std::shared_ptr<MinerTipNotifier> minerNotifier;
 
     if (nThreads == 0 )
         fGenerateVerium = false;
@@ -784,19 +1061,39 @@ void GenerateVerium(bool fGenerate, std::shared_ptr<CWallet> pwallet, int nThrea
     if (nThreads < 0)
         nThreads = std::thread::hardware_concurrency();
 
+    if (minerNotifier)
+    {
+        // Stop the scrypt batches in flight rather than waiting for them
+        minerNotifier->AbortAll();
+        UnregisterSharedValidationInterface(minerNotifier);
+        minerNotifier.reset();
+    }
     if (minerThreads != NULL)
     {
         minerThreads->interrupt_all();
         delete minerThreads;
         minerThreads = NULL;
     }
+    std::atomic_store(&g_miner_hash_meter, std::shared_ptr<MinerHashMeter>());
 
     if (nThreads == 0 || !fGenerate)
         return;
 
+    // All threads mine on the templates of one producer
+    std::shared_ptr<MinerTemplateProducer> producer = std::make_shared<MinerTemplateProducer>(mempool, pwallet);
+    if (!producer->Init())
+    {
+        fGenerateVerium = false;
+        return;
+    }
+
+    std::shared_ptr<MinerHashMeter> meter = std::make_shared<MinerHashMeter>(nThreads, GetTime());
+    std::atomic_store(&g_miner_hash_meter, meter);
+    minerNotifier = std::make_shared<MinerTipNotifier>(nThreads);
+    RegisterSharedValidationInterface(minerNotifier);
     minerThreads = new boost::thread_group();
     for (int i = 0; i < nThreads; i++)
-        minerThreads->create_thread(std::bind(&Miner, pwallet, connman, mempool));
+        minerThreads->create_thread(std::bind(&Miner, producer, connman, mempool, i, meter, minerNotifier));
 }
 
 static bool ProcessBlockFound(const CBlock* pblock, const CChainParams& chainparams)
@@ -819,108 +1116,159 @@ static bool ProcessBlockFound(const CBlock* pblock, const CChainParams& chainpar
     return true;
 }
 
-void Staker(std::shared_ptr<CWallet> pwallet, CConnman* connman, CTxMemPool* mempool)
+void StakingWallets::Add(const std::shared_ptr<CWallet>& pwallet)
 {
-    SetThreadPriority(THREAD_PRIORITY_ABOVE_NORMAL);
-    util::ThreadRename("vericoin-staking");
+    LOCK(m_mutex);
+    for (const Entry& entry : m_wallets)
+        if (entry.key == pwallet.get())
+            return;
+    m_wallets.push_back({pwallet, pwallet.get(), GetAdjustedTime()});
+}
 
-    // Each thread has it's own nonce
-    OutputType output_type = pwallet->m_default_change_type != OutputType::CHANGE_AUTO ? pwallet->m_default_change_type : pwallet->m_default_address_type;
-    ReserveDestination reservedest(pwallet.get(), output_type);
+bool StakingWallets::Remove(const CWallet* pwallet)
+{
+    LOCK(m_mutex);
+    m_wallets.erase(std::remove_if(m_wallets.begin(), m_wallets.end(), [&](const Entry& entry) {
+        return !pwallet || entry.key == pwallet;
+    }), m_wallets.end());
+    return !m_wallets.empty();
+}
 
-    CTxDestination dest;
-    bool ret = reservedest.GetReservedDestination(dest, true);
-    if (!ret)
+bool StakingWallets::Contains(const CWallet* pwallet) const
+{
+    LOCK(m_mutex);
+    for (const Entry& entry : m_wallets)
+        if (entry.key == pwallet)
+            return true;
+    return false;
+}
+
+std::vector<std::pair<std::shared_ptr<CWallet>, int64_t>> StakingWallets::NextRound(int64_t nSearchTime)
+{
+    LOCK(m_mutex);
+    std::vector<std::pair<std::shared_ptr<CWallet>, int64_t>> vRound;
+    for (auto it = m_wallets.begin(); it != m_wallets.end();) {
+        std::shared_ptr<CWallet> pwallet = it->wallet.lock();
+        if (!pwallet) {
+            it = m_wallets.erase(it);
+            continue;
+        }
+        vRound.emplace_back(std::move(pwallet), nSearchTime - it->nLastSearchTime);
+        it->nLastSearchTime = std::max(it->nLastSearchTime, nSearchTime);
+        ++it;
+    }
+    return vRound;
+}
+
+std::shared_ptr<CWallet> StakingWallets::StakeRound(int64_t nSearchTime, const std::function<bool(const std::shared_ptr<CWallet>&, int64_t)>& stake)
+{
+    for (const auto& round : NextRound(nSearchTime))
     {
-        fGenerateVericoin = false;
-        return;
+        const std::shared_ptr<CWallet>& pwallet = round.first;
+        // Removed while an earlier wallet of the round was searched
+        if (!Contains(pwallet.get()))
+            continue;
+        if (pwallet->IsLocked()) {
+            LogPrintf("Staking inactive because wallet %s is locked...\n", pwallet->GetDisplayName());
+            continue;
+        }
+        if (round.second <= 0)
+            continue;
+        if (stake(pwallet, round.second))
+            return pwallet;
     }
+    return nullptr;
+}
+
+static StakingWallets g_staking_wallets;
+
+/**
+ * Turn a kernel found by pwallet into a signed block and submit it. Only this
+ * takes cs_main; the kernel search that precedes it does not.
+ */
+static bool StakeBlock(const std::shared_ptr<CWallet>& pwallet, const StakeKernel& kernel, CTxMemPool* mempool, unsigned int& nExtraNonce)
+{
+    // The coinbase of a proof-of-stake block pays nothing, so needs no destination
+    bool fPoSCancel = false;
+    std::unique_ptr<CBlockTemplate> pblocktemplate;
+    {
+        LOCK2(cs_main, pwallet->cs_wallet);
+        pblocktemplate = BlockAssembler(*mempool, Params()).CreateNewBlock(CScript(), true, pwallet.get(), &fPoSCancel, &kernel);
+    }
+    // The tip moved or the kernel was spent while searching
+    if (!pblocktemplate)
+        return false;
+
+    CBlock *pblock = &pblocktemplate->block;
+    IncrementExtraNonce(pblock, kernel.pindexPrev, nExtraNonce);
+    {
+        LOCK2(cs_main, pwallet->cs_wallet);
+        if (!SignBlock(*pblock, *pwallet))
+        {
+            LogPrintf("Staking(): failed to sign PoS block\n");
+            return false;
+        }
+    }
+    LogPrintf("Staking : proof-of-stake block found %s for wallet %s\n", pblock->GetHash().ToString(), pwallet->GetDisplayName());
+
+    return ProcessBlockFound(pblock, Params());
+}
+
+void Staker(CConnman* connman, CTxMemPool* mempool, std::shared_ptr<MinerTipNotifier> notifier)
+{
+    SetThreadPriority(THREAD_PRIORITY_ABOVE_NORMAL);
+    util::ThreadRename("vericoin-staking");
 
     unsigned int nExtraNonce = 0;
     try
     {
         while (fGenerateVericoin)
         {
-            while (::ChainstateActive().IsInitialBlockDownload() || ::ChainActive().Tip()->nHeight < connman->GetBestHeight()-10)
+            uint64_t nTipEpoch = notifier->GetTipEpoch();
+            if (IsChainSyncing(connman))
             {
                 LogPrintf("Staking inactive while chain is syncing\n");
+                do
+                {
+                    if (!fGenerateVericoin || ShutdownRequested())
+                        return;
 
-                if (!fGenerateVericoin)
-                    return;
-
-                if (!connman->interruptNet.sleep_for(std::chrono::seconds(10)))
-                    return;
+                    notifier->WaitForTipChange(nTipEpoch, std::chrono::seconds(10));
+                    nTipEpoch = notifier->GetTipEpoch();
+                } while (IsChainSyncing(connman));
             }
             while (connman->GetNodeCount(CConnman::CONNECTIONS_ALL) < 5)
             {
                 LogPrintf("Staking inactive, not enough node...\n");
 
-                if (!fGenerateVericoin)
+                if (!fGenerateVericoin || ShutdownRequested())
                     return;
 
-                if (!connman->interruptNet.sleep_for(std::chrono::seconds(10)))
-                    return;
+                notifier->WaitForTipChange(nTipEpoch, std::chrono::seconds(10));
             }
-            while (pwallet->IsLocked()) {
-                LogPrintf("Staking inactive because wallet is locked...\n");
 
-                if (!fGenerateVericoin)
-                    return;
-
-                if (!connman->interruptNet.sleep_for(std::chrono::seconds(5)))
-                    return;
-            }
+            // A new tip wakes the waits below up, since it changes the stake to search
+            nTipEpoch = notifier->GetTipEpoch();
 
-            CBlockIndex* pindexPrev = ::ChainActive().Tip();
-            bool fPoSCancel = false;
-            CScript scriptPubKey = GetScriptForDestination(dest);
-            std::unique_ptr<CBlockTemplate> pblocktemplate;
+            // Search every staking wallet in turn; each search only locks to
+            // snapshot its coins, so several wallets do not stall validation
+            const bool fFound = g_staking_wallets.StakeRound(GetAdjustedTime(), [&](const std::shared_ptr<CWallet>& pwallet, int64_t nSearchInterval) {
+                nLastCoinStakeSearchInterval = nSearchInterval;
+                StakeKernel kernel;
+                return pwallet->SearchStakeKernel(nSearchInterval, kernel) && StakeBlock(pwallet, kernel, mempool, nExtraNonce);
+            }) != nullptr;
 
+            if (fFound)
             {
-                LOCK2(cs_main, pwallet->cs_wallet);
-
-                pblocktemplate = BlockAssembler(*mempool, Params()).CreateNewBlock(scriptPubKey, true, pwallet.get(), &fPoSCancel);
-            }
-
-            if (!pblocktemplate.get())
-            {
-                if (fPoSCancel == true)
-                {
-                    if (!connman->interruptNet.sleep_for(std::chrono::seconds(25)))
-                        return;
-                    continue;
-                }
-
-                LogPrintf("Staking: Keypool ran out, please call keypoolrefill before restarting the staking thread\n");
-                fGenerateVericoin = false;
-		        return;
-            }
-
-            CBlock *pblock = &pblocktemplate->block;
-            IncrementExtraNonce(pblock, pindexPrev, nExtraNonce);
-
-            // ppcoin: if proof-of-stake block found then process block
-            if (pblock->IsProofOfStake())
-            {
-                {
-                    LOCK2(cs_main, pwallet->cs_wallet);
-                    if (!SignBlock(*pblock, *pwallet))
-                    {
-                        LogPrintf("Staking(): failed to sign PoS block\n");
-                        continue;
-                    }
-                }
-                LogPrintf("Staking : proof-of-stake block found %s\n", pblock->GetHash().ToString());
-
-                ProcessBlockFound(pblock, Params());
-                reservedest.KeepDestination();
-
                 // Rest for ~3 minutes after successful block to preserve close quick
                 if (!connman->interruptNet.sleep_for(std::chrono::seconds(60 + GetRand(4))))
                     return;
+                // Our own block moved the tip, that is no reason to cut the wait short
+                nTipEpoch = notifier->GetTipEpoch();
             }
 
-            if (!connman->interruptNet.sleep_for(std::chrono::seconds(25)))
+            notifier->WaitForTipChange(nTipEpoch, std::chrono::seconds(25));
+            if (ShutdownRequested())
                 return;
         }
         fGenerateVericoin = false;
@@ -944,11 +1292,33 @@ bool IsStaking()
     return fGenerateVericoin;
 }
 
+bool IsStaking(const CWallet* pwallet)
+{
+    return fGenerateVericoin && g_staking_wallets.Contains(pwallet);
+}
+
 void GenerateVericoin(bool fGenerate, std::shared_ptr<CWallet> pwallet, CConnman* connman, CTxMemPool* mempool)
 {
-    fGenerateVericoin = fGenerate;
     static boost::thread_group* stakerThreads = NULL;
+    static std::shared_ptr<MinerTipNotifier> stakerNotifier;
+
+    // One thread stakes for every wallet added here
+    if (fGenerate) {
+        if (!pwallet)
+            return;
+        g_staking_wallets.Add(pwallet);
+        if (stakerThreads != NULL && fGenerateVericoin)
+            return; // the running thread picks the wallet up
+    } else if (g_staking_wallets.Remove(pwallet.get())) {
+        return; // the other wallets keep staking
+    }
+    fGenerateVericoin = fGenerate;
 
+    if (stakerNotifier)
+    {
+        UnregisterSharedValidationInterface(stakerNotifier);
+        stakerNotifier.reset();
+    }
     if (stakerThreads != NULL)
     {
         stakerThreads->interrupt_all();
@@ -959,6 +1329,8 @@ void GenerateVericoin(bool fGenerate, std::shared_ptr<CWallet> pwallet, CConnman
     if (!fGenerate)
         return;
 
+    stakerNotifier = std::make_shared<MinerTipNotifier>(1);
+    RegisterSharedValidationInterface(stakerNotifier);
     stakerThreads = new boost::thread_group();
-    stakerThreads->create_thread(std::bind(&Staker, pwallet, connman, mempool));
+    stakerThreads->create_thread(std::bind(&Staker, connman, mempool, stakerNotifier));
 }
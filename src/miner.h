@@ -8,25 +8,40 @@
 
 #include <optional.h>
 #include <primitives/block.h>
+#include <script/script.h>
+#include <sync.h>
 #include <txmempool.h>
 #include <validation.h>
+#include <validationinterface.h>
 
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <memory>
 #include <stdint.h>
+#include <vector>
 
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/ordered_index.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
 
 class CBlockIndex;
 class CChainParams;
 class CScript;
 class CWallet;
+class ReserveDestination;
+struct StakeKernel;
 
 extern int64_t nLastCoinStakeSearchInterval;
 
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Default for -minerhugepages */
+static const bool DEFAULT_MINER_HUGEPAGES = false;
+/** Default for -minernuma */
+static const bool DEFAULT_MINER_NUMA = false;
 
 struct CBlockTemplate
 {
@@ -160,8 +175,9 @@ public:
     explicit BlockAssembler(const CTxMemPool& mempool, const CChainParams& params);
     explicit BlockAssembler(const CTxMemPool& mempool, const CChainParams& params, const Options& options);
 
-    /** Construct a new block template with coinbase to scriptPubKeyIn */
-    std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn, bool fPos = false, CWallet* pwallet = nullptr, bool* pfPoSCancel = nullptr);
+    /** Construct a new block template with coinbase to scriptPubKeyIn. For a proof-of-stake
+     *  block pass the wallet and a kernel it found with CWallet::SearchStakeKernel(). */
+    std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn, bool fPos = false, CWallet* pwallet = nullptr, bool* pfPoSCancel = nullptr, const StakeKernel* pkernel = nullptr);
 
     static Optional<int64_t> m_last_block_num_txs;
     static Optional<int64_t> m_last_block_weight;
@@ -202,6 +218,8 @@ private:
 
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
+/** Set the extranonce of the coinbase and update the merkle root */
+void SetExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock);
 
 void SHA256Transform(void* pstate, void* pinput, const void* pinit);
@@ -211,10 +229,167 @@ void FormatHashBuffers(CBlock* pblock, char* pmidstate, char* pdata, char* phash
 bool CheckWork(CBlock* pblock);
 
 void GenerateVerium(bool fGenerate, std::shared_ptr<CWallet> pwallet, int nThreads, CConnman* connman, CTxMemPool* mempool);
+/** Start or stop staking for pwallet; one thread stakes for all wallets started. Stopping a null wallet stops them all. */
 void GenerateVericoin(bool fGenerate, std::shared_ptr<CWallet> pwallet, CConnman* connman, CTxMemPool* mempool);
 bool IsMining();
 bool IsStaking();
+/** Whether staking runs for this wallet */
+bool IsStaking(const CWallet* pwallet);
+/** Total hashrate of the local miner threads in H/m */
 double GetHashRate();
+/** Hashrate of each local miner thread in H/m, indexed by thread id */
+std::vector<double> GetThreadHashRates();
+
+/**
+ * Hash counters of the miner threads. Each thread only writes its own
+ * buckets with atomic adds, so counting never takes a lock; readers sum
+ * the complete buckets of the last WINDOW_BUCKETS * BUCKET_SECONDS seconds.
+ */
+class MinerHashMeter
+{
+public:
+    static constexpr int64_t BUCKET_SECONDS = 10;
+    static constexpr int WINDOW_BUCKETS = 6;
+
+    MinerHashMeter(size_t nThreads, int64_t nStartTime);
+
+    /** Count hashes done by a thread. Must only be called from that thread. */
+    void Add(size_t nThread, uint64_t nHashes, int64_t nTime);
+    /** Hashrate of a thread in H/m over the sliding window ending at nTime */
+    double GetThreadRate(size_t nThread, int64_t nTime) const;
+    double GetTotalRate(int64_t nTime) const;
+    size_t GetThreadCount() const { return m_threads; }
+
+private:
+    struct Bucket {
+        std::atomic<int64_t> nEpoch{-1};
+        std::atomic<uint64_t> nHashes{0};
+    };
+    /** One spare bucket per thread is being filled while the others are read */
+    static constexpr int SLOTS = WINDOW_BUCKETS + 1;
+
+    const size_t m_threads;
+    const int64_t m_start_time;
+    std::unique_ptr<Bucket[]> m_buckets;
+};
+
+/**
+ * Wakes the miner and staker threads up as soon as the chain tip changes
+ * instead of letting them poll, and raises the abort flag of each thread so
+ * that scrypt batches still hashing the old tip are given up. Transactions
+ * entering the mempool only bump a separate epoch: they are worth a new
+ * template but not the batch in flight.
+ */
+class MinerTipNotifier final : public CValidationInterface
+{
+public:
+    explicit MinerTipNotifier(size_t nThreads);
+
+    /** Abort flag of a thread, cleared by that thread before it reads the tip for a new block */
+    std::atomic<bool>& AbortFlag(size_t nThread) { return m_abort[nThread]; }
+
+    uint64_t GetTipEpoch() const { return m_tip_epoch.load(); }
+
+    /** Bumped for every transaction added to the mempool; removals come with a new tip or are not worth mining */
+    uint64_t GetMempoolEpoch() const { return m_mempool_epoch.load(); }
+
+    /** Sleep until the tip moves past nEpoch or nTimeout elapses. This is a boost interruption point. */
+    void WaitForTipChange(uint64_t nEpoch, std::chrono::milliseconds nTimeout);
+
+    void AbortAll();
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex* pindexNew, const CBlockIndex* pindexFork, bool fInitialDownload) override;
+    void TransactionAddedToMempool(const CTransactionRef& tx) override;
+
+private:
+    const size_t m_threads;
+    std::unique_ptr<std::atomic<bool>[]> m_abort;
+    std::atomic<uint64_t> m_tip_epoch{0};
+    std::atomic<uint64_t> m_mempool_epoch{0};
+    boost::mutex m_mutex;
+    boost::condition_variable m_cond;
+};
+
+/**
+ * Builds one block template per tip and mempool epoch for all the miner
+ * threads, so that N threads do not run N mempool selections under cs_main
+ * and mempool.cs. Each copy handed out gets its own coinbase extranonce, which
+ * gives every thread a merkle root, and so a nonce space, of its own.
+ */
+class MinerTemplateProducer
+{
+public:
+    MinerTemplateProducer(CTxMemPool* mempool, std::shared_ptr<CWallet> pwallet);
+    ~MinerTemplateProducer();
+
+    /** Reserve the coinbase destination, returns false if the keypool ran out */
+    bool Init();
+
+    /**
+     * Copy of the current template with an unused extranonce, rebuilt first if
+     * the tip moved or the mempool changed more than a minute ago. Returns
+     * nullptr if no template can be built; throws what CreateNewBlock throws.
+     */
+    std::unique_ptr<CBlock> GetWork(const CBlockIndex*& pindexPrev);
+
+    /** Called once a block paying to the coinbase destination was found */
+    void KeepDestination();
+
+private:
+    CTxMemPool* const m_mempool;
+    const std::shared_ptr<CWallet> m_wallet;
+
+    Mutex m_mutex;
+    const std::unique_ptr<ReserveDestination> m_reservedest GUARDED_BY(m_mutex);
+    CScript m_script_pubkey GUARDED_BY(m_mutex);
+    std::unique_ptr<CBlockTemplate> m_template GUARDED_BY(m_mutex);
+    const CBlockIndex* m_tip GUARDED_BY(m_mutex) = nullptr;
+    unsigned int m_transactions_updated GUARDED_BY(m_mutex) = 0;
+    int64_t m_created GUARDED_BY(m_mutex) = 0;
+    unsigned int m_extra_nonce GUARDED_BY(m_mutex) = 0;
+};
+
+/**
+ * The wallets the staker thread stakes for. Wallets are only referenced
+ * weakly, and held by the thread for one round of kernel searches, so an
+ * unloaded wallet drops out instead of being kept alive.
+ */
+class StakingWallets
+{
+public:
+    void Add(const std::shared_ptr<CWallet>& pwallet);
+
+    /** Remove a wallet, or all of them if pwallet is null. Returns whether any are left. */
+    bool Remove(const CWallet* pwallet);
+
+    bool Contains(const CWallet* pwallet) const;
+
+    /**
+     * Start a round of searches at nSearchTime: return each loaded wallet with
+     * the seconds since its previous search, and forget unloaded wallets.
+     */
+    std::vector<std::pair<std::shared_ptr<CWallet>, int64_t>> NextRound(int64_t nSearchTime);
+
+    /**
+     * Run a round at nSearchTime, calling stake with each unlocked wallet still
+     * staking and its search interval until one stakes a block, so only one
+     * coinstake is submitted per round. Returns that wallet, or nullptr.
+     */
+    std::shared_ptr<CWallet> StakeRound(int64_t nSearchTime, const std::function<bool(const std::shared_ptr<CWallet>&, int64_t)>& stake);
+
+private:
+    struct Entry
+    {
+        std::weak_ptr<CWallet> wallet;
+        //! Identifies the wallet after it expired
+        const CWallet* key;
+        int64_t nLastSearchTime;
+    };
+
+    mutable Mutex m_mutex;
+    std::vector<Entry> m_wallets GUARDED_BY(m_mutex);
+};
 
 namespace boost {
     class thread_group;
@@ -2686,6 +2686,12 @@ ServiceFlags CConnman::GetLocalServices() const
     return nLocalServices;
 }
 
+void CConnman::RemoveLocalServices(ServiceFlags services)
+{
+    ServiceFlags current = nLocalServices;
+    while (!nLocalServices.compare_exchange_weak(current, ServiceFlags(current & ~services))) {}
+}
+
 void CConnman::SetBestHeight(int height)
 {
     nBestHeight.store(height, std::memory_order_release);
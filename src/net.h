@@ -299,6 +299,10 @@ public:
     //! that peer during `net_processing.cpp:PushNodeVersion()`.
     ServiceFlags GetLocalServices() const;
 
+    //! Stop offering services to the peers connected from now on, as
+    //! after loading a UTXO set snapshot no block below it can be served.
+    void RemoveLocalServices(ServiceFlags services);
+
     //!set the max outbound target in bytes
     void SetMaxOutboundTarget(uint64_t limit);
     uint64_t GetMaxOutboundTarget();
@@ -439,12 +443,13 @@ private:
      * connection (in ConnectNode()) under a member also called
      * nLocalServices.
      *
-     * This data is not marked const, but after being set it should not
-     * change. See the note in CNode::nLocalServices documentation.
+     * Services are only ever removed once set (see RemoveLocalServices()).
+     * Peers already connected keep the services they were offered, see the
+     * note in CNode::nLocalServices documentation.
      *
      * \sa CNode::nLocalServices
      */
-    ServiceFlags nLocalServices;
+    std::atomic<ServiceFlags> nLocalServices;
 
     std::unique_ptr<CSemaphore> semOutbound;
     std::unique_ptr<CSemaphore> semAddnode;
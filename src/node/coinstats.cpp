@@ -14,38 +14,52 @@
 
 #include <map>
 
-static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
+static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, CHashWriter& ss2, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
 {
     assert(!outputs.empty());
     ss << hash;
-    ss << VARINT(outputs.begin()->second.nHeight * 2 + outputs.begin()->second.fCoinBase ? 1u : 0u);
+    ss2 << hash;
+    // hash_serialized_2 kept an operator precedence slip that reduces the
+    // height to whether it is zero; it is reproduced so the hash stays comparable.
+    ss2 << VARINT((outputs.begin()->second.nHeight * 2 + outputs.begin()->second.fCoinBase) ? 1u : 0u);
+    ss << VARINT(outputs.begin()->second.nHeight * 2 + (outputs.begin()->second.fCoinBase ? 1u : 0u));
+    // The coinstake flag and the time are consensus relevant for spending
+    // (see CheckTxInputs()), so a UTXO set that differs in them must not hash
+    // the same.
+    ss << VARINT(outputs.begin()->second.fCoinStake ? 1u : 0u);
+    ss << VARINT(outputs.begin()->second.nTime);
     stats.nTransactions++;
     for (const auto& output : outputs) {
         ss << VARINT(output.first + 1);
         ss << output.second.out.scriptPubKey;
         ss << VARINT_MODE(output.second.out.nValue, VarIntMode::NONNEGATIVE_SIGNED);
+        ss2 << VARINT(output.first + 1);
+        ss2 << output.second.out.scriptPubKey;
+        ss2 << VARINT_MODE(output.second.out.nValue, VarIntMode::NONNEGATIVE_SIGNED);
         stats.nTransactionOutputs++;
         stats.nTotalAmount += output.second.out.nValue;
         stats.nBogoSize += 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
                            2 /* scriptPubKey len */ + output.second.out.scriptPubKey.size() /* scriptPubKey */;
     }
     ss << VARINT(0u);
+    ss2 << VARINT(0u);
 }
 
-//! Calculate statistics about the unspent transaction output set
-bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
+bool GetUTXOStats(CCoinsViewCursor* pcursor, CCoinsStats& stats)
 {
     stats = CCoinsStats();
-    std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
-    assert(pcursor);
-
     CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    CHashWriter ss2(SER_GETHASH, PROTOCOL_VERSION);
     stats.hashBlock = pcursor->GetBestBlock();
     {
+        // A chainstate that is not the node's own, like a downloaded
+        // bootstrap, can be at a block this node does not know yet
         LOCK(cs_main);
-        stats.nHeight = LookupBlockIndex(stats.hashBlock)->nHeight;
+        const CBlockIndex* pindex = LookupBlockIndex(stats.hashBlock);
+        if (pindex) stats.nHeight = pindex->nHeight;
     }
     ss << stats.hashBlock;
+    ss2 << stats.hashBlock;
     uint256 prevkey;
     std::map<uint32_t, Coin> outputs;
     while (pcursor->Valid()) {
@@ -53,7 +67,7 @@ bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
         Coin coin;
         if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
             if (!outputs.empty() && key.hash != prevkey) {
-                ApplyStats(stats, ss, prevkey, outputs);
+                ApplyStats(stats, ss, ss2, prevkey, outputs);
                 outputs.clear();
             }
             prevkey = key.hash;
@@ -65,9 +79,20 @@ bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
         pcursor->Next();
     }
     if (!outputs.empty()) {
-        ApplyStats(stats, ss, prevkey, outputs);
+        ApplyStats(stats, ss, ss2, prevkey, outputs);
     }
     stats.hashSerialized = ss.GetHash();
+    stats.hashSerialized2 = ss2.GetHash();
+    return true;
+}
+
+//! Calculate statistics about the unspent transaction output set
+bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
+{
+    std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
+    assert(pcursor);
+
+    if (!GetUTXOStats(pcursor.get(), stats)) return false;
     stats.nDiskSize = view->EstimateSize();
     return true;
 }
@@ -12,6 +12,7 @@
 #include <cstdint>
 
 class CCoinsView;
+class CCoinsViewCursor;
 
 struct CCoinsStats
 {
@@ -21,6 +22,8 @@ struct CCoinsStats
     uint64_t nTransactionOutputs{0};
     uint64_t nBogoSize{0};
     uint256 hashSerialized{};
+    //! hash_serialized_2, as earlier versions computed it without coinstake flags and times
+    uint256 hashSerialized2{};
     uint64_t nDiskSize{0};
     CAmount nTotalAmount{0};
 
@@ -31,4 +34,8 @@ struct CCoinsStats
 //! Calculate statistics about the unspent transaction output set
 bool GetUTXOStats(CCoinsView* view, CCoinsStats& stats);
 
+//! Calculate the same statistics over the coins of a cursor, in its key order,
+//! such as those read from a UTXO set snapshot. nDiskSize is left unset.
+bool GetUTXOStats(CCoinsViewCursor* pcursor, CCoinsStats& stats);
+
 #endif // BITCOIN_NODE_COINSTATS_H
@@ -10,9 +10,12 @@
 #include <chain.h>
 #include <chainparams.h>
 #include <consensus/validation.h>
+#include <crypto/common.h>
+#include <crypto/sha256.h>
 #include <primitives/transaction.h>
 #include <primitives/block.h>
 #include <uint256.h>
+#include <undo.h>
 #include <index/txindex.h>
 #include <math.h>
 #include <bignum.h>
@@ -22,17 +25,24 @@
 #include <net.h>
 #include <script/standard.h>
 #include <key.h>
+#include <sync.h>
 
 #include <boost/assign/list_of.hpp>
 
 #include <inttypes.h>
+#include <unordered_map>
 
 using namespace std;
 
 double GetDifficulty(const CBlockIndex* blockindex = nullptr);
 
-static int nAverageStakeWeightHeightCached = 0;
-static double dAverageStakeWeightCached = 0;
+// Per-block memo of GetPoSKernelPS() and GetAverageStakeWeight(). Both depend
+// only on a block and its ancestors, so an entry never goes stale; the tables
+// are emptied when they outgrow STAKE_WEIGHT_CACHE_SIZE.
+static const size_t STAKE_WEIGHT_CACHE_SIZE = 4096;
+static Mutex cs_stake_weight;
+static std::unordered_map<uint256, double, BlockHasher> mapPoSKernelPS GUARDED_BY(cs_stake_weight);
+static std::unordered_map<uint256, double, BlockHasher> mapAverageStakeWeight GUARDED_BY(cs_stake_weight);
 
 extern unsigned int nTargetSpacing;
 
@@ -93,13 +103,20 @@ unsigned int GetNextTargetRequired(const CBlockIndex* pindexLast, bool fProofOfS
     return bnNew.GetCompact();
 }
 
-double GetPoSKernelPS(CBlockIndex* pindexPrev)
+static double PoSKernelPSMemo(const CBlockIndex* pindexPrev) EXCLUSIVE_LOCKS_REQUIRED(cs_stake_weight)
 {
+    if (pindexPrev == nullptr)
+        return 0;
+    auto it = mapPoSKernelPS.find(pindexPrev->GetBlockHash());
+    if (it != mapPoSKernelPS.end())
+        return it->second;
+
+    const CBlockIndex* pindexTip = pindexPrev;
     int nPoSInterval = 72;
     double dStakeKernelsTriedAvg = 0;
     int nStakesHandled = 0, nStakesTime = 0;
 
-    CBlockIndex* pindexPrevStake = NULL;
+    const CBlockIndex* pindexPrevStake = NULL;
 
 
     while (pindexPrev && nStakesHandled < nPoSInterval)
@@ -116,7 +133,17 @@ double GetPoSKernelPS(CBlockIndex* pindexPrev)
         pindexPrev = pindexPrev->pprev;
     }
 
-   return nStakesTime ? dStakeKernelsTriedAvg / nStakesTime : 0;
+    double dKernelPS = nStakesTime ? dStakeKernelsTriedAvg / nStakesTime : 0;
+    if (mapPoSKernelPS.size() >= STAKE_WEIGHT_CACHE_SIZE)
+        mapPoSKernelPS.clear();
+    mapPoSKernelPS.emplace(pindexTip->GetBlockHash(), dKernelPS);
+    return dKernelPS;
+}
+
+double GetPoSKernelPS(CBlockIndex* pindexPrev)
+{
+    LOCK(cs_stake_weight);
+    return PoSKernelPSMemo(pindexPrev);
 }
 
 double GetPoSKernelPS()
@@ -154,26 +181,28 @@ double GetAverageStakeWeight(CBlockIndex* pindexPrev)
     //if (g_connman.GetBestHeight() < 1)
     //    return weightAve;
 
-    // Use cached weight if it's still valid
-    if (pindexPrev->nHeight == nAverageStakeWeightHeightCached)
-    {
-        return dAverageStakeWeightCached;
-    }
-    nAverageStakeWeightHeightCached = pindexPrev->nHeight;
-
+    // Use the memoized weight of this block if there is one
+    LOCK(cs_stake_weight);
+    auto it = mapAverageStakeWeight.find(pindexPrev->GetBlockHash());
+    if (it != mapAverageStakeWeight.end())
+        return it->second;
 
+    // Sum in the same order as always: the result feeds consensus through
+    // GetStakeTimeFactoredWeight(), so it must stay bit-identical
     int i;
-    CBlockIndex* currentBlockIndex = pindexPrev;
+    const CBlockIndex* currentBlockIndex = pindexPrev;
     for (i = 0; currentBlockIndex && i < 60; i++)
     {
-        double tempWeight = GetPoSKernelPS(currentBlockIndex);
+        double tempWeight = PoSKernelPSMemo(currentBlockIndex);
         weightSum += tempWeight;
         currentBlockIndex = currentBlockIndex->pprev;
     }
     weightAve = (weightSum/i)+21;
 
-    // Cache the stake weight value
-    dAverageStakeWeightCached = weightAve;
+    // Memoize the stake weight value
+    if (mapAverageStakeWeight.size() >= STAKE_WEIGHT_CACHE_SIZE)
+        mapAverageStakeWeight.clear();
+    mapAverageStakeWeight.emplace(pindexPrev->GetBlockHash(), weightAve);
 
     return weightAve;
 }
@@ -243,13 +272,9 @@ bool GetCoinAge(const CTransaction& tx, const CCoinsViewCache &view, uint64_t& n
     if (tx.IsCoinBase())
         return true;
 
-    // Transaction index is required to get to block header
-    if (!g_txindex)
-        return false;  // Transaction index not available
-
     for (const auto& txin : tx.vin)
     {
-        // First try finding the previous transaction in database
+        // The UTXO entry carries the value and time of the previous transaction
         const COutPoint &prevout = txin.prevout;
         Coin coin;
 
@@ -259,44 +284,30 @@ bool GetCoinAge(const CTransaction& tx, const CCoinsViewCache &view, uint64_t& n
         if (tx.nTime < coin.nTime)
             return false;  // Transaction timestamp violation
 
-        CDiskTxPos postx;
-        CTransactionRef txPrev;
-        if (g_txindex->FindTxPosition(prevout.hash, postx))
-        {
-            CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-            CBlockHeader header;
-            try {
-                file >> header;
-                fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                file >> txPrev;
-            } catch (std::exception &e) {
-                return error("%s() : deserialize or I/O error in GetCoinAge()", __PRETTY_FUNCTION__);
-            }
-            if (txPrev->GetHash() != prevout.hash)
-                return error("%s() : txid mismatch in GetCoinAge()", __PRETTY_FUNCTION__);
-
-            if (header.GetBlockTime() + Params().GetConsensus().nStakeMinAge > tx.nTime)
-                continue; // only count coins meeting min age requirement
+        // and its height gives the block header, without reading txPrev from disk
+        if (coin.nHeight > pindexPrev->nHeight)
+            return error("%s() : tx not in a block in GetCoinAge()", __PRETTY_FUNCTION__);
+        const CBlockIndex* pindexFrom = pindexPrev->GetAncestor(coin.nHeight);
 
-            int64_t nValueIn = txPrev->vout[txin.prevout.n].nValue;
-            int timeWeight = tx.nTime-txPrev->nTime;
+        if (pindexFrom->GetBlockTime() + Params().GetConsensus().nStakeMinAge > tx.nTime)
+            continue; // only count coins meeting min age requirement
 
-            if (pindexPrev->nHeight+1 > Params().GetConsensus().PoSTHeight )
-            {
-                int64_t CoinDay = nValueIn * timeWeight / COIN / (24 * 60 * 60);
-                int64_t factoredTimeWeight = GetStakeTimeFactoredWeight(timeWeight, CoinDay, pindexPrev);
-                bnCoinDay += arith_uint256(nValueIn) * factoredTimeWeight / COIN / (24 * 60 * 60);
-            }
-            else
-            {
-                bnCentSecond += arith_uint256(nValueIn) * timeWeight / CENT;
-            }
+        int64_t nValueIn = coin.out.nValue;
+        int timeWeight = tx.nTime-coin.nTime;
 
-            if (gArgs.GetBoolArg("-printcoinage", false))
-                LogPrintf("coin age nValueIn=%-12lld nTimeDiff=%d bnCentSecond=%s\n", nValueIn, timeWeight, bnCentSecond.ToString());
+        if (pindexPrev->nHeight+1 > Params().GetConsensus().PoSTHeight )
+        {
+            int64_t CoinDay = nValueIn * timeWeight / COIN / (24 * 60 * 60);
+            int64_t factoredTimeWeight = GetStakeTimeFactoredWeight(timeWeight, CoinDay, pindexPrev);
+            bnCoinDay += arith_uint256(nValueIn) * factoredTimeWeight / COIN / (24 * 60 * 60);
         }
         else
-            return error("%s() : tx missing in tx index in GetCoinAge()", __PRETTY_FUNCTION__);
+        {
+            bnCentSecond += arith_uint256(nValueIn) * timeWeight / CENT;
+        }
+
+        if (gArgs.GetBoolArg("-printcoinage", false))
+            LogPrintf("coin age nValueIn=%-12lld nTimeDiff=%d bnCentSecond=%s\n", nValueIn, timeWeight, bnCentSecond.ToString());
     }
 
     if ( pindexPrev->nHeight+1 <= Params().GetConsensus().PoSTHeight )
@@ -538,7 +549,7 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexCurrent, uint64_t &nStake
 
 
 // Get the stake modifier specified by the protocol to hash for a stake kernel
-static bool GetKernelStakeModifier(CBlockIndex* pindexPrev, uint256 hashBlockFrom, unsigned int nTimeTx, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake)
+bool GetKernelStakeModifier(CBlockIndex* pindexPrev, uint256 hashBlockFrom, unsigned int nTimeTx, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake)
 {
     const Consensus::Params& params = Params().GetConsensus();
     nStakeModifier = 0;
@@ -548,7 +559,42 @@ static bool GetKernelStakeModifier(CBlockIndex* pindexPrev, uint256 hashBlockFro
     nStakeModifierHeight = pindexFrom->nHeight;
     nStakeModifierTime = pindexFrom->GetBlockTime();
     int64_t nStakeModifierSelectionInterval = GetStakeModifierSelectionInterval();
-
+    int64_t nSelectionTime = pindexFrom->GetBlockTime() + nStakeModifierSelectionInterval;
+
+    // The walk below returns the first modifier-generating block after pindexFrom
+    // timed at or past nSelectionTime. When pindexFrom is on the active chain below
+    // the fork point, the walk follows the ancestors of pindexEnd, over which
+    // nStakeModifierTimeMax is non-decreasing; unless an earlier modifier is already
+    // past nSelectionTime, that block is found by a binary search instead.
+    const CBlockIndex* pindexEnd = ::ChainActive().Contains(pindexPrev) ? ::ChainActive().Tip() : pindexPrev;
+    if (::ChainActive().Contains(pindexFrom) && pindexEnd->GetAncestor(pindexFrom->nHeight) == pindexFrom &&
+        (int64_t)pindexFrom->nStakeModifierTimeMax < nSelectionTime)
+    {
+        if ((int64_t)pindexEnd->nStakeModifierTimeMax < nSelectionTime)
+        {   // reached best block; may happen if node is behind on block chain
+            if (fPrintProofOfStake || (pindexEnd->GetBlockTime() + params.nStakeMinAge - nStakeModifierSelectionInterval > GetAdjustedTime()))
+                return error("GetKernelStakeModifier() : reached best block %s at height %d from block %s",
+                    pindexEnd->GetBlockHash().ToString(), pindexEnd->nHeight, hashBlockFrom.ToString());
+            else
+                return false;
+        }
+        // the active chain is indexed by height; side chains go through the skip list
+        const bool fActive = pindexEnd == ::ChainActive().Tip();
+        auto ancestor = [&](int nHeight) { return fActive ? ::ChainActive()[nHeight] : pindexEnd->GetAncestor(nHeight); };
+        int nLow = pindexFrom->nHeight + 1, nHigh = pindexEnd->nHeight;
+        while (nLow < nHigh) {
+            int nMid = nLow + (nHigh - nLow) / 2;
+            if ((int64_t)ancestor(nMid)->nStakeModifierTimeMax >= nSelectionTime)
+                nHigh = nMid;
+            else
+                nLow = nMid + 1;
+        }
+        const CBlockIndex* pindex = ancestor(nLow);
+        nStakeModifierHeight = pindex->nHeight;
+        nStakeModifierTime = pindex->GetBlockTime();
+        nStakeModifier = pindex->nStakeModifier;
+        return true;
+    }
 
     // we need to iterate index forward but we cannot depend on chainActive.Next()
     // because there is no guarantee that we are checking blocks in active chain.
@@ -590,8 +636,81 @@ static bool GetKernelStakeModifier(CBlockIndex* pindexPrev, uint256 hashBlockFro
     return true;
 }
 
+const CBlockIndex* FindStakeKernelCoin(const CBlockIndex* pindexPrev, const COutPoint& prevout, Coin& coin)
+{
+    LOCK(cs_main);
+    const CBlockIndex* pindexTip = ::ChainActive().Tip();
+    CCoinsViewCache& coinsTip = ::ChainstateActive().CoinsTip();
+    if (!pindexTip || coinsTip.GetBestBlock() != pindexTip->GetBlockHash())
+        return nullptr;
+    const CBlockIndex* pindexFork = ::ChainActive().FindFork(pindexPrev);
+    if (!pindexFork)
+        return nullptr;
+    const Consensus::Params& params = Params().GetConsensus();
+
+    // An output of a block below the fork point is the same on both chains.
+    // One spent by the active chain above the fork point is in the undo data
+    // of the block spending it.
+    const bool fUnspent = coinsTip.GetCoin(prevout, coin);
+    if (fUnspent && coin.nHeight <= pindexFork->nHeight)
+        return ::ChainActive()[coin.nHeight];
+    for (const CBlockIndex* pindex = ::ChainActive().Next(pindexFork); pindex && !fUnspent; pindex = ::ChainActive().Next(pindex)) {
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex, params))
+            return nullptr;
+        for (size_t i = 1; i < block.vtx.size(); i++) {
+            for (size_t j = 0; j < block.vtx[i]->vin.size(); j++) {
+                if (block.vtx[i]->vin[j].prevout != prevout)
+                    continue;
+                CBlockUndo blockUndo;
+                if (!UndoReadFromDisk(blockUndo, pindex) || blockUndo.vtxundo.size() + 1 != block.vtx.size())
+                    return nullptr;
+                coin = blockUndo.vtxundo[i - 1].vprevout[j];
+                if (coin.IsSpent() || coin.nHeight == 0 || coin.nHeight > pindexFork->nHeight)
+                    return nullptr;
+                return ::ChainActive()[coin.nHeight];
+            }
+        }
+    }
+
+    // Otherwise it can only be an output of the fork's own blocks
+    for (const CBlockIndex* pindex = pindexPrev; pindex != pindexFork; pindex = pindex->pprev) {
+        CBlock block;
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA) || !ReadBlockFromDisk(block, pindex, params))
+            return nullptr;
+        unsigned int nTxOffset = GetSizeOfCompactSize(block.vtx.size());
+        for (const CTransactionRef& tx : block.vtx) {
+            if (tx->GetHash() == prevout.hash) {
+                if (prevout.n >= tx->vout.size())
+                    return nullptr;
+                coin = Coin(tx->vout[prevout.n], pindex->nHeight, tx->IsCoinBase(), tx->IsCoinStake(), tx->nTime, nTxOffset);
+                return pindex;
+            }
+            nTxOffset += ::GetSerializeSize(*tx, CLIENT_VERSION);
+        }
+    }
+    return nullptr;
+}
+
+// Read the header of the block at pos and the transaction nTxOffset bytes past it
+static bool ReadTxAfterHeader(const FlatFilePos& pos, unsigned int nTxOffset, CBlockHeader& header, CTransactionRef& tx)
+{
+    CAutoFile file(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull())
+        return false;
+    try {
+        file >> header;
+        if (fseek(file.Get(), nTxOffset, SEEK_CUR))
+            return false;
+        file >> tx;
+    } catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
+
 // Check kernel hash target and coinstake signature
-bool CheckProofOfStake(BlockValidationState &state, CBlockIndex* pindexPrev, const CTransactionRef& tx, unsigned int nBits, uint256& hashProofOfStake)
+bool CheckProofOfStake(BlockValidationState &state, CBlockIndex* pindexPrev, const CTransactionRef& tx, unsigned int nBits, uint256& hashProofOfStake, bool fCheckSignature)
 {
     if (!tx->IsCoinStake())
         return error("CheckProofOfStake() : called on non-coinstake %s", tx->GetHash().ToString());
@@ -599,42 +718,78 @@ bool CheckProofOfStake(BlockValidationState &state, CBlockIndex* pindexPrev, con
     // Kernel (input 0) must match the stake hash target per coin age (nBits)
     const CTxIn& txin = tx->vin[0];
 
-    // Transaction index is required to get to block header
-    if (!g_txindex)
-        return error("CheckProofOfStake() : transaction index not available");
-
-    // Get transaction index for the previous transaction
-    CDiskTxPos postx;
-    if (!g_txindex->FindTxPosition(txin.prevout.hash, postx))
-        return error("CheckProofOfStake() : tx index not found");  // tx index not found
+    // The kernel output is normally found on the chain of pindexPrev, with
+    // its value, script, time and offset; the block index then gives the
+    // block holding txPrev
+    Coin coin;
+    const CBlockIndex* pindexFrom = FindStakeKernelCoin(pindexPrev, txin.prevout, coin);
+
+    uint256 hashBlockFrom;
+    unsigned int nTimeBlockFrom;
+    unsigned int nTxPrevOffset = 0;
+    unsigned int nTimeTxPrev;
+    CTxOut prevOut;
+    if (pindexFrom && coin.nTxOffset) {
+        // The kernel hash commits to the offset, so the recorded one is only
+        // used once it is seen to point at txPrev
+        CBlockHeader header;
+        CTransactionRef txPrev;
+        if (ReadTxAfterHeader(pindexFrom->GetBlockPos(), coin.nTxOffset, header, txPrev) && txPrev->GetHash() == txin.prevout.hash)
+            nTxPrevOffset = coin.nTxOffset + CBlockHeader::NORMAL_SERIALIZE_SIZE;
+        else
+            LogPrintf("CheckProofOfStake() : recorded offset of %s does not match its block, locating it\n", txin.prevout.ToString());
+    }
+    if (pindexFrom && !nTxPrevOffset) {
+        // An output recorded without its offset is located in its block
+        CBlock blockFrom;
+        if (ReadBlockFromDisk(blockFrom, pindexFrom, Params().GetConsensus())) {
+            unsigned int nOffset = CBlockHeader::NORMAL_SERIALIZE_SIZE + GetSizeOfCompactSize(blockFrom.vtx.size());
+            for (const CTransactionRef& txFrom : blockFrom.vtx) {
+                if (txFrom->GetHash() == txin.prevout.hash) {
+                    nTxPrevOffset = nOffset;
+                    break;
+                }
+                nOffset += ::GetSerializeSize(*txFrom, CLIENT_VERSION);
+            }
+        }
+    }
+    if (nTxPrevOffset) {
+        hashBlockFrom = pindexFrom->GetBlockHash();
+        nTimeBlockFrom = pindexFrom->nTime;
+        nTimeTxPrev = coin.nTime;
+        prevOut = coin.out;
+    } else if (!g_txindex) {
+        return error("CheckProofOfStake() : kernel %s not found without the transaction index", txin.prevout.ToString());
+    } else {
+        // Get transaction index for the previous transaction
+        CDiskTxPos postx;
+        if (!g_txindex->FindTxPosition(txin.prevout.hash, postx))
+            return error("CheckProofOfStake() : tx index not found");  // tx index not found
+        nTxPrevOffset = postx.nTxOffset + CBlockHeader::NORMAL_SERIALIZE_SIZE;
 
-    // Read txPrev and header of its block
-    CBlockHeader header;
-    CTransactionRef txPrev;
-    {
-        CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-        try {
-            file >> header;
-            fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-            file >> txPrev;
-        } catch (std::exception &e) {
+        // Read txPrev and header of its block
+        CBlockHeader header;
+        CTransactionRef txPrev;
+        if (!ReadTxAfterHeader(postx, postx.nTxOffset, header, txPrev))
             return error("%s() : deserialize or I/O error in CheckProofOfStake()", __PRETTY_FUNCTION__);
-        }
         if (txPrev->GetHash() != txin.prevout.hash)
             return error("%s() : txid mismatch in CheckProofOfStake()", __PRETTY_FUNCTION__);
+        hashBlockFrom = header.GetHash();
+        nTimeBlockFrom = header.GetBlockTime();
+        nTimeTxPrev = txPrev->nTime;
+        prevOut = txPrev->vout[txin.prevout.n];
     }
 
-    // Verify signature
-    {
+    // Verify signature; ConnectBlock() leaves this to its script check queue
+    if (fCheckSignature) {
         int nIn = 0;
-        const CTxOut& prevOut = txPrev->vout[tx->vin[nIn].prevout.n];
         TransactionSignatureChecker checker(&(*tx), nIn, prevOut.nValue, PrecomputedTransactionData(*tx));
 
         if (!VerifyScript(tx->vin[nIn].scriptSig, prevOut.scriptPubKey, &(tx->vin[nIn].scriptWitness), SCRIPT_VERIFY_P2SH, checker, nullptr))
             return state.Invalid(BlockValidationResult::BLOCK_CONSENSUS, "invalid-pos-script", strprintf("%s: VerifyScript failed on coinstake %s", __func__, tx->GetHash().ToString()));
     }
 
-    if (!CheckStakeKernelHash(nBits, pindexPrev, header, postx.nTxOffset + CBlockHeader::NORMAL_SERIALIZE_SIZE, txPrev, txin.prevout, tx->nTime, hashProofOfStake, gArgs.GetBoolArg("-debug", false)))
+    if (!CheckStakeKernelHash(nBits, pindexPrev, hashBlockFrom, nTimeBlockFrom, nTxPrevOffset, nTimeTxPrev, prevOut.nValue, txin.prevout, tx->nTime, hashProofOfStake, gArgs.GetBoolArg("-debug", false)))
         return state.Invalid(BlockValidationResult::BLOCK_CONSENSUS, "check-kernel-failed", strprintf("CheckProofOfStake() : INFO: check kernel failed on coinstake %s, hashProof=%s", tx->GetHash().ToString(), hashProofOfStake.ToString())); // may occur during initial download or if behind on block chain sync
 
     return true;
@@ -668,22 +823,23 @@ bool CheckProofOfStake(BlockValidationState &state, CBlockIndex* pindexPrev, con
 //   a proof-of-work situation.
 //
 bool CheckStakeKernelHash(unsigned int nBits, CBlockIndex* pindexPrev, const CBlockHeader& blockFrom, unsigned int nTxPrevOffset, const CTransactionRef& txPrev, const COutPoint& prevout, unsigned int nTimeTx, uint256& hashProofOfStake, bool fPrintProofOfStake)
+{
+    return CheckStakeKernelHash(nBits, pindexPrev, blockFrom.GetHash(), blockFrom.GetBlockTime(), nTxPrevOffset, txPrev->nTime, txPrev->vout[prevout.n].nValue, prevout, nTimeTx, hashProofOfStake, fPrintProofOfStake);
+}
+
+bool CheckStakeKernelHash(unsigned int nBits, CBlockIndex* pindexPrev, const uint256& hashBlockFrom, unsigned int nTimeBlockFrom, unsigned int nTxPrevOffset, unsigned int nTimeTxPrev, CAmount nValueIn, const COutPoint& prevout, unsigned int nTimeTx, uint256& hashProofOfStake, bool fPrintProofOfStake)
 {
     const Consensus::Params& params = Params().GetConsensus();
-    if (nTimeTx < txPrev->nTime)  // Transaction timestamp violation
+    if (nTimeTx < nTimeTxPrev)  // Transaction timestamp violation
         return error("CheckStakeKernelHash() : nTime violation");
 
-    unsigned int nTimeBlockFrom = blockFrom.GetBlockTime();
     if (nTimeBlockFrom + params.nStakeMinAge > nTimeTx) // Min age requirement
         return error("CheckStakeKernelHash() : min age violation");
 
-    CBigNum bnTargetPerCoinDay;
-    bnTargetPerCoinDay.SetCompact(nBits);
-    int64_t nValueIn = txPrev->vout[prevout.n].nValue;
     // v0.3 protocol kernel hash weight starts from 0 at the 30-day min age
     // this change increases active coins participating the hash and helps
     // to secure the network when proof-of-stake difficulty is low
-    CBigNum bnCoinDayWeight = CBigNum(nValueIn) * GetWeight((int64_t)txPrev->nTime, (int64_t)nTimeTx, nValueIn, ChainActive().Tip()->pprev) / COIN / (24 * 60 * 60);
+    int64_t nTimeWeight = GetWeight((int64_t)nTimeTxPrev, (int64_t)nTimeTx, nValueIn, ChainActive().Tip()->pprev);
 
     // Calculate hash
     CDataStream ss(SER_GETHASH, 0);
@@ -691,31 +847,31 @@ bool CheckStakeKernelHash(unsigned int nBits, CBlockIndex* pindexPrev, const CBl
     int nStakeModifierHeight = 0;
     int64_t nStakeModifierTime = 0;
 
-    if (!GetKernelStakeModifier(pindexPrev, blockFrom.GetHash(), nTimeTx, nStakeModifier, nStakeModifierHeight, nStakeModifierTime, fPrintProofOfStake))
+    if (!GetKernelStakeModifier(pindexPrev, hashBlockFrom, nTimeTx, nStakeModifier, nStakeModifierHeight, nStakeModifierTime, fPrintProofOfStake))
         return false;
     ss << nStakeModifier;
 
-    ss << nTimeBlockFrom << nTxPrevOffset << txPrev->nTime << prevout.n << nTimeTx;
+    ss << nTimeBlockFrom << nTxPrevOffset << nTimeTxPrev << prevout.n << nTimeTx;
     hashProofOfStake = Hash(ss.begin(), ss.end());
 
     if (gArgs.GetBoolArg("-debug", false)) {
         LogPrintf(" CheckStakeKernelHash() : using modifier 0x%016x at height=%d timestamp=%s for block from height=%d timestamp=%s\n",
             nStakeModifier, nStakeModifierHeight,
             FormatISO8601DateTime(nStakeModifierTime),
-            ::BlockIndex()[blockFrom.GetHash()]->nHeight,
-            FormatISO8601DateTime(blockFrom.GetBlockTime()));
+            ::BlockIndex()[hashBlockFrom]->nHeight,
+            FormatISO8601DateTime(nTimeBlockFrom));
         LogPrintf("CheckStakeKernelHash() : check modifier=0x%016x nTimeBlockFrom=%u nTxPrevOffset=%u nTimeTxPrev=%u nPrevout=%u nTimeTx=%u hashProof=%s\n",
             nStakeModifier,
-            nTimeBlockFrom, nTxPrevOffset, txPrev->nTime, prevout.n, nTimeTx,
+            nTimeBlockFrom, nTxPrevOffset, nTimeTxPrev, prevout.n, nTimeTx,
             hashProofOfStake.ToString());
     }
 
     // Now check if proof-of-stake hash meets target protocol
-    if (CBigNum(hashProofOfStake) > bnCoinDayWeight * bnTargetPerCoinDay) {
+    if (!StakeKernelMeetsTarget(hashProofOfStake, nBits, nValueIn, nTimeWeight)) {
         if (gArgs.GetBoolArg("-debug", false)) {
-            LogPrintf("CheckStakeKernelHash() : not meeting network required bnCoinDayWeight=%s bnTargetPerCoinDay=%s, value=%s\n",
-                bnCoinDayWeight.GetHex(),
-                bnTargetPerCoinDay.GetHex(),
+            LogPrintf("CheckStakeKernelHash() : not meeting network required bnCoinDayWeight=%s nBits=%08x, value=%s\n",
+                GetCoinDayWeight(nValueIn, nTimeWeight).GetHex(),
+                nBits,
                 hashProofOfStake.GetHex()
             );
         }
@@ -728,6 +884,156 @@ bool CheckStakeKernelHash(unsigned int nBits, CBlockIndex* pindexPrev, const CBl
     return true;
 }
 
+arith_uint256 GetCoinDayWeight(int64_t nValueIn, int64_t nTimeWeight)
+{
+    const uint64_t nValueAbs = nValueIn < 0 ? -(uint64_t)nValueIn : nValueIn;
+    const uint64_t nTimeWeightAbs = nTimeWeight < 0 ? -(uint64_t)nTimeWeight : nTimeWeight;
+    // Both factors are below 2^64, so the product fits and the divisions truncate toward zero
+    arith_uint256 bnCoinDayWeight = arith_uint256(nValueAbs) * arith_uint256(nTimeWeightAbs);
+    bnCoinDayWeight /= arith_uint256((uint64_t)COIN);
+    bnCoinDayWeight /= arith_uint256((uint64_t)(24 * 60 * 60));
+    return bnCoinDayWeight;
+}
+
+bool StakeKernelMeetsTarget(const uint256& hashProofOfStake, unsigned int nBits, int64_t nValueIn, int64_t nTimeWeight)
+{
+    bool fNegative, fOverflow;
+    arith_uint256 bnTargetPerCoinDay;
+    bnTargetPerCoinDay.SetCompact(nBits, &fNegative, &fOverflow);
+    const arith_uint256 hash = UintToArith256(hashProofOfStake);
+
+    const bool fWeightNegative = (nValueIn < 0) != (nTimeWeight < 0);
+    const arith_uint256 bnCoinDayWeight = GetCoinDayWeight(nValueIn, nTimeWeight);
+
+    // A zero bound is only met by a zero hash; a negative one never is
+    if (bnCoinDayWeight == 0 || bnTargetPerCoinDay == 0)
+        return hash == 0;
+    if (fWeightNegative != fNegative)
+        return false;
+    if (fOverflow || bnTargetPerCoinDay > ~arith_uint256() / bnCoinDayWeight)
+        return true;
+    return hash <= bnCoinDayWeight * bnTargetPerCoinDay;
+}
+
+StakeKernelSearch::StakeKernelSearch(unsigned int nBitsIn, CBlockIndex* pindexPrevIn)
+    : nBits(nBitsIn), pindexPrev(pindexPrevIn), pindexWeight(::ChainActive().Tip()->pprev)
+{
+}
+
+bool StakeKernelSearch::AddCoin(const CBlockHeader& blockFrom, unsigned int nTxPrevOffset, const CTransactionRef& txPrev, const COutPoint& prevout)
+{
+    uint64_t nStakeModifier = 0;
+    int nStakeModifierHeight = 0;
+    int64_t nStakeModifierTime = 0;
+    if (!GetKernelStakeModifier(pindexPrev, blockFrom.GetHash(), txPrev->nTime, nStakeModifier, nStakeModifierHeight, nStakeModifierTime, false))
+        return false;
+
+    // The 28-byte kernel of CheckStakeKernelHash() with its SHA-256 padding;
+    // only nTimeTx at offset 24 changes between timestamps
+    Coin coin;
+    memset(coin.block, 0, sizeof(coin.block));
+    WriteLE64(coin.block, nStakeModifier);
+    WriteLE32(coin.block + 8, blockFrom.nTime);
+    WriteLE32(coin.block + 12, nTxPrevOffset);
+    WriteLE32(coin.block + 16, txPrev->nTime);
+    WriteLE32(coin.block + 20, prevout.n);
+    coin.block[28] = 0x80;
+    WriteBE64(coin.block + 56, 28 << 3);
+    coin.nTimeBlockFrom = blockFrom.nTime;
+    coin.nTimeTxPrev = txPrev->nTime;
+    coin.nValueIn = txPrev->vout[prevout.n].nValue;
+    vCoins.push_back(coin);
+    return true;
+}
+
+bool StakeKernelSearch::Find(unsigned int nTimeTx, unsigned int nInterval, size_t& nCoin, unsigned int& nTimeKernel, uint256& hashProofOfStake) const
+{
+    // Hash this many (coin, timestamp) pairs per SHA256D1() call
+    static const size_t KERNEL_BATCH_SIZE = 256;
+
+    const Consensus::Params& params = Params().GetConsensus();
+    std::vector<unsigned char> vBlocks;
+    std::vector<unsigned char> vHashes;
+    std::vector<std::pair<size_t, unsigned int> > vPairs;
+    vBlocks.reserve((KERNEL_BATCH_SIZE + nInterval) * 64);
+    vPairs.reserve(KERNEL_BATCH_SIZE + nInterval);
+
+    for (size_t i = 0; i < vCoins.size(); i++) {
+        const Coin& coin = vCoins[i];
+        for (unsigned int n = 0; n < nInterval && n <= nTimeTx; n++) {
+            unsigned int nTime = nTimeTx - n;
+            if (nTime < coin.nTimeTxPrev || coin.nTimeBlockFrom + params.nStakeMinAge > nTime)
+                continue;
+            vBlocks.insert(vBlocks.end(), coin.block, coin.block + 64);
+            WriteLE32(&vBlocks[vBlocks.size() - 64 + 24], nTime);
+            vPairs.emplace_back(i, nTime);
+        }
+        if (vPairs.size() < KERNEL_BATCH_SIZE && i + 1 < vCoins.size())
+            continue;
+
+        vHashes.resize(vPairs.size() * 32);
+        SHA256D1(vHashes.data(), vBlocks.data(), vPairs.size());
+        for (size_t k = 0; k < vPairs.size(); k++) {
+            const Coin& candidate = vCoins[vPairs[k].first];
+            uint256 hash;
+            memcpy(hash.begin(), &vHashes[k * 32], 32);
+            int64_t nTimeWeight = GetWeight((int64_t)candidate.nTimeTxPrev, (int64_t)vPairs[k].second, candidate.nValueIn, pindexWeight);
+            if (StakeKernelMeetsTarget(hash, nBits, candidate.nValueIn, nTimeWeight)) {
+                nCoin = vPairs[k].first;
+                nTimeKernel = vPairs[k].second;
+                hashProofOfStake = hash;
+                if (gArgs.GetBoolArg("-debug", false))
+                    LogPrintf("StakeKernelSearch::Find() : kernel found for coin %u at nTimeTx=%u hashProof=%s\n", nCoin, nTimeKernel, hash.ToString());
+                return true;
+            }
+        }
+        vBlocks.clear();
+        vPairs.clear();
+    }
+    return false;
+}
+
+StakeSeenSet::StakeSeenSet(size_t nMaxSizeIn) : nMaxSize(nMaxSizeIn)
+{
+}
+
+bool StakeSeenSet::Insert(const std::pair<COutPoint, unsigned int>& stake, const uint256& hashBlock)
+{
+    LOCK(m_mutex);
+    if (!mapStakes.emplace(stake, hashBlock).second)
+        return false;
+    dequeStakes.push_back(stake);
+    while (dequeStakes.size() > nMaxSize) {
+        mapStakes.erase(dequeStakes.front());
+        dequeStakes.pop_front();
+    }
+    return true;
+}
+
+bool StakeSeenSet::IsDuplicate(const std::pair<COutPoint, unsigned int>& stake, const uint256& hashBlock, uint256* phashFirst) const
+{
+    LOCK(m_mutex);
+    const auto it = mapStakes.find(stake);
+    if (it == mapStakes.end() || it->second == hashBlock)
+        return false;
+    if (phashFirst)
+        *phashFirst = it->second;
+    return true;
+}
+
+void StakeSeenSet::Clear()
+{
+    LOCK(m_mutex);
+    mapStakes.clear();
+    dequeStakes.clear();
+}
+
+size_t StakeSeenSet::size() const
+{
+    LOCK(m_mutex);
+    return mapStakes.size();
+}
+
 // Get stake modifier checksum
 unsigned int GetStakeModifierChecksum(const CBlockIndex* pindex)
 {
@@ -7,12 +7,18 @@
 #define BITCOIN_POS_H
 
 #include <amount.h>
+#include <arith_uint256.h>
 #include <consensus/params.h>
 #include <primitives/transaction.h>
+#include <sync.h>
+#include <uint256.h>
 #include <wallet/wallet.h>
 
 #include <algorithm>
+#include <deque>
 #include <list>
+#include <map>
+#include <vector>
 #include <stdint.h>
 
 // those are proofOfStake block before the only PoS implementation
@@ -9486,6 +9492,7 @@ class CBlock;
 class CWallet;
 class CTransaction;
 class CCoinsViewCache;
+class Coin;
 class uint256;
 class BlockValidationState;
 
@@ -9513,13 +9520,102 @@ static const int MODIFIER_INTERVAL_RATIO = 3;
 // Compute the hash modifier for proof-of-stake
 bool ComputeNextStakeModifier(const CBlockIndex* pindexCurrent, uint64_t& nStakeModifier, bool& fGeneratedStakeModifier);
 
+// Get the stake modifier specified by the protocol to hash for a stake kernel
+// whose coin is in block hashBlockFrom, on top of pindexPrev
+bool GetKernelStakeModifier(CBlockIndex* pindexPrev, uint256 hashBlockFrom, unsigned int nTimeTx, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake);
+
 // Check whether stake kernel meets hash target
 // Sets hashProofOfStake on success return
 bool CheckStakeKernelHash(unsigned int nBits, CBlockIndex* pindexPrev, const CBlockHeader& blockFrom, unsigned int nTxPrevOffset, const CTransactionRef& txPrev, const COutPoint& prevout, unsigned int nTimeTx, uint256& hashProofOfStake, bool fPrintProofOfStake=false);
+// Same, given the fields of txPrev and its block the kernel is made of
+bool CheckStakeKernelHash(unsigned int nBits, CBlockIndex* pindexPrev, const uint256& hashBlockFrom, unsigned int nTimeBlockFrom, unsigned int nTxPrevOffset, unsigned int nTimeTxPrev, CAmount nValueIn, const COutPoint& prevout, unsigned int nTimeTx, uint256& hashProofOfStake, bool fPrintProofOfStake=false);
+
+// Coin-day weight |nValueIn * nTimeWeight| / COIN / (24 * 60 * 60), computed
+// without overflow and truncated like the BIGNUM division it replaces
+arith_uint256 GetCoinDayWeight(int64_t nValueIn, int64_t nTimeWeight);
+
+// Check whether a kernel hash meets nBits for a coin of nValueIn weighted by
+// nTimeWeight (see GetWeight), using 256-bit integer math; the product of the
+// coin-day weight and the target saturates instead of wrapping
+bool StakeKernelMeetsTarget(const uint256& hashProofOfStake, unsigned int nBits, int64_t nValueIn, int64_t nTimeWeight);
+
+// Search stake kernels for many coins over a window of timestamps.
+// The stake modifier of each coin is resolved once and the constant part of
+// its kernel is laid out once as a padded SHA-256 block, so every
+// (coin, timestamp) pair costs one batched double-SHA256 and a 256-bit
+// comparison instead of a full CheckStakeKernelHash() call.
+// The constructor and AddCoin() require cs_main; Find() does not.
+class StakeKernelSearch
+{
+public:
+    StakeKernelSearch(unsigned int nBits, CBlockIndex* pindexPrev);
+
+    // Add a coin; returns false if its stake modifier cannot be resolved yet
+    bool AddCoin(const CBlockHeader& blockFrom, unsigned int nTxPrevOffset, const CTransactionRef& txPrev, const COutPoint& prevout);
+
+    // Find the first coin, in AddCoin() order, with a kernel at one of the
+    // nInterval timestamps counting down from nTimeTx. Per coin, later
+    // timestamps are tried first, the same order as CheckStakeKernelHash()
+    // calls in a loop would take. Only what the constructor and AddCoin()
+    // captured is read, so unlike them this does not need cs_main.
+    bool Find(unsigned int nTimeTx, unsigned int nInterval, size_t& nCoin, unsigned int& nTimeKernel, uint256& hashProofOfStake) const;
+
+    size_t size() const { return vCoins.size(); }
+
+private:
+    struct Coin
+    {
+        unsigned char block[64];
+        unsigned int nTimeBlockFrom;
+        unsigned int nTimeTxPrev;
+        int64_t nValueIn;
+    };
+
+    unsigned int nBits;
+    CBlockIndex* pindexPrev;
+    CBlockIndex* pindexWeight;
+    std::vector<Coin> vCoins;
+};
+
+// Number of recent stakes remembered to detect duplicate-stake blocks
+static const size_t MAX_STAKE_SEEN = 20000;
+
+// ppcoin: stakes (prevoutStake, nStakeTime) of recently accepted PoS blocks,
+// each with the hash of the block that used it. A second block with the same
+// stake is a duplicate, whose peer is penalized. The oldest stakes are
+// forgotten beyond nMaxSize. Thread-safe.
+class StakeSeenSet
+{
+public:
+    explicit StakeSeenSet(size_t nMaxSize);
+
+    // Record the stake of an accepted block; returns false if already known
+    bool Insert(const std::pair<COutPoint, unsigned int>& stake, const uint256& hashBlock);
+
+    // Whether the stake was used by a block other than hashBlock, whose hash
+    // is then set in phashFirst if given
+    bool IsDuplicate(const std::pair<COutPoint, unsigned int>& stake, const uint256& hashBlock, uint256* phashFirst = nullptr) const;
+
+    void Clear();
+    size_t size() const;
+
+private:
+    const size_t nMaxSize;
+    mutable Mutex m_mutex;
+    std::map<std::pair<COutPoint, unsigned int>, uint256> mapStakes GUARDED_BY(m_mutex);
+    std::deque<std::pair<COutPoint, unsigned int>> dequeStakes GUARDED_BY(m_mutex);
+};
+
+// Find the kernel output of a coinstake on top of pindexPrev as the chain
+// of pindexPrev has it: in the UTXO set of the active chain, in the undo data
+// of the active blocks above the fork point, or in the blocks of the fork
+// itself. Returns the block of the output, or nullptr.
+const CBlockIndex* FindStakeKernelCoin(const CBlockIndex* pindexPrev, const COutPoint& prevout, Coin& coin);
 
 // Check kernel hash target and coinstake signature
-// Sets hashProofOfStake on success return
-bool CheckProofOfStake(BlockValidationState &state, CBlockIndex* pindexPrev, const CTransactionRef &tx, unsigned int nBits, uint256& hashProofOfStake);
+// Sets hashProofOfStake on success return. Without fCheckSignature the
+// kernel input script is left to the caller's script checks.
+bool CheckProofOfStake(BlockValidationState &state, CBlockIndex* pindexPrev, const CTransactionRef &tx, unsigned int nBits, uint256& hashProofOfStake, bool fCheckSignature = true);
 
 // Check whether the coinstake timestamp meets protocol
 bool CheckCoinStakeTimestamp(int64_t nTimeBlock, int64_t nTimeTx);
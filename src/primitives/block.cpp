@@ -10,6 +10,30 @@
 #include <hash.h>
 #include <tinyformat.h>
 
+#include <atomic>
+#include <string.h>
+#include <vector>
+
+static std::atomic<uint64_t> nWorkHashesComputed{0};
+
+CBlockHeader::CBlockHeader(const CBlockHeader& other)
+{
+    *this = other;
+}
+
+CBlockHeader& CBlockHeader::operator=(const CBlockHeader& other)
+{
+    nVersion = other.nVersion;
+    hashPrevBlock = other.hashPrevBlock;
+    hashMerkleRoot = other.hashMerkleRoot;
+    nTime = other.nTime;
+    nBits = other.nBits;
+    nNonce = other.nNonce;
+    nFlags = other.nFlags;
+    std::atomic_store(&m_work_hash_cache, std::atomic_load(&other.m_work_hash_cache));
+    return *this;
+}
+
 uint256 CBlockHeader::GetHash() const
 {
     if(IsVericoin)
@@ -26,9 +50,45 @@ uint256 CBlockHeader::GetVeriumHash() const
 
 uint256 CBlockHeader::GetWorkHash() const
 {
-    uint256 thash;
-    scryptHash(BEGIN(nVersion), BEGIN(thash));
-    return thash;
+    // The 80 hashed bytes are the contiguous fields nVersion..nNonce. Blocks
+    // are shared between threads, hence the atomic cache swap.
+    std::shared_ptr<const WorkHashCache> cache = std::atomic_load(&m_work_hash_cache);
+    if (cache && memcmp(cache->header, BEGIN(nVersion), sizeof(cache->header)) == 0)
+        return cache->hash;
+
+    auto new_cache = std::make_shared<WorkHashCache>();
+    memcpy(new_cache->header, BEGIN(nVersion), sizeof(new_cache->header));
+    scryptHash(new_cache->header, BEGIN(new_cache->hash));
+    ++nWorkHashesComputed;
+
+    uint256 hash = new_cache->hash;
+    std::atomic_store(&m_work_hash_cache, std::shared_ptr<const WorkHashCache>(std::move(new_cache)));
+    return hash;
+}
+
+void CBlockHeader::MemoizeWorkHashes(const CBlockHeader* headers, size_t count)
+{
+    if (count == 0)
+        return;
+
+    std::vector<unsigned char> input(count * NORMAL_SERIALIZE_SIZE);
+    std::vector<uint256> hashes(count);
+    for (size_t i = 0; i < count; i++)
+        memcpy(&input[i * NORMAL_SERIALIZE_SIZE], BEGIN(headers[i].nVersion), NORMAL_SERIALIZE_SIZE);
+    scryptHashBatch(input.data(), BEGIN(hashes[0]), count);
+    nWorkHashesComputed += count;
+
+    for (size_t i = 0; i < count; i++) {
+        auto cache = std::make_shared<WorkHashCache>();
+        memcpy(cache->header, &input[i * NORMAL_SERIALIZE_SIZE], sizeof(cache->header));
+        cache->hash = hashes[i];
+        std::atomic_store(&headers[i].m_work_hash_cache, std::shared_ptr<const WorkHashCache>(std::move(cache)));
+    }
+}
+
+uint64_t GetWorkHashCount()
+{
+    return nWorkHashesComputed;
 }
 
 std::string CBlock::ToString() const
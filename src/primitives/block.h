@@ -11,6 +11,8 @@
 #include <serialize.h>
 #include <uint256.h>
 
+#include <memory>
+
 /** Nodes collect new transactions into a block, hash them into a hash tree,
  * and scan through nonce values to make the block's hash satisfy proof-of-work
  * requirements.  When they solve the proof-of-work, they broadcast the block
@@ -20,6 +22,15 @@
  */
 class CBlockHeader
 {
+private:
+    /** Memoized scrypt hash, valid only while the 80 hashed header bytes match. */
+    struct WorkHashCache
+    {
+        unsigned char header[80];
+        uint256 hash;
+    };
+    mutable std::shared_ptr<const WorkHashCache> m_work_hash_cache;
+
 public:
     // header
     int32_t nVersion;
@@ -40,6 +51,10 @@ public:
         SetNull();
     }
 
+    // The memoized work hash is swapped atomically, so copies load it likewise
+    CBlockHeader(const CBlockHeader& other);
+    CBlockHeader& operator=(const CBlockHeader& other);
+
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
@@ -65,6 +80,7 @@ public:
         nBits = 0;
         nNonce = 0;
         nFlags = 0;
+        m_work_hash_cache.reset();
     }
 
     bool IsNull() const
@@ -74,7 +90,10 @@ public:
 
     uint256 GetHash() const;
     uint256 GetVeriumHash() const;
+    /** scrypt hash of the header. Memoized, so repeated calls on an unmodified header are cheap. */
     uint256 GetWorkHash() const;
+    /** Compute and memoize the work hashes of `count` consecutive headers with the multi-way scrypt kernels. */
+    static void MemoizeWorkHashes(const CBlockHeader* headers, size_t count);
 
     int64_t GetBlockTime() const
     {
@@ -128,15 +147,8 @@ public:
 
     CBlockHeader GetBlockHeader() const
     {
-        CBlockHeader block;
-        block.nVersion       = nVersion;
-        block.hashPrevBlock  = hashPrevBlock;
-        block.hashMerkleRoot = hashMerkleRoot;
-        block.nTime          = nTime;
-        block.nBits          = nBits;
-        block.nNonce         = nNonce;
-        block.nFlags         = nFlags;
-        return block;
+        // Slicing copy, so the header keeps any memoized work hash
+        return *static_cast<const CBlockHeader*>(this);
     }
 
     // ppcoin: two types of block: proof-of-work or proof-of-stake
@@ -172,6 +184,9 @@ public:
     std::string ToString() const;
 };
 
+/** Number of scrypt header hashes actually computed (memoization misses) since startup */
+uint64_t GetWorkHashCount();
+
 /** Describes a place in the block chain to another node such that if the
  * other node doesn't have the same branch, it can find a recent common trunk.
  * The further back it is, the further before the fork it may be.
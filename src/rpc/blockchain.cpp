@@ -1052,7 +1052,8 @@ static UniValue gettxoutsetinfo(const JSONRPCRequest& request)
                         {RPCResult::Type::NUM, "transactions", "The number of transactions with unspent outputs"},
                         {RPCResult::Type::NUM, "txouts", "The number of unspent transaction outputs"},
                         {RPCResult::Type::NUM, "bogosize", "A meaningless metric for UTXO set size"},
-                        {RPCResult::Type::STR_HEX, "hash_serialized_2", "The serialized hash"},
+                        {RPCResult::Type::STR_HEX, "hash_serialized_2", "The serialized hash, as earlier versions computed it without the coinstake flag and time of coins"},
+                        {RPCResult::Type::STR_HEX, "hash_serialized_3", "The serialized hash"},
                         {RPCResult::Type::NUM, "disk_size", "The estimated size of the chainstate on disk"},
                         {RPCResult::Type::STR_AMOUNT, "total_amount", "The total amount"},
                     }},
@@ -1074,7 +1075,8 @@ static UniValue gettxoutsetinfo(const JSONRPCRequest& request)
         ret.pushKV("transactions", (int64_t)stats.nTransactions);
         ret.pushKV("txouts", (int64_t)stats.nTransactionOutputs);
         ret.pushKV("bogosize", (int64_t)stats.nBogoSize);
-        ret.pushKV("hash_serialized_2", stats.hashSerialized.GetHex());
+        ret.pushKV("hash_serialized_2", stats.hashSerialized2.GetHex());
+        ret.pushKV("hash_serialized_3", stats.hashSerialized.GetHex());
         ret.pushKV("disk_size", stats.nDiskSize);
         ret.pushKV("total_amount", ValueFromAmount(stats.nTotalAmount));
     } else {
@@ -2153,6 +2155,9 @@ UniValue dumptxoutset(const JSONRPCRequest& request)
                     {RPCResult::Type::STR_HEX, "base_hash", "the hash of the base of the snapshot"},
                     {RPCResult::Type::NUM, "base_height", "the height of the base of the snapshot"},
                     {RPCResult::Type::STR, "path", "the absolute path that the snapshot was written to"},
+                    {RPCResult::Type::STR_HEX, "txoutset_hash", "the hash of the UTXO set contents, as hash_serialized_3 of gettxoutsetinfo"},
+                    {RPCResult::Type::NUM, "nchaintx", "the number of transactions in the chain up to and including the base block"},
+                    {RPCResult::Type::STR_AMOUNT, "money_supply", "the money supply at the base block"},
                 }
         },
         RPCExamples{
@@ -2233,6 +2238,77 @@ UniValue dumptxoutset(const JSONRPCRequest& request)
     result.pushKV("base_hash", tip->GetBlockHash().ToString());
     result.pushKV("base_height", tip->nHeight);
     result.pushKV("path", path.string());
+    result.pushKV("txoutset_hash", stats.hashSerialized.ToString());
+    // Together with the base height, what chain params need to accept the snapshot
+    result.pushKV("nchaintx", uint64_t{tip->nChainTx});
+    result.pushKV("money_supply", ValueFromAmount(tip->nMoneySupply));
+    return result;
+}
+
+/**
+ * Load a UTXO set snapshot written by dumptxoutset and sync on from its base.
+ *
+ * @see CChainState::LoadSnapshot
+ */
+UniValue loadtxoutset(const JSONRPCRequest& request)
+{
+    RPCHelpMan{
+        "loadtxoutset",
+        "\nLoad a serialized UTXO set from disk, replacing the UTXO set of a node that is still syncing\n"
+        "below the base of the snapshot. The snapshot must match one compiled into the node, and the\n"
+        "headers up to its base must be known. The blocks below the base are never downloaded, so the\n"
+        "node stops offering to serve blocks, and no index may be enabled (-txindex is on by default,\n"
+        "the -loadtxoutset startup option turns it off).\n"
+        "Not available on Vericoin. No snapshot is compiled into the release chains yet, so for now\n"
+        "this is only of use for testing.\n",
+        {
+            {"path",
+                RPCArg::Type::STR,
+                RPCArg::Optional::NO,
+                /* default_val */ "",
+                "path to the snapshot file. If relative, will be prefixed by datadir."},
+        },
+        RPCResult{
+            RPCResult::Type::OBJ, "", "",
+                {
+                    {RPCResult::Type::NUM, "coins_loaded", "the number of coins loaded from the snapshot"},
+                    {RPCResult::Type::STR_HEX, "base_hash", "the hash of the base of the snapshot"},
+                    {RPCResult::Type::NUM, "base_height", "the height of the base of the snapshot"},
+                    {RPCResult::Type::STR, "path", "the absolute path that the snapshot was loaded from"},
+                }
+        },
+        RPCExamples{
+            HelpExampleCli("loadtxoutset", "utxo.dat")
+        }
+    }.Check(request);
+
+    fs::path path = fs::absolute(request.params[0].get_str(), GetDataDir());
+
+    CAutoFile afile{fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION};
+    if (afile.IsNull()) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Couldn't open file " + path.string() + " for reading.");
+    }
+
+    SnapshotMetadata metadata;
+    try {
+        afile >> metadata;
+    } catch (const std::exception& e) {
+        throw JSONRPCError(RPC_DESERIALIZATION_ERROR, strprintf("Unable to read snapshot metadata: %s", e.what()));
+    }
+
+    std::string error;
+    if (!LoadTxOutSet(afile, metadata, Params(), error)) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to load UTXO set snapshot: " + error);
+    }
+    if (g_rpc_node && g_rpc_node->connman) {
+        g_rpc_node->connman->RemoveLocalServices(NODE_NETWORK);
+    }
+
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("coins_loaded", metadata.m_coins_count);
+    result.pushKV("base_hash", metadata.m_base_blockhash.ToString());
+    result.pushKV("base_height", WITH_LOCK(cs_main, return LookupBlockIndex(metadata.m_base_blockhash)->nHeight));
+    result.pushKV("path", path.string());
     return result;
 }
 
@@ -2277,6 +2353,7 @@ static const CRPCCommand commands[] =
     { "hidden",             "waitforblockheight",     &waitforblockheight,     {"height","timeout"} },
     { "hidden",             "syncwithvalidationinterfacequeue", &syncwithvalidationinterfacequeue, {} },
     { "hidden",             "dumptxoutset",           &dumptxoutset,           {"path"} },
+    { "hidden",             "loadtxoutset",           &loadtxoutset,           {"path"} },
 };
 // clang-format on
 
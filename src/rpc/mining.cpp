@@ -4,7 +4,6 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <amount.h>
-#include <bignum.h>
 #include <chain.h>
 #include <chainparams.h>
 #include <consensus/consensus.h>
@@ -12,6 +11,7 @@
 #include <consensus/params.h>
 #include <consensus/validation.h>
 #include <core_io.h>
+#include <crypto/common.h>
 #include <key_io.h>
 #include <miner.h>
 #include <net.h>
@@ -25,6 +25,7 @@
 #include <script/script.h>
 #include <script/signingprovider.h>
 #include <shutdown.h>
+#include <streams.h>
 #include <txmempool.h>
 #include <univalue.h>
 #include <util/strencodings.h>
@@ -35,12 +36,11 @@
 #include <warnings.h>
 #include <wallet/rpcwallet.h> // Probably need to avoid that ...
 
+#include <deque>
+#include <map>
 #include <memory>
 #include <stdint.h>
 
-static CTxDestination dest;
-static bool setDest = false;
-
 double getPoWKHashPM()
 {
     return GetPoWKHashPM(Params());
@@ -793,6 +793,15 @@ UniValue minerstatus(const JSONRPCRequest& request)
             RPCResult::Type::OBJ, "", "",
             {
                 {RPCResult::Type::STR, "status", "Mining status (active/stopped)"},
+                {RPCResult::Type::NUM, "hashrate", "Total hashrate of the miner threads in H/m, over the last minute"},
+                {RPCResult::Type::ARR, "threads", "",
+                {
+                    {RPCResult::Type::OBJ, "", "",
+                    {
+                        {RPCResult::Type::NUM, "thread", "Miner thread id"},
+                        {RPCResult::Type::NUM, "hashrate", "Hashrate of this thread in H/m, over the last minute"},
+                    }},
+                }},
             }
         },
         RPCExamples{
@@ -807,6 +816,19 @@ UniValue minerstatus(const JSONRPCRequest& request)
     UniValue obj(UniValue::VOBJ);
     obj.pushKV("status",   ( IsMining() ? "active" : "stopped"));
 
+    const std::vector<double> rates = GetThreadHashRates();
+    double total = 0.0;
+    UniValue threads(UniValue::VARR);
+    for (size_t i = 0; i < rates.size(); i++) {
+        UniValue thread(UniValue::VOBJ);
+        thread.pushKV("thread", (uint64_t)i);
+        thread.pushKV("hashrate", rates[i]);
+        threads.push_back(thread);
+        total += rates[i];
+    }
+    obj.pushKV("hashrate", total);
+    obj.pushKV("threads", threads);
+
     return obj;
 }
 
@@ -897,6 +919,119 @@ UniValue minerstop(const JSONRPCRequest& request)
     return obj;
 }
 
+/** Number of getwork entries kept to match solutions back to their block */
+static const size_t MAX_GETWORK_ENTRIES = 4096;
+
+/**
+ * Work handed out by getwork. The template and the merkle branch of its
+ * coinbase are built once per tip and mempool epoch, so a request only hashes
+ * a coinbase with a fresh extranonce up that branch. Entries are kept by
+ * merkle root to match solutions back to their block, the oldest being
+ * evicted past MAX_GETWORK_ENTRIES. cs_main is only taken to build templates.
+ */
+class GetWorkCache
+{
+public:
+    CBlockHeader NewWork(const CTxMemPool& mempool, CWallet* pwallet)
+    {
+        LOCK(m_mutex);
+        if (m_script_pubkey.empty())
+        {
+            OutputType output_type = pwallet->m_default_change_type != OutputType::CHANGE_AUTO ? pwallet->m_default_change_type : pwallet->m_default_address_type;
+            ReserveDestination reservedest(pwallet, output_type);
+            CTxDestination dest;
+            if (!reservedest.GetReservedDestination(dest, true))
+                throw JSONRPCError(RPC_WALLET_KEYPOOL_RAN_OUT, "Error: Keypool ran out, please call keypoolrefill first");
+            reservedest.KeepDestination();
+            m_script_pubkey = GetScriptForDestination(dest);
+        }
+
+        // Only decides whether to rebuild; the template records its own parent
+        const CBlockIndex* pindexTip = WITH_LOCK(cs_main, return ::ChainActive().Tip());
+        const unsigned int nTransactionsUpdated = mempool.GetTransactionsUpdated();
+        if (!m_template || m_tip != pindexTip ||
+            (nTransactionsUpdated != m_transactions_updated && GetTime() - m_created > 60))
+        {
+            if (m_tip != pindexTip)
+            {
+                // Solutions for the old tip would be stale anyway
+                m_work.clear();
+                m_work_order.clear();
+                m_extra_nonce = 0;
+            }
+            m_template.reset();
+            std::unique_ptr<CBlockTemplate> pblocktemplate = BlockAssembler(mempool, Params()).CreateNewBlock(m_script_pubkey, false, pwallet);
+            if (!pblocktemplate)
+                throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
+
+            // The tip may have moved on since, so the coinbase height follows
+            // the block the template actually builds on
+            const CBlockIndex* pindexPrev = WITH_LOCK(cs_main, return LookupBlockIndex(pblocktemplate->block.hashPrevBlock));
+            CHECK_NONFATAL(pindexPrev);
+
+            m_template = std::move(pblocktemplate);
+            m_merkle_branch = BlockCoinbaseMerkleBranch(m_template->block);
+            m_tip = pindexPrev;
+            m_transactions_updated = nTransactionsUpdated;
+            m_created = GetTime();
+        }
+
+        CMutableTransaction txCoinbase(*m_template->block.vtx[0]);
+        txCoinbase.vin[0].scriptSig = (CScript() << (m_tip->nHeight + 1) << CScriptNum(++m_extra_nonce)) + COINBASE_FLAGS;
+        CHECK_NONFATAL(txCoinbase.vin[0].scriptSig.size() <= 100);
+        CTransactionRef coinbase = MakeTransactionRef(std::move(txCoinbase));
+
+        CBlockHeader header = m_template->block.GetBlockHeader();
+        header.hashMerkleRoot = ComputeCoinbaseMerkleRoot(coinbase->GetHash(), m_merkle_branch);
+        UpdateTime(&header);
+        header.nNonce = 0;
+
+        if (m_work.emplace(header.hashMerkleRoot, WorkEntry{m_template, coinbase}).second)
+            m_work_order.push_back(header.hashMerkleRoot);
+        while (m_work_order.size() > MAX_GETWORK_ENTRIES)
+        {
+            m_work.erase(m_work_order.front());
+            m_work_order.pop_front();
+        }
+        return header;
+    }
+
+    /** Full block for a solved header, or nullptr if its merkle root was not handed out */
+    std::unique_ptr<CBlock> GetBlock(const CBlockHeader& solved)
+    {
+        LOCK(m_mutex);
+        auto it = m_work.find(solved.hashMerkleRoot);
+        if (it == m_work.end())
+            return nullptr;
+
+        std::unique_ptr<CBlock> pblock(new CBlock(it->second.tmpl->block));
+        pblock->vtx[0] = it->second.coinbase;
+        pblock->hashMerkleRoot = solved.hashMerkleRoot;
+        pblock->nTime = solved.nTime;
+        pblock->nNonce = solved.nNonce;
+        return pblock;
+    }
+
+private:
+    struct WorkEntry {
+        std::shared_ptr<const CBlockTemplate> tmpl;
+        CTransactionRef coinbase;
+    };
+
+    Mutex m_mutex;
+    CScript m_script_pubkey GUARDED_BY(m_mutex);
+    std::shared_ptr<const CBlockTemplate> m_template GUARDED_BY(m_mutex);
+    std::vector<uint256> m_merkle_branch GUARDED_BY(m_mutex);
+    const CBlockIndex* m_tip GUARDED_BY(m_mutex) = nullptr;
+    unsigned int m_transactions_updated GUARDED_BY(m_mutex) = 0;
+    int64_t m_created GUARDED_BY(m_mutex) = 0;
+    unsigned int m_extra_nonce GUARDED_BY(m_mutex) = 0;
+    std::map<uint256, WorkEntry> m_work GUARDED_BY(m_mutex);
+    std::deque<uint256> m_work_order GUARDED_BY(m_mutex);
+};
+
+static GetWorkCache g_getwork_cache;
+
 UniValue getwork(const JSONRPCRequest& request)
 {
     RPCHelpMan{"getwork",
@@ -917,8 +1052,6 @@ UniValue getwork(const JSONRPCRequest& request)
     if( Params().IsVericoin())
         throw JSONRPCError(RPC_INVALID_REQUEST, "Action impossible on Vericoin");
 
-    LOCK(cs_main);
-
     if(!g_rpc_node->connman)
         throw JSONRPCError(RPC_CLIENT_P2P_DISABLED, "Error: Peer-to-peer functionality missing or disabled");
 
@@ -930,75 +1063,19 @@ UniValue getwork(const JSONRPCRequest& request)
 
     CWallet* const pwallet = wallet.get();
 
-    typedef std::map<uint256, std::pair<CBlock*, CScript> > mapNewBlock_t;
-    static mapNewBlock_t mapNewBlock;
-
     // To CODE
     if (request.params[0].isNull())
     {
-        if( ! setDest )
-        {
-            OutputType output_type = pwallet->m_default_change_type != OutputType::CHANGE_AUTO ? pwallet->m_default_change_type : pwallet->m_default_address_type;
-            ReserveDestination reservedest(pwallet, output_type);
-            reservedest.GetReservedDestination(dest, true);
-            setDest = true;
-        }
-
-        static unsigned int nTransactionsUpdatedLast = 0;
         const CTxMemPool& mempool = EnsureMemPool();
-
-        g_rpc_node->connman->interruptNet.sleep_for(std::chrono::milliseconds(500));
-
-        // Update block
-        static CBlockIndex* pindexPrev;
-        static int64_t nStart;
-        static std::unique_ptr<CBlockTemplate> pblocktemplate;
-
-        if (pindexPrev != ::ChainActive().Tip() ||
-            (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 60))
-        {
-            // Clear pindexPrev so future calls make a new block, despite any failures from here on
-            pindexPrev = nullptr;
-
-            // Store the pindexBest used before CreateNewBlock, to avoid races
-            nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
-            CBlockIndex* pindexPrevNew = ::ChainActive().Tip();
-            nStart = GetTime();
-
-            CScript scriptPubKey = GetScriptForDestination(dest);
-
-            // Create new block
-            pblocktemplate = BlockAssembler(mempool, Params()).CreateNewBlock(scriptPubKey, false, pwallet);
-            if (!pblocktemplate)
-                throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
-
-            // Need to update only after we know CreateNewBlock succeeded
-            pindexPrev = pindexPrevNew;
-        }
-        CHECK_NONFATAL(pindexPrev);
-        CBlock* pblock = &pblocktemplate->block; // pointer for convenience
-
-        // Update nTime
-        UpdateTime(pblock);
-        pblock->nNonce = 0;
-
-        static unsigned int nExtraNonce = 0;
-
-        {
-            LOCK(cs_main);
-            IncrementExtraNonce(pblock, ::ChainActive().Tip(), nExtraNonce);
-        }
-
-        // Save
-        mapNewBlock[pblock->hashMerkleRoot] = std::make_pair(pblock, pblock->vtx[0]->vin[0].scriptSig);
+        CBlock block(g_getwork_cache.NewWork(mempool, pwallet));
 
         // Pre-build hash buffers
         char pmidstate[32];
         char pdata[128];
         char phash1[64];
-        FormatHashBuffers(pblock, pmidstate, pdata, phash1);
+        FormatHashBuffers(&block, pmidstate, pdata, phash1);
 
-	uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+        uint256 hashTarget = ArithToUint256(arith_uint256().SetCompact(block.nBits));
 
         UniValue obj(UniValue::VOBJ);
         obj.pushKV("midstate", HexStr(BEGIN(pmidstate), END(pmidstate)));
@@ -1014,32 +1091,23 @@ UniValue getwork(const JSONRPCRequest& request)
         std::vector<unsigned char> vchData = ParseHex(request.params[0].get_str());
         if (vchData.size() != 128)
             throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter");
-        CBlock* pdata = (CBlock*)&vchData[0];
 
         // Byte reverse
         for (int i = 0; i < 128/4; i++)
-            ((unsigned int*)pdata)[i] = ByteReverse(((unsigned int*)pdata)[i]);
+            WriteLE32(&vchData[4 * i], ReadBE32(&vchData[4 * i]));
+
+        CBlockHeader solved;
+        CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
+        ssHeader.write((const char*)vchData.data(), CBlockHeader::NORMAL_SERIALIZE_SIZE);
+        ssHeader >> solved;
 
         // Get saved block
-        if (!mapNewBlock.count(pdata->hashMerkleRoot))
+        std::unique_ptr<CBlock> pblock = g_getwork_cache.GetBlock(solved);
+        if (!pblock)
             return false;
-        CBlock* pblock = mapNewBlock[pdata->hashMerkleRoot].first;
-
-        pblock->nTime = pdata->nTime;
-        pblock->nNonce = pdata->nNonce;
 
-        CMutableTransaction txCoinbase(*pblock->vtx[0]);
-        txCoinbase.vin[0].scriptSig = mapNewBlock[pdata->hashMerkleRoot].second;
-        pblock->vtx[0] = MakeTransactionRef(std::move(txCoinbase));
-        pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
-
-        return CheckWork(pblock);
+        return CheckWork(pblock.get());
     }
-
-    UniValue obj(UniValue::VOBJ);
-    obj.pushKV("status",   "active");
-
-    return obj;
 }
 
 
@@ -1073,7 +1141,7 @@ UniValue stakingstatus(const JSONRPCRequest& request)
 UniValue stakingstart(const JSONRPCRequest& request)
 {
     RPCHelpMan{"stakingstart",
-        "\nStart staking (Vericoin only)",
+        "\nStart staking with this wallet, alongside any other staking wallets (Vericoin only)",
         {},
         RPCResult{
             RPCResult::Type::OBJ, "", "",
@@ -1112,7 +1180,7 @@ UniValue stakingstart(const JSONRPCRequest& request)
 UniValue stakingstop(const JSONRPCRequest& request)
 {
     RPCHelpMan{"stakingstop",
-        "\nStop staking (Vericoin only)",
+        "\nStop staking with this wallet (Vericoin only)",
         {},
         RPCResult{
             RPCResult::Type::OBJ, "", "",
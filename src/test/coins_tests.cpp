@@ -18,7 +18,7 @@
 #include <boost/test/unit_test.hpp>
 
 int ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out);
-void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo &txundo, int nHeight);
+void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo &txundo, int nHeight, unsigned int nTxOffset);
 
 namespace
 {
@@ -380,7 +380,7 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
 
             // Call UpdateCoins on the top cache
             CTxUndo undo;
-            UpdateCoins(CTransaction(tx), *(stack.back()), undo, height);
+            UpdateCoins(CTransaction(tx), *(stack.back()), undo, height, 0);
 
             // Update the utxo set for future spends
             utxoset.insert(outpoint);
@@ -531,6 +531,60 @@ BOOST_AUTO_TEST_CASE(ccoins_serialization)
     }
 }
 
+BOOST_AUTO_TEST_CASE(ccoins_serialization_tx_offset)
+{
+    const CScript script = GetScriptForDestination(PKHash(uint160(ParseHex("816115944e077fe7c803cfa57f29b36bf87c1d35"))));
+
+    // Without an offset the record is as older versions wrote it
+    CDataStream ss1(SER_DISK, CLIENT_VERSION);
+    ss1 << Coin(CTxOut(COIN, script), 1000, false, true, 1500000000);
+    CDataStream ssLegacy(SER_DISK, CLIENT_VERSION);
+    ssLegacy << VARINT(uint32_t{2000}) << Using<TxOutCompression>(CTxOut(COIN, script)) << VARINT(1u) << VARINT(1500000000u);
+    BOOST_CHECK_EQUAL(HexStr(ss1.begin(), ss1.end()), HexStr(ssLegacy.begin(), ssLegacy.end()));
+    // With one the flags say so and the offset follows
+    CDataStream ss2(SER_DISK, CLIENT_VERSION);
+    ss2 << Coin(CTxOut(COIN, script), 1000, false, true, 1500000000, 300);
+    BOOST_CHECK_EQUAL(ss2.size(), ss1.size() + 2);
+
+    Coin cc1;
+    ss1 >> cc1;
+    BOOST_CHECK(cc1.fCoinStake);
+    BOOST_CHECK_EQUAL(cc1.nTime, 1500000000U);
+    BOOST_CHECK_EQUAL(cc1.nTxOffset, 0U);
+    Coin cc2;
+    ss2 >> cc2;
+    BOOST_CHECK(cc2.fCoinStake);
+    BOOST_CHECK_EQUAL(cc2.nTime, 1500000000U);
+    BOOST_CHECK_EQUAL(cc2.nTxOffset, 300U);
+    BOOST_CHECK(cc2.out == CTxOut(COIN, script));
+
+    // Undo records carry the offset, flagged odd, where a zero used to be
+    CTxUndo undo;
+    undo.vprevout.emplace_back(CTxOut(COIN, script), 1000, false, true, 1500000000, 300);
+    undo.vprevout.emplace_back(CTxOut(COIN, script), 1000, true, false, 1500000000);
+    CDataStream ss3(SER_DISK, CLIENT_VERSION);
+    ss3 << undo;
+    CTxUndo undo2;
+    ss3 >> undo2;
+    BOOST_CHECK_EQUAL(undo2.vprevout[0].nHeight, 1000U);
+    BOOST_CHECK(undo2.vprevout[0].fCoinStake);
+    BOOST_CHECK_EQUAL(undo2.vprevout[0].nTxOffset, 300U);
+    BOOST_CHECK_EQUAL(undo2.vprevout[1].nHeight, 1000U);
+    BOOST_CHECK(undo2.vprevout[1].fCoinBase);
+    BOOST_CHECK_EQUAL(undo2.vprevout[1].nTxOffset, 0U);
+
+    // A record as older versions wrote it, with its zero, has no offset
+    CDataStream ssOld(SER_DISK, CLIENT_VERSION);
+    ssOld << VARINT(uint32_t{1000 * 2 + 1}) << VARINT(1500000000u) << VARINT(0u) << Using<TxOutCompression>(CTxOut(COIN, script));
+    Coin ccOld;
+    ssOld >> Using<TxInUndoFormatter>(ccOld);
+    BOOST_CHECK_EQUAL(ccOld.nHeight, 1000U);
+    BOOST_CHECK(ccOld.fCoinBase);
+    BOOST_CHECK(!ccOld.fCoinStake);
+    BOOST_CHECK_EQUAL(ccOld.nTxOffset, 0U);
+    BOOST_CHECK(ccOld.out == CTxOut(COIN, script));
+}
+
 const static COutPoint OUTPOINT;
 const static CAmount PRUNED = -1;
 const static CAmount ABSENT = -2;
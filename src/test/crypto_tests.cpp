@@ -5,6 +5,7 @@
 #include <crypto/aes.h>
 #include <crypto/chacha20.h>
 #include <crypto/chacha_poly_aead.h>
+#include <crypto/common.h>
 #include <crypto/poly1305.h>
 #include <crypto/hkdf_sha256_32.h>
 #include <crypto/hmac_sha256.h>
@@ -750,4 +751,25 @@ BOOST_AUTO_TEST_CASE(sha256d64)
     }
 }
 
+BOOST_AUTO_TEST_CASE(sha256d1)
+{
+    for (int i = 0; i <= 32; ++i) {
+        unsigned char in[64 * 32] = {};
+        unsigned char out1[32 * 32], out2[32 * 32];
+        for (int j = 0; j < i; ++j) {
+            // Every message length that fits in one padded block.
+            size_t len = (i + j) % 56;
+            unsigned char* block = in + 64 * j;
+            for (size_t k = 0; k < len; ++k) {
+                block[k] = InsecureRandBits(8);
+            }
+            block[len] = 0x80;
+            WriteBE64(block + 56, len << 3);
+            CHash256().Write(block, len).Finalize(out1 + 32 * j);
+        }
+        SHA256D1(out2, in, i);
+        BOOST_CHECK(memcmp(out1, out2, 32 * i) == 0);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
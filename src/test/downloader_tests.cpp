@@ -0,0 +1,650 @@
+// Copyright (c) 2020 The Vericonomy developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <coins.h>
+#include <compat.h>
+#include <crypto/common.h>
+#include <crypto/sha256.h>
+#include <downloader.h>
+#include <fs.h>
+#include <key.h>
+#include <key_io.h>
+#include <node/coinstats.h>
+#include <support/events.h>
+#include <sync.h>
+#include <test/util/setup_common.h>
+#include <tinyformat.h>
+#include <txdb.h>
+#include <util/message.h>
+#include <util/miniunz.h>
+#include <util/strencodings.h>
+#include <util/system.h>
+
+#include <map>
+#include <thread>
+
+#include <event2/buffer.h>
+#include <event2/http.h>
+#include <event2/keyvalq_struct.h>
+#include <event2/thread.h>
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+
+/**
+ * An HTTP server on a loopback port, serving bodies by path. Range requests
+ * are answered unless disabled, and every GET can be made to fail.
+ */
+class LocalHttpServer
+{
+public:
+    explicit LocalHttpServer(std::map<std::string, std::string> files, bool fRanges = true) : m_files(std::move(files)), m_ranges(fRanges)
+    {
+#ifdef WIN32
+        evthread_use_windows_threads();
+#else
+        evthread_use_pthreads();
+#endif
+        m_base = obtain_event_base();
+        m_http = obtain_evhttp(m_base.get());
+        evhttp_set_gencb(m_http.get(), HandleRequest, this);
+        evhttp_bound_socket* sock = evhttp_bind_socket_with_handle(m_http.get(), "127.0.0.1", 0);
+        assert(sock);
+        struct sockaddr_in addr;
+        socklen_t addr_len = sizeof(addr);
+        getsockname(evhttp_bound_socket_get_fd(sock), (struct sockaddr*)&addr, &addr_len);
+        m_port = ntohs(addr.sin_port);
+        m_thread = std::thread([this] { event_base_dispatch(m_base.get()); });
+    }
+
+    ~LocalHttpServer()
+    {
+        event_base_loopbreak(m_base.get());
+        m_thread.join();
+    }
+
+    std::string Url(const std::string& path) const { return strprintf("http://127.0.0.1:%d%s", m_port, path); }
+
+    void SetFile(const std::string& path, const std::string& body)
+    {
+        LOCK(m_mutex);
+        m_files[path] = body;
+    }
+
+    //! Answer GETs after the next n with an error, or never if n is negative
+    void FailAfter(int n)
+    {
+        LOCK(m_mutex);
+        m_fail_after = n;
+    }
+
+    //! Number of GETs answered, and reset it
+    int TakeRequests()
+    {
+        LOCK(m_mutex);
+        const int requests = m_requests;
+        m_requests = 0;
+        return requests;
+    }
+
+private:
+    static void HandleRequest(struct evhttp_request* req, void* arg)
+    {
+        LocalHttpServer* server = static_cast<LocalHttpServer*>(arg);
+        LOCK(server->m_mutex);
+        const auto it = server->m_files.find(evhttp_request_get_uri(req));
+        if (it == server->m_files.end()) {
+            evhttp_send_error(req, HTTP_NOTFOUND, nullptr);
+            return;
+        }
+        const std::string& file = it->second;
+        struct evkeyvalq* headers = evhttp_request_get_output_headers(req);
+        if (server->m_ranges) {
+            evhttp_add_header(headers, "Accept-Ranges", "bytes");
+            evhttp_add_header(headers, "ETag", strprintf("\"%08x\"", crc32(0L, (const Bytef*)file.data(), file.size())).c_str());
+        }
+        if (evhttp_request_get_command(req) == EVHTTP_REQ_HEAD) {
+            evhttp_add_header(headers, "Content-Length", strprintf("%u", file.size()).c_str());
+            evhttp_send_reply(req, HTTP_OK, "OK", nullptr);
+            return;
+        }
+
+        server->m_requests++;
+        if (server->m_fail_after == 0) {
+            evhttp_send_error(req, HTTP_INTERNAL, nullptr);
+            return;
+        }
+        if (server->m_fail_after > 0)
+            server->m_fail_after--;
+
+        struct evbuffer* body = evbuffer_new();
+        const char* range = evhttp_find_header(evhttp_request_get_input_headers(req), "Range");
+        unsigned long long begin, end;
+        if (server->m_ranges && range && sscanf(range, "bytes=%llu-%llu", &begin, &end) == 2 && begin <= end && end < file.size()) {
+            evhttp_add_header(headers, "Content-Range", strprintf("bytes %u-%u/%u", begin, end, file.size()).c_str());
+            evbuffer_add(body, file.data() + begin, end - begin + 1);
+            evhttp_send_reply(req, 206, "Partial Content", body);
+        } else {
+            evbuffer_add(body, file.data(), file.size());
+            evhttp_send_reply(req, HTTP_OK, "OK", body);
+        }
+        evbuffer_free(body);
+    }
+
+    Mutex m_mutex;
+    std::map<std::string, std::string> m_files GUARDED_BY(m_mutex);
+    const bool m_ranges;
+    int m_fail_after GUARDED_BY(m_mutex){-1};
+    int m_requests GUARDED_BY(m_mutex){0};
+    raii_event_base m_base;
+    raii_evhttp m_http;
+    int m_port;
+    std::thread m_thread;
+};
+
+void PutLE16(std::string& s, uint16_t v)
+{
+    unsigned char buf[2];
+    WriteLE16(buf, v);
+    s.append((const char*)buf, 2);
+}
+
+void PutLE32(std::string& s, uint32_t v)
+{
+    unsigned char buf[4];
+    WriteLE32(buf, v);
+    s.append((const char*)buf, 4);
+}
+
+void PutLE64(std::string& s, uint64_t v)
+{
+    unsigned char buf[8];
+    WriteLE64(buf, v);
+    s.append((const char*)buf, 8);
+}
+
+std::string Deflate(const std::string& data)
+{
+    z_stream zs = z_stream();
+    BOOST_REQUIRE(deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+    std::string out(deflateBound(&zs, data.size()), '\0');
+    zs.next_in = (Bytef*)data.data();
+    zs.avail_in = data.size();
+    zs.next_out = (Bytef*)&out[0];
+    zs.avail_out = out.size();
+    BOOST_REQUIRE(deflate(&zs, Z_FINISH) == Z_STREAM_END);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return out;
+}
+
+/**
+ * Build a zip archive of (name, data) entries. Deflated entries may leave
+ * their sizes to data descriptors, and zip64 entries carry them in the extra
+ * field of their local header.
+ */
+std::string MakeZip(const std::vector<std::pair<std::string, std::string>>& entries, bool fDeflate, bool fDescriptor, bool fZip64)
+{
+    fDescriptor &= fDeflate;
+    std::string zip, central;
+    for (const auto& entry : entries) {
+        const std::string data = fDeflate ? Deflate(entry.second) : entry.second;
+        const uint32_t crc = crc32(0L, (const Bytef*)entry.second.data(), entry.second.size());
+        const uint32_t offset = zip.size();
+
+        PutLE32(zip, 0x04034b50);
+        PutLE16(zip, fZip64 ? 45 : 20);
+        PutLE16(zip, fDescriptor ? 1 << 3 : 0);
+        PutLE16(zip, fDeflate ? Z_DEFLATED : 0);
+        PutLE32(zip, 0); // time and date
+        PutLE32(zip, fDescriptor ? 0 : crc);
+        PutLE32(zip, fZip64 ? 0xffffffff : fDescriptor ? 0 : data.size());
+        PutLE32(zip, fZip64 ? 0xffffffff : fDescriptor ? 0 : entry.second.size());
+        PutLE16(zip, entry.first.size());
+        PutLE16(zip, fZip64 ? 20 : 0);
+        zip += entry.first;
+        if (fZip64) {
+            PutLE16(zip, 0x0001);
+            PutLE16(zip, 16);
+            PutLE64(zip, fDescriptor ? 0 : entry.second.size());
+            PutLE64(zip, fDescriptor ? 0 : data.size());
+        }
+        zip += data;
+        if (fDescriptor) {
+            PutLE32(zip, 0x08074b50);
+            PutLE32(zip, crc);
+            if (fZip64) {
+                PutLE64(zip, data.size());
+                PutLE64(zip, entry.second.size());
+            } else {
+                PutLE32(zip, data.size());
+                PutLE32(zip, entry.second.size());
+            }
+        }
+
+        PutLE32(central, 0x02014b50);
+        PutLE16(central, fZip64 ? 45 : 20);
+        PutLE16(central, fZip64 ? 45 : 20);
+        PutLE16(central, fDescriptor ? 1 << 3 : 0);
+        PutLE16(central, fDeflate ? Z_DEFLATED : 0);
+        PutLE32(central, 0);
+        PutLE32(central, crc);
+        PutLE32(central, fZip64 ? 0xffffffff : data.size());
+        PutLE32(central, fZip64 ? 0xffffffff : entry.second.size());
+        PutLE16(central, entry.first.size());
+        PutLE16(central, fZip64 ? 28 : 0);
+        PutLE16(central, 0); // comment length
+        PutLE32(central, 0); // disk, internal attributes
+        PutLE16(central, 0); // external attributes
+        PutLE16(central, 0);
+        PutLE32(central, fZip64 ? 0xffffffff : offset);
+        central += entry.first;
+        if (fZip64) {
+            PutLE16(central, 0x0001);
+            PutLE16(central, 24);
+            PutLE64(central, entry.second.size());
+            PutLE64(central, data.size());
+            PutLE64(central, offset);
+        }
+    }
+    const uint32_t central_offset = zip.size();
+    zip += central;
+    if (fZip64) {
+        const uint64_t record_offset = zip.size();
+        PutLE32(zip, 0x06064b50);
+        PutLE64(zip, 44);
+        PutLE16(zip, 45);
+        PutLE16(zip, 45);
+        PutLE64(zip, 0); // disks
+        PutLE64(zip, entries.size());
+        PutLE64(zip, entries.size());
+        PutLE64(zip, central.size());
+        PutLE64(zip, central_offset);
+        PutLE32(zip, 0x07064b50);
+        PutLE32(zip, 0);
+        PutLE64(zip, record_offset);
+        PutLE32(zip, 1);
+    }
+    PutLE32(zip, 0x06054b50);
+    PutLE32(zip, 0);
+    PutLE16(zip, fZip64 ? 0xffff : entries.size());
+    PutLE16(zip, fZip64 ? 0xffff : entries.size());
+    PutLE32(zip, fZip64 ? 0xffffffff : central.size());
+    PutLE32(zip, fZip64 ? 0xffffffff : central_offset);
+    PutLE16(zip, 0);
+    return zip;
+}
+
+std::string ReadFile(const fs::path& path)
+{
+    fsbridge::ifstream file(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+void WriteFile(const fs::path& path, const std::string& data)
+{
+    fsbridge::ofstream file(path, std::ios::binary);
+    file << data;
+}
+
+std::vector<std::pair<std::string, std::string>> BootstrapEntries()
+{
+    const std::vector<unsigned char> vRandom = g_insecure_rand_ctx.randbytes(100000);
+    return {
+        {"bootstrap/", ""},
+        {"bootstrap/chainstate/CURRENT", "MANIFEST-000002\n"},
+        {"bootstrap/blocks/blk00000.dat", std::string(vRandom.begin(), vRandom.end())},
+        {"bootstrap/blocks/rev00000.dat", std::string(300000, 'r')},
+        {"bootstrap/indexes/empty", ""},
+    };
+}
+
+std::string Sha256Hex(const std::string& data)
+{
+    unsigned char digest[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write((const unsigned char*)data.data(), data.size()).Finalize(digest);
+    return HexStr(digest, digest + sizeof(digest));
+}
+
+std::string ManifestText(const std::vector<std::pair<std::string, std::string>>& entries, const uint256& hashBlock, const uint256& hashUTXO)
+{
+    std::string text = strprintf("bootstrap-manifest 1\nheight 1000\nblockhash %s\nutxohash %s\n", hashBlock.GetHex(), hashUTXO.GetHex());
+    for (const auto& entry : entries) {
+        if (entry.first.back() == '/') continue;
+        text += strprintf("file %s %s\n", Sha256Hex(entry.second), entry.first.substr(std::string("bootstrap/").size()));
+    }
+    return text;
+}
+
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(downloader_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(zip_stream_extract)
+{
+    const auto entries = BootstrapEntries();
+    int n = 0;
+    for (const bool fDeflate : {false, true}) {
+        for (const bool fDescriptor : {false, true}) {
+            for (const bool fZip64 : {false, true}) {
+                const std::string zip = MakeZip(entries, fDeflate, fDescriptor, fZip64);
+                const fs::path root = GetDataDir() / strprintf("extract%d", n++);
+
+                // Feed the archive in pieces of any size, down to single bytes
+                ZipStreamExtractor extractor(root, "bootstrap");
+                for (size_t pos = 0; pos < zip.size();) {
+                    const size_t len = std::min<size_t>(zip.size() - pos, InsecureRandBool() ? 1 + InsecureRandRange(8) : 1 + InsecureRandRange(20000));
+                    BOOST_REQUIRE_EQUAL(extractor.Write((const unsigned char*)zip.data() + pos, len), UNZ_OK);
+                    pos += len;
+                }
+                BOOST_CHECK_EQUAL(extractor.Finish(), UNZ_OK);
+                BOOST_CHECK_EQUAL(extractor.EntriesExtracted(), entries.size());
+
+                BOOST_CHECK(fs::is_directory(root / "bootstrap"));
+                for (const auto& entry : entries) {
+                    if (entry.first.back() == '/') continue;
+                    BOOST_CHECK(ReadFile(root / entry.first) == entry.second);
+                }
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(zip_stream_reject)
+{
+    const fs::path root = GetDataDir() / "reject";
+    const std::vector<std::pair<std::string, std::string>> good{{"bootstrap/file", std::string(1000, 'x')}};
+
+    // Entries outside of the allowed directory
+    for (const char* name : {"bootstrap/../evil", "other/evil", "/evil"}) {
+        const std::string zip = MakeZip({{name, "evil"}}, false, false, false);
+        ZipStreamExtractor extractor(root, "bootstrap");
+        BOOST_CHECK(extractor.Write((const unsigned char*)zip.data(), zip.size()) != UNZ_OK);
+        BOOST_CHECK(extractor.Failed());
+        BOOST_CHECK(!fs::exists(root / "evil"));
+        BOOST_CHECK(!fs::exists(root / "other"));
+    }
+
+    // A corrupted entry, stored and deflated
+    for (const bool fDeflate : {false, true}) {
+        std::string zip = MakeZip(good, fDeflate, false, false);
+        zip[30 + 14 + (fDeflate ? 2 : 500)] ^= 1;
+        ZipStreamExtractor extractor(root, "bootstrap");
+        BOOST_CHECK(extractor.Write((const unsigned char*)zip.data(), zip.size()) != UNZ_OK);
+        BOOST_CHECK(extractor.Failed());
+        BOOST_CHECK(extractor.Finish() != UNZ_OK);
+    }
+
+    // An archive cut short, even right after an entry
+    for (const size_t cut : {size_t{100}, size_t{30 + 14 + 1000}}) {
+        const std::string zip = MakeZip(good, false, false, false);
+        ZipStreamExtractor extractor(root, "bootstrap");
+        BOOST_CHECK_EQUAL(extractor.Write((const unsigned char*)zip.data(), cut), UNZ_OK);
+        BOOST_CHECK(extractor.Finish() != UNZ_OK);
+    }
+
+    // Not a zip archive at all
+    ZipStreamExtractor extractor(root, "bootstrap");
+    BOOST_CHECK(extractor.Write((const unsigned char*)"<html>", 6) != UNZ_OK);
+}
+
+BOOST_AUTO_TEST_CASE(zip_extract_parallel_threads)
+{
+    const auto entries = BootstrapEntries();
+    int n = 0;
+    for (const bool fDeflate : {false, true}) {
+        for (const bool fZip64 : {false, true}) {
+            const std::string zip = MakeZip(entries, fDeflate, fDeflate, fZip64);
+            const fs::path zip_path = GetDataDir() / "parallel.zip";
+            WriteFile(zip_path, zip);
+
+            FILE* file = fsbridge::fopen(zip_path, "rb");
+            std::vector<ZipEntry> central;
+            BOOST_CHECK_EQUAL(zip_read_central_directory(file, central), UNZ_OK);
+            fclose(file);
+            BOOST_REQUIRE_EQUAL(central.size(), entries.size());
+            BOOST_CHECK_EQUAL(central[2].strName, "bootstrap/blocks/blk00000.dat");
+            BOOST_CHECK_EQUAL(central[2].nUncompressedSize, 100000U);
+
+            for (const int nThreads : {1, 4}) {
+                const fs::path root = GetDataDir() / strprintf("parallel%d", n++);
+                std::vector<fs::path> vFiles;
+                Mutex cs_files;
+                uint64_t nEntries = 0;
+                BOOST_CHECK_EQUAL(zip_extract_parallel(zip_path, root, "bootstrap", nThreads, 0, [&](const fs::path& path) {
+                    LOCK(cs_files);
+                    vFiles.push_back(path);
+                }, &nEntries), UNZ_OK);
+                BOOST_CHECK_EQUAL(nEntries, entries.size());
+                BOOST_CHECK_EQUAL(vFiles.size(), entries.size() - 1);
+                for (const auto& entry : entries) {
+                    if (entry.first.back() == '/') continue;
+                    BOOST_CHECK(ReadFile(root / entry.first) == entry.second);
+                }
+            }
+
+            // Only the entries from an offset on
+            const fs::path root = GetDataDir() / strprintf("parallel%d", n++);
+            uint64_t nEntries = 0;
+            BOOST_CHECK_EQUAL(zip_extract_parallel(zip_path, root, "bootstrap", 4, central[3].nLocalHeaderOffset, nullptr, &nEntries), UNZ_OK);
+            BOOST_CHECK_EQUAL(nEntries, 2U);
+            BOOST_CHECK(!fs::exists(root / entries[2].first));
+            BOOST_CHECK(ReadFile(root / entries[3].first) == entries[3].second);
+        }
+    }
+
+    // A corrupted entry, an entry outside of the allowed directory, and no archive
+    const fs::path zip_path = GetDataDir() / "bad.zip";
+    for (const bool fDeflate : {false, true}) {
+        std::string zip = MakeZip({{"bootstrap/file", std::string(1000, 'x')}}, fDeflate, false, false);
+        zip[30 + 14 + (fDeflate ? 2 : 500)] ^= 1;
+        WriteFile(zip_path, zip);
+        BOOST_CHECK(zip_extract_parallel(zip_path, GetDataDir(), "bootstrap", 4) != UNZ_OK);
+    }
+    WriteFile(zip_path, MakeZip({{"bootstrap/file", "x"}, {"bootstrap/../evil", "evil"}}, true, false, false));
+    BOOST_CHECK(zip_extract_parallel(zip_path, GetDataDir() / "traversal", "bootstrap", 4) != UNZ_OK);
+    BOOST_CHECK(!fs::exists(GetDataDir() / "traversal"));
+    BOOST_CHECK(!fs::exists(GetDataDir() / "evil"));
+    WriteFile(zip_path, "<html>");
+    BOOST_CHECK(zip_extract_parallel(zip_path, GetDataDir(), "bootstrap", 4) != UNZ_OK);
+}
+
+BOOST_AUTO_TEST_CASE(download_and_extract)
+{
+    const auto entries = BootstrapEntries();
+    LocalHttpServer server({
+        {"/bootstrap.zip", MakeZip(entries, true, true, false)},
+        {"/bad.zip", MakeZip({{"other/file", "x"}}, true, false, false)},
+    });
+
+    const fs::path root = GetDataDir() / "download";
+    downloadAndExtract(server.Url("/bootstrap.zip"), root, "bootstrap");
+    for (const auto& entry : entries) {
+        if (entry.first.back() == '/') continue;
+        BOOST_CHECK(ReadFile(root / entry.first) == entry.second);
+    }
+
+    BOOST_CHECK_THROW(downloadAndExtract(server.Url("/bad.zip"), root, "bootstrap"), std::runtime_error);
+    BOOST_CHECK(!fs::exists(root / "other"));
+    BOOST_CHECK_THROW(downloadAndExtract(server.Url("/missing.zip"), root, "bootstrap"), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(download_ranges)
+{
+    const std::vector<unsigned char> vData = g_insecure_rand_ctx.randbytes(1000000);
+    const std::string data(vData.begin(), vData.end());
+    LocalHttpServer server({{"/client.tar.gz", data}});
+    const fs::path target = GetDataDir() / "client.tar.gz";
+
+    // One request per chunk of 64 KiB, the last one short
+    downloadFile(server.Url("/client.tar.gz"), target, 1 << 16);
+    BOOST_CHECK(ReadFile(target) == data);
+    BOOST_CHECK_EQUAL(server.TakeRequests(), 16);
+    BOOST_CHECK(!fs::exists(GetDataDir() / "client.tar.gz.part"));
+    BOOST_CHECK(!fs::exists(GetDataDir() / "client.tar.gz.progress"));
+
+    // A server without ranges sends it whole
+    LocalHttpServer plain({{"/client.tar.gz", data}}, false);
+    fs::remove(target);
+    downloadFile(plain.Url("/client.tar.gz"), target, 1 << 16);
+    BOOST_CHECK(ReadFile(target) == data);
+    BOOST_CHECK_EQUAL(plain.TakeRequests(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(download_resume)
+{
+    const std::vector<unsigned char> vData = g_insecure_rand_ctx.randbytes(1000000);
+    const std::string data(vData.begin(), vData.end());
+    LocalHttpServer server({{"/client.tar.gz", data}});
+    const fs::path target = GetDataDir() / "client.tar.gz";
+
+    // Interrupted after 5 chunks, each other one failing every attempt
+    server.FailAfter(5);
+    BOOST_CHECK_THROW(downloadFile(server.Url("/client.tar.gz"), target, 1 << 16), std::runtime_error);
+    BOOST_CHECK(fs::exists(GetDataDir() / "client.tar.gz.part"));
+    BOOST_CHECK(fs::exists(GetDataDir() / "client.tar.gz.progress"));
+    server.TakeRequests();
+
+    // Only the missing chunks are asked for again
+    server.FailAfter(-1);
+    downloadFile(server.Url("/client.tar.gz"), target, 1 << 16);
+    BOOST_CHECK(ReadFile(target) == data);
+    BOOST_CHECK_EQUAL(server.TakeRequests(), 16 - 5);
+
+    // A file changed in between is downloaded from the start
+    server.FailAfter(5);
+    BOOST_CHECK_THROW(downloadFile(server.Url("/client.tar.gz"), target, 1 << 16), std::runtime_error);
+    server.TakeRequests();
+    server.FailAfter(-1);
+    const std::string changed = data.substr(0, 900000) + std::string(100000, 'c');
+    server.SetFile("/client.tar.gz", changed);
+    downloadFile(server.Url("/client.tar.gz"), target, 1 << 16);
+    BOOST_CHECK(ReadFile(target) == changed);
+    BOOST_CHECK_EQUAL(server.TakeRequests(), 16);
+}
+
+BOOST_AUTO_TEST_CASE(download_and_extract_resume)
+{
+    const auto entries = BootstrapEntries();
+    LocalHttpServer server({{"/bootstrap.zip", MakeZip(entries, true, false, false)}});
+    const fs::path root = GetDataDir() / "resume";
+
+    server.FailAfter(3);
+    BOOST_CHECK_THROW(downloadAndExtract(server.Url("/bootstrap.zip"), root, "bootstrap", 1 << 14), std::runtime_error);
+    BOOST_CHECK(fs::exists(root / "bootstrap.zip.part"));
+
+    // The downloaded part of the archive is extracted again from disk
+    server.FailAfter(-1);
+    fs::remove_all(root / "bootstrap");
+    downloadAndExtract(server.Url("/bootstrap.zip"), root, "bootstrap", 1 << 14);
+    for (const auto& entry : entries) {
+        if (entry.first.back() == '/') continue;
+        BOOST_CHECK(ReadFile(root / entry.first) == entry.second);
+    }
+    BOOST_CHECK(!fs::exists(root / "bootstrap.zip.part"));
+    BOOST_CHECK(!fs::exists(root / "bootstrap.zip.progress"));
+}
+
+BOOST_AUTO_TEST_CASE(bootstrap_manifest)
+{
+    const auto entries = BootstrapEntries();
+    const uint256 hashBlock = InsecureRand256(), hashUTXO = InsecureRand256();
+    const std::string text = ManifestText(entries, hashBlock, hashUTXO);
+
+    CKey key;
+    key.MakeNewKey(true);
+    const std::string address = EncodeDestination(PKHash(key.GetPubKey()));
+    std::string signature;
+    BOOST_REQUIRE(MessageSign(key, text, signature));
+    const std::string signed_text = text + "signature " + signature + "\n";
+
+    const BootstrapManifest manifest = parseBootstrapManifest(signed_text, address);
+    BOOST_CHECK_EQUAL(manifest.nHeight, 1000);
+    BOOST_CHECK(manifest.hashBlock == hashBlock);
+    BOOST_CHECK(manifest.hashUTXO == hashUTXO);
+    BOOST_CHECK_EQUAL(manifest.mapFiles.size(), 4U);
+    BOOST_CHECK_EQUAL(manifest.mapFiles.at("blocks/rev00000.dat"), Sha256Hex(std::string(300000, 'r')));
+
+    // Without a signer an unsigned manifest is taken as it is
+    BOOST_CHECK_EQUAL(parseBootstrapManifest(text, "").mapFiles.size(), 4U);
+    BOOST_CHECK_THROW(parseBootstrapManifest(text, address), std::runtime_error);
+
+    // Any change to the signed lines, or a line added after them
+    std::string tampered = signed_text;
+    tampered[tampered.find("file ") + 5] ^= 1;
+    BOOST_CHECK_THROW(parseBootstrapManifest(tampered, address), std::runtime_error);
+    BOOST_CHECK_THROW(parseBootstrapManifest(signed_text + "file " + std::string(64, '0') + " evil\n", address), std::runtime_error);
+    CKey other;
+    other.MakeNewKey(true);
+    BOOST_CHECK_THROW(parseBootstrapManifest(signed_text, EncodeDestination(PKHash(other.GetPubKey()))), std::runtime_error);
+
+    // Malformed manifests
+    BOOST_CHECK_THROW(parseBootstrapManifest("", ""), std::runtime_error);
+    BOOST_CHECK_THROW(parseBootstrapManifest("<html>\n" + text, ""), std::runtime_error);
+    BOOST_CHECK_THROW(parseBootstrapManifest(text + "file 00 blocks/short\n", ""), std::runtime_error);
+    BOOST_CHECK_THROW(parseBootstrapManifest(text + "file " + std::string(64, '0') + " blocks/blk00000.dat\n", ""), std::runtime_error);
+    BOOST_CHECK_THROW(parseBootstrapManifest(text + "unknown line\n", ""), std::runtime_error);
+    BOOST_CHECK_THROW(parseBootstrapManifest("bootstrap-manifest 1\nheight 1\n", ""), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(bootstrap_verifier)
+{
+    const auto entries = BootstrapEntries();
+    LocalHttpServer server({{"/bootstrap.zip", MakeZip(entries, true, false, false)}});
+    const std::string text = ManifestText(entries, uint256(), uint256());
+    const fs::path root = GetDataDir() / "verify";
+
+    auto extract = [&](const BootstrapManifest& manifest) {
+        fs::remove_all(root / "bootstrap");
+        BootstrapVerifier verifier(root / "bootstrap", manifest);
+        downloadAndExtract(server.Url("/bootstrap.zip"), root, "bootstrap", 1 << 14,
+            [&verifier](const fs::path& file_path) { verifier.Add(file_path); });
+        verifier.Finish();
+    };
+
+    extract(parseBootstrapManifest(text, ""));
+
+    // A file that does not match, one that is missing and one not listed
+    BootstrapManifest manifest = parseBootstrapManifest(text, "");
+    manifest.mapFiles["blocks/blk00000.dat"] = Sha256Hex("corrupt");
+    BOOST_CHECK_THROW(extract(manifest), std::runtime_error);
+    manifest = parseBootstrapManifest(text, "");
+    manifest.mapFiles["blocks/blk00001.dat"] = Sha256Hex("");
+    BOOST_CHECK_THROW(extract(manifest), std::runtime_error);
+    manifest = parseBootstrapManifest(text, "");
+    manifest.mapFiles.erase("indexes/empty");
+    BOOST_CHECK_THROW(extract(manifest), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(bootstrap_chainstate)
+{
+    const fs::path chainstate_path = GetDataDir() / "bootstrap" / "chainstate";
+    BootstrapManifest manifest;
+    manifest.hashBlock = InsecureRand256();
+    {
+        CCoinsViewDB db(chainstate_path, 1 << 20, false, true);
+        CCoinsViewCache cache(&db);
+        for (int i = 0; i < 100; i++) {
+            const CTxOut out(InsecureRandRange(1000) * COIN, CScript() << OP_TRUE);
+            cache.AddCoin(COutPoint(InsecureRand256(), InsecureRandRange(4)), Coin(out, 1 + i, i == 0, false, 1500000000 + i), false);
+        }
+        cache.SetBestBlock(manifest.hashBlock);
+        BOOST_REQUIRE(cache.Flush());
+        CCoinsStats stats;
+        BOOST_REQUIRE(GetUTXOStats(&db, stats));
+        manifest.hashUTXO = stats.hashSerialized;
+    }
+
+    verifyBootstrapChainstate(chainstate_path, manifest);
+
+    BootstrapManifest wrong = manifest;
+    wrong.hashUTXO = InsecureRand256();
+    BOOST_CHECK_THROW(verifyBootstrapChainstate(chainstate_path, wrong), std::runtime_error);
+    wrong = manifest;
+    wrong.hashBlock = InsecureRand256();
+    BOOST_CHECK_THROW(verifyBootstrapChainstate(chainstate_path, wrong), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -250,6 +250,29 @@ BOOST_AUTO_TEST_CASE(merkle_test)
 }
 
 
+BOOST_AUTO_TEST_CASE(merkle_test_coinbase_branch)
+{
+    for (int ntx = 1; ntx <= 33; ntx++) {
+        CBlock block;
+        block.vtx.resize(ntx);
+        for (int pos = 0; pos < ntx; pos++) {
+            CMutableTransaction mtx;
+            mtx.nLockTime = InsecureRand32();
+            block.vtx[pos] = MakeTransactionRef(std::move(mtx));
+        }
+        std::vector<uint256> branch = BlockCoinbaseMerkleBranch(block);
+        BOOST_CHECK(branch == BlockMerkleBranch(block, 0));
+        BOOST_CHECK_EQUAL(ComputeCoinbaseMerkleRoot(block.vtx[0]->GetHash(), branch), BlockMerkleRoot(block));
+
+        // The branch does not depend on the coinbase
+        CMutableTransaction coinbase;
+        coinbase.nLockTime = InsecureRand32();
+        block.vtx[0] = MakeTransactionRef(std::move(coinbase));
+        BOOST_CHECK(BlockCoinbaseMerkleBranch(block) == branch);
+        BOOST_CHECK_EQUAL(ComputeCoinbaseMerkleRoot(block.vtx[0]->GetHash(), branch), BlockMerkleRoot(block));
+    }
+}
+
 BOOST_AUTO_TEST_CASE(merkle_test_empty_block)
 {
     bool mutated = false;
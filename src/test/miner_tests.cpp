@@ -0,0 +1,230 @@
+// Copyright (c) 2020 The Vericonomy developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#if defined(HAVE_CONFIG_H)
+#include <config/bitcoin-config.h>
+#endif
+
+#include <chainparams.h>
+#include <miner.h>
+#include <test/util/mining.h>
+#include <test/util/setup_common.h>
+#include <validationinterface.h>
+#ifdef ENABLE_WALLET
+#include <interfaces/chain.h>
+#include <wallet/test/wallet_test_fixture.h>
+#include <wallet/wallet.h>
+#endif
+
+#include <thread>
+#include <vector>
+
+#include <boost/thread/thread.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(miner_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(hash_meter_window)
+{
+    const int64_t bucket = MinerHashMeter::BUCKET_SECONDS;
+    const int64_t window = MinerHashMeter::WINDOW_BUCKETS * bucket;
+    const int64_t start = 1000000 * bucket;
+    MinerHashMeter meter(2, start);
+
+    // Nothing is reported until a bucket is complete
+    meter.Add(0, 50, start);
+    BOOST_CHECK_EQUAL(meter.GetThreadRate(0, start + bucket - 1), 0.0);
+
+    // Thread 0 does 1 H/s, thread 1 does 2 H/s
+    for (int64_t t = start; t < start + 2 * window; t++) {
+        meter.Add(0, 1, t);
+        meter.Add(1, 2, t);
+    }
+    const int64_t now = start + 2 * window;
+    BOOST_CHECK_EQUAL(meter.GetThreadRate(0, now), 60.0);
+    BOOST_CHECK_EQUAL(meter.GetThreadRate(1, now), 120.0);
+    BOOST_CHECK_EQUAL(meter.GetTotalRate(now), 180.0);
+    BOOST_CHECK_EQUAL(meter.GetThreadRate(2, now), 0.0);
+
+    // A thread that stops hashing drops out of the window
+    for (int64_t t = now; t < now + window; t++)
+        meter.Add(1, 2, t);
+    BOOST_CHECK_EQUAL(meter.GetThreadRate(0, now + window), 0.0);
+    BOOST_CHECK_EQUAL(meter.GetThreadRate(1, now + window), 120.0);
+}
+
+BOOST_AUTO_TEST_CASE(hash_meter_warmup)
+{
+    // The rate of a meter started mid-bucket is taken over the time it ran
+    const int64_t bucket = MinerHashMeter::BUCKET_SECONDS;
+    const int64_t start = 1000000 * bucket + bucket / 2;
+    MinerHashMeter meter(1, start);
+    for (int64_t t = start; t < start + 2 * bucket; t++)
+        meter.Add(0, 3, t);
+    BOOST_CHECK_EQUAL(meter.GetThreadRate(0, start + bucket), 180.0);
+}
+
+BOOST_AUTO_TEST_CASE(hash_meter_concurrent)
+{
+    const int64_t bucket = MinerHashMeter::BUCKET_SECONDS;
+    const int64_t start = 1000000 * bucket;
+    const int nThreads = 4;
+    MinerHashMeter meter(nThreads, start);
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < nThreads; i++) {
+        threads.emplace_back([&meter, i, start, bucket] {
+            for (int n = 0; n < 10000; n++)
+                meter.Add(i, 1, start + (n % bucket));
+        });
+    }
+    // Readers never block the miner threads
+    for (int n = 0; n < 1000; n++)
+        meter.GetTotalRate(start + bucket);
+    for (std::thread& thread : threads)
+        thread.join();
+
+    for (int i = 0; i < nThreads; i++)
+        BOOST_CHECK_EQUAL(meter.GetThreadRate(i, start + bucket), 60.0 * 10000 / bucket);
+}
+
+BOOST_AUTO_TEST_CASE(tip_notifier_stop)
+{
+    MinerTipNotifier notifier(2);
+    BOOST_CHECK(!notifier.AbortFlag(0).load());
+    notifier.AbortAll();
+    BOOST_CHECK(notifier.AbortFlag(0).load());
+    BOOST_CHECK(notifier.AbortFlag(1).load());
+
+    // A thread waiting for the tip stops as soon as it is interrupted
+    const uint64_t nEpoch = notifier.GetTipEpoch();
+    bool fInterrupted = false;
+    boost::thread thread([&] {
+        try {
+            notifier.WaitForTipChange(nEpoch, std::chrono::hours(1));
+        } catch (const boost::thread_interrupted&) {
+            fInterrupted = true;
+        }
+    });
+    const int64_t nStart = GetTimeMillis();
+    thread.interrupt();
+    thread.join();
+    BOOST_CHECK(GetTimeMillis() - nStart < 10000);
+    BOOST_CHECK(fInterrupted);
+    BOOST_CHECK_EQUAL(notifier.GetTipEpoch(), nEpoch);
+}
+
+#ifdef ENABLE_WALLET
+/** The chain whose genesis block this build connects, with a wallet to pay the coinbase to */
+struct MinerTestingSetup : public WalletTestingSetup {
+    MinerTestingSetup() : WalletTestingSetup(CLIENT_IS_VERIUM ? CBaseChainParams::VERIUM : CBaseChainParams::VERICOIN) {}
+};
+
+BOOST_FIXTURE_TEST_CASE(template_producer_tip, MinerTestingSetup)
+{
+    std::shared_ptr<MinerTipNotifier> notifier = std::make_shared<MinerTipNotifier>(1);
+    RegisterSharedValidationInterface(notifier);
+    {
+        LOCK(m_wallet.cs_wallet);
+        m_wallet.SetupLegacyScriptPubKeyMan();
+    }
+    MinerTemplateProducer producer(m_node.mempool, std::shared_ptr<CWallet>(&m_wallet, [](CWallet*) {}));
+    BOOST_REQUIRE(producer.Init());
+
+    // Every thread gets the same template with an extranonce of its own
+    CBlockIndex* pindexGenesis = WITH_LOCK(cs_main, return ::ChainActive().Tip());
+    const CBlockIndex* pindexPrev = nullptr;
+    std::unique_ptr<CBlock> pblock1 = producer.GetWork(pindexPrev);
+    BOOST_REQUIRE(pblock1);
+    BOOST_CHECK_EQUAL(pindexPrev, pindexGenesis);
+    std::unique_ptr<CBlock> pblock2 = producer.GetWork(pindexPrev);
+    BOOST_REQUIRE(pblock2);
+    BOOST_CHECK(pblock2->hashPrevBlock == pindexGenesis->GetBlockHash());
+    BOOST_CHECK(pblock2->hashMerkleRoot != pblock1->hashMerkleRoot);
+
+    // A new tip aborts the search on the old one
+    const uint64_t nEpoch = notifier->GetTipEpoch();
+    notifier->AbortFlag(0).store(false);
+    CBlockIndex* pindexTip;
+    {
+        LOCK(cs_main);
+        pindexTip = BuildStakeModifierChain(pindexGenesis, 1, g_insecure_rand_ctx);
+        ::ChainActive().SetTip(pindexTip);
+        ::ChainstateActive().CoinsTip().SetBestBlock(pindexTip->GetBlockHash());
+    }
+    GetMainSignals().UpdatedBlockTip(pindexTip, pindexGenesis, false);
+    SyncWithValidationInterfaceQueue();
+    BOOST_CHECK(notifier->GetTipEpoch() != nEpoch);
+    BOOST_CHECK(notifier->AbortFlag(0).load());
+
+    // and the next work is a fresh template on it
+    std::unique_ptr<CBlock> pblock3 = producer.GetWork(pindexPrev);
+    BOOST_REQUIRE(pblock3);
+    BOOST_CHECK_EQUAL(pindexPrev, pindexTip);
+    BOOST_CHECK(pblock3->hashPrevBlock == pindexTip->GetBlockHash());
+
+    UnregisterSharedValidationInterface(notifier);
+}
+
+BOOST_AUTO_TEST_CASE(staking_wallets_round)
+{
+    NodeContext node;
+    std::unique_ptr<interfaces::Chain> chain = interfaces::MakeChain(node);
+    std::shared_ptr<CWallet> wallet1 = std::make_shared<CWallet>(chain.get(), WalletLocation(), WalletDatabase::CreateDummy());
+    std::shared_ptr<CWallet> wallet2 = std::make_shared<CWallet>(chain.get(), WalletLocation(), WalletDatabase::CreateDummy());
+    std::shared_ptr<CWallet> wallet3 = std::make_shared<CWallet>(chain.get(), WalletLocation(), WalletDatabase::CreateDummy());
+    const int64_t nTime = GetTime();
+    SetMockTime(nTime);
+
+    StakingWallets wallets;
+    wallets.Add(wallet1);
+    wallets.Add(wallet2);
+    wallets.Add(wallet2);
+    BOOST_CHECK(wallets.Contains(wallet2.get()));
+
+    // Both wallets find a kernel, only the first one stakes its block
+    std::vector<const CWallet*> vStaked;
+    auto stake = [&](const std::shared_ptr<CWallet>& pwallet, int64_t nSearchInterval) {
+        BOOST_CHECK_EQUAL(nSearchInterval, 16);
+        vStaked.push_back(pwallet.get());
+        return true;
+    };
+    BOOST_CHECK(wallets.StakeRound(nTime + 16, stake) == wallet1);
+    BOOST_CHECK(vStaked == std::vector<const CWallet*>({wallet1.get()}));
+    // and no wallet searches the same time again
+    vStaked.clear();
+    BOOST_CHECK(!wallets.StakeRound(nTime + 16, stake));
+    BOOST_CHECK(vStaked.empty());
+
+    // A wallet removed during a round is not searched in it, one added is in the next
+    auto change = [&](const std::shared_ptr<CWallet>& pwallet, int64_t nSearchInterval) {
+        vStaked.push_back(pwallet.get());
+        std::thread([&] {
+            wallets.Remove(wallet2.get());
+            wallets.Add(wallet3);
+        }).join();
+        return false;
+    };
+    BOOST_CHECK(!wallets.StakeRound(nTime + 32, change));
+    BOOST_CHECK(vStaked == std::vector<const CWallet*>({wallet1.get()}));
+    BOOST_CHECK(!wallets.Contains(wallet2.get()));
+    vStaked.clear();
+    BOOST_CHECK(!wallets.StakeRound(nTime + 48, [&](const std::shared_ptr<CWallet>& pwallet, int64_t nSearchInterval) {
+        vStaked.push_back(pwallet.get());
+        return false;
+    }));
+    BOOST_CHECK(vStaked == std::vector<const CWallet*>({wallet1.get(), wallet3.get()}));
+
+    // An unloaded wallet drops out
+    const CWallet* pwallet3 = wallet3.get();
+    wallet3.reset();
+    BOOST_CHECK_EQUAL(wallets.NextRound(nTime + 64).size(), 1U);
+    BOOST_CHECK(!wallets.Contains(pwallet3));
+    BOOST_CHECK(wallets.Remove(nullptr) == false);
+
+    SetMockTime(0);
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,331 @@
+// Copyright (c) 2020 The Vericonomy developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bignum.h>
+#include <chain.h>
+#include <chainparams.h>
+#include <coins.h>
+#include <hash.h>
+#include <pos.h>
+#include <rpc/blockchain.h>
+#include <test/util/mining.h>
+#include <test/util/setup_common.h>
+#include <validation.h>
+#include <validationinterface.h>
+
+#include <limits>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(pos_tests, BasicTestingSetup)
+
+/** The BIGNUM comparison CheckStakeKernelHash() makes. */
+static bool LegacyMeetsTarget(const uint256& hash, unsigned int nBits, int64_t nValueIn, int64_t nTimeWeight)
+{
+    CBigNum bnTargetPerCoinDay;
+    bnTargetPerCoinDay.SetCompact(nBits);
+    CBigNum bnCoinDayWeight = CBigNum(nValueIn) * nTimeWeight / COIN / (24 * 60 * 60);
+    return !(CBigNum(hash) > bnCoinDayWeight * bnTargetPerCoinDay);
+}
+
+BOOST_AUTO_TEST_CASE(stake_kernel_target_matches_bignum)
+{
+    const unsigned int bits[] = {0x1d00ffff, 0x1e0fffff, 0x1f00ffff, 0x207fffff, 0x1c0ffff0, 0x03123456, 0x2100ffff, 0x1d80ffff};
+    const int64_t values[] = {0, 1, COIN, 1000 * COIN, 21000000 * COIN, MAX_MONEY};
+    const int64_t weights[] = {-86400, 0, 1, 86400, 30 * 86400, 365 * 86400};
+    for (int i = 0; i < 64; i++) {
+        uint256 hash = InsecureRand256();
+        // Shift some hashes down so that both outcomes are exercised
+        hash = ArithToUint256(UintToArith256(hash) >> InsecureRandRange(256));
+        for (unsigned int nBits : bits) {
+            for (int64_t nValueIn : values) {
+                for (int64_t nTimeWeight : weights) {
+                    BOOST_CHECK_EQUAL(StakeKernelMeetsTarget(hash, nBits, nValueIn, nTimeWeight), LegacyMeetsTarget(hash, nBits, nValueIn, nTimeWeight));
+                }
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(stake_kernel_target_boundary_matches_bignum)
+{
+    // Hashes sitting exactly on, just below and just above the bound, for every compact exponent
+    for (int i = 0; i < 512; i++) {
+        const unsigned int nBits = (InsecureRandRange(0x22) << 24) | (InsecureRandBool() ? 0x00800000 : 0) | InsecureRandBits(23);
+        const int64_t nValueIn = InsecureRandBool() ? InsecureRandRange(MAX_MONEY + 1) : COIN * InsecureRandRange(1000);
+        const int64_t nTimeWeight = InsecureRandRange(90 * 86400);
+        const arith_uint256 bnTarget = arith_uint256().SetCompact(nBits);
+        const arith_uint256 bnWeight = GetCoinDayWeight(nValueIn, nTimeWeight);
+        if (bnWeight != 0 && bnTarget > ~arith_uint256() / bnWeight)
+            continue;
+        const arith_uint256 bound = bnWeight * bnTarget;
+        const arith_uint256 hashes[] = {bound, bound - 1, bound + 1};
+        for (const arith_uint256& hash : hashes) {
+            const uint256 h = ArithToUint256(hash);
+            BOOST_CHECK_EQUAL(StakeKernelMeetsTarget(h, nBits, nValueIn, nTimeWeight), LegacyMeetsTarget(h, nBits, nValueIn, nTimeWeight));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(coin_day_weight_matches_bignum)
+{
+    const int64_t values[] = {0, 1, COIN - 1, COIN, MAX_MONEY, std::numeric_limits<int64_t>::max()};
+    const int64_t weights[] = {0, 1, 86399, 86400, 30 * 86400, std::numeric_limits<int64_t>::max()};
+    for (int64_t nValueIn : values) {
+        for (int64_t nTimeWeight : weights) {
+            CBigNum bnCoinDayWeight = CBigNum(nValueIn) * nTimeWeight / COIN / (24 * 60 * 60);
+            BOOST_CHECK(ArithToUint256(GetCoinDayWeight(nValueIn, nTimeWeight)) == bnCoinDayWeight.getuint256());
+        }
+    }
+    for (int i = 0; i < 256; i++) {
+        const int64_t nValueIn = InsecureRandRange(MAX_MONEY + 1);
+        const int64_t nTimeWeight = InsecureRandRange(365 * 86400);
+        CBigNum bnCoinDayWeight = CBigNum(nValueIn) * nTimeWeight / COIN / (24 * 60 * 60);
+        BOOST_CHECK_EQUAL(GetCoinDayWeight(nValueIn, nTimeWeight).GetLow64(), bnCoinDayWeight.getuint64());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(stake_kernel_target_saturates)
+{
+    // The coin-day weight times the target exceeds 2^256; every hash passes
+    const uint256 max = ArithToUint256(~arith_uint256());
+    BOOST_CHECK(StakeKernelMeetsTarget(max, 0x2100ffff, MAX_MONEY, 365 * 86400));
+    BOOST_CHECK(LegacyMeetsTarget(max, 0x2100ffff, MAX_MONEY, 365 * 86400));
+    // A zero bound is only met by a zero hash
+    BOOST_CHECK(StakeKernelMeetsTarget(uint256(), 0x1d00ffff, 0, 86400));
+    BOOST_CHECK(!StakeKernelMeetsTarget(uint256S("01"), 0x1d00ffff, 0, 86400));
+}
+
+struct VericoinTestingSetup : public TestingSetup {
+    VericoinTestingSetup() : TestingSetup(CBaseChainParams::VERICOIN) {}
+};
+
+/** The block GetKernelStakeModifier() walks forward to, one block at a time. */
+static const CBlockIndex* WalkToModifierBlock(const CBlockIndex* pindexFrom, const CBlockIndex* pindexEnd)
+{
+    int64_t nSelectionInterval = 0;
+    for (int nSection = 0; nSection < 64; nSection++)
+        nSelectionInterval += Params().GetConsensus().nModifierInterval * 63 / (63 + ((63 - nSection) * (MODIFIER_INTERVAL_RATIO - 1)));
+
+    int64_t nModifierTime = pindexFrom->GetBlockTime();
+    const CBlockIndex* pindex = pindexFrom;
+    while (nModifierTime < pindexFrom->GetBlockTime() + nSelectionInterval) {
+        if (pindex == pindexEnd)
+            return nullptr;
+        pindex = pindexEnd->GetAncestor(pindex->nHeight + 1);
+        if (pindex->GeneratedStakeModifier())
+            nModifierTime = pindex->GetBlockTime();
+    }
+    return pindex;
+}
+
+BOOST_FIXTURE_TEST_CASE(stake_modifier_lookup_matches_walk, VericoinTestingSetup)
+{
+    LOCK(cs_main);
+    const int64_t nStakeMinAge = Params().GetConsensus().nStakeMinAge;
+    CBlockIndex* pindexTip = BuildStakeModifierChain(::ChainActive().Tip(), 1500, g_insecure_rand_ctx);
+    ::ChainActive().SetTip(pindexTip);
+    // A longer side chain forking off below the tip, as during a reorg
+    CBlockIndex* pindexFork = ::ChainActive()[1400];
+    CBlockIndex* pindexSide = BuildStakeModifierChain(pindexFork, 150, g_insecure_rand_ctx);
+
+    for (int i = 0; i < 200; i++) {
+        CBlockIndex* pindexFrom = ::ChainActive()[1 + InsecureRandRange(pindexFork->nHeight)];
+        CBlockIndex* pindexPrev;
+        switch (InsecureRandRange(3)) {
+        case 0: pindexPrev = pindexTip; break;
+        case 1: pindexPrev = pindexSide; break;
+        default: pindexPrev = ::ChainActive()[pindexFrom->nHeight + InsecureRandRange(pindexTip->nHeight - pindexFrom->nHeight + 1)];
+        }
+        const CBlockIndex* pindexEnd = ::ChainActive().Contains(pindexPrev) ? pindexTip : pindexPrev;
+
+        CMutableTransaction txPrev;
+        txPrev.nTime = pindexFrom->nTime;
+        txPrev.vout.emplace_back(COIN, CScript());
+        const CTransactionRef tx = MakeTransactionRef(txPrev);
+        const COutPoint prevout(tx->GetHash(), 0);
+        const unsigned int nTimeTx = pindexFrom->nTime + nStakeMinAge + InsecureRandRange(86400);
+
+        uint256 hashProofOfStake;
+        CheckStakeKernelHash(0x1d00ffff, pindexPrev, pindexFrom->GetBlockHeader(), 100, tx, prevout, nTimeTx, hashProofOfStake);
+
+        const CBlockIndex* pindexModifier = WalkToModifierBlock(pindexFrom, pindexEnd);
+        if (!pindexModifier) {
+            BOOST_CHECK(hashProofOfStake.IsNull());
+            continue;
+        }
+        CDataStream ss(SER_GETHASH, 0);
+        ss << pindexModifier->nStakeModifier << pindexFrom->nTime << 100u << tx->nTime << prevout.n << nTimeTx;
+        BOOST_CHECK_EQUAL(hashProofOfStake, Hash(ss.begin(), ss.end()));
+    }
+}
+
+/** GetAverageStakeWeight() recomputed from scratch: 60 windows of 72 blocks. */
+static double RecomputeAverageStakeWeight(const CBlockIndex* pindexPrev)
+{
+    double weightSum = 0;
+    int i;
+    for (i = 0; pindexPrev && i < 60; i++, pindexPrev = pindexPrev->pprev) {
+        double dStakeKernelsTriedAvg = 0;
+        const CBlockIndex* pindex = pindexPrev;
+        const CBlockIndex* pindexLast = pindexPrev;
+        for (int n = 0; pindex && n < 72; n++, pindex = pindex->pprev) {
+            dStakeKernelsTriedAvg += GetDifficulty(pindex) * 4294967296.0;
+            pindexLast = pindex;
+        }
+        int nStakesTime = pindexPrev->nTime - pindexLast->nTime;
+        weightSum += nStakesTime ? dStakeKernelsTriedAvg / nStakesTime : 0;
+    }
+    return (weightSum / i) + 21;
+}
+
+BOOST_FIXTURE_TEST_CASE(average_stake_weight_memo, VericoinTestingSetup)
+{
+    LOCK(cs_main);
+    CBlockIndex* pindexTip = BuildStakeModifierChain(::ChainActive().Tip(), 200, g_insecure_rand_ctx);
+    // A competing block at the height of the tip must not share its weight
+    CBlockIndex* pindexFork = BuildStakeModifierChain(pindexTip->GetAncestor(150), 50, g_insecure_rand_ctx);
+    BOOST_CHECK_EQUAL(pindexFork->nHeight, pindexTip->nHeight);
+
+    for (CBlockIndex* pindex : {pindexTip, pindexFork, pindexTip->GetAncestor(180), pindexTip->GetAncestor(30)}) {
+        const double expected = RecomputeAverageStakeWeight(pindex);
+        BOOST_CHECK_EQUAL(GetAverageStakeWeight(pindex), expected);
+        // Memoized the second time round
+        BOOST_CHECK_EQUAL(GetAverageStakeWeight(pindex), expected);
+    }
+    BOOST_CHECK(GetAverageStakeWeight(pindexTip) != GetAverageStakeWeight(pindexFork));
+}
+
+BOOST_FIXTURE_TEST_CASE(coin_age_from_utxo, VericoinTestingSetup)
+{
+    LOCK(cs_main);
+    CBlockIndex* pindexTip = BuildStakeModifierChain(::ChainActive().Tip(), 1500, g_insecure_rand_ctx);
+    CCoinsView viewDummy;
+    CCoinsViewCache view(&viewDummy);
+
+    // An output old enough to count, one younger than the minimum age, and one not in the UTXO set
+    const CBlockIndex* pindexOld = pindexTip->GetAncestor(100);
+    const CBlockIndex* pindexYoung = pindexTip->GetAncestor(1450);
+    const COutPoint prevoutOld(InsecureRand256(), 0), prevoutYoung(InsecureRand256(), 1), prevoutMissing(InsecureRand256(), 2);
+    view.AddCoin(prevoutOld, Coin(CTxOut(1000 * COIN, CScript()), pindexOld->nHeight, false, false, pindexOld->nTime - 5), false);
+    view.AddCoin(prevoutYoung, Coin(CTxOut(500 * COIN, CScript()), pindexYoung->nHeight, false, false, pindexYoung->nTime), false);
+
+    CMutableTransaction tx;
+    tx.nTime = pindexTip->nTime + 1;
+    tx.vin.emplace_back(prevoutOld);
+    tx.vin.emplace_back(prevoutYoung);
+    tx.vin.emplace_back(prevoutMissing);
+
+    uint64_t nCoinAge;
+    BOOST_CHECK(GetCoinAge(CTransaction(tx), view, nCoinAge, pindexTip));
+    const arith_uint256 bnCentSecond = arith_uint256(1000 * COIN) * (tx.nTime - (pindexOld->nTime - 5)) / CENT;
+    BOOST_CHECK_EQUAL(nCoinAge, (bnCentSecond * CENT / COIN / (24 * 60 * 60)).GetLow64());
+
+    // An output that is not in a block of the chain has no age to count
+    const COutPoint prevoutMempool(InsecureRand256(), 3);
+    view.AddCoin(prevoutMempool, Coin(CTxOut(COIN, CScript()), MEMPOOL_HEIGHT, false, false, pindexOld->nTime), false);
+    tx.vin.emplace_back(prevoutMempool);
+    BOOST_CHECK(!GetCoinAge(CTransaction(tx), view, nCoinAge, pindexTip));
+}
+
+BOOST_AUTO_TEST_CASE(stake_seen_set)
+{
+    StakeSeenSet stakes(3);
+    const uint256 hashBlock = InsecureRand256(), hashOther = InsecureRand256();
+    const std::pair<COutPoint, unsigned int> stake(COutPoint(InsecureRand256(), 1), 1500000000);
+
+    BOOST_CHECK(!stakes.IsDuplicate(stake, hashBlock));
+    BOOST_CHECK(stakes.Insert(stake, hashBlock));
+    BOOST_CHECK(!stakes.Insert(stake, hashOther));
+
+    // The block that used the stake may come again, any other block is a duplicate
+    BOOST_CHECK(!stakes.IsDuplicate(stake, hashBlock));
+    BOOST_CHECK(stakes.IsDuplicate(stake, hashOther));
+
+    // The same output staked at another time is not
+    BOOST_CHECK(!stakes.IsDuplicate(std::make_pair(stake.first, stake.second + 16), hashOther));
+
+    // The oldest stakes are forgotten first
+    for (int i = 0; i < 3; i++) {
+        BOOST_CHECK(stakes.Insert(std::make_pair(COutPoint(InsecureRand256(), i), 1500000000), InsecureRand256()));
+        BOOST_CHECK_EQUAL(stakes.size(), size_t(std::min(i + 2, 3)));
+    }
+    BOOST_CHECK(!stakes.IsDuplicate(stake, hashOther));
+
+    stakes.Clear();
+    BOOST_CHECK_EQUAL(stakes.size(), 0U);
+}
+
+/** Records the blocks that completed validation */
+struct BlockCheckedCatcher : public CValidationInterface {
+    std::vector<uint256> vChecked;
+
+protected:
+    void BlockChecked(const CBlock& block, const BlockValidationState&) override { vChecked.push_back(block.GetHash()); }
+};
+
+BOOST_FIXTURE_TEST_CASE(duplicate_stake_reorg, VericoinTestingSetup)
+{
+    // The active chain and a fork with more work, both from genesis
+    CBlockIndex *pindexTip, *pindexFork;
+    {
+        LOCK(cs_main);
+        CBlockIndex* pindexGenesis = ::ChainActive().Tip();
+        pindexTip = BuildStakeModifierChain(pindexGenesis, 3, g_insecure_rand_ctx);
+        pindexFork = BuildStakeModifierChain(pindexGenesis, 4, g_insecure_rand_ctx);
+        for (CBlockIndex* pindexEnd : {pindexTip, pindexFork}) {
+            for (int nHeight = 1; nHeight <= pindexEnd->nHeight; nHeight++) {
+                CBlockIndex* pindex = pindexEnd->GetAncestor(nHeight);
+                pindex->nChainWork = pindex->pprev->nChainWork + GetBlockProof(*pindex);
+            }
+        }
+        ::ChainActive().SetTip(pindexTip);
+        ::ChainstateActive().CoinsTip().SetBestBlock(pindexTip->GetBlockHash());
+    }
+    SetMockTime(pindexTip->GetBlockTime());
+    BOOST_REQUIRE(!::ChainstateActive().IsInitialBlockDownload());
+
+    // A block staking what the tip staked
+    CMutableTransaction coinbase, coinstake;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.SetNull();
+    coinbase.vin[0].scriptSig = CScript() << 4 << OP_0;
+    coinbase.vout.resize(1);
+    coinbase.vout[0].SetEmpty();
+    coinstake.nTime = pindexTip->nTime;
+    coinstake.vin.emplace_back(COutPoint(InsecureRand256(), 0));
+    coinstake.vout.resize(2);
+    coinstake.vout[0].SetEmpty();
+    coinstake.vout[1] = CTxOut(COIN, CScript() << OP_TRUE);
+    CBlock block;
+    block.nTime = pindexTip->nTime;
+    block.nBits = pindexTip->nBits;
+    block.vtx = {MakeTransactionRef(coinbase), MakeTransactionRef(coinstake)};
+    BOOST_REQUIRE(block.IsProofOfStake());
+    g_stake_seen.Insert(block.GetProofOfStake(), pindexTip->GetBlockHash());
+
+    BlockCheckedCatcher catcher;
+    RegisterValidationInterface(&catcher);
+
+    // Next to the first block it cannot outweigh it, so it is dropped unchecked
+    block.hashPrevBlock = pindexTip->pprev->GetBlockHash();
+    bool fNewBlock = false, fPoSDuplicate = false;
+    BOOST_CHECK(!ProcessNewBlock(Params(), std::make_shared<const CBlock>(block), true, &fNewBlock, nullptr, &fPoSDuplicate));
+    BOOST_CHECK(fPoSDuplicate);
+    BOOST_CHECK(catcher.vChecked.empty());
+    BOOST_CHECK(!WITH_LOCK(cs_main, return LookupBlockIndex(block.GetHash())));
+
+    // On a chain with more work it is validated, as that chain may win
+    block.hashPrevBlock = pindexFork->GetBlockHash();
+    fPoSDuplicate = false;
+    ProcessNewBlock(Params(), std::make_shared<const CBlock>(block), true, &fNewBlock, nullptr, &fPoSDuplicate);
+    BOOST_CHECK(fPoSDuplicate);
+    BOOST_CHECK(catcher.vChecked == std::vector<uint256>({block.GetHash()}));
+
+    UnregisterValidationInterface(&catcher);
+    g_stake_seen.Clear();
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,206 @@
+// Copyright (c) 2020 The Vericonomy developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <crypto/scrypt.h>
+#include <primitives/block.h>
+#include <test/util/setup_common.h>
+#include <uint256.h>
+
+#include <atomic>
+#include <memory>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(scrypt_tests, BasicTestingSetup)
+
+static CBlockHeader TestHeader(uint32_t nNonce)
+{
+    CBlockHeader header;
+    header.nVersion = 1;
+    header.hashMerkleRoot = uint256S("0x60424046d38de827de0ed1a20a351aa7f3557e3e1d3df6bfb34a94bc6161ec68");
+    header.nTime = 1399690945;
+    header.nBits = 0x1e0fffff;
+    header.nNonce = nNonce;
+    return header;
+}
+
+BOOST_AUTO_TEST_CASE(scrypthash_pooled_scratchpad)
+{
+    std::vector<unsigned char> scratchbuf(SCRYPT_SCRATCHPAD_SIZE);
+    std::vector<uint256> expected;
+    for (uint32_t nNonce = 612416; nNonce < 612420; nNonce++) {
+        CBlockHeader header = TestHeader(nNonce);
+        uint256 hash_owned, hash_pooled;
+        scryptHash(BEGIN(header.nVersion), BEGIN(hash_owned), scratchbuf.data());
+        scryptHash(BEGIN(header.nVersion), BEGIN(hash_pooled));
+        BOOST_CHECK(hash_owned == hash_pooled);
+        expected.push_back(hash_owned);
+    }
+#if !CLIENT_IS_VERIUM
+    // Vericoin genesis block
+    BOOST_CHECK(expected[0] == uint256S("0x000004da58a02be894a6c916d349fe23cc29e21972cafb86b5d3f07c4b8e6bb8"));
+#endif
+
+    // Scratchpads handed back to the pool by one thread are reused by others.
+    std::vector<uint256> results(expected.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < expected.size(); i++) {
+        threads.emplace_back([&results, i] {
+            CBlockHeader header = TestHeader(612416 + i);
+            scryptHash(BEGIN(header.nVersion), BEGIN(results[i]));
+        });
+    }
+    for (auto& t : threads) t.join();
+    BOOST_CHECK(results == expected);
+}
+
+BOOST_AUTO_TEST_CASE(workhash_memoization)
+{
+    CBlockHeader header = TestHeader(612416);
+    uint256 expected;
+    scryptHash(BEGIN(header.nVersion), BEGIN(expected));
+
+    uint64_t nCount = GetWorkHashCount();
+    BOOST_CHECK(header.GetWorkHash() == expected);
+    BOOST_CHECK_EQUAL(GetWorkHashCount(), nCount + 1);
+    BOOST_CHECK(header.GetWorkHash() == expected);
+    BOOST_CHECK_EQUAL(GetWorkHashCount(), nCount + 1);
+
+    // Copies, including blocks built from the header, share the memoized hash
+    CBlock block(header);
+    BOOST_CHECK(block.GetWorkHash() == expected);
+    BOOST_CHECK(block.GetBlockHeader().GetWorkHash() == expected);
+    BOOST_CHECK_EQUAL(GetWorkHashCount(), nCount + 1);
+
+    // nFlags is not part of the hashed header
+    block.nFlags = 1;
+    BOOST_CHECK(block.GetWorkHash() == expected);
+    BOOST_CHECK_EQUAL(GetWorkHashCount(), nCount + 1);
+
+    // Changing a hashed field invalidates the memoized hash
+    block.nNonce++;
+    uint256 expected_next;
+    scryptHash(BEGIN(block.nVersion), BEGIN(expected_next));
+    BOOST_CHECK(block.GetWorkHash() == expected_next);
+    BOOST_CHECK_EQUAL(GetWorkHashCount(), nCount + 2);
+    BOOST_CHECK(header.GetWorkHash() == expected);
+    BOOST_CHECK_EQUAL(GetWorkHashCount(), nCount + 2);
+}
+
+BOOST_AUTO_TEST_CASE(scrypt_autodetect)
+{
+    // The description ends with the lane count of the selected kernel
+    std::string impl = ScryptAutoDetect();
+    BOOST_CHECK(impl.size() > 5 && impl.compare(impl.size() - 4, 4, "way)") == 0);
+    BOOST_CHECK(ScryptAutoDetect() == impl);
+}
+
+BOOST_AUTO_TEST_CASE(scrypthash_batch)
+{
+    // Enough headers for two rounds of the widest kernel plus single-way leftovers
+#if CLIENT_IS_VERIUM
+    const size_t count = 3;
+#else
+    const size_t count = 29;
+#endif
+    std::vector<CBlockHeader> headers;
+    std::vector<unsigned char> input;
+    for (size_t i = 0; i < count; i++) {
+        headers.push_back(TestHeader(612416 + i));
+        headers.back().nTime += i / 2; // lanes must not share a midstate
+        input.insert(input.end(), BEGIN(headers.back().nVersion), BEGIN(headers.back().nVersion) + 80);
+    }
+
+    std::vector<uint256> hashes(count);
+    scryptHashBatch(input.data(), BEGIN(hashes[0]), count);
+    for (size_t i = 0; i < count; i++) {
+        uint256 expected;
+        scryptHash(BEGIN(headers[i].nVersion), BEGIN(expected));
+        BOOST_CHECK(hashes[i] == expected);
+    }
+
+    // Memoized batch hashes are served without recomputation
+    CBlockHeader::MemoizeWorkHashes(headers.data(), headers.size());
+    uint64_t nCount = GetWorkHashCount();
+    for (size_t i = 0; i < count; i++)
+        BOOST_CHECK(headers[i].GetWorkHash() == hashes[i]);
+    BOOST_CHECK_EQUAL(GetWorkHashCount(), nCount);
+}
+
+BOOST_AUTO_TEST_CASE(scrypt_multi_abort)
+{
+    // Kernels that run several cores or a C++ core give up when asked to
+    const std::string impl = ScryptAutoDetect();
+    const bool fAbortable = impl.find("(12way)") != std::string::npos ||
+                            impl.find("(16way)") != std::string::npos ||
+                            impl.find("(24way)") != std::string::npos;
+
+    std::unique_ptr<unsigned char, decltype(&free)> scratchbuf(scrypt_buffer_alloc(), &free);
+    BOOST_REQUIRE(scratchbuf);
+    CBlockHeader header = TestHeader(612416);
+    uint256 target; // nothing meets a zero target
+    std::atomic<bool> abort(true);
+    int nHashes = -1;
+    BOOST_CHECK(!scrypt_N_1_1_256_multi(BEGIN(header.nVersion), target, &nHashes, scratchbuf.get(), &abort));
+    if (fAbortable)
+        BOOST_CHECK_EQUAL(nHashes, 0);
+    else
+        BOOST_CHECK(nHashes > 0);
+    BOOST_CHECK_EQUAL(header.nNonce, 612416U);
+
+#if !CLIENT_IS_VERIUM
+    abort = false;
+    nHashes = -1;
+    BOOST_CHECK(!scrypt_N_1_1_256_multi(BEGIN(header.nVersion), target, &nHashes, scratchbuf.get(), &abort));
+    BOOST_CHECK(nHashes > 0);
+#endif
+}
+
+#ifdef HAVE_SCRYPT_16WAY
+BOOST_AUTO_TEST_CASE(scrypt_avx512_kernels)
+{
+    if (ScryptAutoDetect() != "avx512(16way)") {
+        BOOST_TEST_MESSAGE("AVX512F not available, skipping");
+        return;
+    }
+
+    // 16-way SHA256 transform against the scalar one, lane by lane
+    uint32_t block[16 * 16], init[16 * 8], state[16 * 8];
+    for (uint32_t& w : block) w = InsecureRand32();
+    scrypt_avx512::sha256_init_16way(init);
+    BOOST_CHECK_EQUAL(init[0], 0x6a09e667U);
+    BOOST_CHECK_EQUAL(init[16 * 7 + 15], 0x5be0cd19U);
+    for (int swap = 0; swap < 2; swap++) {
+        memcpy(state, init, sizeof(state));
+        scrypt_avx512::sha256_transform_16way(state, block, swap);
+        for (int k = 0; k < 16; k++) {
+            uint32_t lane_block[16], lane_state[8];
+            for (int i = 0; i < 16; i++) lane_block[i] = block[16 * i + k];
+            for (int i = 0; i < 8; i++) lane_state[i] = init[16 * i + k];
+            sha256_transform(lane_state, lane_block, swap);
+            for (int i = 0; i < 8; i++) BOOST_CHECK_EQUAL(state[16 * i + k], lane_state[i]);
+        }
+    }
+
+    // 16-way Salsa20/8 core against the scalar scrypt_core, with a small N
+    const int nTestN = 1024;
+    std::vector<uint32_t> X(16 * 32), V(16 * 32 * nTestN), lane_V(32 * nTestN);
+    for (uint32_t& w : X) w = InsecureRand32();
+    std::vector<uint32_t> expected(X.size());
+    for (int k = 0; k < 16; k++) {
+        uint32_t lane_X[32];
+        for (int i = 0; i < 32; i++) lane_X[i] = X[16 * i + k];
+        scrypt_core(lane_X, lane_V.data(), nTestN);
+        for (int i = 0; i < 32; i++) expected[16 * i + k] = lane_X[i];
+    }
+    scrypt_avx512::scrypt_core_16way(X.data(), V.data(), nTestN);
+    BOOST_CHECK(X == expected);
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
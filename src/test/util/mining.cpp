@@ -10,6 +10,7 @@
 #include <miner.h>
 #include <node/context.h>
 #include <pow.h>
+#include <random.h>
 #include <script/standard.h>
 #include <validation.h>
 
@@ -51,3 +52,24 @@ std::shared_ptr<CBlock> PrepareBlock(const NodeContext& node, const CScript& coi
 
     return block;
 }
+
+CBlockIndex* BuildStakeModifierChain(CBlockIndex* pindexPrev, int nBlocks, FastRandomContext& rng)
+{
+    AssertLockHeld(cs_main);
+    for (int i = 0; i < nBlocks; i++) {
+        CBlockHeader header;
+        header.hashPrevBlock = pindexPrev->GetBlockHash();
+        header.nTime = pindexPrev->nTime + 30 + rng.randrange(61);
+        header.nBits = 0x1e0fffff - rng.randrange(0x10000);
+        header.nNonce = rng.rand32();
+        CBlockIndex* pindex = new CBlockIndex(header);
+        pindex->phashBlock = &::BlockIndex().emplace(header.GetHash(), pindex).first->first;
+        pindex->pprev = pindexPrev;
+        pindex->nHeight = pindexPrev->nHeight + 1;
+        pindex->BuildSkip();
+        pindex->SetStakeModifier(rng.rand64(), rng.randrange(3) == 0);
+        pindex->nStakeModifierTimeMax = std::max(pindexPrev->nStakeModifierTimeMax, pindex->GeneratedStakeModifier() ? pindex->nTime : 0u);
+        pindexPrev = pindex;
+    }
+    return pindexPrev;
+}
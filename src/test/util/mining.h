@@ -9,7 +9,9 @@
 #include <string>
 
 class CBlock;
+class CBlockIndex;
 class CScript;
+class FastRandomContext;
 class CTxIn;
 struct NodeContext;
 
@@ -22,4 +24,12 @@ std::shared_ptr<CBlock> PrepareBlock(const NodeContext&, const CScript& coinbase
 /** RPC-like helper function, returns the generated coin */
 CTxIn generatetoaddress(const NodeContext&, const std::string& address);
 
+/**
+ * Add nBlocks synthetic headers on top of pindexPrev to the block index, spaced
+ * 30 to 90 seconds apart with varying nBits, about a third of them generating a
+ * stake modifier.
+ * Returns the last one; does not change the active chain. Requires cs_main.
+ */
+CBlockIndex* BuildStakeModifierChain(CBlockIndex* pindexPrev, int nBlocks, FastRandomContext& rng);
+
 #endif // BITCOIN_TEST_UTIL_MINING_H
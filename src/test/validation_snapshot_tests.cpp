@@ -0,0 +1,257 @@
+// Copyright (c) 2020 The Vericonomy developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chain.h>
+#include <chainparams.h>
+#include <coins.h>
+#include <consensus/validation.h>
+#include <index/txindex.h>
+#include <node/coinstats.h>
+#include <node/utxo_snapshot.h>
+#include <streams.h>
+#include <test/util/mining.h>
+#include <test/util/setup_common.h>
+#include <txdb.h>
+#include <validation.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+/** The chain whose genesis block this build connects. */
+struct SnapshotTestingSetup : public TestingSetup {
+    SnapshotTestingSetup() : TestingSetup(CLIENT_IS_VERIUM ? CBaseChainParams::VERIUM : CBaseChainParams::VERICOIN) {}
+};
+
+/** The chain params with other expected snapshots, loading them as on Verium unless fIsVericoin. */
+struct SnapshotParams : public CChainParams {
+    SnapshotParams(const MapAssumeutxo& data, bool fIsVericoin = false) : CChainParams(Params())
+    {
+        m_assumeutxo_data = data;
+        consensus.fIsVericoin = fIsVericoin;
+    }
+};
+
+typedef std::vector<std::pair<COutPoint, Coin>> SnapshotCoins;
+
+SnapshotCoins RandomCoins(int nCoins, int nMaxHeight)
+{
+    SnapshotCoins coins;
+    for (int i = 0; i < nCoins; i++) {
+        const CTxOut out(1 + InsecureRandRange(1000 * COIN), CScript() << OP_TRUE);
+        coins.emplace_back(COutPoint(InsecureRand256(), InsecureRandRange(4)),
+            Coin(out, 1 + InsecureRandRange(nMaxHeight), i % 10 == 0, i % 7 == 0, 1500000000 + InsecureRandRange(1000000)));
+    }
+    std::sort(coins.begin(), coins.end(), [](const std::pair<COutPoint, Coin>& a, const std::pair<COutPoint, Coin>& b) { return a.first < b.first; });
+    return coins;
+}
+
+/** The hash_serialized_3 of a UTXO set of these coins. */
+uint256 HashCoins(const SnapshotCoins& coins, const uint256& hashBlock)
+{
+    CCoinsViewDB db("", 1 << 20, true, false);
+    CCoinsViewCache cache(&db);
+    for (const auto& coin : coins) {
+        cache.AddCoin(coin.first, Coin(coin.second), false);
+    }
+    cache.SetBestBlock(hashBlock);
+    BOOST_REQUIRE(cache.Flush());
+    CCoinsStats stats;
+    BOOST_REQUIRE(GetUTXOStats(&db, stats));
+    return stats.hashSerialized;
+}
+
+/** Write the coins as dumptxoutset does. */
+void WriteSnapshot(const fs::path& path, const SnapshotMetadata& metadata, const SnapshotCoins& coins, bool fTrailing = false)
+{
+    CAutoFile file(fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION);
+    file << metadata;
+    for (const auto& coin : coins) {
+        file << coin.first;
+        file << coin.second;
+    }
+    if (fTrailing) file << uint8_t{0};
+}
+
+bool LoadSnapshotFile(const fs::path& path, const CChainParams& chainparams, std::string& error)
+{
+    CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+    SnapshotMetadata metadata;
+    file >> metadata;
+    return LoadTxOutSet(file, metadata, chainparams, error);
+}
+
+/** Headers above the tip, as the headers sync accepts them. */
+CBlockIndex* BuildHeaders(int nBlocks)
+{
+    LOCK(cs_main);
+    CBlockIndex* pindexTip = BuildStakeModifierChain(::ChainActive().Tip(), nBlocks, g_insecure_rand_ctx);
+    for (CBlockIndex* pindex = pindexTip; pindex != ::ChainActive().Tip(); pindex = pindex->pprev) {
+        pindex->nStatus = BLOCK_VALID_TREE;
+    }
+    for (int nHeight = ::ChainActive().Height() + 1; nHeight <= pindexTip->nHeight; nHeight++) {
+        CBlockIndex* pindex = pindexTip->GetAncestor(nHeight);
+        pindex->nChainWork = pindex->pprev->nChainWork + GetBlockProof(*pindex);
+    }
+    return pindexTip;
+}
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(validation_snapshot_tests, SnapshotTestingSetup)
+
+BOOST_AUTO_TEST_CASE(loadtxoutset)
+{
+    CBlockIndex* pindexHeaders = BuildHeaders(200);
+    CBlockIndex* pindexBase = pindexHeaders->GetAncestor(150);
+    const SnapshotCoins coins = RandomCoins(500, pindexBase->nHeight);
+    const AssumeutxoData au_data{HashCoins(coins, pindexBase->GetBlockHash()), 1000, 12345 * COIN};
+    const SnapshotParams params({{pindexBase->nHeight, au_data}});
+    const SnapshotMetadata metadata(pindexBase->GetBlockHash(), coins.size(), au_data.nChainTx);
+    const fs::path path = GetDataDir() / "utxo.dat";
+    WriteSnapshot(path, metadata, coins);
+
+    // A coin of the chain so far, which the snapshot replaces
+    const COutPoint outpointOld(InsecureRand256(), 0);
+    {
+        LOCK(cs_main);
+        ::ChainstateActive().CoinsTip().AddCoin(outpointOld, Coin(CTxOut(COIN, CScript()), 0, true, false, 1500000000), false);
+    }
+
+    std::string error;
+    BOOST_REQUIRE_MESSAGE(LoadSnapshotFile(path, params, error), error);
+
+    {
+    LOCK(cs_main);
+    BOOST_CHECK_EQUAL(::ChainActive().Tip(), pindexBase);
+    BOOST_CHECK_EQUAL(pindexBase->nChainTx, au_data.nChainTx);
+    BOOST_CHECK_EQUAL(pindexBase->nMoneySupply, au_data.nMoneySupply);
+    for (const CBlockIndex* pindex = pindexBase; pindex->pprev; pindex = pindex->pprev) {
+        BOOST_CHECK(pindex->IsValid(BLOCK_VALID_SCRIPTS));
+        BOOST_CHECK(pindex->HaveTxsDownloaded());
+        BOOST_CHECK(!(pindex->nStatus & BLOCK_HAVE_DATA));
+        BOOST_CHECK(pindex->nStatus & BLOCK_ASSUMED_VALID);
+    }
+    // The blocks above the base are still to download
+    BOOST_CHECK(!pindexHeaders->HaveTxsDownloaded());
+
+    CCoinsViewCache& tip = ::ChainstateActive().CoinsTip();
+    BOOST_CHECK_EQUAL(tip.GetBestBlock(), pindexBase->GetBlockHash());
+    BOOST_CHECK(!tip.HaveCoin(outpointOld));
+    for (const auto& coin : coins) {
+        Coin loaded;
+        BOOST_REQUIRE(tip.GetCoin(coin.first, loaded));
+        BOOST_CHECK(loaded.out == coin.second.out);
+        BOOST_CHECK_EQUAL(loaded.nHeight, coin.second.nHeight);
+        BOOST_CHECK_EQUAL(loaded.fCoinBase, coin.second.fCoinBase);
+        BOOST_CHECK_EQUAL(loaded.fCoinStake, coin.second.fCoinStake);
+        BOOST_CHECK_EQUAL(loaded.nTime, coin.second.nTime);
+    }
+    CCoinsStats stats;
+    BOOST_REQUIRE(GetUTXOStats(&::ChainstateActive().CoinsDB(), stats));
+    BOOST_CHECK_EQUAL(stats.hashSerialized, au_data.hash_serialized);
+    BOOST_CHECK_EQUAL(stats.coins_count, coins.size());
+    BOOST_CHECK(HaveTxOutSetSnapshot());
+    }
+
+    // The snapshot is no longer above the tip
+    BOOST_CHECK(!LoadSnapshotFile(path, params, error));
+    BOOST_CHECK_EQUAL(WITH_LOCK(cs_main, return ::ChainActive().Tip()), pindexBase);
+
+    // and the blocks it stands in for cannot be disconnected
+    BlockValidationState state;
+    BOOST_CHECK(!InvalidateBlock(state, Params(), pindexBase->GetAncestor(100)));
+    BOOST_CHECK(state.IsError());
+    BOOST_CHECK_EQUAL(WITH_LOCK(cs_main, return ::ChainActive().Tip()), pindexBase);
+}
+
+BOOST_AUTO_TEST_CASE(loadtxoutset_rejected)
+{
+    CBlockIndex* pindexBase = BuildHeaders(100);
+    const SnapshotCoins coins = RandomCoins(100, pindexBase->nHeight);
+    const AssumeutxoData au_data{HashCoins(coins, pindexBase->GetBlockHash()), 500, 100 * COIN};
+    const SnapshotParams params({{pindexBase->nHeight, au_data}});
+    const SnapshotMetadata metadata(pindexBase->GetBlockHash(), coins.size(), au_data.nChainTx);
+    const fs::path path = GetDataDir() / "utxo.dat";
+    const CBlockIndex* pindexGenesis = WITH_LOCK(cs_main, return ::ChainActive().Tip());
+
+    const auto check_rejected = [&](const CChainParams& chainparams) {
+        std::string error;
+        BOOST_CHECK(!LoadSnapshotFile(path, chainparams, error));
+        BOOST_CHECK(!error.empty());
+        LOCK(cs_main);
+        BOOST_CHECK_EQUAL(::ChainActive().Tip(), pindexGenesis);
+        BOOST_CHECK(::ChainstateActive().CoinsTip().GetBestBlock() == pindexGenesis->GetBlockHash());
+        std::unique_ptr<CCoinsViewCursor> pcursor(::ChainstateActive().CoinsDB().Cursor());
+        BOOST_CHECK(!pcursor->Valid());
+    };
+
+    WriteSnapshot(path, metadata, coins);
+    // On Vericoin
+    check_rejected(SnapshotParams({{pindexBase->nHeight, au_data}}, true));
+    // Not expected at its height
+    check_rejected(SnapshotParams({{pindexBase->nHeight - 1, au_data}}));
+    // Of other coins
+    check_rejected(SnapshotParams({{pindexBase->nHeight, {InsecureRand256(), au_data.nChainTx, au_data.nMoneySupply}}}));
+    // Of another transaction count
+    check_rejected(SnapshotParams({{pindexBase->nHeight, {au_data.hash_serialized, au_data.nChainTx + 1, au_data.nMoneySupply}}}));
+
+    // Based on an unknown block
+    WriteSnapshot(path, SnapshotMetadata(InsecureRand256(), coins.size(), au_data.nChainTx), coins);
+    check_rejected(params);
+    // With a coin missing, or counting one less
+    WriteSnapshot(path, metadata, SnapshotCoins(coins.begin(), coins.end() - 1));
+    check_rejected(params);
+    WriteSnapshot(path, SnapshotMetadata(pindexBase->GetBlockHash(), coins.size() - 1, au_data.nChainTx), coins);
+    check_rejected(params);
+    // With data after the last coin
+    WriteSnapshot(path, metadata, coins, true);
+    check_rejected(params);
+    // Out of order
+    SnapshotCoins coins_swapped = coins;
+    std::swap(coins_swapped[10], coins_swapped[11]);
+    WriteSnapshot(path, metadata, coins_swapped);
+    check_rejected(params);
+    // With a coin newer than the base
+    SnapshotCoins coins_newer = coins;
+    coins_newer[10].second.nHeight = pindexBase->nHeight + 1;
+    WriteSnapshot(path, metadata, coins_newer);
+    check_rejected(SnapshotParams({{pindexBase->nHeight, {HashCoins(coins_newer, pindexBase->GetBlockHash()), au_data.nChainTx, au_data.nMoneySupply}}}));
+
+    // The snapshot itself loads
+    WriteSnapshot(path, metadata, coins);
+    std::string error;
+    BOOST_CHECK(!WITH_LOCK(cs_main, return HaveTxOutSetSnapshot()));
+    BOOST_CHECK_MESSAGE(LoadSnapshotFile(path, params, error), error);
+}
+
+BOOST_AUTO_TEST_CASE(loadtxoutset_with_index)
+{
+    CBlockIndex* pindexBase = BuildHeaders(100);
+    const SnapshotCoins coins = RandomCoins(100, pindexBase->nHeight);
+    const AssumeutxoData au_data{HashCoins(coins, pindexBase->GetBlockHash()), 500, 100 * COIN};
+    const SnapshotParams params({{pindexBase->nHeight, au_data}});
+    const fs::path path = GetDataDir() / "utxo.dat";
+    WriteSnapshot(path, SnapshotMetadata(pindexBase->GetBlockHash(), coins.size(), au_data.nChainTx), coins);
+    const CBlockIndex* pindexGenesis = WITH_LOCK(cs_main, return ::ChainActive().Tip());
+
+    // The transaction index could not sync the blocks below the base
+    g_txindex = MakeUnique<TxIndex>(1 << 20, true);
+    g_txindex->Start();
+    std::string error;
+    BOOST_CHECK(!LoadSnapshotFile(path, params, error));
+    BOOST_CHECK(error.find("index") != std::string::npos);
+    {
+    LOCK(cs_main);
+    BOOST_CHECK_EQUAL(::ChainActive().Tip(), pindexGenesis);
+    BOOST_CHECK(!HaveTxOutSetSnapshot());
+    }
+    g_txindex->Stop();
+    g_txindex.reset();
+
+    BOOST_CHECK_MESSAGE(LoadSnapshotFile(path, params, error), error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -141,6 +141,57 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     return ret;
 }
 
+bool CCoinsViewDB::LoadCoins(CCoinsViewCursor& cursor, const uint256& hashBlock, uint64_t nCoins)
+{
+    CDBBatch batch(db);
+    size_t batch_size = (size_t)gArgs.GetArg("-dbbatchsize", nDefaultDbBatchSize);
+    assert(!hashBlock.IsNull());
+
+    // As in BatchWrite, mark the database as being in the middle of a
+    // transition until the last batch.
+    batch.Erase(DB_BEST_BLOCK);
+    batch.Write(DB_HEAD_BLOCKS, Vector(hashBlock, GetBestBlock()));
+
+    const auto flush_partial = [&] {
+        if (batch.SizeEstimate() > batch_size) {
+            LogPrint(BCLog::COINDB, "Writing partial batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
+            db.WriteBatch(batch);
+            batch.Clear();
+        }
+    };
+
+    size_t erased = 0;
+    std::unique_ptr<CDBIterator> pcursor(db.NewIterator());
+    COutPoint key;
+    CoinEntry entry(&key);
+    for (pcursor->Seek(DB_COIN); pcursor->Valid(); pcursor->Next()) {
+        if (!pcursor->GetKey(entry) || entry.key != DB_COIN) break;
+        batch.Erase(entry);
+        erased++;
+        flush_partial();
+    }
+
+    uint64_t count = 0;
+    Coin coin;
+    for (; cursor.Valid(); cursor.Next()) {
+        if (!cursor.GetKey(key) || !cursor.GetValue(coin)) break;
+        batch.Write(entry, coin);
+        count++;
+        flush_partial();
+    }
+    if (count != nCoins) {
+        return error("%s: loaded %u coins instead of %u", __func__, count, nCoins);
+    }
+
+    batch.Erase(DB_HEAD_BLOCKS);
+    batch.Write(DB_BEST_BLOCK, hashBlock);
+
+    LogPrint(BCLog::COINDB, "Writing final batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
+    bool ret = db.WriteBatch(batch);
+    LogPrint(BCLog::COINDB, "Replaced %u transaction outputs with %u in coin database...\n", (unsigned int)erased, (unsigned int)count);
+    return ret;
+}
+
 size_t CCoinsViewDB::EstimateSize() const
 {
     return db.EstimateSize(DB_COIN, (char)(DB_COIN+1));
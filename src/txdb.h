@@ -57,6 +57,15 @@ public:
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
     CCoinsViewCursor *Cursor() const override;
 
+    /**
+     * Replace all coins with those of a cursor, such as one over a UTXO set
+     * snapshot, in large batches straight to the database rather than through
+     * a cache. The cursor must give its coins in key order, which keeps the
+     * writes sequential. Fails, leaving the database marked as in transition
+     * to hashBlock, unless it gives exactly nCoins coins.
+     */
+    bool LoadCoins(CCoinsViewCursor& cursor, const uint256& hashBlock, uint64_t nCoins);
+
     //! Attempt to update from an older database format. Returns whether an error occurred.
     bool Upgrade();
     size_t EstimateSize() const override;
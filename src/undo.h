@@ -16,19 +16,22 @@
 /** Formatter for undo information for a CTxIn
  *
  *  Contains the prevout's CTxOut being spent, and its metadata as well
- *  (coinbase or not, height). The serialization contains a dummy value of
- *  zero. This is compatible with older versions which expect to see
- *  the transaction version there.
+ *  (coinbase or coinstake, height, time). Where older versions expect to see
+ *  the transaction version, current records store the offset of the
+ *  transaction in its block, shifted left by one with the low bit set. An
+ *  even value there (older records only ever wrote zero) marks the older
+ *  format, whose height code carries no coinstake flag and no offset.
  */
 struct TxInUndoFormatter
 {
     template<typename Stream>
     void Ser(Stream &s, const Coin& txout) {
-       ::Serialize(s, VARINT(txout.nHeight * uint32_t{2} + txout.fCoinBase ));
+        const uint32_t nCode = txout.nHeight * uint32_t{4} + txout.fCoinStake * uint32_t{2} + txout.fCoinBase;
+        ::Serialize(s, VARINT(nCode));
         ::Serialize(s, VARINT(txout.nTime));
-        if (txout.nHeight > 0) {
+        if (nCode >= 2) {
             // Required to maintain compatibility with older undo format.
-            ::Serialize(s, (unsigned char)0);
+            ::Serialize(s, VARINT(txout.nTxOffset * 2 + 1));
         }
         ::Serialize(s, Using<TxOutCompression>(txout.out));
     }
@@ -37,17 +40,24 @@ struct TxInUndoFormatter
     void Unser(Stream &s, Coin& txout) {
         uint32_t nCode = 0;
         ::Unserialize(s, VARINT(nCode));
-        txout.nHeight = nCode >> 2;
-        txout.fCoinBase = nCode & 1;
-        txout.fCoinStake = nCode & 2;
         ::Unserialize(s, VARINT(txout.nTime));
-        if (txout.nHeight > 0) {
+        unsigned int nSlot = 0;
+        if (nCode >= 2) {
             // Old versions stored the version number for the last spend of
-            // a transaction's outputs. Non-final spends were indicated with
-            // height = 0.
-            unsigned int nVersionDummy;
-            ::Unserialize(s, VARINT(nVersionDummy));
+            // a transaction's outputs there, and later ones a zero.
+            // Non-final spends were indicated with height = 0.
+            ::Unserialize(s, VARINT(nSlot));
+        }
+        if (nSlot & 1) {
+            txout.nHeight = nCode >> 2;
+            txout.fCoinStake = nCode & 2;
+            txout.nTxOffset = nSlot >> 1;
+        } else {
+            txout.nHeight = nCode >> 1;
+            txout.fCoinStake = false;
+            txout.nTxOffset = 0;
         }
+        txout.fCoinBase = nCode & 1;
         ::Unserialize(s, Using<TxOutCompression>(txout.out));
     }
 };
@@ -18,19 +18,16 @@
 
 #include <util/miniunz.h>
 
+#include <crypto/common.h>
 #include <logging.h>
-#include <sys/stat.h>
+#include <tinyformat.h>
+#include <util/system.h>
+#include <util/threadnames.h>
 
-#ifdef _WIN32
-#include <direct.h>
-#  define MKDIR(d) _mkdir(d)
-#else
-#  define MKDIR(d) mkdir(d, 0775)
-#endif
-
-#ifdef MAC_OSX
-#  define fopen64 fopen
-#endif
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <thread>
 
 
 int is_file_within_path(const fs::path& file_path, const fs::path& dir_path)
@@ -38,6 +35,11 @@ int is_file_within_path(const fs::path& file_path, const fs::path& dir_path)
     boost::filesystem::path file_path_abs = absolute(file_path);
     boost::filesystem::path dir_path_abs = absolute(dir_path);
 
+    /* absolute() does not resolve "..", so a name climbing out of the directory would still match it */
+    for (const boost::filesystem::path& part : file_path)
+        if (part == "..")
+            return 0;
+
     int file_len = std::distance(file_path_abs.begin(), file_path_abs.end());
     int dir_len = std::distance(dir_path.begin(), dir_path.end());
     if (dir_len > file_len)
@@ -46,127 +48,697 @@ int is_file_within_path(const fs::path& file_path, const fs::path& dir_path)
     return std::equal(dir_path.begin(), dir_path.end(), file_path_abs.begin());
 }
 
-int zip_extract_currentfile(unzFile uf, const fs::path& root_file_path, const char * allowed_dir)
+static const uint32_t ZIP_LOCAL_HEADER_SIGNATURE = 0x04034b50;
+static const uint32_t ZIP_DATA_DESCRIPTOR_SIGNATURE = 0x08074b50;
+static const uint32_t ZIP_CENTRAL_HEADER_SIGNATURE = 0x02014b50;
+static const uint32_t ZIP_END_OF_CENTRAL_DIR_SIGNATURE = 0x06054b50;
+static const size_t ZIP_LOCAL_HEADER_SIZE = 30;
+static const uint16_t ZIP_FLAG_ENCRYPTED = 1 << 0;
+static const uint16_t ZIP_FLAG_DATA_DESCRIPTOR = 1 << 3;
+static const uint16_t ZIP_EXTRA_ZIP64 = 0x0001;
+static const size_t ZIP_STREAM_BUFFER_SIZE = 1 << 16;
+
+ZipStreamExtractor::ZipStreamExtractor(const fs::path& root_file_path_in, const char* allowed_dir, std::function<void(const fs::path&)> on_file_in)
+    : root_file_path(root_file_path_in), allowed_dir_path(root_file_path_in / allowed_dir), on_file(std::move(on_file_in)), vOut(ZIP_STREAM_BUFFER_SIZE)
 {
-    unz_file_info64 file_info = unz_file_info64();
-    FILE* fout = NULL;
-    int size_buf = 8192;
-    void* buf = NULL;
-    int err;
-    int errclose;
-    char filename_inzip[256] = {0};
-    const char *curr_filename = NULL;
-
-    err = unzGetCurrentFileInfo64(uf, &file_info, filename_inzip, sizeof(filename_inzip), NULL, 0, NULL, 0);
-    if (err != UNZ_OK)
+}
+
+ZipStreamExtractor::~ZipStreamExtractor()
+{
+    if (fInflating)
+        inflateEnd(&zs);
+    if (fout)
+        fclose(fout);
+}
+
+int ZipStreamExtractor::Fail(int err)
+{
+    if (fInflating)
+        inflateEnd(&zs);
+    fInflating = false;
+    if (fout)
+        fclose(fout);
+    fout = nullptr;
+    state = State::FAILED;
+    return err;
+}
+
+/* Gather input into vBuffer until it holds nNeed bytes */
+bool ZipStreamExtractor::Buffer(const unsigned char*& data, size_t& len)
+{
+    const size_t take = std::min(len, nNeed - vBuffer.size());
+    vBuffer.insert(vBuffer.end(), data, data + take);
+    data += take;
+    len -= take;
+    return vBuffer.size() == nNeed;
+}
+
+int ZipStreamExtractor::Write(const unsigned char* data, size_t len)
+{
+    const unsigned char* const begin = data;
+    const uint64_t nBase = nConsumed;
+    nConsumed += len;
+
+    while (true)
     {
-        LogPrintf("error %d with zipfile in unzGetCurrentFileInfo64\n", err);
-        return err;
+        switch (state)
+        {
+        case State::FAILED:
+            return UNZ_PARAMERROR;
+
+        case State::END:
+            return UNZ_OK;
+
+        case State::SIGNATURE:
+        {
+            if (!Buffer(data, len))
+                return UNZ_OK;
+            const uint32_t signature = ReadLE32(vBuffer.data());
+            if (signature == ZIP_CENTRAL_HEADER_SIGNATURE || signature == ZIP_END_OF_CENTRAL_DIR_SIGNATURE)
+            {
+                state = State::END;
+                break;
+            }
+            if (signature != ZIP_LOCAL_HEADER_SIGNATURE)
+            {
+                LogPrintf("invalid zipfile: unexpected signature %08x\n", signature);
+                return Fail(UNZ_BADZIPFILE);
+            }
+            nNeed = ZIP_LOCAL_HEADER_SIZE;
+            state = State::HEADER;
+            break;
+        }
+
+        case State::HEADER:
+        {
+            if (!Buffer(data, len))
+                return UNZ_OK;
+            if (nNeed == ZIP_LOCAL_HEADER_SIZE)
+            {
+                /* The fixed part is in, the name and extra field follow it */
+                nNeed += ReadLE16(&vBuffer[26]) + ReadLE16(&vBuffer[28]);
+                if (nNeed > ZIP_LOCAL_HEADER_SIZE)
+                    break;
+            }
+            const int err = OpenEntry();
+            if (err != UNZ_OK)
+                return Fail(err);
+            state = State::DATA;
+            break;
+        }
+
+        case State::DATA:
+        {
+            if (nMethod == 0)
+            {
+                /* Stored, so the header gave the size */
+                const size_t take = std::min<uint64_t>(len, nCompressedSize - nCompressedRead);
+                const int err = WriteEntry(data, take);
+                if (err != UNZ_OK)
+                    return Fail(err);
+                data += take;
+                len -= take;
+                nCompressedRead += take;
+                if (nCompressedRead < nCompressedSize)
+                    return UNZ_OK;
+            }
+            else
+            {
+                /* Deflated, so the entry ends where its deflate stream does */
+                if (len == 0)
+                    return UNZ_OK;
+                const size_t take = std::min<size_t>(len, std::numeric_limits<uInt>::max());
+                zs.next_in = const_cast<unsigned char*>(data);
+                zs.avail_in = take;
+                int ret;
+                do
+                {
+                    zs.next_out = vOut.data();
+                    zs.avail_out = vOut.size();
+                    ret = inflate(&zs, Z_NO_FLUSH);
+                    if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+                    {
+                        LogPrintf("error %d with zipfile in inflate of %s\n", ret, strName);
+                        return Fail(UNZ_BADZIPFILE);
+                    }
+                    const int err = WriteEntry(vOut.data(), vOut.size() - zs.avail_out);
+                    if (err != UNZ_OK)
+                        return Fail(err);
+                }
+                while (ret != Z_STREAM_END && (zs.avail_in > 0 || zs.avail_out == 0));
+
+                const size_t consumed = take - zs.avail_in;
+                data += consumed;
+                len -= consumed;
+                nCompressedRead += consumed;
+                if (ret != Z_STREAM_END)
+                    break;
+                inflateEnd(&zs);
+                fInflating = false;
+            }
+
+            if (nFlags & ZIP_FLAG_DATA_DESCRIPTOR)
+            {
+                vBuffer.clear();
+                nNeed = 4;
+                state = State::DESCRIPTOR;
+                break;
+            }
+            const int err = CloseEntry();
+            if (err != UNZ_OK)
+                return Fail(err);
+            nExtractedOffset = nBase + (data - begin);
+            break;
+        }
+
+        case State::DESCRIPTOR:
+        {
+            if (!Buffer(data, len))
+                return UNZ_OK;
+            if (nNeed == 4)
+            {
+                /* The descriptor signature is optional, without it these were the CRC */
+                nNeed = (ReadLE32(vBuffer.data()) == ZIP_DATA_DESCRIPTOR_SIGNATURE ? 8 : 4) + (fZip64 ? 16 : 8);
+                break;
+            }
+            const unsigned char* descriptor = &vBuffer[nNeed - (fZip64 ? 20 : 12)];
+            nCrcExpected = ReadLE32(descriptor);
+            nCompressedSize = fZip64 ? ReadLE64(descriptor + 4) : ReadLE32(descriptor + 4);
+            nUncompressedSize = fZip64 ? ReadLE64(descriptor + 12) : ReadLE32(descriptor + 8);
+            const int err = CloseEntry();
+            if (err != UNZ_OK)
+                return Fail(err);
+            nExtractedOffset = nBase + (data - begin);
+            break;
+        }
+        }
+    }
+}
+
+int ZipStreamExtractor::Finish()
+{
+    if (state == State::FAILED)
+        return UNZ_PARAMERROR;
+    if (state != State::END)
+    {
+        LogPrintf("invalid zipfile: archive ends before its central directory\n");
+        return Fail(UNZ_BADZIPFILE);
+    }
+    return UNZ_OK;
+}
+
+int ZipStreamExtractor::OpenEntry()
+{
+    nFlags = ReadLE16(&vBuffer[6]);
+    nMethod = ReadLE16(&vBuffer[8]);
+    nCrcExpected = ReadLE32(&vBuffer[14]);
+    nCompressedSize = ReadLE32(&vBuffer[18]);
+    nUncompressedSize = ReadLE32(&vBuffer[22]);
+    const size_t size_filename = ReadLE16(&vBuffer[26]);
+    strName.assign((const char*)&vBuffer[ZIP_LOCAL_HEADER_SIZE], size_filename);
+
+    /* A zip64 entry has its sizes in the extra field, and 64-bit sizes in its data descriptor */
+    fZip64 = false;
+    size_t pos = ZIP_LOCAL_HEADER_SIZE + size_filename;
+    while (pos + 4 <= vBuffer.size())
+    {
+        const uint16_t id = ReadLE16(&vBuffer[pos]);
+        const size_t size = ReadLE16(&vBuffer[pos + 2]);
+        pos += 4;
+        if (pos + size > vBuffer.size())
+            break;
+        if (id == ZIP_EXTRA_ZIP64)
+        {
+            fZip64 = true;
+            size_t field = pos;
+            if (nUncompressedSize == 0xffffffff && field + 8 <= pos + size)
+            {
+                nUncompressedSize = ReadLE64(&vBuffer[field]);
+                field += 8;
+            }
+            if (nCompressedSize == 0xffffffff && field + 8 <= pos + size)
+                nCompressedSize = ReadLE64(&vBuffer[field]);
+        }
+        pos += size;
+    }
+
+    if (strName.empty() || (nFlags & ZIP_FLAG_ENCRYPTED) || (nMethod != 0 && nMethod != Z_DEFLATED))
+    {
+        LogPrintf("invalid zipfile: unsupported entry %s (flags %d, method %d)\n", strName, nFlags, nMethod);
+        return UNZ_BADZIPFILE;
     }
 
-    boost::filesystem::path file_path = root_file_path / filename_inzip;
-    boost::filesystem::path bootstrap_dir_path = root_file_path / allowed_dir;
+    file_path = root_file_path / strName;
 
     /* Sanity check to prevent path traversal attacks in case of a malicious zip file */
-    if (!is_file_within_path(file_path, bootstrap_dir_path))
+    if (!is_file_within_path(file_path, allowed_dir_path))
     {
-        LogPrintf("invalid zipfile: file has invalid directory: %s\n", filename_inzip);
+        LogPrintf("invalid zipfile: file has invalid directory: %s\n", strName);
         return UNZ_BADZIPFILE;
     }
 
-    std::string curr_filename_str = file_path.string();
-    curr_filename = file_path.string().c_str();
+    const char lastChar = strName[strName.length() - 1];
+    const bool fDirectory = lastChar == '/' || lastChar == '\\';
+    try {
+        /* Some zips don't contain directory alone before file */
+        boost::filesystem::create_directories(fDirectory ? file_path : file_path.parent_path());
+    } catch (const boost::filesystem::filesystem_error& e) {
+        LogPrintf("error creating directory for %s: %s\n", strName, e.what());
+        return UNZ_ERRNO;
+    }
 
-    int curr_filename_len = curr_filename_str.length();
-    if (curr_filename_len > 0)
+    if (fDirectory)
+    {
+        LogPrintf(" extracting: creating dir %s\n", file_path.string());
+    }
+    else
     {
-        char lastChar = curr_filename_str[curr_filename_len-1];
-        if (lastChar == '/' || lastChar == '\\')
+        LogPrintf(" extracting: %s\n", file_path.string());
+        fout = fsbridge::fopen(file_path, "wb");
+        if (fout == NULL)
         {
-            LogPrintf(" extracting: creating dir %s\n", curr_filename);
-            MKDIR(curr_filename);
-            return UNZ_OK;
+            LogPrintf("error opening %s\n", file_path.string());
+            return UNZ_ERRNO;
         }
     }
 
-    buf = (void*)malloc(size_buf);
-    if (buf == NULL)
+    if (nMethod == Z_DEFLATED)
     {
-        LogPrintf("Error allocating memory\n");
-        return UNZ_INTERNALERROR;
+        zs = z_stream();
+        if (inflateInit2(&zs, -MAX_WBITS) != Z_OK)
+            return UNZ_INTERNALERROR;
+        fInflating = true;
     }
 
-    err = unzOpenCurrentFile(uf);
-    if (err != UNZ_OK)
-        LogPrintf("error %d with zipfile in unzOpenCurrentFilePassword\n", err);
+    nCompressedRead = 0;
+    nWritten = 0;
+    nCrc = crc32(0L, Z_NULL, 0);
+    return UNZ_OK;
+}
 
-    /* Create the file on disk so we can unzip to it */
-    if (err == UNZ_OK)
+int ZipStreamExtractor::WriteEntry(const unsigned char* data, size_t len)
+{
+    if (len == 0)
+        return UNZ_OK;
+    if (fout == NULL)
     {
-        fout = fopen64(curr_filename, "wb");
-        /* Some zips don't contain directory alone before file */
-        if (fout == NULL)
-            LogPrintf("error opening %s\n", curr_filename);
+        LogPrintf("invalid zipfile: directory %s has data\n", strName);
+        return UNZ_BADZIPFILE;
     }
+    if (fwrite(data, len, 1, fout) != 1)
+    {
+        LogPrintf("error %d in writing extracted file\n", errno);
+        return UNZ_ERRNO;
+    }
+    nCrc = crc32(nCrc, data, len);
+    nWritten += len;
+    return UNZ_OK;
+}
 
-    /* Read from the zip, unzip to buffer, and write to disk */
+int ZipStreamExtractor::CloseEntry()
+{
+    const bool fFile = fout != NULL;
     if (fout != NULL)
     {
-        LogPrintf(" extracting: %s\n", curr_filename);
+        const int errclose = fclose(fout);
+        fout = nullptr;
+        if (errclose != 0)
+        {
+            LogPrintf("error %d in closing extracted file\n", errno);
+            return UNZ_ERRNO;
+        }
+    }
 
-        do
+    if (nWritten != nUncompressedSize || nCompressedRead != nCompressedSize || nCrc != nCrcExpected)
+    {
+        LogPrintf("invalid zipfile: %s does not match its sizes and CRC\n", strName);
+        return UNZ_CRCERROR;
+    }
+
+    if (fFile && on_file)
+        on_file(file_path);
+
+    nEntries++;
+    vBuffer.clear();
+    nNeed = 4;
+    state = State::SIGNATURE;
+    return UNZ_OK;
+}
+
+static const uint32_t ZIP64_END_OF_CENTRAL_DIR_SIGNATURE = 0x06064b50;
+static const uint32_t ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIGNATURE = 0x07064b50;
+static const size_t ZIP_END_OF_CENTRAL_DIR_SIZE = 22;
+static const size_t ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE = 20;
+static const size_t ZIP64_END_OF_CENTRAL_DIR_SIZE = 56;
+static const size_t ZIP_CENTRAL_HEADER_SIZE = 46;
+static const size_t ZIP_EXTRACT_BUFFER_SIZE = 1 << 20;
+
+static bool zip_seek(FILE* file, uint64_t nPos)
+{
+#ifdef WIN32
+    return _fseeki64(file, nPos, SEEK_SET) == 0;
+#else
+    return fseeko(file, nPos, SEEK_SET) == 0;
+#endif
+}
+
+static bool zip_read_at(FILE* file, uint64_t nPos, unsigned char* buf, size_t len)
+{
+    return zip_seek(file, nPos) && fread(buf, 1, len, file) == len;
+}
+
+int zip_read_central_directory(FILE* file, std::vector<ZipEntry>& entries)
+{
+    entries.clear();
+
+#ifdef WIN32
+    const int64_t nFileSize = _fseeki64(file, 0, SEEK_END) == 0 ? _ftelli64(file) : -1;
+#else
+    const int64_t nFileSize = fseeko(file, 0, SEEK_END) == 0 ? ftello(file) : -1;
+#endif
+    if (nFileSize < 0)
+    {
+        LogPrintf("error %d in seeking zipfile\n", errno);
+        return UNZ_ERRNO;
+    }
+
+    /* The end of central directory record is last, followed only by a comment of up to 64 KiB */
+    const size_t nTail = std::min<uint64_t>(nFileSize, ZIP_END_OF_CENTRAL_DIR_SIZE + 0xffff);
+    std::vector<unsigned char> tail(nTail);
+    if (!zip_read_at(file, nFileSize - nTail, tail.data(), nTail))
+    {
+        LogPrintf("error %d in reading zipfile\n", errno);
+        return UNZ_ERRNO;
+    }
+    int64_t pos = (int64_t)nTail - (int64_t)ZIP_END_OF_CENTRAL_DIR_SIZE;
+    while (pos >= 0 && ReadLE32(&tail[pos]) != ZIP_END_OF_CENTRAL_DIR_SIGNATURE)
+        pos--;
+    if (pos < 0)
+    {
+        LogPrintf("invalid zipfile: no end of central directory\n");
+        return UNZ_BADZIPFILE;
+    }
+
+    uint64_t nCount = ReadLE16(&tail[pos + 10]);
+    uint64_t nSize = ReadLE32(&tail[pos + 12]);
+    uint64_t nOffset = ReadLE32(&tail[pos + 16]);
+    if (nCount == 0xffff || nSize == 0xffffffff || nOffset == 0xffffffff)
+    {
+        /* Too big for the record, so the zip64 record right before it has the values */
+        const uint64_t nRecordPos = nFileSize - nTail + pos;
+        unsigned char locator[ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE];
+        unsigned char record[ZIP64_END_OF_CENTRAL_DIR_SIZE];
+        if (nRecordPos < sizeof(locator) ||
+            !zip_read_at(file, nRecordPos - sizeof(locator), locator, sizeof(locator)) ||
+            ReadLE32(locator) != ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIGNATURE ||
+            !zip_read_at(file, ReadLE64(locator + 8), record, sizeof(record)) ||
+            ReadLE32(record) != ZIP64_END_OF_CENTRAL_DIR_SIGNATURE)
         {
-            err = unzReadCurrentFile(uf, buf, size_buf);
-            if (err < 0)
-            {
-                LogPrintf("error %d with zipfile in unzReadCurrentFile\n", err);
-                break;
-            }
-            if (err == 0)
+            LogPrintf("invalid zipfile: no zip64 end of central directory\n");
+            return UNZ_BADZIPFILE;
+        }
+        nCount = ReadLE64(record + 32);
+        nSize = ReadLE64(record + 40);
+        nOffset = ReadLE64(record + 48);
+    }
+    if (nOffset > (uint64_t)nFileSize || nSize > nFileSize - nOffset || nCount > nSize / ZIP_CENTRAL_HEADER_SIZE)
+    {
+        LogPrintf("invalid zipfile: central directory out of the archive\n");
+        return UNZ_BADZIPFILE;
+    }
+
+    std::vector<unsigned char> dir(nSize);
+    if (!zip_read_at(file, nOffset, dir.data(), nSize))
+    {
+        LogPrintf("error %d in reading zipfile\n", errno);
+        return UNZ_ERRNO;
+    }
+
+    entries.reserve(nCount);
+    size_t p = 0;
+    for (uint64_t i = 0; i < nCount; i++)
+    {
+        if (p + ZIP_CENTRAL_HEADER_SIZE > dir.size() || ReadLE32(&dir[p]) != ZIP_CENTRAL_HEADER_SIGNATURE)
+        {
+            LogPrintf("invalid zipfile: central directory is corrupt\n");
+            return UNZ_BADZIPFILE;
+        }
+        ZipEntry entry;
+        entry.nFlags = ReadLE16(&dir[p + 8]);
+        entry.nMethod = ReadLE16(&dir[p + 10]);
+        entry.nCrc = ReadLE32(&dir[p + 16]);
+        entry.nCompressedSize = ReadLE32(&dir[p + 20]);
+        entry.nUncompressedSize = ReadLE32(&dir[p + 24]);
+        const size_t size_filename = ReadLE16(&dir[p + 28]);
+        const size_t size_extra = ReadLE16(&dir[p + 30]);
+        const size_t size_comment = ReadLE16(&dir[p + 32]);
+        entry.nLocalHeaderOffset = ReadLE32(&dir[p + 42]);
+        p += ZIP_CENTRAL_HEADER_SIZE;
+        if (p + size_filename + size_extra + size_comment > dir.size())
+        {
+            LogPrintf("invalid zipfile: central directory is corrupt\n");
+            return UNZ_BADZIPFILE;
+        }
+        entry.strName.assign((const char*)&dir[p], size_filename);
+        p += size_filename;
+
+        /* The zip64 extra field holds the values that did not fit, in this order */
+        for (size_t extra = p; extra + 4 <= p + size_extra;)
+        {
+            const uint16_t id = ReadLE16(&dir[extra]);
+            const size_t size = ReadLE16(&dir[extra + 2]);
+            extra += 4;
+            if (extra + size > p + size_extra)
                 break;
-            if (fwrite(buf, err, 1, fout) != 1)
+            if (id == ZIP_EXTRA_ZIP64)
             {
-                LogPrintf("error %d in writing extracted file\n", errno);
-                err = UNZ_ERRNO;
-                break;
+                size_t field = extra;
+                for (uint64_t* value : {&entry.nUncompressedSize, &entry.nCompressedSize, &entry.nLocalHeaderOffset})
+                {
+                    if (*value == 0xffffffff && field + 8 <= extra + size)
+                    {
+                        *value = ReadLE64(&dir[field]);
+                        field += 8;
+                    }
+                }
             }
+            extra += size;
         }
-        while (err > 0);
+        p += size_extra + size_comment;
+        entries.push_back(std::move(entry));
+    }
+    return UNZ_OK;
+}
 
-        if (fout)
-            fclose(fout);
+/* Inflate one entry from file, open on the archive, into a new file at file_path */
+static int zip_extract_entry(FILE* file, const ZipEntry& entry, const fs::path& file_path, std::vector<unsigned char>& vIn, std::vector<unsigned char>& vOut)
+{
+    unsigned char header[ZIP_LOCAL_HEADER_SIZE];
+    if (!zip_read_at(file, entry.nLocalHeaderOffset, header, sizeof(header)) || ReadLE32(header) != ZIP_LOCAL_HEADER_SIGNATURE)
+    {
+        LogPrintf("invalid zipfile: no local header for %s\n", entry.strName);
+        return UNZ_BADZIPFILE;
+    }
+    if (!zip_seek(file, entry.nLocalHeaderOffset + ZIP_LOCAL_HEADER_SIZE + ReadLE16(&header[26]) + ReadLE16(&header[28])))
+    {
+        LogPrintf("error %d in seeking zipfile\n", errno);
+        return UNZ_ERRNO;
     }
 
-    errclose = unzCloseCurrentFile(uf);
-    if (errclose != UNZ_OK)
-        LogPrintf("error %d with zipfile in unzCloseCurrentFile\n", errclose);
+    FILE* fout = fsbridge::fopen(file_path, "wb");
+    if (fout == NULL)
+    {
+        LogPrintf("error opening %s\n", file_path.string());
+        return UNZ_ERRNO;
+    }
+    /* The size is known up front, so the file system can lay the file out in one go */
+    if (entry.nUncompressedSize > 0 && entry.nUncompressedSize <= std::numeric_limits<unsigned int>::max())
+    {
+        AllocateFileRange(fout, 0, entry.nUncompressedSize);
+        fseek(fout, 0, SEEK_SET);
+    }
+
+    z_stream zs = z_stream();
+    if (entry.nMethod == Z_DEFLATED && inflateInit2(&zs, -MAX_WBITS) != Z_OK)
+    {
+        fclose(fout);
+        return UNZ_INTERNALERROR;
+    }
+
+    int err = UNZ_OK;
+    uint64_t nRead = 0;
+    uint64_t nWritten = 0;
+    uint32_t nCrc = crc32(0L, Z_NULL, 0);
+    bool fStreamEnd = false;
+    auto write = [&](const unsigned char* data, size_t len) {
+        if (len == 0)
+            return UNZ_OK;
+        if (len > entry.nUncompressedSize - nWritten)
+        {
+            LogPrintf("invalid zipfile: %s is bigger than its size\n", entry.strName);
+            return UNZ_BADZIPFILE;
+        }
+        if (fwrite(data, len, 1, fout) != 1)
+        {
+            LogPrintf("error %d in writing extracted file\n", errno);
+            return UNZ_ERRNO;
+        }
+        nCrc = crc32(nCrc, data, len);
+        nWritten += len;
+        return UNZ_OK;
+    };
+
+    while (err == UNZ_OK && nRead < entry.nCompressedSize && !fStreamEnd)
+    {
+        const size_t len = fread(vIn.data(), 1, std::min<uint64_t>(vIn.size(), entry.nCompressedSize - nRead), file);
+        if (len == 0)
+        {
+            LogPrintf("error %d in reading zipfile\n", errno);
+            err = UNZ_ERRNO;
+            break;
+        }
+        nRead += len;
+        if (entry.nMethod == 0)
+        {
+            err = write(vIn.data(), len);
+            continue;
+        }
+        zs.next_in = vIn.data();
+        zs.avail_in = len;
+        int ret;
+        do
+        {
+            zs.next_out = vOut.data();
+            zs.avail_out = vOut.size();
+            ret = inflate(&zs, Z_NO_FLUSH);
+            if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+            {
+                LogPrintf("error %d with zipfile in inflate of %s\n", ret, entry.strName);
+                err = UNZ_BADZIPFILE;
+                break;
+            }
+            err = write(vOut.data(), vOut.size() - zs.avail_out);
+        }
+        while (err == UNZ_OK && ret != Z_STREAM_END && (zs.avail_in > 0 || zs.avail_out == 0));
+        fStreamEnd = ret == Z_STREAM_END;
+    }
+    if (entry.nMethod == Z_DEFLATED)
+        inflateEnd(&zs);
 
-    free(buf);
+    if (fclose(fout) != 0 && err == UNZ_OK)
+    {
+        LogPrintf("error %d in closing extracted file\n", errno);
+        err = UNZ_ERRNO;
+    }
+    if (err == UNZ_OK && (nWritten != entry.nUncompressedSize || nRead != entry.nCompressedSize || nCrc != entry.nCrc ||
+                          (entry.nMethod == Z_DEFLATED && (!fStreamEnd || zs.avail_in > 0))))
+    {
+        LogPrintf("invalid zipfile: %s does not match its sizes and CRC\n", entry.strName);
+        err = UNZ_CRCERROR;
+    }
     return err;
 }
 
-int zip_extract_all(unzFile uf, const fs::path& root_file_path, const char * allowed_dir)
+int zip_extract_parallel(const fs::path& zip_path, const fs::path& root_file_path, const char* allowed_dir, int nThreads,
+                         uint64_t nFromOffset, const std::function<void(const fs::path&)>& on_file, uint64_t* pnEntries)
 {
-    int err = unzGoToFirstFile(uf);
+    FILE* file = fsbridge::fopen(zip_path, "rb");
+    if (file == NULL)
+    {
+        LogPrintf("error opening %s\n", zip_path.string());
+        return UNZ_ERRNO;
+    }
+    std::vector<ZipEntry> entries;
+    const int err = zip_read_central_directory(file, entries);
+    fclose(file);
     if (err != UNZ_OK)
+        return err;
+
+    /* Every entry is checked, then every directory made, before any thread starts */
+    const fs::path allowed_dir_path = root_file_path / allowed_dir;
+    std::vector<const ZipEntry*> vEntries;
+    for (const ZipEntry& entry : entries)
     {
-        LogPrintf("error %d with zipfile in unzGoToFirstFile\n", err);
-        return 1;
+        if (entry.nLocalHeaderOffset < nFromOffset)
+            continue;
+        if (entry.strName.empty() || (entry.nFlags & ZIP_FLAG_ENCRYPTED) || (entry.nMethod != 0 && entry.nMethod != Z_DEFLATED))
+        {
+            LogPrintf("invalid zipfile: unsupported entry %s (flags %d, method %d)\n", entry.strName, entry.nFlags, entry.nMethod);
+            return UNZ_BADZIPFILE;
+        }
+
+        /* Sanity check to prevent path traversal attacks in case of a malicious zip file */
+        if (!is_file_within_path(root_file_path / entry.strName, allowed_dir_path))
+        {
+            LogPrintf("invalid zipfile: file has invalid directory: %s\n", entry.strName);
+            return UNZ_BADZIPFILE;
+        }
+        vEntries.push_back(&entry);
     }
 
-    do
+    std::vector<const ZipEntry*> vFiles;
+    for (const ZipEntry* entry : vEntries)
     {
-        err = zip_extract_currentfile(uf, root_file_path, allowed_dir);
-        if (err != UNZ_OK)
-            break;
-        err = unzGoToNextFile(uf);
+        const fs::path file_path = root_file_path / entry->strName;
+        const char lastChar = entry->strName[entry->strName.length() - 1];
+        const bool fDirectory = lastChar == '/' || lastChar == '\\';
+        try {
+            boost::filesystem::create_directories(fDirectory ? file_path : file_path.parent_path());
+        } catch (const boost::filesystem::filesystem_error& e) {
+            LogPrintf("error creating directory for %s: %s\n", entry->strName, e.what());
+            return UNZ_ERRNO;
+        }
+        if (fDirectory)
+            LogPrintf(" extracting: creating dir %s\n", file_path.string());
+        else
+            vFiles.push_back(entry);
     }
-    while (err == UNZ_OK);
 
-    if (err != UNZ_END_OF_LIST_OF_FILE)
+    /* Largest first, so no thread is left with a big file once the others are done */
+    std::sort(vFiles.begin(), vFiles.end(), [](const ZipEntry* a, const ZipEntry* b) { return a->nUncompressedSize > b->nUncompressedSize; });
+
+    std::atomic<size_t> nNext{0};
+    std::atomic<int> nError{UNZ_OK};
+    auto extract = [&] {
+        FILE* fin = fsbridge::fopen(zip_path, "rb");
+        if (fin == NULL)
+        {
+            LogPrintf("error opening %s\n", zip_path.string());
+            nError = UNZ_ERRNO;
+            return;
+        }
+        std::vector<unsigned char> vIn(ZIP_EXTRACT_BUFFER_SIZE);
+        std::vector<unsigned char> vOut(ZIP_EXTRACT_BUFFER_SIZE);
+        size_t i;
+        while (nError == UNZ_OK && (i = nNext++) < vFiles.size())
+        {
+            const fs::path file_path = root_file_path / vFiles[i]->strName;
+            LogPrintf(" extracting: %s\n", file_path.string());
+            const int errentry = zip_extract_entry(fin, *vFiles[i], file_path, vIn, vOut);
+            if (errentry != UNZ_OK)
+            {
+                nError = errentry;
+                break;
+            }
+            if (on_file)
+                on_file(file_path);
+        }
+        fclose(fin);
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < std::min<int64_t>(nThreads, vFiles.size()); i++)
     {
-        LogPrintf("error %d with zipfile in unzGoToNextFile\n", err);
-        return 1;
+        threads.emplace_back([&extract, i] {
+            util::ThreadRename(strprintf("unzip.%i", i));
+            extract();
+        });
     }
-    return UNZ_OK;
-}
\ No newline at end of file
+    extract();
+    for (std::thread& thread : threads)
+        thread.join();
+
+    if (nError == UNZ_OK && pnEntries)
+        *pnEntries = vEntries.size();
+    return nError;
+}
@@ -3,8 +3,106 @@
 
 #include <boost/filesystem.hpp>
 #include <minizip/unzip.h>
+#include <zlib.h>
 #include <fs.h>
 
-int zip_extract_all(unzFile uf, const fs::path& root_file_path, const char * allowed_dir);
+#include <functional>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+/** An entry of a zip archive, as its central directory lists it */
+struct ZipEntry
+{
+    std::string strName;
+    uint16_t nFlags{0};
+    uint16_t nMethod{0};
+    uint32_t nCrc{0};
+    uint64_t nCompressedSize{0};
+    uint64_t nUncompressedSize{0};
+    uint64_t nLocalHeaderOffset{0};
+};
+
+/** Read the central directory of the zip archive in file, zip64 or not. */
+int zip_read_central_directory(FILE* file, std::vector<ZipEntry>& entries);
+
+/**
+ * Extract a zip archive on disk under root_file_path, which its entries must
+ * not leave allowed_dir of, on nThreads threads. The central directory is
+ * read once, then each thread opens the archive for itself and inflates
+ * whole entries, largest first, into files preallocated to their size.
+ * Entries whose local header is before nFromOffset are skipped as already
+ * extracted. on_file, if set, is given the path of each file once it is
+ * complete and checked, from the thread that extracted it.
+ */
+int zip_extract_parallel(const fs::path& zip_path, const fs::path& root_file_path, const char* allowed_dir, int nThreads,
+                         uint64_t nFromOffset = 0, const std::function<void(const fs::path&)>& on_file = nullptr, uint64_t* pnEntries = nullptr);
+
+/**
+ * Extract a zip archive from its bytes as they arrive, without the archive
+ * ever being on disk. Entries are read from their local headers in archive
+ * order and inflated straight into their files under root_file_path, which
+ * they must not leave allowed_dir of. Entries may be stored or deflated and
+ * may use zip64 sizes or trailing data descriptors. The central directory
+ * is not needed, so everything from its start on is skipped. on_file, if
+ * set, is given the path of each file once it is complete and checked.
+ */
+class ZipStreamExtractor
+{
+public:
+    ZipStreamExtractor(const fs::path& root_file_path, const char* allowed_dir, std::function<void(const fs::path&)> on_file = nullptr);
+    ~ZipStreamExtractor();
+
+    /** Feed the next bytes of the archive. Returns UNZ_OK or an error, after which every call fails. */
+    int Write(const unsigned char* data, size_t len);
+    /** Returns UNZ_OK if the archive ended after a complete entry. */
+    int Finish();
+
+    bool Failed() const { return state == State::FAILED; }
+    uint64_t EntriesExtracted() const { return nEntries; }
+    /** Offset in the archive of the local header of the first entry not extracted yet. */
+    uint64_t ExtractedOffset() const { return nExtractedOffset; }
+
+private:
+    enum class State { SIGNATURE, HEADER, DATA, DESCRIPTOR, END, FAILED };
+
+    int Fail(int err);
+    bool Buffer(const unsigned char*& data, size_t& len);
+    int OpenEntry();
+    int WriteEntry(const unsigned char* data, size_t len);
+    int CloseEntry();
+
+    const fs::path root_file_path;
+    const fs::path allowed_dir_path;
+    const std::function<void(const fs::path&)> on_file;
+
+    State state{State::SIGNATURE};
+    // Header bytes gathered across writes, until nNeed of them are there
+    std::vector<unsigned char> vBuffer;
+    size_t nNeed{4};
+
+    // The entry being extracted
+    std::string strName;
+    fs::path file_path;
+    uint16_t nFlags{0};
+    uint16_t nMethod{0};
+    uint32_t nCrcExpected{0};
+    uint64_t nCompressedSize{0};
+    uint64_t nUncompressedSize{0};
+    bool fZip64{false};
+    uint64_t nCompressedRead{0};
+    uint64_t nWritten{0};
+    uint32_t nCrc{0};
+    FILE* fout{nullptr};
+    z_stream zs;
+    bool fInflating{false};
+    std::vector<unsigned char> vOut;
+
+    uint64_t nEntries{0};
+    // Bytes of the archive fed before the current Write(), and up to the last complete entry
+    uint64_t nConsumed{0};
+    uint64_t nExtractedOffset{0};
+};
 
 #endif // BITCOIN_UTIL_MINIUNZ_H
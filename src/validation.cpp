@@ -14,12 +14,16 @@
 #include <consensus/tx_check.h>
 #include <consensus/tx_verify.h>
 #include <consensus/validation.h>
+#include <crypto/scrypt.h>
 #include <cuckoocache.h>
 #include <flatfile.h>
 #include <hash.h>
+#include <index/blockfilterindex.h>
 #include <index/txindex.h>
 #include <logging.h>
 #include <logging/timer.h>
+#include <node/coinstats.h>
+#include <node/utxo_snapshot.h>
 #include <policy/policy.h>
 #include <policy/settings.h>
 #include <pos.h>
@@ -31,6 +35,7 @@
 #include <script/script.h>
 #include <script/sigcache.h>
 #include <shutdown.h>
+#include <streams.h>
 #include <timedata.h>
 #include <tinyformat.h>
 #include <txdb.h>
@@ -102,9 +107,10 @@ bool CBlockIndexWorkComparator::operator()(const CBlockIndex *pa, const CBlockIn
 
 namespace {
 BlockManager g_blockman;
-uint256 vStakeSeen[1024];
 } // anon namespace
 
+StakeSeenSet g_stake_seen{MAX_STAKE_SEEN};
+
 std::unique_ptr<CChainState> g_chainstate;
 
 CChainState& ChainstateActive() {
@@ -139,6 +145,7 @@ std::atomic_bool fReindex(false);
 bool fRequireStandard = true;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
+bool fCheckHeaderPoW = false;
 size_t nCoinCacheUsage = 5000 * 300;
 int64_t nMaxTipAge = DEFAULT_MAX_TIP_AGE;
 
@@ -163,6 +170,10 @@ namespace {
 
     /** Dirty block file entries. */
     std::set<int> setDirtyFileInfo;
+
+    /** Whether the chainstate was once loaded from a UTXO set snapshot, below
+     *  whose base blocks have no data. */
+    bool fHaveSnapshot = false;
 } // anon namespace
 
 CBlockIndex* LookupBlockIndex(const uint256& hash)
@@ -1229,7 +1240,7 @@ void CChainState::InvalidBlockFound(CBlockIndex *pindex, const BlockValidationSt
     }
 }
 
-void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo &txundo, int nHeight)
+void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo &txundo, int nHeight, unsigned int nTxOffset)
 {
     // mark inputs spent
     if (!tx.IsCoinBase()) {
@@ -1241,13 +1252,13 @@ void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo &txund
         }
     }
     // add outputs
-    AddCoins(inputs, tx, nHeight);
+    AddCoins(inputs, tx, nHeight, false, nTxOffset);
 }
 
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight)
 {
     CTxUndo txundo;
-    UpdateCoins(tx, inputs, txundo, nHeight);
+    UpdateCoins(tx, inputs, txundo, nHeight, 0);
 }
 
 bool CScriptCheck::operator()() {
@@ -1592,6 +1603,67 @@ void ThreadScriptCheck(int worker_num) {
     scriptcheckqueue.Thread();
 }
 
+/** Headers per CWorkHashCheck: two rounds of the multi-way scrypt kernel this CPU runs */
+static size_t WorkHashCheckHeaders()
+{
+    static const size_t nHeaders = 2 * scrypt_throughput();
+    return nHeaders;
+}
+
+/**
+ * Closure representing the memoization of a run of header work hashes.
+ * Always succeeds; the proof-of-work itself is checked in CheckBlockHeader.
+ */
+class CWorkHashCheck
+{
+private:
+    const CBlockHeader* m_headers{nullptr};
+    size_t m_count{0};
+
+public:
+    CWorkHashCheck() {}
+    CWorkHashCheck(const CBlockHeader* headers, size_t count) : m_headers(headers), m_count(count) {}
+
+    bool operator()()
+    {
+        CBlockHeader::MemoizeWorkHashes(m_headers, m_count);
+        return true;
+    }
+
+    void swap(CWorkHashCheck& check)
+    {
+        std::swap(m_headers, check.m_headers);
+        std::swap(m_count, check.m_count);
+    }
+};
+
+static CCheckQueue<CWorkHashCheck> workhashcheckqueue(1);
+
+void ThreadWorkHashCheck(int worker_num) {
+    util::ThreadRename(strprintf("headerch.%i", worker_num));
+    workhashcheckqueue.Thread();
+}
+
+/** Compute the work hashes of a HEADERS message, spread over the script-checking threads. */
+static void MemoizeHeaderWorkHashes(const std::vector<CBlockHeader>& headers)
+{
+    if (headers.empty())
+        return;
+    if (!g_parallel_script_checks) {
+        CBlockHeader::MemoizeWorkHashes(headers.data(), headers.size());
+        return;
+    }
+
+    CCheckQueueControl<CWorkHashCheck> control(&workhashcheckqueue);
+    std::vector<CWorkHashCheck> vChecks;
+    const size_t nCheckHeaders = WorkHashCheckHeaders();
+    vChecks.reserve((headers.size() + nCheckHeaders - 1) / nCheckHeaders);
+    for (size_t i = 0; i < headers.size(); i += nCheckHeaders)
+        vChecks.emplace_back(&headers[i], std::min(nCheckHeaders, headers.size() - i));
+    control.Add(vChecks);
+    control.Wait();
+}
+
 // 0.13.0 was shipped with a segwit deployment defined for testnet, but not for
 // mainnet. We no longer need to support disabling the segwit deployment
 // except for testing purposes, due to limitations of the functional test
@@ -1652,7 +1724,7 @@ static int64_t nTimeTotal = 0;
 static int64_t nBlocksTotal = 0;
 
 // These checks can only be done when all previous block have been added.
-bool VericoinContextualBlockChecks(const CBlock& block, BlockValidationState& state, CBlockIndex* pindex, bool fJustCheck)
+bool VericoinContextualBlockChecks(const CBlock& block, BlockValidationState& state, CBlockIndex* pindex, bool fJustCheck, bool fCheckSignature)
 {
     // Verium
     const CChainParams& chainparams = Params();
@@ -1661,7 +1733,7 @@ bool VericoinContextualBlockChecks(const CBlock& block, BlockValidationState& st
 
     uint256 hashProofOfStake = uint256();
     // ppcoin: verify hash target and signature of coinstake tx
-    if (block.IsProofOfStake() && !CheckProofOfStake(state, pindex->pprev, block.vtx[1], block.nBits, hashProofOfStake)) {
+    if (block.IsProofOfStake() && !CheckProofOfStake(state, pindex->pprev, block.vtx[1], block.nBits, hashProofOfStake, fCheckSignature)) {
         LogPrintf("WARNING: %s: check proof-of-stake failed for block %s\n", __func__, block.GetHash().ToString());
         return false; // do not error here as we expect this during initial block download
     }
@@ -1712,6 +1784,7 @@ bool VericoinContextualBlockChecks(const CBlock& block, BlockValidationState& st
         return error("ConnectBlock() : SetStakeEntropyBit() failed");
     pindex->SetStakeModifier(nStakeModifier, fGeneratedStakeModifier);
     pindex->nStakeModifierChecksum = nStakeModifierChecksum;
+    pindex->nStakeModifierTimeMax = std::max(pindex->pprev ? pindex->pprev->nStakeModifierTimeMax : 0u, pindex->GeneratedStakeModifier() ? pindex->nTime : 0u);
     setDirtyBlockIndex.insert(pindex);  // queue a write to disk
 
     return true;
@@ -1728,7 +1801,7 @@ bool CChainState::ConnectBlock(const CBlock& block, BlockValidationState& state,
     assert(*pindex->phashBlock == block.GetHash());
     int64_t nTimeStart = GetTimeMicros();
 
-    if ( chainparams.IsVericoin() && pindex->nStakeModifier == 0 && pindex->nStakeModifierChecksum == 0 && !VericoinContextualBlockChecks(block, state, pindex, fJustCheck))
+    if ( chainparams.IsVericoin() && pindex->nStakeModifier == 0 && pindex->nStakeModifierChecksum == 0 && !VericoinContextualBlockChecks(block, state, pindex, fJustCheck, false))
         return error("%s: failed PoS check %s", __func__, state.ToString());
 
     // Check it again in case a previous version let a bad block in
@@ -1829,6 +1902,8 @@ bool CChainState::ConnectBlock(const CBlock& block, BlockValidationState& state,
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
     std::vector<PrecomputedTransactionData> txdata;
     txdata.reserve(block.vtx.size()); // Required so that pointers to individual PrecomputedTransactionData don't get invalidated
+    // ppcoin: the coins record where their transaction sits in the block, for the stake kernel
+    unsigned int nTxOffset = chainparams.IsVericoin() ? GetSizeOfCompactSize(block.vtx.size()) : 0;
 
 
     // ppcoin: coin stake tx earns reward instead of paying fee
@@ -1933,6 +2008,14 @@ bool CChainState::ConnectBlock(const CBlock& block, BlockValidationState& state,
                     strprintf("ConnectBlock(): %s not paying required fee=%s, paid=%s", tx.GetHash().ToString(), requiredFee, nTxValueIn - nTxValueOut));
             }
 
+            // The coinstake kernel signature is part of the proof-of-stake,
+            // so it is checked even where the other scripts are skipped
+            if (!fScriptChecks && tx.IsCoinStake()) {
+                CScriptCheck check(view.AccessCoin(tx.vin[0].prevout).out, tx, 0, SCRIPT_VERIFY_P2SH, false, &txdata[i]);
+                if (!check())
+                    return state.Invalid(BlockValidationResult::BLOCK_CONSENSUS, "invalid-pos-script", strprintf("%s: VerifyScript failed on coinstake %s", __func__, tx.GetHash().ToString()));
+            }
+
             control.Add(vChecks);
         }
 
@@ -1940,7 +2023,9 @@ bool CChainState::ConnectBlock(const CBlock& block, BlockValidationState& state,
         if (i > 0) {
             blockundo.vtxundo.push_back(CTxUndo());
         }
-        UpdateCoins(tx, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
+        UpdateCoins(tx, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight, nTxOffset);
+        if (nTxOffset)
+            nTxOffset += ::GetSerializeSize(tx, CLIENT_VERSION);
     }
     int64_t nTime3 = GetTimeMicros(); nTimeConnect += nTime3 - nTime2;
     LogPrint(BCLog::BENCH, "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs (%.2fms/blk)]\n", (unsigned)block.vtx.size(), MILLI * (nTime3 - nTime2), MILLI * (nTime3 - nTime2) / block.vtx.size(), nInputs <= 1 ? 0 : MILLI * (nTime3 - nTime2) / (nInputs-1), nTimeConnect * MICRO, nTimeConnect * MILLI / nBlocksTotal);
@@ -1981,6 +2066,10 @@ bool CChainState::ConnectBlock(const CBlock& block, BlockValidationState& state,
         setDirtyBlockIndex.insert(pindex);
     }
 
+    // ppcoin: the coinstake signature is checked now, see AcceptBlock()
+    if (block.IsProofOfStake() && !IsInitialBlockDownload())
+        g_stake_seen.Insert(block.GetProofOfStake(), pindex->GetBlockHash());
+
     assert(pindex->phashBlock);
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
@@ -2196,6 +2285,9 @@ bool CChainState::DisconnectTip(BlockValidationState& state, const CChainParams&
 {
     CBlockIndex *pindexDelete = m_chain.Tip();
     assert(pindexDelete);
+    // The UTXO set of a snapshot cannot be taken back below its base
+    if (pindexDelete->nStatus & BLOCK_ASSUMED_VALID)
+        return state.Error(strprintf("block %s is not above the base of the loaded UTXO set snapshot and cannot be disconnected", pindexDelete->GetBlockHash().ToString()));
     // Read block from disk.
     std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
     CBlock& block = *pblock;
@@ -2243,6 +2335,7 @@ static int64_t nTimeConnectTotal = 0;
 static int64_t nTimeFlush = 0;
 static int64_t nTimeChainState = 0;
 static int64_t nTimePostConnect = 0;
+static uint64_t nWorkHashesLastTip = 0;
 
 struct PerBlockConnectTrace {
     CBlockIndex* pindex = nullptr;
@@ -2341,6 +2434,9 @@ bool CChainState::ConnectTip(BlockValidationState& state, const CChainParams& ch
     int64_t nTime6 = GetTimeMicros(); nTimePostConnect += nTime6 - nTime5; nTimeTotal += nTime6 - nTime1;
     LogPrint(BCLog::BENCH, "  - Connect postprocess: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime6 - nTime5) * MILLI, nTimePostConnect * MICRO, nTimePostConnect * MILLI / nBlocksTotal);
     LogPrint(BCLog::BENCH, "- Connect block: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime6 - nTime1) * MILLI, nTimeTotal * MICRO, nTimeTotal * MILLI / nBlocksTotal);
+    uint64_t nWorkHashes = GetWorkHashCount();
+    LogPrint(BCLog::BENCH, "- Header work hashes computed: %u [%u total]\n", nWorkHashes - nWorkHashesLastTip, nWorkHashes);
+    nWorkHashesLastTip = nWorkHashes;
 
     connectTrace.BlockConnected(pindexNew, std::move(pthisBlock));
     return true;
@@ -2881,6 +2977,7 @@ CBlockIndex* BlockManager::AddToBlockIndex(const CBlockHeader& block)
         pindexNew->BuildSkip();
     }
     pindexNew->nTimeMax = (pindexNew->pprev ? std::max(pindexNew->pprev->nTimeMax, pindexNew->nTime) : pindexNew->nTime);
+    pindexNew->nStakeModifierTimeMax = std::max(pindexNew->pprev ? pindexNew->pprev->nStakeModifierTimeMax : 0u, pindexNew->GeneratedStakeModifier() ? pindexNew->nTime : 0u);
 
     const CChainParams& chainparams = Params();
 
@@ -3012,16 +3109,9 @@ static bool FindUndoPos(BlockValidationState &state, int nFile, FlatFilePos &pos
 
 static bool CheckBlockHeader(const CBlockHeader& block, BlockValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true)
 {
-
-     /*
-     * Vericonomy:
-     *
-     *   Header verification takes a long time due to having to compute scrypt hashes.
-     * This is a lengthy process, and so for this reason we skip it. This is acceptable
-     * since we're going to run a full validation of each and every block in the chain
-     * once the full data set is received.
-     *
-     */
+    // Check proof of work matches claimed amount
+    if (fCheckPOW && !CheckProofOfWork(block.GetWorkHash(), block.nBits, consensusParams))
+        return state.Invalid(BlockValidationResult::BLOCK_INVALID_HEADER, "high-hash", "proof of work failed");
 
     return true;
 }
@@ -3038,10 +3128,6 @@ bool CheckBlock(const CBlock& block, BlockValidationState& state, const Consensu
     if (!CheckBlockHeader(block, state, consensusParams, fCheckPOW && !block.IsProofOfStake()))
         return false;
 
-    // Check proof of work matches claimed amount
-    if ( !block.IsProofOfStake() && fCheckPOW && !CheckProofOfWork(block.GetWorkHash(), block.nBits, consensusParams))
-        return state.Invalid(BlockValidationResult::BLOCK_MUTATED, "high-hash", "proof of work failed");
-
     // Check the merkle root.
     if (fCheckMerkleRoot) {
         bool mutated;
@@ -3322,10 +3408,7 @@ bool BlockManager::AcceptBlockHeader(const CBlockHeader& block, BlockValidationS
             return true;
         }
 
-        if (!CheckBlockHeader(block, state, chainparams.GetConsensus(), !IsProofOfStake(chainparams.GetConsensus(), pindex->nHeight+1)))
-            return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), state.ToString());
-
-        // Get prev block index
+        // Get prev block index; its height tells whether this header must carry proof of work
         CBlockIndex* pindexPrev = nullptr;
         BlockMap::iterator mi = m_block_index.find(block.hashPrevBlock);
         if (mi == m_block_index.end()) {
@@ -3333,6 +3416,11 @@ bool BlockManager::AcceptBlockHeader(const CBlockHeader& block, BlockValidationS
             return state.Invalid(BlockValidationResult::BLOCK_MISSING_PREV, "prev-blk-not-found");
         }
         pindexPrev = (*mi).second;
+
+        const bool fCheckPOW = fCheckHeaderPoW && !IsProofOfStake(chainparams.GetConsensus(), pindexPrev->nHeight + 1);
+        if (!CheckBlockHeader(block, state, chainparams.GetConsensus(), fCheckPOW))
+            return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), state.ToString());
+
         if (pindexPrev->nStatus & BLOCK_FAILED_MASK) {
             LogPrintf("ERROR: %s: prev block invalid\n", __func__);
             return state.Invalid(BlockValidationResult::BLOCK_INVALID_PREV, "bad-prevblk");
@@ -3391,6 +3479,12 @@ bool BlockManager::AcceptBlockHeader(const CBlockHeader& block, BlockValidationS
 // Exposed wrapper for AcceptBlockHeader
 bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, BlockValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex)
 {
+    // Vericoin indexes blocks by their scrypt hash, and header proof-of-work
+    // checks need it too. Hash the whole message up front, on all cores and
+    // without cs_main; AcceptBlockHeader then hits the memoized hashes.
+    if (chainparams.IsVericoin() || fCheckHeaderPoW)
+        MemoizeHeaderWorkHashes(headers);
+
     {
         LOCK(cs_main);
 
@@ -3500,12 +3594,31 @@ bool CChainState::AcceptBlock(const std::shared_ptr<const CBlock>& pblock, Block
         return error("%s: %s", __func__, state.ToString());
     }
 
-    // ppcoin: check PoS
-    if (!VericoinContextualBlockChecks(block, state, pindex, false)) {
+    // ppcoin: check PoS. A block extending the tip is connected right away,
+    // and ConnectBlock() verifies its coinstake signature then, so only
+    // blocks off the tip have it checked here, which keeps a block staking
+    // someone else's output from being stored. Without the transaction index
+    // the kernel of a block off the tip is looked up on that block's own
+    // chain; a block whose kernel or parent stake modifier cannot be found
+    // there is not stored, nor marked invalid, so it can be fetched again
+    // once its fork is connectable.
+    const bool fExtendsTip = pindex->pprev == m_chain.Tip();
+    Coin coinKernel;
+    if (!g_txindex && !fExtendsTip &&
+        ((pindex->pprev->nStakeModifier == 0 && pindex->pprev->nStakeModifierChecksum == 0) ||
+         (block.IsProofOfStake() && !FindStakeKernelCoin(pindex->pprev, block.vtx[1]->vin[0].prevout, coinKernel)))) {
+        return error("%s: proof of stake of block %s off the tip cannot be checked yet", __func__, pindex->GetBlockHash().ToString());
+    }
+    if (!VericoinContextualBlockChecks(block, state, pindex, false, !fExtendsTip)) {
         pindex->nStatus |= BLOCK_FAILED_VALID;
         setDirtyBlockIndex.insert(pindex);
         return state.Invalid(BlockValidationResult::BLOCK_CONSENSUS, "bad-pos", "proof of stake is incorrect");
     }
+    // Only stakes of blocks with a checked signature are remembered, so a
+    // peer cannot claim the stake of someone else's block. ConnectBlock()
+    // remembers those of the blocks extending the tip.
+    if (!fExtendsTip && block.IsProofOfStake() && !IsInitialBlockDownload())
+        g_stake_seen.Insert(block.GetProofOfStake(), pindex->GetBlockHash());
 
     // Header is valid/has work, merkle tree and segwit merkle tree are good...RELAY NOW
     // (but if it does not build on our best tip, let the SendMessages loop relay it)
@@ -3544,6 +3657,25 @@ bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<cons
         // Therefore, the following critical section must include the CheckBlock() call as well.
         LOCK(cs_main);
 
+        // ppcoin: a block reusing the stake of another block gets its peer
+        // penalized. While the first block is on the active chain the
+        // duplicate is only validated if it could take its chain past the
+        // tip, as then it may be on a chain that wins over the first block.
+        uint256 hashFirst;
+        if (chainparams.IsVericoin() && pblock->IsProofOfStake() && !::ChainstateActive().IsInitialBlockDownload() &&
+            g_stake_seen.IsDuplicate(pblock->GetProofOfStake(), pblock->GetHash(), &hashFirst)) {
+            if (fPoSDuplicate) *fPoSDuplicate = true;
+            LogPrintf("%s: duplicate proof-of-stake (%s, %d) for block %s\n", __func__,
+                      pblock->GetProofOfStake().first.ToString(), pblock->GetProofOfStake().second, pblock->GetHash().ToString());
+            const CBlockIndex* pindexFirst = LookupBlockIndex(hashFirst);
+            const CBlockIndex* pindexPrev = LookupBlockIndex(pblock->hashPrevBlock);
+            if (pindexFirst && pindexPrev && ::ChainActive().Contains(pindexFirst) &&
+                pindexPrev->nChainWork + GetBlockProof(CBlockIndex(*pblock)) <= ::ChainActive().Tip()->nChainWork) {
+                if (ppindex) *ppindex = nullptr;
+                return error("%s: block %s reuses the stake of active block %s", __func__, pblock->GetHash().ToString(), hashFirst.ToString());
+            }
+        }
+
         // Ensure that CheckBlock() passes before calling AcceptBlock, as
         // belt-and-suspenders.
         bool ret = CheckBlock(*pblock, state, chainparams.GetConsensus());
@@ -3558,13 +3690,6 @@ bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<cons
             return error("%s: AcceptBlock FAILED (%s)", __func__, state.ToString());
         }
 
-        // search for dup
-        if (chainparams.IsVericoin() &&  pindex->IsProofOfStake() && !::ChainstateActive().IsInitialBlockDownload()) {
-            int32_t ndx = univHash(pindex->hashProofOfStake);
-            if (fPoSDuplicate && vStakeSeen[ndx] == pindex->hashProofOfStake)
-                *fPoSDuplicate = true;
-            vStakeSeen[ndx] = pindex->hashProofOfStake;
-        }
     }
 
     NotifyHeaderTip();
@@ -3680,6 +3805,7 @@ bool BlockManager::LoadBlockIndex(
         CBlockIndex* pindex = item.second;
         pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
         pindex->nTimeMax = (pindex->pprev ? std::max(pindex->pprev->nTimeMax, pindex->nTime) : pindex->nTime);
+        pindex->nStakeModifierTimeMax = std::max(pindex->pprev ? pindex->pprev->nStakeModifierTimeMax : 0u, pindex->GeneratedStakeModifier() ? pindex->nTime : 0u);
         // We can link the chain of blocks for which we've received transactions at some point.
         // Pruned nodes may have deleted the block.
         if (pindex->nTx > 0) {
@@ -3773,6 +3899,9 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams) EXCLUSIVE_LOCKS_RE
         }
     }
 
+    // Check whether a UTXO set snapshot was loaded
+    pblocktree->ReadFlag("txoutsetsnapshot", fHaveSnapshot);
+
     // Check whether we need to continue reindexing
     bool fReindexing = false;
     pblocktree->ReadReindexing(fReindexing);
@@ -3809,6 +3938,275 @@ bool CChainState::LoadChainTip(const CChainParams& chainparams)
     return true;
 }
 
+namespace {
+/**
+ * The coins of a UTXO set snapshot as written by dumptxoutset, read from the
+ * file as they are iterated. Stops at the first coin that cannot be read, is
+ * out of key order, is spent or is newer than the base block, and at any data
+ * after the last one; Complete() then tells why.
+ */
+class SnapshotCoinsCursor : public CCoinsViewCursor
+{
+public:
+    SnapshotCoinsCursor(CAutoFile& file, const SnapshotMetadata& metadata, int nBaseHeight)
+        : CCoinsViewCursor(metadata.m_base_blockhash), m_file(file), m_coins_left(metadata.m_coins_count), m_base_height(nBaseHeight)
+    {
+        Next();
+    }
+
+    bool GetKey(COutPoint& key) const override
+    {
+        if (!m_valid) return false;
+        key = m_key;
+        return true;
+    }
+
+    bool GetValue(Coin& coin) const override
+    {
+        if (!m_valid) return false;
+        coin = m_coin;
+        return true;
+    }
+
+    unsigned int GetValueSize() const override { return ::GetSerializeSize(m_coin, CLIENT_VERSION); }
+
+    bool Valid() const override { return m_valid; }
+
+    void Next() override
+    {
+        m_valid = false;
+        if (m_coins_left == 0) {
+            if (std::fgetc(m_file.Get()) != EOF) m_error = "unexpected data after the last coin";
+            return;
+        }
+
+        COutPoint key;
+        Coin coin;
+        try {
+            m_file >> key;
+            m_file >> coin;
+        } catch (const std::exception& e) {
+            m_error = strprintf("unable to read coin %u: %s", m_coins_read, e.what());
+            return;
+        }
+        if (m_coins_read > 0 && !(m_key < key)) {
+            m_error = strprintf("coin %s is out of order", key.ToString());
+            return;
+        }
+        if (coin.IsSpent()) {
+            m_error = strprintf("coin %s is spent", key.ToString());
+            return;
+        }
+        if ((int)coin.nHeight > m_base_height) {
+            m_error = strprintf("coin %s is newer than the base block", key.ToString());
+            return;
+        }
+        m_key = key;
+        m_coin = std::move(coin);
+        m_coins_left--;
+        m_coins_read++;
+        m_valid = true;
+    }
+
+    //! Whether all coins were read, and nothing else
+    bool Complete(std::string& error) const
+    {
+        if (!m_error.empty()) {
+            error = m_error;
+            return false;
+        }
+        if (m_valid || m_coins_left > 0) {
+            error = "not all coins were read";
+            return false;
+        }
+        return true;
+    }
+
+private:
+    CAutoFile& m_file;
+    uint64_t m_coins_left;
+    uint64_t m_coins_read{0};
+    const int m_base_height;
+    COutPoint m_key;
+    Coin m_coin;
+    bool m_valid{false};
+    std::string m_error;
+};
+} // namespace
+
+const AssumeutxoData* ExpectedAssumeutxo(int height, const CChainParams& chainparams)
+{
+    const MapAssumeutxo& mapAssumeutxo = chainparams.Assumeutxo();
+    const auto it = mapAssumeutxo.find(height);
+    return it == mapAssumeutxo.end() ? nullptr : &it->second;
+}
+
+bool CChainState::LoadSnapshot(CAutoFile& coins_file, const SnapshotMetadata& metadata, const CChainParams& chainparams, std::string& error)
+{
+    if (chainparams.IsVericoin()) {
+        // Checking a stake kernel reads the block and transaction of the coin
+        // staked, which can be any below the base
+        error = "UTXO set snapshots cannot be loaded on Vericoin, whose proof-of-stake checks need the blocks below them";
+        return false;
+    }
+
+    // The indexes are built from the data of every block, which the blocks
+    // below the base will not have
+    bool fIndex = g_txindex != nullptr;
+    ForEachBlockFilterIndex([&fIndex](BlockFilterIndex&) { fIndex = true; });
+    if (fIndex) {
+        error = "UTXO set snapshots cannot be loaded while an index is enabled, restart with -txindex=0 -blockfilterindex=0, or load it with -loadtxoutset, which leaves -txindex off";
+        return false;
+    }
+
+    const CBlockIndex* pindexBase = WITH_LOCK(cs_main, return LookupBlockIndex(metadata.m_base_blockhash));
+    if (!pindexBase) {
+        error = strprintf("the snapshot base block %s is not a known header", metadata.m_base_blockhash.ToString());
+        return false;
+    }
+    const AssumeutxoData* au_data = ExpectedAssumeutxo(pindexBase->nHeight, chainparams);
+    if (!au_data) {
+        error = strprintf("no UTXO set snapshot is expected at height %d", pindexBase->nHeight);
+        return false;
+    }
+    if (metadata.m_nchaintx != au_data->nChainTx) {
+        error = strprintf("the snapshot counts %u transactions up to its base instead of %u", metadata.m_nchaintx, au_data->nChainTx);
+        return false;
+    }
+
+    // Hash the whole snapshot before writing any of it, without cs_main
+    const long nCoinsPos = std::ftell(coins_file.Get());
+    {
+        SnapshotCoinsCursor cursor(coins_file, metadata, pindexBase->nHeight);
+        CCoinsStats stats;
+        if (!GetUTXOStats(&cursor, stats) || !cursor.Complete(error)) {
+            if (error.empty()) error = "unable to read the snapshot";
+            return false;
+        }
+        if (stats.hashSerialized != au_data->hash_serialized) {
+            error = strprintf("the snapshot hashes to %s instead of %s", stats.hashSerialized.ToString(), au_data->hash_serialized.ToString());
+            return false;
+        }
+    }
+    if (nCoinsPos < 0 || std::fseek(coins_file.Get(), nCoinsPos, SEEK_SET) != 0) {
+        error = "unable to rewind the snapshot";
+        return false;
+    }
+
+    CBlockIndex* pindexNew;
+    {
+        LOCK(m_cs_chainstate);
+        LOCK(cs_main);
+        CBlockIndex* pindexOld = m_chain.Tip();
+        pindexNew = LookupBlockIndex(metadata.m_base_blockhash);
+        if (!pindexOld || pindexOld->nHeight >= pindexNew->nHeight || pindexNew->GetAncestor(pindexOld->nHeight) != pindexOld) {
+            error = "the chain tip is not below the snapshot base block";
+            return false;
+        }
+
+        // The blocks from the tip up to the base, which the snapshot stands in for
+        std::vector<CBlockIndex*> vToFake;
+        for (CBlockIndex* pindex = pindexNew; pindex != pindexOld; pindex = pindex->pprev) {
+            if (pindex->nStatus & BLOCK_FAILED_MASK) {
+                error = strprintf("block %s below the snapshot base is invalid", pindex->GetBlockHash().ToString());
+                return false;
+            }
+            vToFake.push_back(pindex);
+        }
+        std::reverse(vToFake.begin(), vToFake.end());
+        unsigned int nChainTx = pindexOld->nChainTx;
+        for (const CBlockIndex* pindex : vToFake) {
+            if (pindex != pindexNew) nChainTx += std::max(pindex->nTx, 1u);
+        }
+        if (au_data->nChainTx <= nChainTx) {
+            error = strprintf("the snapshot counts fewer transactions than the %u of the blocks below its base", nChainTx);
+            return false;
+        }
+
+        ForceFlushStateToDisk();
+        SnapshotCoinsCursor cursor(coins_file, metadata, pindexNew->nHeight);
+        if (!CoinsDB().LoadCoins(cursor, metadata.m_base_blockhash, metadata.m_coins_count)) {
+            error = "failed to write the snapshot to the coin database";
+            return AbortNode(strprintf("%s, restart with -reindex-chainstate", error));
+        }
+        CoinsTip().SetBestBlock(metadata.m_base_blockhash);
+
+        // Blocks without data count one transaction; the base gets the rest
+        // of the expected count, as GuessVerificationProgress() reads it.
+        // They are assumed valid, never checked, and have no undo data.
+        for (CBlockIndex* pindex : vToFake) {
+            if (pindex->nTx == 0) pindex->nTx = 1;
+            if (pindex == pindexNew) pindex->nTx = au_data->nChainTx - pindex->pprev->nChainTx;
+            pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
+            pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
+            pindex->nStatus |= BLOCK_ASSUMED_VALID;
+            setDirtyBlockIndex.insert(pindex);
+        }
+        pindexNew->nMoneySupply = au_data->nMoneySupply;
+
+        // Link the blocks that were waiting on one of them, as
+        // ReceivedBlockTransactions() does
+        std::deque<CBlockIndex*> queue;
+        const auto take_unlinked = [&](CBlockIndex* pindex) {
+            auto range = m_blockman.m_blocks_unlinked.equal_range(pindex);
+            while (range.first != range.second) {
+                CBlockIndex* pindexChild = range.first->second;
+                if (pindexNew->GetAncestor(pindexChild->nHeight) != pindexChild) queue.push_back(pindexChild);
+                range.first = m_blockman.m_blocks_unlinked.erase(range.first);
+            }
+        };
+        for (CBlockIndex* pindex : vToFake) {
+            take_unlinked(pindex);
+        }
+        while (!queue.empty()) {
+            CBlockIndex* pindex = queue.front();
+            queue.pop_front();
+            pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
+            {
+                LOCK(cs_nBlockSequenceId);
+                pindex->nSequenceId = nBlockSequenceId++;
+            }
+            setBlockIndexCandidates.insert(pindex);
+            take_unlinked(pindex);
+        }
+
+        m_chain.SetTip(pindexNew);
+        setBlockIndexCandidates.insert(pindexNew);
+        PruneBlockIndexCandidates();
+        if (!fHaveSnapshot) {
+            fHaveSnapshot = true;
+            pblocktree->WriteFlag("txoutsetsnapshot", true);
+        }
+        ForceFlushStateToDisk();
+        // Its transactions were checked against the old UTXO set
+        ::mempool.clear();
+        LogPrintf("Loaded UTXO set snapshot of %u coins at height %d, hash=%s\n", metadata.m_coins_count, pindexNew->nHeight, pindexNew->GetBlockHash().ToString());
+
+        GetMainSignals().UpdatedBlockTip(pindexNew, pindexOld, IsInitialBlockDownload());
+    }
+    uiInterface.NotifyBlockTip(IsInitialBlockDownload(), pindexNew);
+    return true;
+}
+
+bool HaveTxOutSetSnapshot()
+{
+    AssertLockHeld(cs_main);
+    return fHaveSnapshot;
+}
+
+bool LoadTxOutSet(CAutoFile& coins_file, const SnapshotMetadata& metadata, const CChainParams& chainparams, std::string& error)
+{
+    if (!::ChainstateActive().LoadSnapshot(coins_file, metadata, chainparams, error)) return false;
+
+    // Connect the blocks above the base that were already downloaded
+    BlockValidationState state;
+    if (!ActivateBestChain(state, chainparams)) {
+        error = state.ToString();
+        return false;
+    }
+    return true;
+}
+
 CVerifyDB::CVerifyDB()
 {
     uiInterface.ShowProgress(_("Verifying blocks...").translated, 0, false);
@@ -3848,6 +4246,11 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
         uiInterface.ShowProgress(_("Verifying blocks...").translated, percentageDone, false);
         if (pindex->nHeight <= ::ChainActive().Height()-nCheckDepth)
             break;
+        if (pindex->nStatus & BLOCK_ASSUMED_VALID) {
+            // The base of the UTXO set snapshot the chainstate was loaded from
+            LogPrintf("VerifyDB(): no undo data at %d, hash=%s, the base of the loaded UTXO set snapshot\n", pindex->nHeight, pindex->GetBlockHash().ToString());
+            break;
+        }
         CBlock block;
         // check level 0: read from disk
         if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
@@ -3923,6 +4326,7 @@ bool CChainState::RollforwardBlock(const CBlockIndex* pindex, CCoinsViewCache& i
         return error("ReplayBlock(): ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
     }
 
+    unsigned int nTxOffset = params.IsVericoin() ? GetSizeOfCompactSize(block.vtx.size()) : 0;
     for (const CTransactionRef& tx : block.vtx) {
         if (!tx->IsCoinBase()) {
             for (const CTxIn &txin : tx->vin) {
@@ -3930,7 +4334,9 @@ bool CChainState::RollforwardBlock(const CBlockIndex* pindex, CCoinsViewCache& i
             }
         }
         // Pass check = true as every addition may be an overwrite.
-        AddCoins(inputs, *tx, pindex->nHeight, true);
+        AddCoins(inputs, *tx, pindex->nHeight, true, nTxOffset);
+        if (nTxOffset)
+            nTxOffset += ::GetSerializeSize(*tx, CLIENT_VERSION);
     }
     return true;
 }
@@ -4163,6 +4569,8 @@ void UnloadBlockIndex()
     nLastBlockFile = 0;
     setDirtyBlockIndex.clear();
     setDirtyFileInfo.clear();
+    fHaveSnapshot = false;
+    g_stake_seen.Clear();
 
     ::ChainstateActive().UnloadBlockIndex();
 }
@@ -4399,11 +4807,16 @@ void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
             assert(pindex == m_chain.Genesis()); // The current active chain's genesis block must be this block.
         }
         if (!pindex->HaveTxsDownloaded()) assert(pindex->nSequenceId <= 0); // nSequenceId can't be set positive for blocks that aren't linked (negative is used for preciousblock)
-        // VALID_TRANSACTIONS is equivalent to nTx > 0 for all nodes (whether or not pruning has occurred).
-        // HAVE_DATA is only equivalent to nTx > 0 (or VALID_TRANSACTIONS) if no pruning has occurred.
-        assert(!(pindex->nStatus & BLOCK_HAVE_DATA) == (pindex->nTx == 0));
-        assert(pindexFirstMissing == pindexFirstNeverProcessed);
+        // VALID_TRANSACTIONS is equivalent to nTx > 0 for all nodes (whether or not a snapshot was loaded).
+        // HAVE_DATA is only equivalent to nTx > 0 (or VALID_TRANSACTIONS) if no snapshot was loaded.
+        if (!fHaveSnapshot) {
+            assert(!(pindex->nStatus & BLOCK_HAVE_DATA) == (pindex->nTx == 0));
+            assert(pindexFirstMissing == pindexFirstNeverProcessed);
+        } else if (pindex->nStatus & BLOCK_HAVE_DATA) {
+            assert(pindex->nTx > 0);
+        }
         if (pindex->nStatus & BLOCK_HAVE_UNDO) assert(pindex->nStatus & BLOCK_HAVE_DATA);
+        if (pindex->nStatus & BLOCK_ASSUMED_VALID) assert(fHaveSnapshot && !(pindex->nStatus & BLOCK_HAVE_UNDO));
         assert(((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS) == (pindex->nTx > 0)); // This is pruning-independent.
         // All parents having had data (at some point) is equivalent to all parents being VALID_TRANSACTIONS, which is equivalent to HaveTxsDownloaded().
         assert((pindexFirstNeverProcessed == nullptr) == pindex->HaveTxsDownloaded());
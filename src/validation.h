@@ -31,6 +31,7 @@
 #include <utility>
 #include <vector>
 
+class CAutoFile;
 class CChainState;
 class BlockValidationState;
 class CBlockIndex;
@@ -44,11 +45,14 @@ class CScriptCheck;
 class CTxMemPool;
 class TxValidationState;
 class CKeyStore;
+struct AssumeutxoData;
 struct ChainTxData;
 
 struct DisconnectedBlockTransactions;
 struct PrecomputedTransactionData;
 struct LockPoints;
+class SnapshotMetadata;
+class StakeSeenSet;
 
 /** Fee Settings */
 #if CLIENT_IS_VERIUM
@@ -133,7 +137,7 @@ static const int64_t DEFAULT_MAX_TIP_AGE = 24 * 60 * 60;
 static const int64_t MAX_FEE_ESTIMATION_TIP_AGE = 3 * 60 * 60;
 
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
-static const bool DEFAULT_TXINDEX = true;  // ppcoin: txindex is required for PoS calculations (might change in the future)
+static const bool DEFAULT_TXINDEX = true;
 static const char* const DEFAULT_BLOCKFILTERINDEX = "0";
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
 /** Default for -persistmempool */
@@ -177,6 +181,9 @@ extern bool g_parallel_script_checks;
 extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
+/** Whether proof of work is checked on headers, before their block is downloaded.
+ * Off by default on Verium, where each header costs a 128 MiB scrypt hash. */
+extern bool fCheckHeaderPoW;
 extern size_t nCoinCacheUsage;
 /** A fee rate smaller than this is considered zero fee (for relaying, mining and transaction creation) */
 extern CFeeRate minRelayTxFee;
@@ -192,6 +199,9 @@ extern arith_uint256 nMinimumChainWork;
 /** Best header we've seen so far (used for getheaders queries' starting points). */
 extern CBlockIndex *pindexBestHeader;
 
+/** ppcoin: stakes of the recently accepted proof-of-stake blocks */
+extern StakeSeenSet g_stake_seen;
+
 /** Block files containing a block-height within MIN_BLOCKS_TO_KEEP of ::ChainActive().Tip() will not be pruned. */
 static const unsigned int MIN_BLOCKS_TO_KEEP = 288;
 
@@ -242,6 +252,7 @@ CFeeRate GetMinRelayTxFeeRate();
  * @param[in]   pblock  The block we want to process.
  * @param[in]   fForceProcessing Process this block even if unrequested; used for non-network block sources and whitelisted peers.
  * @param[out]  fNewBlock A boolean which is set to indicate if the block was first received via this call
+ * @param[out]  fPoSDuplicate Set if the block reuses the stake of another block. While the first block is active such a block is dropped without validation, unless it could take its chain past the tip.
  * @returns     If the block was processed, independently of block validity
  */
 bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<const CBlock> pblock, bool fForceProcessing, bool* fNewBlock, CBlockIndex** ppindex = nullptr, bool* fPoSDuplicate = nullptr) LOCKS_EXCLUDED(cs_main);
@@ -275,6 +286,8 @@ bool LoadBlockIndex(const CChainParams& chainparams) EXCLUSIVE_LOCKS_REQUIRED(cs
 void UnloadBlockIndex();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck(int worker_num);
+/** Run an instance of the header work hash checking thread */
+void ThreadWorkHashCheck(int worker_num);
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
 bool GetTransaction(const uint256& hash, CTransactionRef& tx, const Consensus::Params& params, uint256& hashBlock, const CBlockIndex* const blockIndex = nullptr);
 /**
@@ -735,6 +748,16 @@ public:
     /** Update the chain tip based on database information, i.e. CoinsTip()'s best block. */
     bool LoadChainTip(const CChainParams& chainparams) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
+    /**
+     * Replace the UTXO set with the coins of a snapshot, as written by
+     * dumptxoutset and positioned after its metadata, and make its base block
+     * the tip. The snapshot must hash to what the chain params expect for the
+     * height of the base, which must be a known header above the tip. The
+     * blocks up to the base are taken as valid without their data, which is
+     * never downloaded.
+     */
+    bool LoadSnapshot(CAutoFile& coins_file, const SnapshotMetadata& metadata, const CChainParams& chainparams, std::string& error) LOCKS_EXCLUDED(cs_main);
+
     //! Dictates whether we need to flush the cache to disk or not.
     //!
     //! @return the state of the size of the coins cache.
@@ -762,7 +785,9 @@ private:
 
 unsigned int GetNextTargetOrWorkRequired(const CBlockIndex* pindexLast, bool fProofOfStake, const Consensus::Params& consensusParams);
 bool IsProofOfStake(const Consensus::Params& consensusParams, int nHeight);
-bool VericoinContextualBlockChecks(const CBlock& block, BlockValidationState& state, CBlockIndex* pindex, bool fJustCheck);
+/** Check the proof-of-stake of a block and set its stake modifier. Without fCheckSignature the
+ *  coinstake kernel signature is left to ConnectBlock(), which checks it with the block's scripts. */
+bool VericoinContextualBlockChecks(const CBlock& block, BlockValidationState& state, CBlockIndex* pindex, bool fJustCheck, bool fCheckSignature = true);
 
 /** Mark a block as precious and reorganize.
  *
@@ -809,6 +834,15 @@ int32_t ComputeBlockVersion();
 /** Get block file info entry for one block file */
 CBlockFileInfo* GetBlockFileInfo(size_t n);
 
+/** The UTXO set snapshot the chain params expect at a height, if any. */
+const AssumeutxoData* ExpectedAssumeutxo(int height, const CChainParams& chainparams);
+
+/** Whether the chainstate was loaded from a UTXO set snapshot, below whose base blocks have no data. */
+bool HaveTxOutSetSnapshot() EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+/** Load a UTXO set snapshot into the active chainstate and sync on from it (see CChainState::LoadSnapshot). */
+bool LoadTxOutSet(CAutoFile& coins_file, const SnapshotMetadata& metadata, const CChainParams& chainparams, std::string& error) LOCKS_EXCLUDED(cs_main);
+
 /** Dump the mempool to disk. */
 bool DumpMempool(const CTxMemPool& pool);
 
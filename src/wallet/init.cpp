@@ -75,6 +75,8 @@ void WalletInit::AddWalletOptions() const
     gArgs.AddArg("-walletrejectlongchains", strprintf("Wallet will not create transactions that violate mempool chain limits (default: %u)", DEFAULT_WALLET_REJECT_LONG_CHAINS), ArgsManager::ALLOW_ANY | ArgsManager::DEBUG_ONLY, OptionsCategory::WALLET_DEBUG_TEST);
     gArgs.AddArg("-staking=<boolean>", "Enable/Disable staking - Vericoin only (default: 1)", ArgsManager::ALLOW_ANY, OptionsCategory::WALLET);
     gArgs.AddArg("-mining=<n>", "Start mining with n being the number of threads - Verium only (default: 0)", ArgsManager::ALLOW_ANY, OptionsCategory::WALLET);
+    gArgs.AddArg("-minerhugepages", strprintf("Map the miner scratchpads on huge pages (Linux) - Verium only (default: %u)", DEFAULT_MINER_HUGEPAGES), ArgsManager::ALLOW_ANY, OptionsCategory::WALLET);
+    gArgs.AddArg("-minernuma", strprintf("Bind each miner thread and its scratchpad to one NUMA node (Linux) - Verium only (default: %u)", DEFAULT_MINER_NUMA), ArgsManager::ALLOW_ANY, OptionsCategory::WALLET);
 }
 
 bool WalletInit::ParameterInteraction() const
@@ -163,7 +165,8 @@ void WalletInit::StartProcess(NodeContext& node) const
                 LogPrintf("No wallet. Staking disabled\n");
             }
             else {
-                GenerateVericoin(true, GetWallets()[0], node.connman.get(), node.mempool);
+                for (const std::shared_ptr<CWallet>& wallet : GetWallets())
+                    GenerateVericoin(true, wallet, node.connman.get(), node.mempool);
             }
         }
     }
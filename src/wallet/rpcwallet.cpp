@@ -2548,7 +2548,7 @@ static UniValue getwalletinfo(const JSONRPCRequest& request)
         obj.pushKV("newmint", ValueFromAmount(pwallet->GetNewMint()));
         obj.pushKV("stake", ValueFromAmount(bal.m_mine_stake));
 
-        if( IsStaking() ) {
+        if( IsStaking(pwallet) ) {
             uint64_t staketime = pwallet->GetTimeToStake();
             int stakerate = 1;
             if (staketime > 3600){
@@ -619,4 +619,68 @@ BOOST_FIXTURE_TEST_CASE(dummy_input_size_test, TestChain100Setup)
     BOOST_CHECK_EQUAL(CalculateNestedKeyhashInputSize(true), DUMMY_NESTED_P2WPKH_INPUT_SIZE);
 }
 
+BOOST_AUTO_TEST_CASE(stake_kernel_input_cache)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    AddKey(m_wallet, key);
+    const CScript scriptMine = GetScriptForRawPubKey(key.GetPubKey());
+
+    auto make_block = [](const std::vector<CMutableTransaction>& txs, int height) {
+        CMutableTransaction coinbase;
+        coinbase.vin.resize(1);
+        coinbase.vin[0].scriptSig = CScript() << height << OP_0;
+        coinbase.vout.emplace_back(COIN, CScript() << OP_TRUE);
+        CBlock block;
+        block.nTime = 1500000000 + height;
+        block.vtx.push_back(MakeTransactionRef(coinbase));
+        for (const CMutableTransaction& tx : txs)
+            block.vtx.push_back(MakeTransactionRef(tx));
+        return block;
+    };
+
+    // Receiving coins caches where they sit, with the transaction index offset
+    CMutableTransaction txReceive;
+    txReceive.vin.emplace_back(COutPoint(InsecureRand256(), 0));
+    txReceive.vout.emplace_back(10 * COIN, scriptMine);
+    txReceive.vout.emplace_back(20 * COIN, scriptMine);
+    const uint256 hashReceive = txReceive.GetHash();
+    CMutableTransaction txKeep;
+    txKeep.vin.emplace_back(COutPoint(InsecureRand256(), 0));
+    txKeep.vout.emplace_back(30 * COIN, scriptMine);
+    StakeKernelInput input;
+    BOOST_CHECK(!m_wallet.GetStakeKernelInput(hashReceive, input));
+    const CBlock block1 = make_block({txReceive, txKeep}, 1);
+    m_wallet.blockConnected(block1, 1);
+    BOOST_REQUIRE(m_wallet.GetStakeKernelInput(hashReceive, input));
+    BOOST_CHECK(input.blockFrom.GetHash() == block1.GetHash());
+    BOOST_CHECK_EQUAL(input.nTxPrevOffset, CBlockHeader::NORMAL_SERIALIZE_SIZE + GetSizeOfCompactSize(3) + ::GetSerializeSize(*block1.vtx[0], CLIENT_VERSION));
+    BOOST_CHECK(!m_wallet.GetStakeKernelInput(block1.vtx[0]->GetHash(), input));
+
+    // Spending one output keeps the input for the other, and a payment
+    // to someone else is not cached at all
+    CMutableTransaction txSpend;
+    txSpend.vin.emplace_back(COutPoint(hashReceive, 0));
+    txSpend.vout.emplace_back(9 * COIN, CScript() << OP_TRUE);
+    m_wallet.blockConnected(make_block({txSpend}, 2), 2);
+    BOOST_CHECK(m_wallet.GetStakeKernelInput(hashReceive, input));
+    BOOST_CHECK(!m_wallet.GetStakeKernelInput(txSpend.GetHash(), input));
+
+    // Spending the last one drops it
+    CMutableTransaction txSpendLast;
+    txSpendLast.vin.emplace_back(COutPoint(hashReceive, 1));
+    txSpendLast.vout.emplace_back(19 * COIN, CScript() << OP_TRUE);
+    m_wallet.blockConnected(make_block({txSpendLast}, 3), 3);
+    BOOST_CHECK(!m_wallet.GetStakeKernelInput(hashReceive, input));
+    BOOST_CHECK(m_wallet.GetStakeKernelInput(txKeep.GetHash(), input));
+
+    // Locking only locks the keys away, the inputs are public chain data
+    {
+        LOCK(m_wallet.cs_wallet);
+        m_wallet.mapMasterKeys[++m_wallet.nMasterKeyMaxID] = CMasterKey();
+    }
+    BOOST_CHECK(m_wallet.IsLocked());
+    BOOST_CHECK(m_wallet.GetStakeKernelInput(txKeep.GetHash(), input));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
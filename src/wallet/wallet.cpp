@@ -30,7 +30,6 @@
 #include <util/moneystr.h>
 #include <util/translation.h>
 #include <validation.h>
-#include <bignum.h>
 #include <pos.h>
 #include <txdb.h>
 #include <wallet/coincontrol.h>
@@ -1178,6 +1177,30 @@ void CWallet::blockConnected(const CBlock& block, int height)
         SyncTransaction(block.vtx[index], {CWalletTx::Status::CONFIRMED, height, block_hash, (int)index});
         transactionRemovedFromMempool(block.vtx[index], MemPoolRemovalReason::BLOCK);
     }
+
+    // Remember where the transactions paying us sit for the stake kernel
+    // search, with the same offsets as the transaction index, and forget
+    // those whose last output of ours this block spends
+    if (std::none_of(block.vtx.begin(), block.vtx.end(), [&](const CTransactionRef& tx) { return mapWallet.count(tx->GetHash()); }))
+        return;
+    unsigned int nTxOffset = CBlockHeader::NORMAL_SERIALIZE_SIZE + GetSizeOfCompactSize(block.vtx.size());
+    for (const CTransactionRef& tx : block.vtx) {
+        if (mapWallet.count(tx->GetHash()) && IsMine(*tx))
+            m_stake_kernel_inputs[tx->GetHash()] = {block.GetBlockHeader(), nTxOffset};
+        nTxOffset += ::GetSerializeSize(*tx, CLIENT_VERSION);
+
+        for (const CTxIn& txin : tx->vin) {
+            const auto it = mapWallet.find(txin.prevout.hash);
+            if (it == mapWallet.end() || !m_stake_kernel_inputs.count(txin.prevout.hash))
+                continue;
+            const CTransaction& txPrev = *it->second.tx;
+            bool fUnspent = false;
+            for (unsigned int n = 0; n < txPrev.vout.size() && !fUnspent; n++)
+                fUnspent = IsMine(txPrev.vout[n]) && !IsSpent(txin.prevout.hash, n);
+            if (!fUnspent)
+                m_stake_kernel_inputs.erase(txin.prevout.hash);
+        }
+    }
 }
 
 void CWallet::blockDisconnected(const CBlock& block, int height)
@@ -1192,6 +1215,7 @@ void CWallet::blockDisconnected(const CBlock& block, int height)
     m_last_block_processed_height = height - 1;
     m_last_block_processed = block.hashPrevBlock;
     for (const CTransactionRef& ptx : block.vtx) {
+        m_stake_kernel_inputs.erase(ptx->GetHash());
         if (ptx.get()->IsCoinStake() && IsFromMe(*ptx.get())) {
             LogPrintf("Abandoning wtx %s\n", ptx.get()->GetHash().ToString());
 		    AbandonTransaction(ptx.get()->GetHash());
@@ -4496,6 +4520,42 @@ int64_t CWallet::GetNewMint() const
     return nTotal;
 }
 
+bool CWallet::GetStakeKernelInput(const uint256& txid, StakeKernelInput& input) const
+{
+    LOCK2(cs_main, cs_wallet);
+    auto it = m_stake_kernel_inputs.find(txid);
+    if (it != m_stake_kernel_inputs.end()) {
+        input = it->second;
+        return true;
+    }
+
+    // Transactions confirmed before this session are looked up once, in the
+    // UTXO set if it recorded their offset, else through the transaction index
+    const Coin& coin = AccessByTxid(::ChainstateActive().CoinsTip(), txid);
+    if (!coin.IsSpent() && coin.nTxOffset && coin.nHeight <= (unsigned int)::ChainActive().Height()) {
+        input.blockFrom = ::ChainActive()[coin.nHeight]->GetBlockHeader();
+        input.nTxPrevOffset = CBlockHeader::NORMAL_SERIALIZE_SIZE + coin.nTxOffset;
+        m_stake_kernel_inputs.emplace(txid, input);
+        return true;
+    }
+
+    CDiskTxPos postx;
+    if (!g_txindex || !g_txindex->FindTxPosition(txid, postx))
+        return false;
+
+    CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull())
+        return error("%s: OpenBlockFile failed", __func__);
+    try {
+        file >> input.blockFrom;
+    } catch (const std::exception& e) {
+        return error("%s: deserialize or I/O error - %s", __func__, e.what());
+    }
+    input.nTxPrevOffset = CBlockHeader::NORMAL_SERIALIZE_SIZE + postx.nTxOffset;
+    m_stake_kernel_inputs.emplace(txid, input);
+    return true;
+}
+
 bool CWallet::GetStakeWeight(uint64_t& nWeight) const
 {
     CAmount nBalance = GetBalance().m_mine_trusted;
@@ -4519,17 +4579,16 @@ bool CWallet::GetStakeWeight(uint64_t& nWeight) const
 
     for (const auto& pcoin : setCoins)
     {
-        CDiskTxPos postx;
-        if (!g_txindex->FindTxPosition(pcoin.first->GetHash(), postx))
+        StakeKernelInput input;
+        if (!GetStakeKernelInput(pcoin.first->GetHash(), input))
             continue;
 
         int64_t nTimeWeight = GetWeight((int64_t)pcoin.first->GetTxTime(), (int64_t)GetTime(), (int64_t)pcoin.first->tx->vout[pcoin.second].nValue, ChainActive().Tip()->pprev);
-        CBigNum bnCoinDayWeight = CBigNum(pcoin.first->tx->vout[pcoin.second].nValue) * nTimeWeight / COIN / (24 * 60 * 60);
 
         // Weight is greater than zero
         if (nTimeWeight > 0)
         {
-            nWeight += bnCoinDayWeight.getuint64();
+            nWeight += GetCoinDayWeight(pcoin.first->tx->vout[pcoin.second].nValue, nTimeWeight).GetLow64();
         }
     }
 
@@ -4554,154 +4613,166 @@ uint64_t CWallet::GetTimeToStake() const
     return nEstimateTime;
 }
 
-// create coin stake transaction
 typedef std::vector<unsigned char> valtype;
-bool CWallet::CreateCoinStake(const CWallet* pwallet, unsigned int nBits, int64_t nSearchInterval, int64_t nFees, CMutableTransaction& txNew)
-{
-
-    if (gArgs.GetBoolArg("-debug", false))
-        LogPrintf("CreateCoinStake: Entering function\n");
 
-    // The following split & combine thresholds are important to security
-    // Should not be adjusted if you don't understand the consequences
-    static unsigned int nStakeSplitAge = 14 * 24 * 60 * 60;
-    int64_t nCombineThreshold = 500 * COIN;
+// The following split & combine thresholds are important to security
+// Should not be adjusted if you don't understand the consequences
+static const unsigned int nStakeSplitAge = 14 * 24 * 60 * 60;
+static const int64_t nCombineThreshold = 500 * COIN;
+static const int64_t nMaxStakeSearchInterval = 60;
 
-    CBigNum bnTargetPerCoinDay;
-    bnTargetPerCoinDay.SetCompact(nBits);
+bool CWallet::SearchStakeKernel(int64_t nSearchInterval, StakeKernel& kernel) const
+{
+    if (gArgs.GetBoolArg("-debug", false))
+        LogPrintf("SearchStakeKernel: Entering function\n");
 
-    // Transaction index is required to get to block header
-    if (!g_txindex)
-        return error("CreateCoinStake: transaction index unavailable");
     const Consensus::Params& params = Params().GetConsensus();
+    const unsigned int nTimeTx = GetAdjustedTime();
 
-    LOCK2(cs_main, cs_wallet);
-    txNew.vin.clear();
-    txNew.vout.clear();
-
-    // Mark coin stake transaction
-    CScript scriptEmpty;
-    scriptEmpty.clear();
-    txNew.vout.push_back(CTxOut(0, scriptEmpty));
-
-    // Choose coins to use
-    CAmount nBalance = GetBalance().m_mine_trusted;
-    CAmount nReserveBalance = 0;
-    if (gArgs.IsArgSet("-reservebalance") && !ParseMoney(gArgs.GetArg("-reservebalance", ""), nReserveBalance))
-        return error("CreateCoinStake: invalid reserve balance amount");
-
-    if (nBalance <= nReserveBalance)
-        return false;
-
-    std::set<std::pair<const CWalletTx*,unsigned int> > setCoins;
-    std::vector<CTransactionRef> vwtxPrev;
-    CAmount nValueIn = 0;
-
-    if (!SelectCoinsSimple(nBalance - nReserveBalance, txNew.nTime, setCoins, nValueIn))
-        return false;
-
-
-    if (setCoins.empty()) {
-        if (gArgs.GetBoolArg("-debug", false))
-            LogPrintf("CreateCoinStake: no coins selected\n");
-        return false;
-    }
+    // Snapshot the tip and the coins that can carry a kernel
+    std::unique_ptr<StakeKernelSearch> search;
+    std::vector<COutPoint> vKernelPrevouts;
+    std::vector<CScript> vKernelScripts;
+    std::vector<int64_t> vKernelBlockTimes;
+    {
+        LOCK2(cs_main, cs_wallet);
+        kernel.pindexPrev = ::ChainActive().Tip();
+        kernel.nBits = GetNextTargetRequired(kernel.pindexPrev, true, params);
 
-    CAmount nCredit = 0;
-    CScript scriptPubKeyKernel;
+        CAmount nBalance = GetBalance().m_mine_trusted;
+        CAmount nReserveBalance = 0;
+        if (gArgs.IsArgSet("-reservebalance") && !ParseMoney(gArgs.GetArg("-reservebalance", ""), nReserveBalance))
+            return error("SearchStakeKernel: invalid reserve balance amount");
 
-    for (const auto& pcoin : setCoins)
-    {
-        CDiskTxPos postx;
-        if (!g_txindex->FindTxPosition(pcoin.first->GetHash(), postx))
-            continue;
+        if (nBalance <= nReserveBalance)
+            return false;
 
-        // Read block header
-        CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-        CBlockHeader header;
-        CTransactionRef tx;
-        try {
-            file >> header;
-            fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-            file >> tx;
-        } catch (std::exception &e) {
-            return error("%s() : deserialize or I/O error in CreateCoinStake()", __PRETTY_FUNCTION__);
-        }
+        std::set<std::pair<const CWalletTx*,unsigned int> > setCoins;
+        CAmount nValueIn = 0;
+        if (!SelectCoinsSimple(nBalance - nReserveBalance, nTimeTx, setCoins, nValueIn))
+            return false;
 
-        static int nMaxStakeSearchInterval = 60;
-        if (header.GetBlockTime() + params.nStakeMinAge > txNew.nTime - nMaxStakeSearchInterval) {
+        if (setCoins.empty()) {
             if (gArgs.GetBoolArg("-debug", false))
-                LogPrintf("CreateCoinStake: %s, not old enough\n", header.GetHash().GetHex());
-            continue; // only count coins meeting min age requirement
+                LogPrintf("SearchStakeKernel: no coins selected\n");
+            return false;
         }
 
-        bool fKernelFound = false;
-        for (unsigned int n=0; n<std::min(nSearchInterval,(int64_t)nMaxStakeSearchInterval) && !fKernelFound; n++)
+        search = MakeUnique<StakeKernelSearch>(kernel.nBits, kernel.pindexPrev);
+        for (const auto& pcoin : setCoins)
         {
-            // Search backward in time from the given txNew timestamp
-            // Search nSearchInterval seconds back up to nMaxStakeSearchInterval
-            uint256 hashProofOfStake = uint256();
-            COutPoint prevoutStake = COutPoint(pcoin.first->GetHash(), pcoin.second);
-            if (CheckStakeKernelHash(nBits, ::ChainActive().Tip(), header, postx.nTxOffset + CBlockHeader::NORMAL_SERIALIZE_SIZE, tx, prevoutStake, txNew.nTime - n, hashProofOfStake))
-            {
-                // Found a kernel
+            StakeKernelInput input;
+            if (!GetStakeKernelInput(pcoin.first->GetHash(), input))
+                continue;
+            const CBlockHeader& header = input.blockFrom;
+
+            if (header.GetBlockTime() + params.nStakeMinAge > nTimeTx - nMaxStakeSearchInterval) {
                 if (gArgs.GetBoolArg("-debug", false))
-                    LogPrintf("CreateCoinStake: kernel found\n");
+                    LogPrintf("SearchStakeKernel: %s, not old enough\n", header.GetHash().GetHex());
+                continue; // only count coins meeting min age requirement
+            }
 
-                std::vector<valtype> vSolutions;
-                txnouttype whichType;
-                CScript scriptPubKeyOut;
-                scriptPubKeyKernel = pcoin.first->tx->vout[pcoin.second].scriptPubKey;
-                whichType = Solver(scriptPubKeyKernel, vSolutions);
+            std::vector<valtype> vSolutions;
+            txnouttype whichType;
+            CScript scriptPubKeyOut;
+            const CScript& scriptPubKeyCoin = pcoin.first->tx->vout[pcoin.second].scriptPubKey;
+            whichType = Solver(scriptPubKeyCoin, vSolutions);
 
+            if (whichType != TX_PUBKEY && whichType != TX_PUBKEYHASH && whichType != TX_WITNESS_V0_KEYHASH)
+            {
                 if (gArgs.GetBoolArg("-debug", false))
-                    LogPrintf("CreateCoinStake: parsed kernel type=%d\n", whichType);
+                    LogPrintf("SearchStakeKernel: no support for kernel type=%d\n", whichType);
+                continue;  // only support pay to public key and pay to address and pay to witness keyhash
+            }
 
-                if (whichType != TX_PUBKEY && whichType != TX_PUBKEYHASH && whichType != TX_WITNESS_V0_KEYHASH)
+            if (whichType == TX_PUBKEYHASH || whichType == TX_WITNESS_V0_KEYHASH) // pay to address type or witness keyhash
+            {
+                // convert to pay to public key type
+                CKey key;
+                if (!GetLegacyScriptPubKeyMan()->GetKey(CKeyID(uint160(vSolutions[0])), key))
                 {
                     if (gArgs.GetBoolArg("-debug", false))
-                        LogPrintf("CreateCoinStake: no support for kernel type=%d\n", whichType);
-                    break;  // only support pay to public key and pay to address and pay to witness keyhash
+                        LogPrintf("SearchStakeKernel: failed to get key for kernel type=%d\n", whichType);
+                    continue;  // unable to find corresponding public key
                 }
 
-		        if (whichType == TX_PUBKEYHASH || whichType == TX_WITNESS_V0_KEYHASH) // pay to address type or witness keyhash
-                {
-                    // convert to pay to public key type
-                    CKey key;
-                    if (!pwallet->GetLegacyScriptPubKeyMan()->GetKey(CKeyID(uint160(vSolutions[0])), key))
-                    {
-                        if (gArgs.GetBoolArg("-debug", false))
-                            LogPrintf("CreateCoinStake: failed to get key for kernel type=%d\n", whichType);
+                scriptPubKeyOut << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+            }
+            else
+                scriptPubKeyOut = scriptPubKeyCoin;
 
-		       	        break;  // unable to find corresponding public key
-                    }
+            const COutPoint prevout(pcoin.first->GetHash(), pcoin.second);
+            if (!search->AddCoin(header, input.nTxPrevOffset, pcoin.first->tx, prevout))
+                continue;
+            vKernelPrevouts.push_back(prevout);
+            vKernelScripts.push_back(scriptPubKeyOut);
+            vKernelBlockTimes.push_back(header.GetBlockTime());
+        }
+    }
 
-                    scriptPubKeyOut << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
-                }
-                else
-                    scriptPubKeyOut = scriptPubKeyKernel;
+    // Search backward in time from the current timestamp, nSearchInterval
+    // seconds back up to nMaxStakeSearchInterval. This only hashes the
+    // snapshot above, so validation and RPC are not held up meanwhile.
+    size_t nKernel = 0;
+    uint256 hashProofOfStake;
+    if (nSearchInterval <= 0 || !search->Find(nTimeTx, std::min(nSearchInterval, nMaxStakeSearchInterval), nKernel, kernel.nTime, hashProofOfStake))
+        return false;
 
-                txNew.nTime -= n;
-                txNew.vin.push_back(CTxIn(pcoin.first->GetHash(), pcoin.second));
-                nCredit += pcoin.first->tx->vout[pcoin.second].nValue;
-                vwtxPrev.push_back(tx);
-                txNew.vout.push_back(CTxOut(0, scriptPubKeyOut));
+    if (gArgs.GetBoolArg("-debug", false))
+        LogPrintf("SearchStakeKernel: kernel found\n");
 
-                if (txNew.nTime - header.GetBlockTime() < nStakeSplitAge )
-                    txNew.vout.push_back(CTxOut(0, scriptPubKeyOut)); //split stake
+    kernel.prevout = vKernelPrevouts[nKernel];
+    kernel.scriptPubKeyOut = vKernelScripts[nKernel];
+    kernel.fSplit = kernel.nTime - vKernelBlockTimes[nKernel] < nStakeSplitAge;
+    return true;
+}
 
-                if (gArgs.GetBoolArg("-debug", false))
-                    LogPrintf("CreateCoinStake: added kernel type=%d\n", whichType);
+bool CWallet::CreateCoinStake(const StakeKernel& kernel, int64_t nFees, CMutableTransaction& txNew) const
+{
+    AssertLockHeld(cs_main);
+    const Consensus::Params& params = Params().GetConsensus();
 
-                fKernelFound = true;
-                break;
-            }
-        }
+    // The kernel was searched without locks; check it still stands
+    if (kernel.pindexPrev != ::ChainActive().Tip()) {
+        if (gArgs.GetBoolArg("-debug", false))
+            LogPrintf("CreateCoinStake: tip changed since the kernel search\n");
+        return false;
+    }
 
-        if (fKernelFound)
-            break; // if kernel is found stop searching
+    LOCK(cs_wallet);
+    const CWalletTx* pkernelTx = GetWalletTx(kernel.prevout.hash);
+    if (!pkernelTx || IsSpent(kernel.prevout.hash, kernel.prevout.n) || !::ChainstateActive().CoinsTip().HaveCoin(kernel.prevout)) {
+        if (gArgs.GetBoolArg("-debug", false))
+            LogPrintf("CreateCoinStake: kernel %s spent since the search\n", kernel.prevout.ToString());
+        return false;
     }
 
+    txNew.vin.clear();
+    txNew.vout.clear();
+    txNew.nTime = kernel.nTime;
+
+    // Mark coin stake transaction
+    CScript scriptEmpty;
+    scriptEmpty.clear();
+    txNew.vout.push_back(CTxOut(0, scriptEmpty));
+
+    CAmount nBalance = GetBalance().m_mine_trusted;
+    CAmount nReserveBalance = 0;
+    if (gArgs.IsArgSet("-reservebalance") && !ParseMoney(gArgs.GetArg("-reservebalance", ""), nReserveBalance))
+        return error("CreateCoinStake: invalid reserve balance amount");
+
+    std::vector<CTransactionRef> vwtxPrev;
+    const CScript& scriptPubKeyKernel = pkernelTx->tx->vout[kernel.prevout.n].scriptPubKey;
+    txNew.vin.push_back(CTxIn(kernel.prevout));
+    CAmount nCredit = pkernelTx->tx->vout[kernel.prevout.n].nValue;
+    vwtxPrev.push_back(pkernelTx->tx);
+    txNew.vout.push_back(CTxOut(0, kernel.scriptPubKeyOut));
+    if (kernel.fSplit)
+        txNew.vout.push_back(CTxOut(0, kernel.scriptPubKeyOut)); //split stake
+
+    if (gArgs.GetBoolArg("-debug", false))
+        LogPrintf("CreateCoinStake: added kernel\n");
+
     if (nCredit == 0 || nCredit > nBalance - nReserveBalance) {
         if (gArgs.GetBoolArg("-debug", false)) {
             LogPrintf("CreateCoinStake: not enough credit generated\n");
@@ -4710,24 +4781,15 @@ bool CWallet::CreateCoinStake(const CWallet* pwallet, unsigned int nBits, int64_
 	    return false;
     }
 
+    std::set<std::pair<const CWalletTx*,unsigned int> > setCoins;
+    CAmount nValueIn = 0;
+    SelectCoinsSimple(nBalance - nReserveBalance, txNew.nTime, setCoins, nValueIn);
     for (const auto& pcoin : setCoins)
     {
-        CDiskTxPos postx;
-        if (!g_txindex->FindTxPosition(pcoin.first->GetHash(), postx))
+        StakeKernelInput input;
+        if (!GetStakeKernelInput(pcoin.first->GetHash(), input))
             continue;
-
-        // Read block header
-        CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-        CBlockHeader header;
-        CTransactionRef tx;
-        try {
-            file >> header;
-            fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-            file >> tx;
-        } catch (std::exception &e) {
-            return error("%s() : deserialize or I/O error in CreateCoinStake()", __PRETTY_FUNCTION__);
-        }
-
+        const CTransactionRef& tx = pcoin.first->tx;
 
         // Attempt to add more inputs
         // Only add coins of the same key/address as kernel
@@ -4787,7 +4849,7 @@ bool CWallet::CreateCoinStake(const CWallet* pwallet, unsigned int nBits, int64_
     int nIn = 0;
     for (const auto& pcoin : vwtxPrev)
     {
-        if (!SignSignature(*pwallet->GetLegacyScriptPubKeyMan(), *pcoin, txNew, nIn++, SIGHASH_ALL))
+        if (!SignSignature(*GetLegacyScriptPubKeyMan(), *pcoin, txNew, nIn++, SIGHASH_ALL))
             return error("CreateCoinStake: failed to sign coinstake");
     }
 
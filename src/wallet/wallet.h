@@ -11,6 +11,7 @@
 #include <interfaces/handler.h>
 #include <outputtype.h>
 #include <policy/feerate.h>
+#include <primitives/block.h>
 #include <psbt.h>
 #include <tinyformat.h>
 #include <ui_interface.h>
@@ -602,6 +603,30 @@ struct CoinSelectionParams
 };
 
 class WalletRescanReserver; //forward declarations for ScanForWalletTransactions/RescanFromTime
+
+/** What the stake kernel hash needs from the block holding a wallet transaction */
+struct StakeKernelInput
+{
+    CBlockHeader blockFrom;
+    //! Offset of the transaction in the block, header included
+    unsigned int nTxPrevOffset;
+};
+
+/** A kernel found by CWallet::SearchStakeKernel(), turned into a coinstake by CWallet::CreateCoinStake() */
+struct StakeKernel
+{
+    //! Tip the kernel was searched on; the coinstake is only valid on top of it
+    CBlockIndex* pindexPrev;
+    unsigned int nBits;
+    COutPoint prevout;
+    //! Coinstake timestamp the kernel was found at
+    unsigned int nTime;
+    //! Pay to public key script the stake returns to
+    CScript scriptPubKeyOut;
+    //! Whether the stake is young enough to be split in two outputs
+    bool fSplit;
+};
+
 /**
  * A CWallet maintains a set of transactions and balances, and provides the ability to create new transactions.
  */
@@ -767,6 +792,8 @@ public:
     std::unique_ptr<interfaces::Chain::Lock> LockChain() { return m_chain ? m_chain->lock() : nullptr; }
 
     std::map<uint256, CWalletTx> mapWallet GUARDED_BY(cs_wallet);
+    //! Stake kernel inputs of confirmed wallet transactions with unspent outputs of ours, see GetStakeKernelInput()
+    mutable std::map<uint256, StakeKernelInput> m_stake_kernel_inputs GUARDED_BY(cs_wallet);
 
     typedef std::multimap<int64_t, CWalletTx*> TxItems;
     TxItems wtxOrdered;
@@ -1193,10 +1220,24 @@ public:
     const CKeyingMaterial& GetEncryptionKey() const override;
     bool HasEncryptionKeys() const override;
 
+    /**
+     * Get the stake kernel input of a confirmed wallet transaction. It is read
+     * once from the UTXO set or the transaction index and then kept up to date
+     * as blocks connect and disconnect, so the kernel search does not touch the disk.
+     */
+    bool GetStakeKernelInput(const uint256& txid, StakeKernelInput& input) const;
+
     bool GetStakeWeight(uint64_t& nWeight) const;
     bool IsUnlockStakingOnly() const;
     uint64_t GetTimeToStake() const;
-    bool CreateCoinStake(const CWallet* pwallet, unsigned int nBits, int64_t nSearchInterval, int64_t nFees, CMutableTransaction& txNew);
+    /**
+     * Search the last nSearchInterval seconds for a kernel among the wallet's
+     * coins. cs_main and cs_wallet are only held to snapshot the tip and the
+     * candidate coins; the search itself runs without them.
+     */
+    bool SearchStakeKernel(int64_t nSearchInterval, StakeKernel& kernel) const;
+    /** Build and sign the coinstake for a kernel, if it is still valid on the current tip */
+    bool CreateCoinStake(const StakeKernel& kernel, int64_t nFees, CMutableTransaction& txNew) const EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
     /** Get last block processed height */
     int GetLastBlockHeight() const EXCLUSIVE_LOCKS_REQUIRED(cs_wallet)
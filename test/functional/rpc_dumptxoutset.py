@@ -43,6 +43,10 @@ class DumptxoutsetTest(BitcoinTestFramework):
             assert_equal(
                 digest, 'be032e5f248264ba08e11099ac09dbd001f6f87ffc68bf0f87043d8146d50664')
 
+        # The snapshot hashes as the UTXO set it was taken from.
+        assert_equal(out['txoutset_hash'], node.gettxoutsetinfo()['hash_serialized_3'])
+        assert_equal(out['nchaintx'], 101)
+
         # Specifying a path to an existing file will fail.
         assert_raises_rpc_error(
             -8, '{} already exists'.format(FILENAME),  node.dumptxoutset, FILENAME)